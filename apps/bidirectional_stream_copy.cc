@@ -24,8 +24,13 @@ void bidirectional_stream_copy( Socket& socket, string_view peer_name )
   input.set_blocking( false );
   output.set_blocking( false );
 
+  // The rules ask their interest functions only when the streams change (or a shutdown flag is set)
+  EventLoop::Notifier interest_changed;
+  outbound.set_listener( [&] { interest_changed.raise(); } );
+  inbound.set_listener( [&] { interest_changed.raise(); } );
+
   // rule 1: read from stdin into outbound byte stream
-  eventloop.add_rule(
+  auto stdin_rule = eventloop.add_rule(
     "read from stdin into outbound byte stream",
     input,
     Direction::In,
@@ -48,9 +53,10 @@ void bidirectional_stream_copy( Socket& socket, string_view peer_name )
       outbound.set_error();
       inbound.set_error();
     } );
+  stdin_rule.subscribe( interest_changed );
 
   // rule 2: read from outbound byte stream into socket
-  eventloop.add_rule(
+  auto socket_write_rule = eventloop.add_rule(
     "read from outbound byte stream into socket",
     socket,
     Direction::Out,
@@ -61,6 +67,7 @@ void bidirectional_stream_copy( Socket& socket, string_view peer_name )
       if ( outbound.reader().is_finished() ) {
         socket.shutdown( SHUT_WR );
         outbound_shutdown = true;
+        interest_changed.raise();
         cerr << "DEBUG: Outbound stream to " << peer_name << " finished.\n";
       }
     },
@@ -73,9 +80,10 @@ void bidirectional_stream_copy( Socket& socket, string_view peer_name )
       outbound.set_error();
       inbound.set_error();
     } );
+  socket_write_rule.subscribe( interest_changed );
 
   // rule 3: read from socket into inbound byte stream
-  eventloop.add_rule(
+  auto socket_read_rule = eventloop.add_rule(
     "read from socket into inbound byte stream",
     socket,
     Direction::In,
@@ -98,9 +106,10 @@ void bidirectional_stream_copy( Socket& socket, string_view peer_name )
       outbound.set_error();
       inbound.set_error();
     } );
+  socket_read_rule.subscribe( interest_changed );
 
   // rule 4: read from inbound byte stream into stdout
-  eventloop.add_rule(
+  auto stdout_rule = eventloop.add_rule(
     "read from inbound byte stream into stdout",
     output,
     Direction::Out,
@@ -111,6 +120,7 @@ void bidirectional_stream_copy( Socket& socket, string_view peer_name )
       if ( inbound.reader().is_finished() ) {
         output.close();
         inbound_shutdown = true;
+        interest_changed.raise();
         cerr << "DEBUG: Inbound stream from " << peer_name << " finished"
              << ( inbound.has_error() ? " uncleanly.\n" : ".\n" );
       }
@@ -124,6 +134,7 @@ void bidirectional_stream_copy( Socket& socket, string_view peer_name )
       outbound.set_error();
       inbound.set_error();
     } );
+  stdout_rule.subscribe( interest_changed );
 
   // loop until completion
   while ( true ) {
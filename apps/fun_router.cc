@@ -49,7 +49,8 @@ void print_usage( const string_view argv0 )
        << "      <config> = interface:<name>:<virtual interface addr>:<physical local port>:<physical peer "
           "addr:port>\n"
        << "   or <config> = route:<prefix addr>:<prefix len>:<interface_name> (directly attached)\n"
-       << "   or <config> = route:<prefix addr>:<prefix len>:<interface_name>:<next-hop addr>\n\n";
+       << "   or <config> = route:<prefix addr>:<prefix len>:<interface_name>:<next-hop addr>\n"
+       << "   or <config> = ecn:<queue threshold> (mark ECN-capable datagrams CE beyond this queue depth)\n\n";
 }
 
 // Split a colon-delimited string into pieces
@@ -133,6 +134,15 @@ void apply_configs( const span<char*>& args,
 
       router.add_route(
         Address { prefix_addr }.ipv4_numeric(), stoi( prefix_len ), next_hop, iface_name_to_idx.at( iface_name ) );
+    } else if ( fields.at( 0 ) == "ecn" ) {
+      // Set the ECN marking threshold
+
+      if ( fields.size() != 2 ) {
+        print_usage( args[0] );
+        throw runtime_error( "could not parse config \"" + string( config ) + "\"" );
+      }
+
+      router.set_ecn_threshold( stoul( fields[1] ) );
     } else {
       print_usage( args[0] );
       throw runtime_error( "could not parse config \"" + string( config ) + "\"" );
@@ -1,5 +1,6 @@
 #include "address.hh"
 #include "bidirectional_stream_copy.hh"
+#include "clock.hh"
 #include "helpers.hh"
 #include "network_interface.hh"
 #include "socket.hh"
@@ -10,6 +11,8 @@
 #include <chrono>
 #include <cstdlib>
 #include <iostream>
+#include <span>
+#include <string>
 #include <utility>
 
 using namespace std;
@@ -29,13 +32,6 @@ EthernetAddress random_host_ethernet_address()
   return addr;
 }
 
-// millisecond-granularity timestamp
-inline uint64_t timestamp_ms()
-{
-  static_assert( std::is_same_v<chrono::steady_clock::duration, std::chrono::nanoseconds> );
-
-  return chrono::steady_clock::now().time_since_epoch().count() / 1000000;
-}
 
 // "Adapter" class that represents TCP, encapsulated in IP, encapsulated in Ethernet, encapsulated in UDP
 class TCP_over_IP_over_Ethernet_over_UDP_Adapter : public TCPOverIPv4Adapter
@@ -109,9 +105,20 @@ public:
     interface_.send_datagram( wrap_tcp_in_ip( msg ), next_hop_ );
   }
 
+  // Encapsulate several TCPMessages, and send the resulting user datagrams with one system call.
+  void write_batch( span<const TCPMessage> msgs )
+  {
+    tick_network_interface();
+    output_->start_batch();
+    for ( const auto& msg : msgs ) {
+      interface_.send_datagram( wrap_tcp_in_ip( msg ), next_hop_ );
+    }
+    output_->finish_batch();
+  }
+
   // Pass through connect and tick.
   void connect( const Address& physical_dest ) { output_->connect( physical_dest ); }
-  void tick( const size_t ms_since_last_tick ) { interface_.tick( ms_since_last_tick ); }
+  void tick( const chrono::microseconds since_last_tick ) { interface_.tick( since_last_tick ); }
 
   FileDescriptor& fd() { return output_->socket_; }
 
@@ -123,6 +130,21 @@ private:
     UDPSocket socket_ {};
     optional<Address> physical_dest_ {};
 
+    // While batching, frames are serialized into `batch_` (reusing its strings) and sent together at the end.
+    bool batching_ {};
+    vector<string> batch_ {};
+    size_t batch_size_ {};
+
+    void start_batch() { batching_ = true; }
+    void finish_batch()
+    {
+      batching_ = false;
+      if ( batch_size_ > 0 ) {
+        socket_.send_batch( span { batch_.data(), batch_size_ }, physical_dest_ );
+        batch_size_ = 0;
+      }
+    }
+
     bool is_connected() const { return physical_dest_.has_value(); }
     void connect( const Address& physical_dest )
     {
@@ -136,6 +158,18 @@ private:
         throw runtime_error( "attempt to transmit on unconnected Ethernet-over-UDP port" );
       }
 
+      if ( batching_ ) {
+        if ( batch_size_ == batch_.size() ) {
+          batch_.emplace_back();
+        }
+        string& slot = batch_[batch_size_++];
+        slot.clear();
+        for ( const auto& buf : serialize( x ) ) {
+          slot.append( buf.get() );
+        }
+        return;
+      }
+
       socket_.send( serialize( x ), physical_dest_ );
     }
   };
@@ -143,11 +177,10 @@ private:
   void tick_network_interface()
   {
     // inform NetworkInterface that time has passed
-    const size_t new_tick = timestamp_ms();
+    const auto new_tick = monotonic_time();
     if ( new_tick > last_tick_ ) {
-      const size_t ms_since_last_tick = new_tick - last_tick_;
-      interface_.tick( ms_since_last_tick
-                       * 5 ); // run at 5x speed to avoid having to wait 30 seconds in real life if router reboots
+      // run at 5x speed to avoid having to wait 30 seconds in real life if router reboots
+      interface_.tick( ( new_tick - last_tick_ ) * 5 );
     }
     last_tick_ = new_tick;
   }
@@ -156,7 +189,7 @@ private:
   NetworkInterface interface_;
   Address next_hop_;
   vector<string> incoming_datagram_ {};
-  size_t last_tick_ = timestamp_ms();
+  chrono::microseconds last_tick_ = monotonic_time();
 };
 
 // "Socket" class that represents a TCP socket, using the TCP-over-IP-over-Ethernet-over-UDP adapter above.
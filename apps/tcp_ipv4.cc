@@ -11,6 +11,7 @@
 #include <span>
 #include <string>
 #include <tuple>
+#include <utility>
 
 using namespace std;
 
@@ -31,12 +32,18 @@ void show_usage( const char* argv0, const char* msg )
        << "   -s <port>       Set source port (client mode only)              (random)\n\n"
 
        << "   -w <winsz>      Use a window of <winsz> bytes                   " << TCPConfig::MAX_PAYLOAD_SIZE
-       << "\n\n"
+       << "\n"
+       << "   -W <maxwin>     Auto-tune the window up to <maxwin> bytes       (no auto-tuning)\n\n"
 
        << "   -t <tmout>      Set rt_timeout to tmout                         " << TCPConfig::TIMEOUT_DFLT << "\n\n"
 
        << "   -d <tundev>     Connect to tun <tundev>                         " << TUN_DFLT << "\n\n"
 
+       << "   -F              Use TCP Fast Open cookies.                      (off)\n"
+       << "   -E              Negotiate ECN.                                  (off)\n"
+       << "   -G              Coalesce received segments (GRO).               (off)\n"
+       << "   -T              Segment bursts at the adapter (TSO).            (off)\n\n"
+
        << "   -Lu <loss>      Set uplink loss to <rate> (float in 0..1)       (no loss)\n"
        << "   -Ld <loss>      Set downlink loss to <rate> (float in 0..1)     (no loss)\n\n"
 
@@ -56,7 +63,7 @@ void check_argc( const span<char*>& args, size_t curr, const char* err )
   }
 }
 
-tuple<TCPConfig, FdAdapterConfig, bool, const char*> get_config( const span<char*>& args )
+tuple<TCPConfig, FdAdapterConfig, bool, bool, const char*> get_config( const span<char*>& args )
 {
   TCPConfig c_fsm {};
   c_fsm.isn = Wrap32 { random_device()() };
@@ -66,6 +73,7 @@ tuple<TCPConfig, FdAdapterConfig, bool, const char*> get_config( const span<char
 
   size_t curr = 1;
   bool listen = false;
+  bool gro = false;
   const size_t argc = args.size();
 
   string source_address = LOCAL_ADDRESS_DFLT;
@@ -91,6 +99,11 @@ tuple<TCPConfig, FdAdapterConfig, bool, const char*> get_config( const span<char
       c_fsm.recv_capacity = strtol( args[curr + 1], nullptr, 0 );
       curr += 2;
 
+    } else if ( strncmp( "-W", args[curr], 3 ) == 0 ) {
+      check_argc( args, curr, "ERROR: -W requires one argument." );
+      c_fsm.recv_capacity_max = strtol( args[curr + 1], nullptr, 0 );
+      curr += 2;
+
     } else if ( strncmp( "-t", args[curr], 3 ) == 0 ) {
       check_argc( args, curr, "ERROR: -t requires one argument." );
       c_fsm.rt_timeout = strtol( args[curr + 1], nullptr, 0 );
@@ -101,6 +114,22 @@ tuple<TCPConfig, FdAdapterConfig, bool, const char*> get_config( const span<char
       tundev = args[curr + 1];
       curr += 2;
 
+    } else if ( strncmp( "-F", args[curr], 3 ) == 0 ) {
+      c_filt.fast_open = true;
+      curr += 1;
+
+    } else if ( strncmp( "-E", args[curr], 3 ) == 0 ) {
+      c_fsm.ecn = true;
+      curr += 1;
+
+    } else if ( strncmp( "-G", args[curr], 3 ) == 0 ) {
+      gro = true;
+      curr += 1;
+
+    } else if ( strncmp( "-T", args[curr], 3 ) == 0 ) {
+      c_fsm.segmentation_offload = true;
+      curr += 1;
+
     } else if ( strncmp( "-Lu", args[curr], 3 ) == 0 ) {
       check_argc( args, curr, "ERROR: -Lu requires one argument." );
       const float lossrate = strtof( args[curr + 1], nullptr );
@@ -139,7 +168,20 @@ tuple<TCPConfig, FdAdapterConfig, bool, const char*> get_config( const span<char
     c_filt.source = { source_address, source_port };
   }
 
-  return make_tuple( c_fsm, c_filt, listen, tundev );
+  return make_tuple( c_fsm, c_filt, listen, gro, tundev );
+}
+
+template<class SocketT>
+void run( SocketT& tcp_socket, const TCPConfig& c_fsm, const FdAdapterConfig& c_filt, bool listen )
+{
+  if ( listen ) {
+    tcp_socket.listen_and_accept( c_fsm, c_filt );
+  } else {
+    tcp_socket.connect( c_fsm, c_filt );
+  }
+
+  bidirectional_stream_copy( tcp_socket, tcp_socket.peer_address().to_string() );
+  tcp_socket.wait_until_closed();
 }
 } // namespace
 
@@ -157,18 +199,17 @@ int main( int argc, char** argv )
       return EXIT_FAILURE;
     }
 
-    auto [c_fsm, c_filt, listen, tun_dev_name] = get_config( args );
-    LossyTCPOverIPv4MinnowSocket tcp_socket( LossyFdAdapter<TCPOverIPv4OverTunFdAdapter>(
-      TCPOverIPv4OverTunFdAdapter( TunFD( tun_dev_name == nullptr ? TUN_DFLT : tun_dev_name ) ) ) );
+    auto [c_fsm, c_filt, listen, gro, tun_dev_name] = get_config( args );
+    LossyFdAdapter<TCPOverIPv4OverTunFdAdapter> adapter(
+      TCPOverIPv4OverTunFdAdapter( TunFD( tun_dev_name == nullptr ? TUN_DFLT : tun_dev_name ) ) );
 
-    if ( listen ) {
-      tcp_socket.listen_and_accept( c_fsm, c_filt );
+    if ( gro ) {
+      GROTCPOverIPv4MinnowSocket tcp_socket( GROAdapter( std::move( adapter ) ) );
+      run( tcp_socket, c_fsm, c_filt, listen );
     } else {
-      tcp_socket.connect( c_fsm, c_filt );
+      LossyTCPOverIPv4MinnowSocket tcp_socket( std::move( adapter ) );
+      run( tcp_socket, c_fsm, c_filt, listen );
     }
-
-    bidirectional_stream_copy( tcp_socket, tcp_socket.peer_address().to_string() );
-    tcp_socket.wait_until_closed();
   } catch ( const exception& e ) {
     cerr << "Exception: " << e.what() << "\n";
     return EXIT_FAILURE;
@@ -45,6 +45,10 @@ ttest(recv_reorder)
 ttest(recv_reorder_more)
 ttest(recv_close)
 ttest(recv_special)
+ttest(recv_autotune)
+ttest(recv_ecn)
+ttest(recv_predict)
+ttest(recv_gro)
 
 ttest(send_connect)
 ttest(send_transmit)
@@ -53,6 +57,19 @@ ttest(send_ack)
 ttest(send_close)
 ttest(send_retx)
 ttest(send_extra)
+ttest(send_fast_open)
+ttest(fast_open_cookies)
+ttest(send_ecn)
+ttest(send_buffer)
+ttest(send_tso)
+ttest(send_headers)
+
+ttest(eventloop)
+ttest(ring_pipe)
+ttest(tcp_minnow_co_socket)
+
+ttest(tcp_stack)
+ttest(tcp_stack_shards)
 
 ttest(net_interface)
 
@@ -1,14 +1,33 @@
 #include "byte_stream.hh"
 #include "debug.hh"
 
+#include <algorithm>
+
 using namespace std;
 
 ByteStream::ByteStream( uint64_t capacity ) : capacity_( capacity ) {}
 
+// Resize the stream, but never below the bytes that are already buffered.
+void ByteStream::set_capacity(uint64_t capacity)
+{
+  const uint8_t before = this->readiness();
+  this->capacity_ = max(capacity, static_cast<uint64_t>(this->buffer_.size()));
+  this->notify(before);
+}
+
+// Signal that the stream suffered an error.
+void ByteStream::set_error()
+{
+  const uint8_t before = this->readiness();
+  this->error_ = true;
+  this->notify(before);
+}
+
 // Push data to stream, but only as much as available capacity allows.
 void Writer::push(const string &data)
 {
   // Your code here (and in each method below)
+  const uint8_t before = this->readiness();
   if (this->available_capacity() >= data.size()) {
     this->bytes_pushed_ += data.size();
     this->buffer_ += data;
@@ -17,12 +36,15 @@ void Writer::push(const string &data)
     this->bytes_pushed_ += this->available_capacity();
     this->buffer_ += data.substr(0, this->available_capacity());
   }
+  this->notify(before);
 }
 
 // Signal that the stream has reached its ending. Nothing more will be written.
 void Writer::close()
 {
+  const uint8_t before = this->readiness();
   this->closed_ = true;
+  this->notify(before);
 }
 
 // Has the stream been closed?
@@ -55,8 +77,10 @@ string_view Reader::peek() const
 // Remove `len` bytes from the buffer.
 void Reader::pop( uint64_t len )
 {
-  this->buffer_ = this->buffer_.substr(len, this->buffer_.size() - len);
+  const uint8_t before = this->readiness();
+  this->buffer_.erase(0, len);
   this->bytes_popped_ += len;
+  this->notify(before);
 }
 
 // Is the stream finished (closed and fully popped)?
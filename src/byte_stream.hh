@@ -1,8 +1,10 @@
 #pragma once
 
 #include <cstdint>
+#include <functional>
 #include <string>
 #include <string_view>
+#include <utility>
 
 class Reader;
 class Writer;
@@ -18,9 +20,19 @@ public:
   Writer& writer();
   const Writer& writer() const;
 
-  void set_error() { error_ = true; };       // Signal that the stream suffered an error.
+  void set_error();                          // Signal that the stream suffered an error.
   bool has_error() const { return error_; }; // Has the stream had an error?
 
+  // Resize the stream (used by the TCPReceiver's receive-buffer auto-tuning).
+  // The capacity never drops below the number of bytes currently buffered.
+  void set_capacity( uint64_t capacity );
+  uint64_t capacity() const { return capacity_; }
+
+  // Edge notifications: `listener` is called when the stream becomes readable or empty, writable or full,
+  // closed, finished or errored (not on every push and pop), so that an event loop can keep its interest in
+  // the stream up to date without asking on every wakeup.
+  void set_listener( std::function<void()> listener ) { listener_ = std::move( listener ); }
+
 protected:
   // Please add any additional state to the ByteStream here, and not to the Writer and Reader interfaces.
   uint64_t capacity_;
@@ -29,6 +41,12 @@ protected:
   std::string buffer_ {};
   uint64_t bytes_popped_ {};
   uint64_t bytes_pushed_ {};
+  std::function<void()> listener_ {};
+
+  // The states that the listener hears about, as flags (if there is a listener)
+  uint8_t readiness() const;
+  // Call the listener if the readiness is no longer `before`
+  void notify( uint8_t before ) const;
 };
 
 class Writer : public ByteStream
@@ -26,6 +26,25 @@ void read( Reader& reader, uint64_t max_len, string& out )
   }
 }
 
+uint8_t ByteStream::readiness() const
+{
+  if ( not listener_ ) {
+    return 0;
+  }
+
+  // (finished is closed and not readable, so the flags cover it)
+  const bool readable = not buffer_.empty();
+  const bool writable = buffer_.size() < capacity_;
+  return static_cast<uint8_t>( readable | writable << 1U | closed_ << 2U | error_ << 3U );
+}
+
+void ByteStream::notify( uint8_t before ) const
+{
+  if ( listener_ and readiness() != before ) {
+    listener_();
+  }
+}
+
 Reader& ByteStream::reader()
 {
   static_assert( sizeof( Reader ) == sizeof( ByteStream ),
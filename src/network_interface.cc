@@ -8,6 +8,7 @@
 #include "network_interface.hh"
 
 using namespace std;
+using namespace std::chrono_literals;
 
 //! \param[in] ethernet_address Ethernet (what ARP calls "hardware") address of the interface
 //! \param[in] ip_address IP (what ARP calls "protocol") address of the interface
@@ -31,27 +32,19 @@ NetworkInterface::NetworkInterface( string_view name,
 void NetworkInterface::send_datagram(const InternetDatagram &dgram, const Address& next_hop) {
   const uint32_t target_ip = next_hop.ipv4_numeric();
   // Check if we already know the MAC for this IP
-  for (auto &i : this->ip_mac_table) {
-    if (i.first.ip == target_ip) {
-      EthernetFrame frame;
-      frame.header.src = this->ethernet_address_;
-      frame.header.dst = i.first.mac;
-      frame.header.type = EthernetHeader::TYPE_IPv4;
-      frame.payload = serialize(dgram);
-      this->transmit(frame);
-      return;
-    }
+  if (const auto it = this->ip_mac_table.find(target_ip); it != this->ip_mac_table.end()) {
+    EthernetFrame frame;
+    frame.header.src = this->ethernet_address_;
+    frame.header.dst = it->second.mac;
+    frame.header.type = EthernetHeader::TYPE_IPv4;
+    frame.payload = serialize(dgram);
+    this->transmit(frame);
+    return;
   }
   // Queue the datagram for later
   this->pending_datagrams.emplace_back(dgram, target_ip);
-  // Check if we already have a pending ARP request for this IP
-  bool transmit_arp = true;
-  for (auto &i : this->arp) {
-    if (i.first == target_ip) {
-      transmit_arp = false;
-    }
-  }
-  if (transmit_arp) {
+  // Send an ARP request, unless one for this IP is pending
+  if (!this->arp.contains(target_ip)) {
     ARPMessage arpmsg;
     arpmsg.opcode = ARPMessage::OPCODE_REQUEST;
     arpmsg.sender_ethernet_address = this->ethernet_address_;
@@ -65,7 +58,7 @@ void NetworkInterface::send_datagram(const InternetDatagram &dgram, const Addres
     frame.header.type = EthernetHeader::TYPE_ARP;
     frame.payload = serialize(arpmsg);
     this->transmit(frame);
-    this->arp.emplace_back(target_ip, 5000);
+    this->arp[target_ip] = this->timers.schedule((this->now + 5s).count(), {target_ip, false});
   }
 }
 
@@ -86,7 +79,10 @@ void NetworkInterface::recv_frame(EthernetFrame frame) {
   }
   ARPMessage arpmsg;
   if (parse(arpmsg, frame.payload)) {
-    this->ip_mac_table.emplace_back(IP_MAC_NODE {arpmsg.sender_ip_address, arpmsg.sender_ethernet_address}, 30000);
+    // Learn (or refresh) the mapping for 30 seconds
+    Mapping &mapping = this->ip_mac_table[arpmsg.sender_ip_address];
+    mapping.mac = arpmsg.sender_ethernet_address;
+    this->timers.reschedule(mapping.timer, (this->now + 30s).count(), {arpmsg.sender_ip_address, true});
     // Send any queued datagrams for this IP
     auto it = this->pending_datagrams.begin();
     while (it != this->pending_datagrams.end()) {
@@ -124,26 +120,26 @@ void NetworkInterface::recv_frame(EthernetFrame frame) {
 
 //! \param[in] ms_since_last_tick the number of milliseconds since the last call to this method
 void NetworkInterface::tick(const size_t ms_since_last_tick) {
-  for (auto &i : this->arp) {
-    i.second -= static_cast<int32_t>(ms_since_last_tick);
-  }
-  for (auto &i : this->ip_mac_table) {
-    i.second -= static_cast<int32_t>(ms_since_last_tick);
-  }
-  while (!this->arp.empty() && this->arp.front().second <= 0) {
-    const uint32_t expired_ip = this->arp.front().first;
+  this->tick(chrono::microseconds(chrono::milliseconds(ms_since_last_tick)));
+}
+
+//! \param[in] since_last_tick the time since the last call to a tick method
+void NetworkInterface::tick(const chrono::microseconds since_last_tick) {
+  this->now += since_last_tick;
+  this->timers.advance(this->now.count(), [this](const ArpTimer &timer) {
+    if (timer.mapping) {
+      this->ip_mac_table.erase(timer.ip);
+      return;
+    }
     // Drop any pending datagrams for this expired ARP request
+    this->arp.erase(timer.ip);
     auto it = this->pending_datagrams.begin();
     while (it != this->pending_datagrams.end()) {
-      if (it->second == expired_ip) {
+      if (it->second == timer.ip) {
         it = this->pending_datagrams.erase(it);
       } else {
         ++it;
       }
     }
-    this->arp.pop_front();
-  }
-  while (!this->ip_mac_table.empty() && this->ip_mac_table.front().second <= 0) {
-    this->ip_mac_table.pop_front();
-  }
+  });
 }
@@ -3,9 +3,12 @@
 #include "address.hh"
 #include "ethernet_frame.hh"
 #include "ipv4_datagram.hh"
+#include "timer_wheel.hh"
 
+#include <chrono>
 #include <memory>
 #include <queue>
+#include <unordered_map>
 
 // A "network interface" that connects IP (the internet layer, or network layer)
 // with Ethernet (the network access layer, or link layer).
@@ -60,18 +63,15 @@ public:
   // Called periodically when time elapses
   void tick( size_t ms_since_last_tick );
 
+  // The same, at microsecond resolution
+  void tick( std::chrono::microseconds since_last_tick );
+
   // Accessors
   const std::string& name() const { return name_; }
   const OutputPort& output() const { return *port_; }
   OutputPort& output() { return *port_; }
   std::queue<InternetDatagram>& datagrams_received() { return datagrams_received_; }
 
-  struct IP_MAC_NODE {
-    uint32_t ip;
-    EthernetAddress mac;
-    IP_MAC_NODE(uint32_t ip_, EthernetAddress mac_) : ip(ip_), mac(mac_) {}
-  };
-
 private:
   // Human-readable name of the interface
   std::string name_;
@@ -89,9 +89,25 @@ private:
   // Datagrams that have been received
   std::queue<InternetDatagram> datagrams_received_ {};
 
-  std::deque<std::pair<uint32_t, int32_t>> arp {};
+  // Time passes in ticks (in microseconds); each ARP request (for five seconds) and learned mapping (for thirty)
+  // has a timer in a wheel of 1 ms buckets, so a tick visits only what expires, rather than every entry
+  struct ArpTimer {
+    uint32_t ip {};
+    bool mapping {}; // else, a request
+  };
+  using ArpTimers = HierarchicalTimerWheel<ArpTimer>;
+  std::chrono::microseconds now {0};
+  ArpTimers timers {1000};
+
+  // Outstanding ARP requests, by IP address
+  std::unordered_map<uint32_t, ArpTimers::Handle> arp {};
 
-  std::deque<std::pair<IP_MAC_NODE, int32_t>> ip_mac_table {};
+  // Learned mappings, by IP address
+  struct Mapping {
+    EthernetAddress mac {};
+    ArpTimers::Handle timer {};
+  };
+  std::unordered_map<uint32_t, Mapping> ip_mac_table {};
 
   std::deque<std::pair<InternetDatagram, uint32_t>> pending_datagrams {};
 };
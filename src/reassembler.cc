@@ -51,3 +51,12 @@ void Reassembler::insert(uint64_t first_index, string data, bool is_last_substri
 uint64_t Reassembler::count_bytes_pending() const {
   return this->bytes_pending;
 }
+
+bool Reassembler::append_in_order(const string &data) {
+  if (!this->dq.empty() || this->last_tag || data.size() > this->output_.writer().available_capacity()) {
+    return false;
+  }
+  this->output_.writer().push(data);
+  this->head += data.size();
+  return true;
+}
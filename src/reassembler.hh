@@ -32,6 +32,11 @@ public:
    */
   void insert( uint64_t first_index, std::string data, bool is_last_substring );
 
+  // Fast path for a substring that starts at next_pos(): if nothing is waiting to be reassembled and the
+  // end of the stream is not yet known, write it straight to the output. Returns false (doing nothing)
+  // if the substring needs the general path.
+  bool append_in_order( const std::string& data );
+
   // How many bytes are stored in the Reassembler itself?
   // This function is for testing only; don't add extra state to support it.
   uint64_t count_bytes_pending() const;
@@ -43,6 +48,9 @@ public:
   // Access output stream writer, but const-only (can't write from outside)
   const Writer& writer() const { return output_.writer(); }
 
+  // Resize the output stream (the TCPReceiver grows and shrinks its buffer when auto-tuning)
+  void set_capacity( uint64_t capacity ) { output_.set_capacity( capacity ); }
+
   // [start, end) is the range of bytes that the Reassembler is currently waiting for.
   // The next byte to write is at index next_pos().
   uint64_t start() const { return this->output_.reader().bytes_popped(); }
@@ -27,7 +27,6 @@ void Router::route_one_datagram( InternetDatagram& dgram )
     return;
   }
   dgram.header.ttl--;
-  dgram.header.compute_checksum();
 
   // Longest-prefix match
   const Route* best = nullptr;
@@ -44,6 +43,16 @@ void Router::route_one_datagram( InternetDatagram& dgram )
     return; // no match, drop
   }
 
+  // Mark instead of queueing silently if the output queue is over the ECN threshold
+  size_t& depth = output_queue_depth_.at( best->interface_num );
+  if ( ecn_threshold_ > 0 and depth >= ecn_threshold_ and dgram.header.ecn() != IPv4Header::ECN_NOT_ECT
+       and dgram.header.ecn() != IPv4Header::ECN_CE ) {
+    dgram.header.set_ecn( IPv4Header::ECN_CE );
+    ecn_marks_++;
+  }
+  depth++;
+  dgram.header.compute_checksum();
+
   const Address next = best->next_hop.value_or( Address::from_ipv4_numeric( dgram.header.dst ) );
   interface( best->interface_num )->send_datagram( dgram, next );
 }
@@ -51,6 +60,7 @@ void Router::route_one_datagram( InternetDatagram& dgram )
 // Go through all the interfaces, and route every incoming datagram to its proper outgoing interface.
 void Router::route()
 {
+  output_queue_depth_.assign( interfaces_.size(), 0 );
   for ( auto& iface : interfaces_ ) {
     auto& queue = iface->datagrams_received();
     while ( !queue.empty() ) {
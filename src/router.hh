@@ -31,6 +31,13 @@ public:
   // Route packets between the interfaces
   void route();
 
+  // Explicit Congestion Notification (RFC 3168): the datagrams forwarded by one call to route() are queued
+  // together on their output interfaces. An ECN-capable datagram that finds `threshold` or more datagrams
+  // ahead of it in its output queue is marked Congestion Experienced instead of being forwarded unmarked.
+  // A threshold of 0 disables marking.
+  void set_ecn_threshold( size_t threshold ) { ecn_threshold_ = threshold; }
+  uint64_t ecn_marks() const { return ecn_marks_; }
+
 private:
   void route_one_datagram( InternetDatagram& dgram );
 
@@ -43,4 +50,8 @@ private:
 
   std::vector<Route> routing_table_ {};
   std::vector<std::shared_ptr<NetworkInterface>> interfaces_ {};
+
+  size_t ecn_threshold_ {};
+  uint64_t ecn_marks_ {};
+  std::vector<size_t> output_queue_depth_ {};
 };
@@ -0,0 +1,186 @@
+#include "sharded_tcp_stack.hh"
+
+#include "eventloop.hh"
+#include "exception.hh"
+#include "ipv4_header.hh"
+
+#include <random>
+#include <stdexcept>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <utility>
+
+using namespace std;
+
+namespace {
+//! A second FileDescriptor for the same open file (with its own counters, so two threads can each use one)
+FileDescriptor dup_fd( const FileDescriptor& fd )
+{
+  return FileDescriptor { CheckSystemCall( "dup", ::dup( fd.fd_num() ) ) };
+}
+
+uint32_t get_be32( string_view s, size_t pos )
+{
+  uint32_t val = 0;
+  for ( size_t i = 0; i < 4; ++i ) {
+    val = val << 8 | static_cast<uint8_t>( s[pos + i] );
+  }
+  return val;
+}
+
+uint16_t get_be16( string_view s, size_t pos )
+{
+  return static_cast<uint16_t>( static_cast<uint8_t>( s[pos] ) << 8 | static_cast<uint8_t>( s[pos + 1] ) );
+}
+} // namespace
+
+ShardedTCPStack::Shard::Shard()
+  : wakeup( CheckSystemCall( "eventfd", ::eventfd( 0, EFD_NONBLOCK ) ) ), wakeup_writer( dup_fd( wakeup ) )
+{}
+
+ShardedTCPStack::ShardedTCPStack( FileDescriptor&& device,
+                                  size_t n_shards,
+                                  const TCPConfig& cfg,
+                                  const SetupFunction& setup )
+  : seed_( random_device {}() ), device_( move( device ) )
+{
+  if ( n_shards == 0 ) {
+    throw runtime_error( "ShardedTCPStack needs at least one shard" );
+  }
+  // (so the dispatcher can read until nothing is left; the shards' duplicates, made later, share the flag)
+  device_->set_blocking( false );
+
+  for ( size_t i = 0; i < n_shards; ++i ) {
+    shards_.push_back( make_unique<Shard>() );
+  }
+  start_shards( cfg, setup );
+  dispatcher_ = thread( &ShardedTCPStack::dispatch, this );
+}
+
+ShardedTCPStack::ShardedTCPStack( vector<FileDescriptor>&& queues,
+                                  const TCPConfig& cfg,
+                                  const SetupFunction& setup )
+  : seed_( random_device {}() )
+{
+  if ( queues.empty() ) {
+    throw runtime_error( "ShardedTCPStack needs at least one shard" );
+  }
+
+  for ( auto& queue : queues ) {
+    shards_.push_back( make_unique<Shard>() );
+    shards_.back()->queue.emplace( move( queue ) );
+  }
+  start_shards( cfg, setup );
+}
+
+void ShardedTCPStack::start_shards( const TCPConfig& cfg, const SetupFunction& setup )
+{
+  for ( size_t i = 0; i < shards_.size(); ++i ) {
+    shards_[i]->thread = thread( &ShardedTCPStack::run_shard, this, i, cfg, setup );
+  }
+}
+
+ShardedTCPStack::~ShardedTCPStack()
+{
+  stop();
+}
+
+void ShardedTCPStack::stop()
+{
+  stop_ = true;
+  if ( dispatcher_.joinable() ) {
+    dispatcher_.join();
+  }
+  for ( auto& shard : shards_ ) {
+    if ( shard->thread.joinable() ) {
+      shard->thread.join();
+    }
+  }
+}
+
+size_t ShardedTCPStack::steer( string_view datagram ) const
+{
+  if ( datagram.size() < IPv4Header::LENGTH ) {
+    return 0;
+  }
+  const size_t header_length = static_cast<size_t>( static_cast<uint8_t>( datagram[0] ) & 0x0f ) * 4;
+  constexpr size_t PROTO = 9, SRC = 12, DST = 16;
+  if ( static_cast<uint8_t>( datagram[PROTO] ) != IPv4Header::PROTO_TCP or datagram.size() < header_length + 4 ) {
+    return 0;
+  }
+
+  return shard_of( FlowKey { .local_address = get_be32( datagram, DST ),
+                             .remote_address = get_be32( datagram, SRC ),
+                             .local_port = get_be16( datagram, header_length + 2 ),
+                             .remote_port = get_be16( datagram, header_length ) } );
+}
+
+void ShardedTCPStack::dispatch()
+{
+  EventLoop eventloop;
+  vector<bool> woken( shards_.size() );
+
+  eventloop.add_rule( "steer datagrams to shards", *device_, Direction::In, [&] {
+    for ( size_t i = 0; i < MAX_READS_PER_EVENT; ++i ) {
+      // each datagram is read into a buffer of its own (left uninitialized for the read to fill), which the
+      // shard then takes over with no copy
+      string datagram;
+      datagram.resize_and_overwrite( MAX_DATAGRAM_SIZE, []( char*, size_t size ) { return size; } );
+      device_->read( datagram );
+      if ( device_->would_block() ) {
+        break;
+      }
+      const size_t index = steer( datagram );
+      Shard& shard = *shards_[index];
+      if ( shard.inbound.push( move( datagram ) ) ) {
+        woken[index] = true;
+      } else {
+        ++shard.dropped;
+      }
+    }
+
+    for ( size_t index = 0; index < shards_.size(); ++index ) {
+      if ( woken[index] ) {
+        const uint64_t one = 1;
+        shards_[index]->wakeup_writer.write(
+          string_view { reinterpret_cast<const char*>( &one ), sizeof( one ) } ); // NOLINT(*-reinterpret-cast)
+        woken[index] = false;
+      }
+    }
+  } );
+
+  while ( not stop_ ) {
+    if ( eventloop.wait_next_event( STOP_CHECK_MS ) == EventLoop::Result::Exit ) {
+      return;
+    }
+  }
+}
+
+void ShardedTCPStack::run_shard( size_t index, const TCPConfig& cfg, const SetupFunction& setup )
+{
+  Shard& shard = *shards_[index];
+
+  // a shard with a device queue of its own reads it; otherwise, it reads what the dispatcher steers to it
+  const bool own_queue = shard.queue.has_value();
+  TCPStack stack { own_queue ? move( *shard.queue ) : dup_fd( *device_ ), cfg, own_queue };
+
+  if ( not own_queue ) {
+    stack.eventloop().add_rule( "receive steered datagrams", shard.wakeup, Direction::In, [&] {
+      string counter( sizeof( uint64_t ), 0 );
+      shard.wakeup.read( counter );
+
+      string datagram;
+      while ( shard.inbound.pop( datagram ) ) {
+        vector<string> buffers( 1 );
+        buffers[0] = move( datagram );
+        stack.receive( move( buffers ) );
+      }
+    } );
+  }
+
+  setup( stack, index );
+
+  while ( not stop_ ) {
+    stack.wait_next_event( STOP_CHECK_MS );
+  }
+}
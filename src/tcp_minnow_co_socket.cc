@@ -0,0 +1,4 @@
+#include "tcp_minnow_co_socket_impl.hh"
+
+//! Specialization of TCPMinnowCoSocket for TCPOverIPv4OverTunFdAdapter
+template class TCPMinnowCoSocket<TCPOverIPv4OverTunFdAdapter>;
@@ -1,5 +1,7 @@
 #include "tcp_minnow_socket_impl.hh"
 
-//! Specializations of TCPMinnowSocket for TCPOverIPv4OverTunFdAdapter and its lossy version
+//! Specializations of TCPMinnowSocket for TCPOverIPv4OverTunFdAdapter its lossy version, and the
+//! lossy version with generic receive offload
 template class TCPMinnowSocket<TCPOverIPv4OverTunFdAdapter>;
 template class TCPMinnowSocket<LossyFdAdapter<TCPOverIPv4OverTunFdAdapter>>;
+template class TCPMinnowSocket<GROAdapter<LossyFdAdapter<TCPOverIPv4OverTunFdAdapter>>>;
@@ -1,9 +1,12 @@
 #include "tcp_receiver.hh"
 #include "debug.hh"
+#include "tcp_config.hh"
+
+#include <algorithm>
 
 using namespace std;
 
-void TCPReceiver::receive(const TCPSenderMessage &message) {
+void TCPReceiver::receive(const TCPSenderMessage &message, bool congestion_experienced) {
   if (message.RST) {
     this->reassembler_.reader().set_error();
     return;
@@ -15,11 +18,47 @@ void TCPReceiver::receive(const TCPSenderMessage &message) {
   if (!this->zero_point_tag) {
     return;
   }
+  if (message.CWR) {
+    this->ece = false;
+  }
+  if (congestion_experienced) {
+    this->ece = true;
+  }
   uint64_t first_index = message.seqno.unwrap(this->zero_point, this->writer().bytes_pushed());
   if (!message.SYN) {
     first_index--;
   }
+  this->shrink_capacity();
   this->reassembler_.insert(first_index, message.payload, message.FIN);
+
+  if (this->autotuning()) {
+    this->last_receipt = this->now;
+    this->measure_rtt();
+    this->adjust_capacity();
+  }
+}
+
+bool TCPReceiver::receive_predicted(const TCPSenderMessage &message) {
+  if (!this->zero_point_tag || message.SYN || message.FIN || message.RST || message.CWR) {
+    return false;
+  }
+  if (message.seqno != Wrap32::wrap(this->writer().bytes_pushed() + 1, this->zero_point)) {
+    return false;
+  }
+  if (message.payload.empty()) {
+    return true;
+  }
+  this->shrink_capacity();
+  if (!this->reassembler_.append_in_order(message.payload)) {
+    return false;
+  }
+
+  if (this->autotuning()) {
+    this->last_receipt = this->now;
+    this->measure_rtt();
+    this->adjust_capacity();
+  }
+  return true;
 }
 
 TCPReceiverMessage TCPReceiver::send() const {
@@ -36,10 +75,122 @@ TCPReceiverMessage TCPReceiver::send() const {
     res.ackno = Wrap32::wrap(ackno, this->zero_point);
   }
   uint64_t cap = this->reassembler_.writer().available_capacity();
+  if (this->shrink_edge.has_value()) {
+    // (the application may have read since the capacity last caught up; that frees no extra space)
+    cap = min(cap, this->shrunk_capacity() - this->reader().bytes_buffered());
+  }
   if (cap > 65535) {
     cap = 65535;
   }
   res.window_size = static_cast<uint16_t>(cap);
   res.RST = this->reassembler_.reader().has_error();
+  res.ECE = this->ece;
   return res;
 }
+
+void TCPReceiver::tick(uint64_t ms_since_last_tick) {
+  this->tick(chrono::microseconds(chrono::milliseconds(ms_since_last_tick)));
+}
+
+void TCPReceiver::tick(chrono::microseconds since_last_tick) {
+  this->now += since_last_tick;
+  if (!this->autotuning() || this->rtt.count() == 0) {
+    return;
+  }
+  this->shrink_capacity();
+  // An idle flow gives its memory back, as long as nothing is waiting in the Reassembler.
+  if (this->now - this->last_receipt < this->idle_timeout() || this->reassembler_.count_bytes_pending() > 0) {
+    return;
+  }
+  if (this->writer().capacity() > this->initial_capacity && !this->shrink_edge.has_value()) {
+    this->shrink_edge = this->reader().bytes_popped() + this->writer().capacity();
+    this->shrink_capacity();
+  }
+  this->space = 0;
+  this->space_seq = this->reader().bytes_popped();
+  this->space_time = this->now;
+  this->rtt_pending = false;
+}
+
+chrono::microseconds TCPReceiver::idle_timeout() const {
+  const chrono::microseconds minimum = chrono::milliseconds(TCPConfig::TIMEOUT_DFLT);
+  return max(chrono::microseconds(IDLE_RTTS * this->rtt), minimum);
+}
+
+optional<uint64_t> TCPReceiver::time_to_idle() const {
+  const auto remaining = this->time_to_idle_us();
+  if (!remaining.has_value()) {
+    return nullopt;
+  }
+  return chrono::ceil<chrono::milliseconds>(remaining.value()).count();
+}
+
+// Only the first tick past the idle timeout matters: the ones after it find the same, until the next receive.
+optional<chrono::microseconds> TCPReceiver::time_to_idle_us() const {
+  if (!this->autotuning() || this->rtt.count() == 0 || this->now - this->last_receipt >= this->idle_timeout()) {
+    return nullopt;
+  }
+  return this->last_receipt + this->idle_timeout() - this->now;
+}
+
+// The time the sender takes to fill the window we advertised is (an upper bound on) the RTT.
+void TCPReceiver::measure_rtt() {
+  const uint64_t pushed = this->writer().bytes_pushed();
+  if (!this->rtt_pending) {
+    if (this->writer().available_capacity() == 0) {
+      return;
+    }
+    this->rtt_edge = pushed + this->writer().available_capacity();
+    this->rtt_start = this->now;
+    this->rtt_pending = true;
+    return;
+  }
+  if (pushed < this->rtt_edge) {
+    return;
+  }
+  const chrono::microseconds sample = max(this->now - this->rtt_start, chrono::microseconds(1));
+  if (this->rtt.count() == 0 || sample < this->rtt) {
+    this->rtt = sample;
+  }
+  else {
+    this->rtt = (7 * this->rtt + sample) / 8;
+  }
+  this->rtt_pending = false;
+}
+
+// The buffer shrinks only as fast as the application reads, so the right edge of the window stays where it
+// was advertised (RFC 9293 3.8.6.2.2), and the window closes as the sender reaches it.
+uint64_t TCPReceiver::shrunk_capacity() const {
+  return max(this->initial_capacity, this->shrink_edge.value() - this->reader().bytes_popped());
+}
+
+void TCPReceiver::shrink_capacity() {
+  if (!this->shrink_edge.has_value()) {
+    return;
+  }
+  const uint64_t target = this->shrunk_capacity();
+  if (target < this->writer().capacity()) {
+    this->reassembler_.set_capacity(target);
+  }
+  if (target == this->initial_capacity) {
+    this->shrink_edge.reset();
+  }
+}
+
+// Once per RTT, grow the buffer to twice what the application consumed in the last RTT.
+void TCPReceiver::adjust_capacity() {
+  if (this->rtt.count() == 0 || this->now - this->space_time < this->rtt) {
+    return;
+  }
+  const uint64_t copied = this->reader().bytes_popped() - this->space_seq;
+  if (copied > this->space) {
+    this->space = copied;
+    const uint64_t target = min(2 * copied, this->max_capacity);
+    if (target > this->writer().capacity()) {
+      this->reassembler_.set_capacity(target);
+      this->shrink_edge.reset();
+    }
+  }
+  this->space_seq = this->reader().bytes_popped();
+  this->space_time = this->now;
+}
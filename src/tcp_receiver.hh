@@ -4,29 +4,85 @@
 #include "tcp_receiver_message.hh"
 #include "tcp_sender_message.hh"
 
+#include <chrono>
+#include <optional>
+
 class TCPReceiver
 {
 public:
-  // Construct with given Reassembler
-  explicit TCPReceiver( Reassembler&& reassembler ) : reassembler_( std::move( reassembler ) ) {}
+  // Construct with given Reassembler. If `capacity_ceiling` exceeds the Reassembler's capacity, the receive
+  // buffer is auto-tuned between the two based on the measured bandwidth-delay product.
+  explicit TCPReceiver( Reassembler&& reassembler, uint64_t capacity_ceiling = 0 )
+    : reassembler_( std::move( reassembler ) )
+    , initial_capacity( reassembler_.writer().capacity() )
+    , max_capacity( capacity_ceiling )
+  {}
 
   /*
    * The TCPReceiver receives TCPSenderMessages, inserting their payload into the Reassembler
-   * at the correct stream index.
+   * at the correct stream index. `congestion_experienced` is true if the datagram carrying the
+   * message was marked CE by a router; the mark is echoed (ECE) until the sender answers with CWR.
    */
-  void receive(const TCPSenderMessage &message);
+  void receive(const TCPSenderMessage &message, bool congestion_experienced = false);
+
+  /*
+   * Header-prediction fast path: if the message is the next in-sequence segment, carries no flags, and
+   * its payload can go straight to the stream, accept it and return true. Otherwise do nothing and
+   * return false (the caller falls back to receive()).
+   */
+  bool receive_predicted(const TCPSenderMessage &message);
 
   // The TCPReceiver sends TCPReceiverMessages to the peer's TCPSender.
   TCPReceiverMessage send() const;
 
+  /* Time has passed by the given # of milliseconds since the last time the tick() method was called */
+  void tick( uint64_t ms_since_last_tick );
+
+  /* The same, at microsecond resolution */
+  void tick( std::chrono::microseconds since_last_tick );
+
   // Access the output
   const Reassembler& reassembler() const { return reassembler_; }
   Reader& reader() { return reassembler_.reader(); }
   const Reader& reader() const { return reassembler_.reader(); }
   const Writer& writer() const { return reassembler_.writer(); }
 
+  // Receive-buffer auto-tuning state
+  // receiver-side RTT estimate in ms (0 if not yet measured)
+  uint64_t rtt_estimate() const { return std::chrono::duration_cast<std::chrono::milliseconds>(rtt).count(); }
+  bool autotuning() const { return max_capacity > initial_capacity; }
+  // ms (rounded up) until tick() finds the flow idle (nullopt if it will not, or already has, until the next
+  // receive)
+  std::optional<uint64_t> time_to_idle() const;
+  std::optional<std::chrono::microseconds> time_to_idle_us() const; // the same, to the microsecond
+
 private:
+  void measure_rtt();
+  void adjust_capacity();
+  void shrink_capacity();
+  uint64_t shrunk_capacity() const;
+  std::chrono::microseconds idle_timeout() const;
+
   Reassembler reassembler_;
   Wrap32 zero_point {0};
   bool zero_point_tag {false};
+  bool ece {false};
+
+  // Receive-buffer auto-tuning, in the style of Linux tcp_rcv_rtt_measure() and tcp_rcv_space_adjust().
+  // The RTT is estimated as the time it takes the sender to fill one advertised window, and the buffer is
+  // grown to twice the bytes the application consumed in the last RTT. An idle flow shrinks back, without
+  // moving the right edge of the window it advertised (`shrink_edge`, while shrinking).
+  static constexpr uint64_t IDLE_RTTS = 8;
+  uint64_t initial_capacity;
+  uint64_t max_capacity;
+  std::chrono::microseconds now {0};
+  std::chrono::microseconds last_receipt {0};
+  std::chrono::microseconds rtt {0};
+  bool rtt_pending {false};
+  uint64_t rtt_edge {0};
+  std::chrono::microseconds rtt_start {0};
+  uint64_t space {0};
+  uint64_t space_seq {0};
+  std::chrono::microseconds space_time {0};
+  std::optional<uint64_t> shrink_edge {};
 };
@@ -8,45 +8,109 @@ uint64_t TCPSender::sequence_numbers_in_flight() const {
   return this->flight_count;
 }
 
+// How long until the retransmission timer expires? (In ms, rounded up, so a wakeup then is not early.)
+optional<uint64_t> TCPSender::time_to_retransmission() const {
+  const auto remaining = this->time_to_retransmission_us();
+  if (!remaining.has_value()) {
+    return nullopt;
+  }
+  return chrono::ceil<chrono::milliseconds>(remaining.value()).count();
+}
+
+optional<chrono::microseconds> TCPSender::time_to_retransmission_us() const {
+  if (this->q.empty()) {
+    return nullopt;
+  }
+  return this->RTO - min(this->timer, this->RTO);
+}
+
 // How many consecutive retransmissions have happened?
 uint64_t TCPSender::consecutive_retransmissions() const {
   return this->retran_count;
 }
 
 void TCPSender::push(const TransmitFunction& transmit) {
+  this->push<TransmitFunction>(transmit);
+}
+
+void TCPSender::tick(uint64_t ms_since_last_tick, const TransmitFunction& transmit) {
+  this->tick<TransmitFunction>(ms_since_last_tick, transmit);
+}
+
+void TCPSender::tick(chrono::microseconds since_last_tick, const TransmitFunction& transmit) {
+  this->tick<TransmitFunction>(since_last_tick, transmit);
+}
+
+// Decide what push() sends: queue new segments as the window allows, and list everything to transmit.
+void TCPSender::plan_push() {
+  this->to_transmit.clear();
+  if (this->syn_data_rejected) {
+    // Resend the data from a refused Fast Open SYN right away instead of waiting for the RTO.
+    this->syn_data_rejected = false;
+    this->to_transmit.push_back({this->q.front(), 0});
+  }
+  // With segmentation offload, consecutive segments are still tracked (and retransmitted) one MSS at a time,
+  // but are transmitted together as one burst. A SYN always goes out on its own.
+  Segment burst {};
+  uint64_t burst_offset = 0;
   while (true) {
-    TCPSenderMessage res {};
+    Segment seg {};
     const bool add = (this->window == 0);
     this->window += add;
 
-    res.SYN = !this->SYN_tag;
-    res.FIN = false;
-    res.RST = this->reader().has_error();
-    res.payload = "";
-    res.seqno = this->isn_;
-    const auto str = this->input_.reader().peek();
-    uint64_t len = min(TCPConfig::MAX_PAYLOAD_SIZE, str.size());
-    len = min(len, this->window - this->sequence_numbers_in_flight() - res.sequence_length());
-    res.payload = str.substr(0, len);
-    res.seqno = Wrap32::wrap(this->abs_seqno(), this->isn_);
-    this->input_.reader().pop(len);
-    if (!this->FIN_tag && this->input_.reader().is_finished() && res.sequence_length() + 1 + this->sequence_numbers_in_flight() <= this->window) {
-      res.FIN = true;
+    seg.SYN = !this->SYN_tag;
+    seg.seqno = Wrap32::wrap(this->abs_seqno(), this->isn_);
+    const uint64_t unsent = this->bytes_unsent();
+    uint64_t len = min(TCPConfig::MAX_PAYLOAD_SIZE, unsent);
+    len = min(len, this->window - this->sequence_numbers_in_flight() - seg.SYN);
+    const uint64_t used = this->sequence_numbers_in_flight() + seg.SYN;
+    len = min(len, this->cwnd > used ? this->cwnd - used : 0);
+    seg.length = len;
+    if (!this->FIN_tag && this->writer().is_closed() && len == unsent && seg.sequence_length() + 1 + this->sequence_numbers_in_flight() <= min(this->window, this->cwnd)) {
+      seg.FIN = true;
       this->FIN_tag = true;
     }
     this->SYN_tag = true;
 
     this->window -= add;
 
-    if (res.sequence_length() > 0) {
-      this->q.push(res);
-      this->flight_count += res.sequence_length();
-      transmit(res);
+    if (seg.sequence_length() > 0) {
+      seg.CWR = this->cwr_pending;
+      this->cwr_pending = false;
+      this->q.push(seg);
+      this->flight_count += seg.sequence_length();
+      if (!this->segmentation_offload || seg.SYN) {
+        this->to_transmit.push_back({seg, this->unacked_bytes});
+      }
+      else if (burst.sequence_length() == 0) {
+        burst = seg;
+        burst_offset = this->unacked_bytes;
+      }
+      else {
+        burst.length += seg.length;
+        burst.FIN = seg.FIN;
+      }
+      this->unacked_bytes += len;
     }
     else {
       break;
     }
   }
+  if (burst.sequence_length() > 0) {
+    this->to_transmit.push_back({burst, burst_offset});
+  }
+}
+
+// Build the message for an outstanding segment, with its payload copied out of the outbound stream
+// (`offset` bytes past the first unacknowledged byte) into a reused buffer.
+const TCPSenderMessage& TCPSender::build_message(const Segment& seg, uint64_t offset) {
+  this->outgoing.seqno = seg.seqno;
+  this->outgoing.SYN = seg.SYN;
+  this->outgoing.FIN = seg.FIN;
+  this->outgoing.CWR = seg.CWR;
+  this->outgoing.RST = this->reader().has_error();
+  this->outgoing.payload.assign(this->reader().peek().substr(offset, seg.length));
+  return this->outgoing;
 }
 
 TCPSenderMessage TCPSender::make_empty_message() const {
@@ -58,6 +122,12 @@ TCPSenderMessage TCPSender::make_empty_message() const {
   return res;
 }
 
+void TCPSender::set_syn_payload_limit(uint64_t max_bytes) {
+  if (!this->SYN_tag) {
+    this->window = 1 + min(max_bytes, TCPConfig::MAX_PAYLOAD_SIZE);
+  }
+}
+
 void TCPSender::receive(const TCPReceiverMessage& msg) {
   this->window = msg.window_size;
   if (msg.RST) {
@@ -66,6 +136,7 @@ void TCPSender::receive(const TCPReceiverMessage& msg) {
   if (!msg.ackno.has_value()) {
     return;
   }
+  uint64_t acked = 0;
   while (!this->q.empty()) {
     const uint32_t p1 = q.front().seqno.sub(this->isn_);
     const uint32_t p2 = msg.ackno.value().sub(this->isn_);
@@ -73,32 +144,72 @@ void TCPSender::receive(const TCPReceiverMessage& msg) {
       break;
     }
     if (p1 + this->q.front().sequence_length() <= p2) {
+      acked += this->q.front().sequence_length();
       this->flight_count -= this->q.front().sequence_length();
+      this->reader().pop(this->q.front().length);
+      this->unacked_bytes -= this->q.front().length;
       this->q.pop();
-      this->timer = 0;
+      this->timer = {};
       this->retran_count = 0;
-      this->RTO = this->initial_RTO_ms_;
+      this->RTO = this->initial_RTO_;
     }
     else {
       break;
     }
   }
+  // A Fast Open SYN whose payload was not accepted: only the SYN is acknowledged. Keep the data
+  // outstanding as an ordinary segment.
+  if (!this->q.empty() && this->q.front().SYN && this->q.front().length > 0
+      && msg.ackno.value() == this->isn_ + 1) {
+    this->q.front().SYN = false;
+    this->q.front().seqno = this->isn_ + 1;
+    this->flight_count--;
+    this->timer = {};
+    this->retran_count = 0;
+    this->RTO = this->initial_RTO_;
+    this->syn_data_rejected = true;
+  }
+
+  if (msg.ECE) {
+    this->reduce_congestion_window(msg.ackno.value().unwrap(this->isn_, this->abs_seqno()));
+  }
+  else if (this->cwnd != UINT64_MAX) {
+    // Congestion avoidance: one more segment per window acknowledged.
+    this->cwnd_acked += acked;
+    if (this->cwnd_acked >= this->cwnd) {
+      this->cwnd_acked -= this->cwnd;
+      this->cwnd += TCPConfig::MAX_PAYLOAD_SIZE;
+    }
+  }
 }
 
-void TCPSender::tick(uint64_t ms_since_last_tick, const TransmitFunction& transmit) {
+// Respond to an ECN-Echo as if a segment had been lost, without retransmitting anything. Echoes for data sent
+// before the last reduction describe the same congestion event and are ignored.
+void TCPSender::reduce_congestion_window(uint64_t ackno) {
+  if (ackno <= this->recover) {
+    return;
+  }
+  this->cwnd = max(this->flight_count / 2, 2 * TCPConfig::MAX_PAYLOAD_SIZE);
+  this->cwnd_acked = 0;
+  this->recover = this->abs_seqno();
+  this->cwr_pending = true;
+}
+
+bool TCPSender::retransmission_due(chrono::microseconds since_last_tick) {
   if (q.empty()) {
-    this->timer = 0;
+    this->timer = {};
     this->retran_count = 0;
-    this->RTO = this->initial_RTO_ms_;
-    return;
+    this->RTO = this->initial_RTO_;
+    return false;
   }
-  this->timer += ms_since_last_tick;
-  if (this->timer >= this->RTO) {
-    transmit(q.front());
-    if (this->window != 0) {
-      this->retran_count++;
-      this->RTO <<= 1;
-    }
-    this->timer = 0;
+  this->timer += since_last_tick;
+  return this->timer >= this->RTO;
+}
+
+void TCPSender::count_retransmission() {
+  if (this->window != 0) {
+    this->retran_count++;
+    this->RTO *= 2;
   }
+  this->timer = {};
 }
@@ -4,15 +4,29 @@
 #include "tcp_receiver_message.hh"
 #include "tcp_sender_message.hh"
 
+#include <chrono>
+#include <concepts>
+#include <cstdint>
 #include <functional>
+#include <optional>
 #include <queue>
+#include <vector>
+
+/* Anything that can be called to send a TCPSenderMessage */
+template<typename F>
+concept TCPSenderMessageSink = std::invocable<const F&, const TCPSenderMessage&>;
 
 class TCPSender
 {
 public:
   /* Construct TCP sender with given default Retransmission Timeout and possible ISN */
   TCPSender(ByteStream&& input, Wrap32 isn, uint64_t initial_RTO_ms)
-    : input_(std::move(input)), isn_(isn), initial_RTO_ms_(initial_RTO_ms), RTO(initial_RTO_ms)
+    : TCPSender(std::move(input), isn, std::chrono::milliseconds(initial_RTO_ms))
+    {}
+
+  /* The same, with the timeout at microsecond resolution */
+  TCPSender(ByteStream&& input, Wrap32 isn, std::chrono::microseconds initial_RTO)
+    : input_(std::move(input)), isn_(isn), initial_RTO_(initial_RTO), RTO(initial_RTO)
     {}
 
   /* Generate an empty TCPSenderMessage */
@@ -30,27 +44,108 @@ public:
   /* Time has passed by the given # of milliseconds since the last time the tick() method was called */
   void tick( uint64_t ms_since_last_tick, const TransmitFunction& transmit );
 
+  /* The same, at microsecond resolution */
+  void tick( std::chrono::microseconds since_last_tick, const TransmitFunction& transmit );
+
+  /* The same, for any callable sink: the call is not type-erased, so it can be inlined all the way down */
+  template<TCPSenderMessageSink F>
+  void push( const F& transmit )
+  {
+    this->plan_push();
+    for (const Transmission& t : this->to_transmit) {
+      transmit(this->build_message(t.seg, t.offset));
+    }
+  }
+
+  template<TCPSenderMessageSink F>
+  void tick( uint64_t ms_since_last_tick, const F& transmit )
+  {
+    this->tick(std::chrono::microseconds(std::chrono::milliseconds(ms_since_last_tick)), transmit);
+  }
+
+  template<TCPSenderMessageSink F>
+  void tick( std::chrono::microseconds since_last_tick, const F& transmit )
+  {
+    if (this->retransmission_due(since_last_tick)) {
+      transmit(this->build_message(this->q.front(), 0));
+      this->count_retransmission();
+    }
+  }
+
+  /* TCP Fast Open (RFC 7413): let the SYN carry up to `max_bytes` of payload before the peer's window is known */
+  void set_syn_payload_limit( uint64_t max_bytes );
+
+  /* Segmentation offload: have push() send each burst as one message, however many MSS it covers, and leave
+     splitting it into MSS-sized segments to the datagram adapter */
+  void set_segmentation_offload( bool enabled ) { segmentation_offload = enabled; }
+
   // Accessors
   uint64_t sequence_numbers_in_flight() const;  // How many sequence numbers are outstanding?
   uint64_t consecutive_retransmissions() const; // How many consecutive retransmissions have happened?
+  uint64_t congestion_window() const { return cwnd; } // UINT64_MAX until the first ECN-Echo
+  std::optional<uint64_t> time_to_retransmission() const; // ms until tick() resends (nullopt: nothing in flight)
+  std::optional<std::chrono::microseconds> time_to_retransmission_us() const; // the same, to the microsecond
   const Writer& writer() const { return input_.writer(); }
   const Reader& reader() const { return input_.reader(); }
   Writer& writer() { return input_.writer(); }
 
-  uint64_t abs_seqno() const { return reader().bytes_popped() + SYN_tag + FIN_tag; }
+  uint64_t abs_seqno() const { return reader().bytes_popped() + unacked_bytes + SYN_tag + FIN_tag; }
+
+  // Bytes written to the outbound stream but not yet sent. (The stream also holds sent bytes until they are
+  // acknowledged.)
+  uint64_t bytes_unsent() const { return reader().bytes_buffered() - unacked_bytes; }
+
+  // Has the outbound stream been closed and all of it sent (though perhaps not yet acknowledged)?
+  bool fully_sent() const { return writer().is_closed() && bytes_unsent() == 0; }
 
 private:
   Reader& reader() { return input_.reader(); }
 
+  // An outstanding segment. Its payload is not copied: unacknowledged bytes stay in the outbound stream
+  // until they are acknowledged, and the payload is rebuilt from there whenever the segment is (re)sent.
+  struct Segment {
+    Wrap32 seqno {0};
+    uint64_t length {0}; // payload bytes
+    bool SYN {false};
+    bool FIN {false};
+    bool CWR {false};
+    uint64_t sequence_length() const { return SYN + length + FIN; }
+  };
+
+  // A segment to transmit, `offset` bytes past the first unacknowledged byte of the outbound stream
+  struct Transmission {
+    Segment seg {};
+    uint64_t offset {0};
+  };
+
+  void plan_push();                                      // queue new segments, and fill to_transmit
+  bool retransmission_due(std::chrono::microseconds since_last_tick); // advance the timer: resend q.front()?
+  void count_retransmission();                           // back off after resending q.front()
+  const TCPSenderMessage& build_message(const Segment& seg, uint64_t offset);
+
   ByteStream input_;
   Wrap32 isn_;
-  uint64_t initial_RTO_ms_;
+  std::chrono::microseconds initial_RTO_;
   uint64_t retran_count {0};
   uint64_t flight_count {0};
-  uint64_t RTO;
-  uint64_t timer {0};
+  std::chrono::microseconds RTO;
+  std::chrono::microseconds timer {0}; // an owner with a timer wheel holds time_to_retransmission_us() there
   uint64_t window {1};
-  std::queue<TCPSenderMessage> q {};
+  std::queue<Segment> q {};
+  uint64_t unacked_bytes {0};   // payload bytes sent and still in input_
+  TCPSenderMessage outgoing {}; // reused for every transmission
+  std::vector<Transmission> to_transmit {}; // what the current push() sends
   bool SYN_tag {false};
   bool FIN_tag {false};
+  bool syn_data_rejected {false}; // peer acked our SYN but not the Fast Open data it carried
+  bool segmentation_offload {false};
+
+  // ECN congestion response (RFC 3168 section 6.1.2). The congestion window is unlimited until the receiver
+  // echoes a congestion mark; then it is halved (at most once per window of data) and grows by one segment
+  // per window acknowledged. The segment after each reduction carries CWR.
+  void reduce_congestion_window(uint64_t ackno);
+  uint64_t cwnd {UINT64_MAX};
+  uint64_t cwnd_acked {0};
+  uint64_t recover {0};
+  bool cwr_pending {false};
 };
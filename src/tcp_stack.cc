@@ -0,0 +1,414 @@
+#include "tcp_stack.hh"
+
+#include "clock.hh"
+#include "helpers.hh"
+#include "random.hh"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+using namespace std;
+
+namespace {
+Address make_address( uint32_t address, uint16_t port )
+{
+  return Address { Address::from_ipv4_numeric( address ).ip(), port };
+}
+
+class Wrap32Raw : public Wrap32
+{
+public:
+  explicit Wrap32Raw( Wrap32 n ) : Wrap32( n ) {}
+  uint32_t raw_value() const { return raw_value_; }
+};
+
+uint32_t raw_value( Wrap32 n )
+{
+  return Wrap32Raw { n }.raw_value();
+}
+
+// A SYN cookie is a 5-bit period counter and a 27-bit keyed hash
+constexpr unsigned SYN_COOKIE_HASH_BITS = 27;
+} // namespace
+
+TCPStack::Connection::Connection( const FlowKey& flow, const TCPConfig& cfg ) : flow_( flow ), peer_( cfg )
+{
+  adapter_.config_mut().source = make_address( flow.local_address, flow.local_port );
+  adapter_.config_mut().destination = make_address( flow.remote_address, flow.remote_port );
+}
+
+TCPStack::TCPStack( FileDescriptor&& device, const TCPConfig& cfg, bool read_device )
+  : cfg_( cfg )
+  , device_( move( device ) )
+  , rng_( get_random_engine() )
+  , last_tick_( monotonic_time() )
+  , syn_cookie_secret_( uniform_int_distribution<uint64_t> {}( rng_ ) )
+  , wakeup_category_( eventloop_.add_category( "TCP stack timers" ) )
+{
+  if ( read_device ) {
+    device_.set_blocking( false ); // (so read_datagrams can read until nothing is left)
+    eventloop_.add_rule(
+      "receive datagrams for the TCP stack", device_, Direction::In, [this] { read_datagrams(); } );
+  }
+}
+
+shared_ptr<TCPStack::Connection> TCPStack::connect( const Address& local, const Address& remote )
+{
+  const FlowKey flow { .local_address = local.ipv4_numeric(),
+                       .remote_address = remote.ipv4_numeric(),
+                       .local_port = local.port(),
+                       .remote_port = remote.port() };
+  if ( flows_.find( flow ) ) {
+    throw runtime_error( "TCPStack::connect: connection to " + remote.to_string() + " from "
+                         + local.to_string() + " already exists" );
+  }
+
+  auto connection = open( flow, random_isn() );
+  push( *connection );
+  return connection;
+}
+
+TCPStack::Listener::Listener( const Address& local, size_t backlog, size_t syn_cookie_threshold )
+  : address_( local.ipv4_numeric() )
+  , port_( local.port() )
+  , backlog_( backlog )
+  , syn_cookie_threshold_( syn_cookie_threshold )
+{}
+
+shared_ptr<TCPStack::Connection> TCPStack::Listener::accept()
+{
+  if ( queue_.empty() ) {
+    return nullptr;
+  }
+  auto connection = move( queue_.front() );
+  queue_.pop_front();
+  return connection;
+}
+
+shared_ptr<TCPStack::Listener> TCPStack::listen( const Address& local,
+                                                size_t backlog,
+                                                size_t syn_cookie_threshold )
+{
+  return listeners_.emplace_back( make_shared<Listener>( local, backlog, syn_cookie_threshold ) );
+}
+
+void TCPStack::push( Connection& connection )
+{
+  catch_up( connection );
+  connection.peer_.push( transmit( connection ) );
+  schedule( connection );
+}
+
+EventLoop::Result TCPStack::wait_next_event( int timeout_ms )
+{
+  arm_wakeup();
+  const auto ret = eventloop_.wait_next_event( timeout_ms );
+
+  const auto now = monotonic_time();
+  tick( now - last_tick_ );
+  last_tick_ = now;
+
+  return ret;
+}
+
+void TCPStack::arm_wakeup()
+{
+  const auto expiry = timers_.next_expiry();
+  if ( not expiry.has_value() ) {
+    if ( wakeup_.has_value() ) {
+      wakeup_->cancel();
+      wakeup_.reset();
+    }
+    return;
+  }
+
+  // (the stack's time is behind the monotonic clock by the time since the last tick)
+  const auto deadline = last_tick_ + chrono::microseconds { expiry.value() - min( expiry.value(), time_us_ ) };
+  if ( wakeup_.has_value() and wakeup_deadline_ <= deadline ) {
+    return; // a timer that fires early is harmless: the stack ticks, and arms another
+  }
+  if ( wakeup_.has_value() ) {
+    wakeup_->cancel();
+  }
+  const auto delay = max( deadline - monotonic_time(), chrono::microseconds {} );
+  wakeup_ = eventloop_.add_timer( wakeup_category_, delay, [this] { wakeup_.reset(); } );
+  wakeup_deadline_ = deadline;
+}
+
+void TCPStack::tick( chrono::microseconds since_last_tick )
+{
+  time_us_ += since_last_tick.count();
+  timers_.advance( time_us_, [this]( const Timer& timer ) {
+    if ( timer.tombstone ) {
+      tombstones_.erase( timer.flow );
+    } else if ( auto* connection = flows_.find( timer.flow ) ) {
+      expire( **connection );
+    }
+  } );
+}
+
+void TCPStack::catch_up( Connection& connection )
+{
+  if ( connection.time_us_ < time_us_ ) {
+    connection.peer_.tick( chrono::microseconds { time_us_ - connection.time_us_ }, transmit( connection ) );
+    connection.time_us_ = time_us_;
+  }
+}
+
+void TCPStack::schedule( Connection& connection )
+{
+  const TCPPeer& peer = connection.peer_;
+  if ( not peer.active() or peer.lingering() ) {
+    timers_.reschedule( connection.timer_, time_us_, { .flow = connection.flow_ } );
+  } else if ( const auto delay = peer.next_deadline_us(); delay.has_value() ) {
+    timers_.reschedule( connection.timer_, time_us_ + delay->count(), { .flow = connection.flow_ } );
+  } else {
+    timers_.cancel( connection.timer_ ); // nothing to do until it sends or receives
+  }
+}
+
+void TCPStack::expire( Connection& connection )
+{
+  catch_up( connection );
+  if ( connection.peer_.lingering() ) {
+    retire( connection );
+  } else if ( not connection.active() ) {
+    if ( connection.listener_ ) { // the handshake never completed
+      --connection.listener_->half_open_;
+    }
+  } else {
+    schedule( connection );
+    return;
+  }
+  flows_.erase( connection.flow_ ); // (which may free the connection)
+  ++stats_.connections_closed;
+}
+
+void TCPStack::read_datagrams()
+{
+  for ( size_t i = 0; i < MAX_READS_PER_EVENT; ++i ) {
+    vector<string> strs( 3 );
+    strs[0].resize( IPv4Header::LENGTH );
+    strs[1].resize( TCPSegment::HEADER_LENGTH );
+    device_.read( strs );
+    if ( device_.would_block() ) {
+      return;
+    }
+    receive( move( strs ) );
+  }
+}
+
+void TCPStack::receive( vector<string> datagram )
+{
+  ++stats_.datagrams_received;
+  InternetDatagram ip_dgram;
+  if ( not parse( ip_dgram, move( datagram ) ) ) {
+    ++stats_.datagrams_invalid;
+    return;
+  }
+  deliver( move( ip_dgram ) );
+}
+
+void TCPStack::deliver( InternetDatagram ip_dgram )
+{
+  auto seg = TCPOverIPv4Adapter::parse_tcp_in_ip( ip_dgram );
+  if ( not seg.has_value() ) {
+    ++stats_.datagrams_invalid;
+    return;
+  }
+
+  const FlowKey flow { .local_address = ip_dgram.header.dst,
+                       .remote_address = ip_dgram.header.src,
+                       .local_port = seg->udinfo.dst_port,
+                       .remote_port = seg->udinfo.src_port };
+
+  Connection* connection = nullptr;
+  if ( auto* found = flows_.find( flow ) ) {
+    connection = found->get();
+  } else if ( Tombstone* tombstone = tombstones_.find( flow ); tombstone and not seg->message.sender->SYN ) {
+    receive_on_tombstone( flow, *tombstone, seg->message );
+    return;
+  } else if ( Listener* listener = find_listener( flow ); listener and not seg->message.sender->RST ) {
+    const TCPMessage& msg = seg->message;
+    if ( msg.sender->SYN and not msg.receiver->ackno.has_value() ) {
+      connection = accept_syn( *listener, flow, msg );
+    } else if ( not msg.sender->SYN and msg.receiver->ackno.has_value() and listener->syn_cookies() ) {
+      connection = accept_syn_cookie( *listener, flow, msg );
+    }
+  }
+
+  if ( not connection ) {
+    ++stats_.datagrams_unmatched;
+    return;
+  }
+
+  catch_up( *connection );
+  connection->peer_.receive( move( seg->message ), transmit( *connection ) );
+  if ( connection->listener_ and connection->established() ) {
+    establish( *connection );
+  }
+  if ( connection->on_receive_ ) {
+    connection->on_receive_();
+  }
+
+  if ( connection->peer_.lingering() ) {
+    retire( *connection );
+    flows_.erase( flow ); // (which may free the connection)
+    ++stats_.connections_closed;
+  } else {
+    schedule( *connection );
+  }
+}
+
+TCPStack::Listener* TCPStack::find_listener( const FlowKey& flow ) const
+{
+  for ( const auto& listener : listeners_ ) {
+    if ( listener->port_ == flow.local_port
+         and ( listener->address_ == 0 or listener->address_ == flow.local_address ) ) {
+      return listener.get();
+    }
+  }
+  return nullptr;
+}
+
+TCPStack::Connection* TCPStack::accept_syn( Listener& listener, const FlowKey& flow, const TCPMessage& syn )
+{
+  const bool backlog_full = listener.queue_.size() + listener.half_open_ >= listener.backlog_;
+
+  if ( listener.syn_cookies() and listener.queue_.size() < listener.backlog_
+       and ( backlog_full or listener.half_open_ >= listener.syn_cookie_threshold_ ) ) {
+    const uint64_t period = timestamp_ms() / SYN_COOKIE_PERIOD_MS;
+    const uint32_t cookie = syn_cookie( flow, raw_value( syn.sender->seqno ), period );
+    const auto window_size = static_cast<uint16_t>( min( cfg_.recv_capacity, size_t { UINT16_MAX } ) );
+    const TCPMessage syn_ack {
+      .sender = TCPSenderMessage { .seqno = Wrap32 { cookie }, .SYN = true },
+      .receiver = TCPReceiverMessage { .ackno = syn.sender->seqno + 1, .window_size = window_size } };
+    write_stateless( flow, syn_ack );
+    ++listener.stats_.syn_cookies_sent;
+    return nullptr;
+  }
+
+  if ( backlog_full ) {
+    ++listener.stats_.syns_dropped;
+    return nullptr;
+  }
+
+  ++listener.stats_.syns_received;
+  ++listener.half_open_;
+  Connection& connection = *open( flow, random_isn() );
+  connection.listener_ = &listener;
+  return &connection;
+}
+
+TCPStack::Connection* TCPStack::accept_syn_cookie( Listener& listener, const FlowKey& flow, const TCPMessage& ack )
+{
+  const uint32_t client_isn = raw_value( ack.sender->seqno ) - 1;
+  const uint32_t cookie = raw_value( ack.receiver->ackno.value() ) - 1;
+  const uint64_t period = timestamp_ms() / SYN_COOKIE_PERIOD_MS;
+  if ( cookie != syn_cookie( flow, client_isn, period ) and cookie != syn_cookie( flow, client_isn, period - 1 ) ) {
+    ++listener.stats_.syn_cookies_rejected;
+    return nullptr;
+  }
+
+  if ( listener.queue_.size() >= listener.backlog_ ) {
+    ++listener.stats_.syns_dropped;
+    return nullptr;
+  }
+
+  ++listener.stats_.syn_cookies_accepted;
+  ++listener.half_open_;
+  Connection& connection = *open( flow, Wrap32 { cookie } );
+  connection.listener_ = &listener;
+
+  // Replay the SYN that the cookie stands for (our SYN-ACK to it was already sent), so the ACK completes the
+  // handshake
+  TCPMessage syn { .sender = TCPSenderMessage { .seqno = Wrap32 { client_isn }, .SYN = true },
+                         .receiver = TCPReceiverMessage { .window_size = ack.receiver->window_size } };
+  connection.peer_.receive( move( syn ), []( const TCPMessage& ) {} );
+  return &connection;
+}
+
+uint32_t TCPStack::syn_cookie( const FlowKey& flow, uint32_t client_isn, uint64_t period ) const
+{
+  const uint64_t hash = flow_hash( flow, syn_cookie_secret_ ^ ( uint64_t { client_isn } << 32 | period ) );
+  return static_cast<uint32_t>( period << SYN_COOKIE_HASH_BITS | ( hash & ( ( 1U << SYN_COOKIE_HASH_BITS ) - 1 ) ) );
+}
+
+void TCPStack::establish( Connection& connection )
+{
+  Listener& listener = *connection.listener_;
+  connection.listener_ = nullptr;
+  --listener.half_open_;
+  listener.queue_.push_back( *flows_.find( connection.flow_ ) );
+  ++listener.stats_.connections_queued;
+  listener.stats_.max_queued = max( listener.stats_.max_queued, uint64_t { listener.queue_.size() } );
+}
+
+void TCPStack::retire( Connection& connection )
+{
+  if ( connection.listener_ ) {
+    --connection.listener_->half_open_;
+    connection.listener_ = nullptr;
+  }
+  connection.retired_ = true;
+  timers_.cancel( connection.timer_ );
+
+  const TCPReceiverMessage ack = connection.peer_.receiver().send();
+  tombstones_.insert(
+    connection.flow_,
+    Tombstone { .seqno = connection.peer_.sender().make_empty_message().seqno,
+                .ackno = ack.ackno.value(),
+                .window_size = ack.window_size,
+                .timer = timers_.schedule( time_us_ + TCPPeer::linger_time_us( cfg_ ).count(),
+                                           { .flow = connection.flow_, .tombstone = true } ) } );
+}
+
+void TCPStack::receive_on_tombstone( const FlowKey& flow, Tombstone& tombstone, const TCPMessage& msg )
+{
+  if ( msg.sender->RST or msg.receiver->RST ) {
+    timers_.cancel( tombstone.timer );
+    tombstones_.erase( flow );
+    return;
+  }
+
+  timers_.reschedule( tombstone.timer,
+                      time_us_ + TCPPeer::linger_time_us( cfg_ ).count(),
+                      { .flow = flow, .tombstone = true } );
+
+  if ( msg.sender->sequence_length() > 0 ) { // a retransmitted FIN (our ACK of it was lost)
+    write_stateless( flow,
+                     TCPMessage { .sender = TCPSenderMessage { .seqno = tombstone.seqno },
+                                  .receiver = TCPReceiverMessage { .ackno = tombstone.ackno,
+                                                                   .window_size = tombstone.window_size } } );
+    ++stats_.tombstone_acks;
+  }
+}
+
+void TCPStack::write_stateless( const FlowKey& flow, const TCPMessage& msg )
+{
+  stateless_adapter_.config_mut().source = make_address( flow.local_address, flow.local_port );
+  stateless_adapter_.config_mut().destination = make_address( flow.remote_address, flow.remote_port );
+  stateless_adapter_.write_tcp_in_ip( device_, msg );
+}
+
+Wrap32 TCPStack::random_isn()
+{
+  return Wrap32 { uniform_int_distribution<uint32_t> {}( rng_ ) };
+}
+
+shared_ptr<TCPStack::Connection> TCPStack::open( const FlowKey& flow, Wrap32 isn )
+{
+  if ( Tombstone* tombstone = tombstones_.find( flow ) ) { // a new connection replaces the flow's tombstone
+    timers_.cancel( tombstone->timer );
+    tombstones_.erase( flow );
+  }
+  TCPConfig cfg = cfg_;
+  cfg.isn = isn;
+  auto connection = make_shared<Connection>( flow, cfg );
+  connection->time_us_ = time_us_;
+  flows_.insert( flow, connection );
+  ++stats_.connections_opened;
+  return connection;
+}
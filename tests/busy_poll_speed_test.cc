@@ -0,0 +1,165 @@
+#include "clock.hh"
+#include "eventloop.hh"
+#include "exception.hh"
+#include "link_adapter.hh"
+#include "tcp_minnow_socket.hh"
+#include "tcp_minnow_socket_impl.hh"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+constexpr size_t MESSAGE_SIZE = 64;
+constexpr size_t N_ROUND_TRIPS = 2'000;
+
+using Socket = TCPMinnowSocket<LinkAdapter>;
+
+// A message carries the time it was sent
+string make_message()
+{
+  string message( MESSAGE_SIZE, 'x' );
+  const int64_t now = monotonic_time().count();
+  memcpy( message.data(), &now, sizeof( now ) );
+  return message;
+}
+
+microseconds latency( const string& message )
+{
+  int64_t sent {};
+  memcpy( &sent, message.data(), sizeof( sent ) );
+  return monotonic_time() - microseconds { sent };
+}
+
+// Read one whole message (or return false at EOF)
+bool read_message( Socket& socket, string& message )
+{
+  message.clear();
+  string buffer;
+  while ( message.size() < MESSAGE_SIZE ) {
+    buffer.resize( MESSAGE_SIZE - message.size() );
+    socket.read( buffer );
+    if ( socket.eof() ) {
+      return false;
+    }
+    message += buffer;
+  }
+  return true;
+}
+
+// Bounce messages between two TCPMinnowSockets (each with its TCPPeer thread), and report the one-way latency
+// of each message (from the sender's write to the receiver's read), and how the TCPPeer threads waited
+void ping_pong( microseconds busy_poll, bool shared_memory )
+{
+  array<int, 2> fds {};
+  CheckSystemCall( "socketpair", ::socketpair( AF_UNIX, SOCK_DGRAM, 0, fds.data() ) );
+  Socket client { LinkAdapter { FileDescriptor { fds[0] } } };
+  Socket server { LinkAdapter { FileDescriptor { fds[1] } } };
+  if ( shared_memory ) {
+    client.use_shared_memory();
+    server.use_shared_memory();
+  }
+
+  TCPConfig tcp_config;
+  tcp_config.rt_timeout = 10;
+  tcp_config.busy_poll = busy_poll;
+  FdAdapterConfig client_config;
+  client_config.source = { "10.144.0.1", "40000" };
+  client_config.destination = { "10.144.0.2", "80" };
+  FdAdapterConfig server_config;
+  server_config.source = { "10.144.0.2", "80" };
+
+  thread listener { [&] { server.listen_and_accept( tcp_config, server_config ); } };
+  client.connect( tcp_config, client_config );
+  listener.join();
+
+  vector<microseconds> server_latencies;
+  server_latencies.reserve( N_ROUND_TRIPS );
+  thread echo { [&] {
+    string message;
+    while ( read_message( server, message ) ) {
+      server_latencies.push_back( latency( message ) );
+      server.write_all( make_message() );
+    }
+    server.wait_until_closed();
+  } };
+
+  vector<microseconds> latencies;
+  latencies.reserve( 2 * N_ROUND_TRIPS );
+  string message;
+  for ( size_t i = 0; i < N_ROUND_TRIPS; ++i ) {
+    client.write_all( make_message() );
+    if ( not read_message( client, message ) ) {
+      throw runtime_error( "unexpected EOF" );
+    }
+    latencies.push_back( latency( message ) );
+  }
+  client.wait_until_closed();
+  echo.join();
+
+  latencies.insert( latencies.end(), server_latencies.begin(), server_latencies.end() );
+  ranges::sort( latencies );
+  auto percentile = [&]( size_t p ) { return latencies.at( latencies.size() * p / 100 ).count(); };
+
+  nanoseconds spin_time {};
+  nanoseconds blocked_time {};
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+  uint64_t polls = 0;
+  for ( const auto* stats : { &client.eventloop_stats(), &server.eventloop_stats() } ) {
+    spin_time += stats->spin_time;
+    blocked_time += stats->blocked_time;
+    hits += stats->busy_poll_hits;
+    misses += stats->busy_poll_misses;
+    polls += stats->busy_polls;
+  }
+
+  cout << "  " << ( shared_memory ? "RingPipes, " : "socketpair," ) << " busy-poll " << setw( 4 ) << busy_poll.count()
+       << " us: one-way latency p50 " << setw( 5 )
+       << percentile( 50 ) << " us, p99 " << setw( 5 ) << percentile( 99 ) << " us";
+  if ( busy_poll > microseconds::zero() ) {
+    cout << "; spin/idle " << fixed << setprecision( 2 )
+         << duration<double>( spin_time ).count() / max( duration<double>( blocked_time ).count(), 1e-9 ) << ", "
+         << setprecision( 1 ) << 100.0 * static_cast<double>( hits ) / static_cast<double>( max( hits + misses, 1UL ) )
+         << "% of waits served by spinning, " << setprecision( 1 )
+         << static_cast<double>( polls ) / static_cast<double>( 2 * N_ROUND_TRIPS ) << " spinning polls per message";
+  }
+  cout << "\n";
+}
+
+void program_body()
+{
+  cout << "Ping-pong of " << N_ROUND_TRIPS << " " << MESSAGE_SIZE << "-byte messages each way, with "
+       << thread::hardware_concurrency() << " CPU" << ( thread::hardware_concurrency() == 1 ? "" : "s" )
+       << " (busy-polling needs a spare core for each TCPPeer thread):\n";
+  for ( const bool shared_memory : { false, true } ) {
+    for ( const auto busy_poll : { 0, 50, 500 } ) {
+      ping_pong( microseconds { busy_poll }, shared_memory );
+    }
+  }
+}
+} // namespace
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
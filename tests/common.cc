@@ -90,6 +90,9 @@ string to_string( const TCPSenderMessage& msg )
   if ( msg.RST ) {
     o << " +RST";
   }
+  if ( msg.CWR ) {
+    o << " +CWR";
+  }
   o << ")";
   return o.str();
 }
@@ -0,0 +1,545 @@
+#include "byte_stream.hh"
+#include "eventloop.hh"
+#include "exception.hh"
+#include "gro_adapter.hh"
+#include "lossy_fd_adapter.hh"
+#include "socket.hh"
+#include "tcp_over_ip.hh"
+#include "test_should_be.hh"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <fcntl.h>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <span>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+namespace {
+pair<FileDescriptor, FileDescriptor> stream_pair()
+{
+  array<int, 2> fds {};
+  CheckSystemCall( "socketpair", ::socketpair( AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds.data() ) );
+  return { FileDescriptor { fds[0] }, FileDescriptor { fds[1] } };
+}
+
+string read_some( FileDescriptor& fd )
+{
+  string buffer( 100, 0 );
+  fd.read( buffer );
+  return buffer;
+}
+
+void check_backend( EventLoop::Backend backend )
+{
+  // A rule runs when its fd is ready and it is interested, and not otherwise
+  {
+    EventLoop loop { backend };
+    // (without io_uring, the IoUring backend falls back to Epoll)
+    const bool fallback = backend == EventLoop::Backend::IoUring and not IoUring::available();
+    test_should_be( loop.backend() == ( fallback ? EventLoop::Backend::Epoll : backend ), true );
+    auto [a, b] = stream_pair();
+    string received;
+    bool want_read = true;
+    loop.add_rule(
+      "read", a, Direction::In, [&] { received += read_some( a ); }, [&] { return want_read; } );
+
+    test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Timeout, true );
+    b.write( "hello" );
+    test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Success, true );
+    test_should_be( received == "hello", true );
+
+    want_read = false;
+    b.write( "again" );
+    test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Exit, true );
+    want_read = true;
+    test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Success, true );
+    test_should_be( received == "helloagain", true );
+  }
+
+  // A rule subscribed to a Notifier asks its interest function only after the Notifier is raised (here, by a
+  // ByteStream's edge notifications)
+  {
+    EventLoop loop { backend };
+    auto [a, b] = stream_pair();
+    ByteStream stream { 4 };
+    EventLoop::Notifier changed;
+    size_t edges = 0;
+    size_t asked = 0;
+    stream.set_listener( [&] {
+      ++edges;
+      changed.raise();
+    } );
+    auto rule = loop.add_rule(
+      "write",
+      a,
+      Direction::Out,
+      [&] { stream.reader().pop( a.write( stream.reader().peek() ) ); },
+      [&] {
+        ++asked;
+        return stream.reader().bytes_buffered() > 0;
+      } );
+    rule.subscribe( changed );
+
+    test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Exit, true );
+    test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Exit, true );
+    test_should_be( asked, size_t { 1 } );
+
+    stream.writer().push( "ab" );
+    test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Success, true );
+    test_should_be( read_some( b ) == "ab", true );
+    test_should_be( asked, size_t { 2 } );
+
+    // the pop emptied the stream, so the next wait asks again (but not the one after)
+    test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Exit, true );
+    test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Exit, true );
+    test_should_be( asked, size_t { 3 } );
+
+    // readable, (no change,) full
+    stream.writer().push( "c" );
+    stream.writer().push( "d" );
+    stream.writer().push( "xyz" );
+    test_should_be( edges, size_t { 4 } );
+    test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Success, true );
+    test_should_be( read_some( b ) == "cdxy", true );
+    test_should_be( asked, size_t { 4 } );
+    test_should_be( edges, size_t { 5 } );
+
+    stream.writer().close();
+    stream.set_error();
+    test_should_be( edges, size_t { 7 } );
+  }
+
+  // Two rules on one fd (one per direction), and a cancelled rule
+  {
+    EventLoop loop { backend };
+    auto [a, b] = stream_pair();
+    size_t reads = 0;
+    size_t writes = 0;
+    bool want_write = true;
+    loop.add_rule( "read", a, Direction::In, [&] {
+      read_some( a );
+      ++reads;
+    } );
+    auto write_rule = loop.add_rule(
+      "write",
+      a,
+      Direction::Out,
+      [&] {
+        a.write( "x" );
+        ++writes;
+        want_write = false;
+      },
+      [&] { return want_write; } );
+
+    test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Success, true );
+    test_should_be( writes, size_t { 1 } );
+    test_should_be( read_some( b ) == "x", true );
+
+    b.write( "y" );
+    test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Success, true );
+    test_should_be( reads, size_t { 1 } );
+
+    want_write = true;
+    write_rule.cancel();
+    test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Timeout, true );
+    test_should_be( writes, size_t { 1 } );
+  }
+
+  // A rule is cancelled at EOF, and the loop exits when no rules are left
+  {
+    EventLoop loop { backend };
+    auto [a, b] = stream_pair();
+    bool cancelled = false;
+    loop.add_rule(
+      "read", a, Direction::In, [&] { read_some( a ); }, [] { return true; }, [&] { cancelled = true; } );
+    b.close();
+    test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Success, true );
+    test_should_be( a.eof(), true );
+    test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Exit, true );
+    test_should_be( cancelled, true );
+  }
+
+  // Many rules, a few of them ready
+  {
+    constexpr size_t N_PAIRS = 500;
+    EventLoop loop { backend };
+    vector<pair<FileDescriptor, FileDescriptor>> pairs;
+    pairs.reserve( N_PAIRS );
+    vector<size_t> reads( N_PAIRS );
+    const size_t category = loop.add_category( "read" );
+    for ( size_t i = 0; i < N_PAIRS; ++i ) {
+      auto& [a, b] = pairs.emplace_back( stream_pair() );
+      loop.add_rule( category, a, Direction::In, [&reads, &fd = a, i] {
+        read_some( fd );
+        ++reads[i];
+      } );
+    }
+    for ( size_t i = 0; i < N_PAIRS; i += 100 ) {
+      pairs[i].second.write( "ready" );
+    }
+    for ( size_t i = 0; i < N_PAIRS / 100; ++i ) {
+      test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Success, true );
+    }
+    test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Timeout, true );
+    for ( size_t i = 0; i < N_PAIRS; ++i ) {
+      test_should_be( reads[i], size_t { i % 100 == 0 } );
+    }
+  }
+
+  // With Dispatch::AllReady, one wait (and one system call) serves every ready rule
+  {
+    constexpr size_t N_PAIRS = 50;
+    EventLoop loop { backend, EventLoop::Dispatch::AllReady };
+    test_should_be( loop.dispatch() == EventLoop::Dispatch::AllReady, true );
+    vector<pair<FileDescriptor, FileDescriptor>> pairs;
+    pairs.reserve( N_PAIRS );
+    size_t reads = 0;
+    const size_t category = loop.add_category( "read" );
+    for ( size_t i = 0; i < N_PAIRS; ++i ) {
+      auto& [a, b] = pairs.emplace_back( stream_pair() );
+      loop.add_rule( category, a, Direction::In, [&reads, &fd = a] {
+        read_some( fd );
+        ++reads;
+      } );
+    }
+    for ( size_t i = 0; i < N_PAIRS; i += 10 ) {
+      pairs[i].second.write( "ready" );
+    }
+    test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Success, true );
+    test_should_be( reads, N_PAIRS / 10 );
+    test_should_be( loop.stats().syscalls, uint64_t { 1 } );
+    test_should_be( loop.stats().callbacks, uint64_t { N_PAIRS / 10 } );
+    test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Timeout, true );
+    test_should_be( loop.stats().waits, uint64_t { 2 } );
+  }
+
+  // ... but a rule that an earlier callback made uninterested is skipped
+  {
+    EventLoop loop { backend, EventLoop::Dispatch::AllReady };
+    auto [a, b] = stream_pair();
+    auto [c, d] = stream_pair();
+    size_t runs = 0;
+    bool want_read = true;
+    auto rule = [&] {
+      ++runs;
+      want_read = false;
+    };
+    loop.add_rule( "first", a, Direction::In, rule, [&] { return want_read; } );
+    loop.add_rule( "second", c, Direction::In, rule, [&] { return want_read; } );
+    b.write( "x" );
+    d.write( "x" );
+    test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Success, true );
+    test_should_be( runs, size_t { 1 } );
+  }
+
+  // A non-fd rule runs up to its budget in one wait, without holding up the ready fd rules
+  {
+    constexpr size_t BUDGET = 8;
+    EventLoop loop { backend, EventLoop::Dispatch::AllReady, BUDGET };
+    auto [a, b] = stream_pair();
+    size_t work = 3 * BUDGET;
+    size_t reads = 0;
+    loop.add_rule( "work", [&] { --work; }, [&] { return work > 0; } );
+    loop.add_rule( "read", a, Direction::In, [&] {
+      read_some( a );
+      ++reads;
+    } );
+    b.write( "x" );
+
+    test_should_be( loop.wait_next_event( 1000 ) == EventLoop::Result::Success, true );
+    test_should_be( work, 2 * BUDGET );
+    test_should_be( reads, size_t { 1 } );
+    test_should_be( loop.wait_next_event( 1000 ) == EventLoop::Result::Success, true );
+    test_should_be( loop.wait_next_event( 1000 ) == EventLoop::Result::Success, true );
+    test_should_be( work, size_t { 0 } );
+    test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Timeout, true );
+  }
+
+  // Timers run in deadline order, no earlier than their deadlines, and the loop exits when none are left
+  {
+    EventLoop loop { backend };
+    const auto start = chrono::steady_clock::now();
+    vector<pair<uint64_t, chrono::steady_clock::duration>> fired;
+    const size_t category = loop.add_category( "timer" );
+    for ( const uint64_t delay_ms : { 30, 10, 20 } ) {
+      loop.add_timer( category, delay_ms, [&, delay_ms] {
+        fired.emplace_back( delay_ms, chrono::steady_clock::now() - start );
+      } );
+    }
+    test_should_be( loop.timer_count(), size_t { 3 } );
+    test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Timeout, true );
+    while ( loop.wait_next_event( 1000 ) == EventLoop::Result::Success ) {}
+    test_should_be( fired.size(), size_t { 3 } );
+    for ( size_t i = 0; i < fired.size(); ++i ) {
+      test_should_be( fired[i].first, uint64_t { 10 * ( i + 1 ) } );
+      test_should_be( fired[i].second >= chrono::milliseconds( fired[i].first ), true );
+    }
+    test_should_be( loop.timer_count(), size_t { 0 } );
+  }
+
+  // A periodic timer runs until it is cancelled, and a cancelled timer does not run (or hold up the exit)
+  {
+    EventLoop loop { backend };
+    size_t ticks = 0;
+    size_t cancelled_runs = 0;
+    auto cancelled = loop.add_timer( "cancelled", 5, [&] { ++cancelled_runs; } );
+    optional<EventLoop::RuleHandle> periodic;
+    periodic = loop.add_timer(
+      "periodic",
+      1,
+      [&] {
+        if ( ++ticks == 5 ) {
+          periodic->cancel();
+        }
+      },
+      2 );
+    cancelled.cancel();
+    while ( loop.wait_next_event( 1000 ) == EventLoop::Result::Success ) {}
+    test_should_be( ticks, size_t { 5 } );
+    test_should_be( cancelled_runs, size_t { 0 } );
+    test_should_be( loop.wait_next_event( 0 ) == EventLoop::Result::Exit, true );
+  }
+
+  // A timer that is not due by the timeout does not run
+  {
+    EventLoop loop { backend };
+    bool ran = false;
+    loop.add_timer( "later", 1000, [&] { ran = true; } );
+    test_should_be( loop.wait_next_event( 10 ) == EventLoop::Result::Timeout, true );
+    test_should_be( ran, false );
+  }
+
+  // A busy-polling loop serves a ready fd without blocking, and blocks only after spinning for its budget
+  {
+    EventLoop loop { backend };
+    loop.set_busy_poll( chrono::milliseconds( 2 ) );
+    auto [a, b] = stream_pair();
+    size_t reads = 0;
+    loop.add_rule( "read", a, Direction::In, [&] {
+      read_some( a );
+      ++reads;
+    } );
+    b.write( "x" );
+    test_should_be( loop.wait_next_event( 1000 ) == EventLoop::Result::Success, true );
+    test_should_be( reads, size_t { 1 } );
+    test_should_be( loop.stats().busy_poll_hits, uint64_t { 1 } );
+    test_should_be( loop.stats().blocked_time == chrono::nanoseconds::zero(), true );
+
+    test_should_be( loop.wait_next_event( 10 ) == EventLoop::Result::Timeout, true );
+    test_should_be( loop.stats().busy_poll_misses, uint64_t { 1 } );
+    test_should_be( loop.stats().spin_time >= chrono::milliseconds( 2 ), true );
+    test_should_be( loop.stats().blocked_time > chrono::nanoseconds::zero(), true );
+  }
+
+  // With a spin check, the spin polls the fds only now and then, and returns as soon as the check is true
+  {
+    EventLoop loop { backend };
+    loop.set_busy_poll( chrono::milliseconds( 2 ) );
+    auto [a, b] = stream_pair();
+    loop.add_rule( "read", a, Direction::In, [&] { read_some( a ); } );
+    size_t checks = 0;
+    bool ready = false;
+    loop.add_spin_check( [&] {
+      ++checks;
+      return ready;
+    } );
+
+    test_should_be( loop.wait_next_event( 10 ) == EventLoop::Result::Timeout, true );
+    test_should_be( loop.stats().spin_checks, uint64_t { checks } );
+    test_should_be( loop.stats().busy_polls < loop.stats().spin_checks, true );
+    test_should_be( loop.stats().busy_polls
+                      <= uint64_t { chrono::milliseconds( 2 ) / EventLoop::SPIN_POLL_INTERVAL + 1 },
+                    true );
+
+    ready = true;
+    test_should_be( loop.wait_next_event( 1000 ) == EventLoop::Result::Success, true );
+    test_should_be( loop.stats().busy_poll_hits, uint64_t { 1 } );
+
+    ready = false;
+    b.write( "x" );
+    test_should_be( loop.wait_next_event( 1000 ) == EventLoop::Result::Success, true );
+    test_should_be( loop.stats().busy_poll_hits, uint64_t { 2 } );
+  }
+}
+
+// A regular file and /dev/null never block, so epoll refuses them, but (as with poll) a rule on one runs
+// whenever it is interested
+void check_unpollable_fds( EventLoop::Backend backend )
+{
+  EventLoop loop { backend };
+  string name = "/tmp/eventloop-test-XXXXXX";
+  FileDescriptor file { CheckSystemCall( "mkstemp", ::mkstemp( name.data() ) ) };
+  CheckSystemCall( "unlink", ::unlink( name.c_str() ) );
+  file.write( "contents" );
+  CheckSystemCall( "lseek", static_cast<int>( ::lseek( file.fd_num(), 0, SEEK_SET ) ) );
+  FileDescriptor null_in { CheckSystemCall( "open", ::open( "/dev/null", O_RDONLY ) ) };
+  FileDescriptor null_out { CheckSystemCall( "open", ::open( "/dev/null", O_WRONLY ) ) };
+
+  string from_file;
+  bool written = false;
+  loop.add_rule( "file", file, Direction::In, [&] { from_file += read_some( file ); } );
+  loop.add_rule( "null in", null_in, Direction::In, [&] { test_should_be( read_some( null_in ).empty(), true ); } );
+  loop.add_rule(
+    "null out", null_out, Direction::Out, [&] { written = null_out.write( "x" ) == 1; }, [&] { return not written; } );
+
+  size_t waits = 0;
+  while ( loop.wait_next_event( -1 ) != EventLoop::Result::Exit ) {
+    test_should_be( ++waits < 10, true );
+  }
+  test_should_be( from_file == "contents", true );
+  test_should_be( file.eof(), true );
+  test_should_be( null_in.eof(), true );
+  test_should_be( written, true );
+}
+
+// A BatchWriter writes each datagram whole, and in order (with io_uring, in one system call per batch)
+void check_batch_writer( bool use_io_uring )
+{
+  constexpr size_t N_DATAGRAMS = 300; // more than one batch
+  array<int, 2> fds {};
+  CheckSystemCall( "socketpair", ::socketpair( AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0, fds.data() ) );
+  FileDescriptor a { fds[0] };
+  FileDescriptor b { fds[1] };
+  const int buffer_size = 4 * 1024 * 1024;
+  CheckSystemCall( "setsockopt", ::setsockopt( a.fd_num(), SOL_SOCKET, SO_SNDBUF, &buffer_size, sizeof( int ) ) );
+  CheckSystemCall( "setsockopt", ::setsockopt( b.fd_num(), SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof( int ) ) );
+
+  BatchWriter writer { a, use_io_uring };
+  test_should_be( writer.uses_io_uring(), use_io_uring );
+  for ( size_t i = 0; i < N_DATAGRAMS; ++i ) {
+    const string header = "datagram " + to_string( i );
+    writer.add( array<string_view, 2> { header, string( i % 7, 'x' ) } );
+  }
+  writer.flush();
+  test_should_be( writer.syscalls(), use_io_uring ? uint64_t { 2 } : uint64_t { N_DATAGRAMS } );
+
+  for ( size_t i = 0; i < N_DATAGRAMS; ++i ) {
+    test_should_be( read_some( b ) == "datagram " + to_string( i ) + string( i % 7, 'x' ), true );
+  }
+  test_should_be( b.readable(), false );
+}
+
+// With io_uring, the ring reads an fd that is read ahead, and a rule on it finds the bytes already read: a stream's
+// in order (with what did not fit kept for the next read), each datagram whole, and then EOF
+void check_read_ahead()
+{
+  {
+    EventLoop loop { EventLoop::Backend::IoUring };
+    auto [a, b] = stream_pair();
+    loop.read_ahead( a );
+    string received;
+    loop.add_rule( "read", a, Direction::In, [&] {
+      string buffer( 3, 0 ); // (less than the ring reads)
+      a.read( buffer );
+      received += buffer;
+    } );
+
+    b.write( "hello" );
+    while ( received.size() < 5 ) {
+      test_should_be( loop.wait_next_event( 1000 ) == EventLoop::Result::Success, true );
+    }
+    test_should_be( received == "hello", true );
+    test_should_be( a.readable(), false ); // (nothing left from the ring, which is the only reader of the fd)
+
+    b.write( " world" );
+    b.close();
+    size_t waits = 0;
+    while ( loop.wait_next_event( 1000 ) != EventLoop::Result::Exit ) {
+      test_should_be( ++waits < 10, true );
+    }
+    test_should_be( received == "hello world", true );
+    test_should_be( a.eof(), true );
+    test_should_be( loop.stats().read_aheads >= 3, true );
+  }
+
+  // (an fd that already has a rule, and that is written before it is read ahead)
+  {
+    EventLoop loop { EventLoop::Backend::IoUring };
+    array<int, 2> fds {};
+    CheckSystemCall( "socketpair", ::socketpair( AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0, fds.data() ) );
+    FileDescriptor a { fds[0] };
+    FileDescriptor b { fds[1] };
+    vector<string> received;
+    loop.add_rule( "read", a, Direction::In, [&] { received.push_back( read_some( a ) ); } );
+    b.write( "one" );
+    test_should_be( loop.wait_next_event( 1000 ) == EventLoop::Result::Success, true );
+    loop.read_ahead( a );
+    b.write( "two" );
+    b.write( "three" );
+    while ( received.size() < 3 ) {
+      test_should_be( loop.wait_next_event( 1000 ) == EventLoop::Result::Success, true );
+    }
+    test_should_be( ( received == vector<string> { "one", "two", "three" } ), true );
+    test_should_be( loop.stats().read_aheads, uint64_t { 2 } );
+  }
+}
+
+// An adapter that records the size of each batch written to it
+class BatchRecorder : public TCPOverIPv4Adapter
+{
+  FileDescriptor fd_;
+  shared_ptr<vector<size_t>> batches_;
+
+public:
+  BatchRecorder( FileDescriptor&& fd, shared_ptr<vector<size_t>> batches )
+    : fd_( move( fd ) ), batches_( move( batches ) )
+  {}
+  optional<TCPMessage> read() { return {}; }
+  void write( const TCPMessage& ) { batches_->push_back( 1 ); }
+  void write_batch( span<const TCPMessage> msgs ) { batches_->push_back( msgs.size() ); }
+  FileDescriptor& fd() { return fd_; }
+};
+
+// The GRO and lossy adapters pass batches on (so a socket over them can batch its writes), and a lossy one
+// passes on the runs of messages it does not drop
+void check_adapter_batches()
+{
+  auto batches = make_shared<vector<size_t>>();
+  GROAdapter adapter { LossyFdAdapter { BatchRecorder { stream_pair().first, batches } } };
+  const vector<TCPMessage> msgs( 1000 );
+  adapter.write_batch( msgs );
+  test_should_be( *batches == vector<size_t> { 1000 }, true );
+
+  batches->clear();
+  adapter.config_mut().loss_rate_up = UINT16_MAX / 2;
+  adapter.write_batch( msgs );
+  const size_t written = reduce( batches->begin(), batches->end() );
+  test_should_be( written > 0 and written < msgs.size(), true );
+  test_should_be( batches->size() > 1, true );
+  test_should_be( ranges::find( *batches, 0 ) == batches->end(), true );
+}
+} // namespace
+
+int main()
+{
+  try {
+    check_backend( EventLoop::Backend::Poll );
+    check_backend( EventLoop::Backend::Epoll );
+    check_backend( EventLoop::Backend::IoUring );
+    check_unpollable_fds( EventLoop::Backend::Poll );
+    check_unpollable_fds( EventLoop::Backend::Epoll );
+    check_unpollable_fds( EventLoop::Backend::IoUring );
+    check_batch_writer( false );
+    if ( IoUring::available() ) {
+      check_batch_writer( true );
+      check_read_ahead();
+    }
+    check_adapter_batches();
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return 1;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,204 @@
+#include "address.hh"
+#include "helpers.hh"
+#include "tcp_over_ip.hh"
+#include "tcp_segment.hh"
+#include "test_should_be.hh"
+
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+namespace {
+const Address client_address { "10.144.0.1", 40000 };
+const Address server_address { "10.144.0.2", 80 };
+
+TCPSegment make_segment( const Address& source,
+                         const Address& destination,
+                         const optional<string>& cookie,
+                         const string& payload = {} )
+{
+  TCPSegment seg;
+  seg.udinfo.src_port = source.port();
+  seg.udinfo.dst_port = destination.port();
+  seg.message.sender->seqno = Wrap32 { 1000 };
+  seg.message.sender->SYN = true;
+  seg.message.sender->payload = payload;
+  seg.message.receiver->window_size = 1000;
+  seg.fast_open_cookie = cookie;
+  return seg;
+}
+
+// The IPv4 datagram that carries `seg` (with its payload copied, so it can be parsed)
+InternetDatagram make_datagram( const Address& source, const Address& destination, TCPSegment seg )
+{
+  InternetDatagram dgram;
+  dgram.header.src = source.ipv4_numeric();
+  dgram.header.dst = destination.ipv4_numeric();
+  dgram.header.len = dgram.header.hlen * 4 + seg.header_length() + seg.message.sender->payload.size();
+  seg.compute_checksum( dgram.header.pseudo_checksum() );
+  dgram.header.compute_checksum();
+  dgram.payload = serialize( seg );
+  return clone( dgram );
+}
+
+// A client's SYN, with or without a Fast Open option
+InternetDatagram client_syn( const optional<string>& cookie, const string& payload )
+{
+  return make_datagram(
+    client_address, server_address, make_segment( client_address, server_address, cookie, payload ) );
+}
+
+// A server's SYN-ACK, with or without a Fast Open option
+InternetDatagram server_syn_ack( const optional<string>& cookie )
+{
+  TCPSegment seg = make_segment( server_address, client_address, cookie );
+  seg.message.receiver->ackno = Wrap32 { 2000 };
+  return make_datagram( server_address, client_address, move( seg ) );
+}
+
+// The Fast Open option that an adapter puts on a message
+optional<string> sent_cookie( TCPOverIPv4Adapter& adapter, const TCPMessage& msg )
+{
+  InternetDatagram dgram = clone( adapter.wrap_tcp_in_ip( msg ) );
+  auto seg = TCPOverIPv4Adapter::parse_tcp_in_ip( dgram );
+  if ( not seg.has_value() ) {
+    throw runtime_error( "adapter wrote an unparseable segment" );
+  }
+  return seg->fast_open_cookie;
+}
+
+TCPMessage syn( bool ack )
+{
+  TCPMessage msg;
+  msg.sender->seqno = Wrap32 { 2000 };
+  msg.sender->SYN = true;
+  if ( ack ) {
+    msg.receiver->ackno = Wrap32 { 1001 };
+  }
+  msg.receiver->window_size = 1000;
+  return msg;
+}
+
+TCPOverIPv4Adapter listening_server()
+{
+  TCPOverIPv4Adapter server;
+  server.config_mut().source = server_address;
+  server.config_mut().fast_open = true;
+  server.set_listening( true );
+  return server;
+}
+
+TCPOverIPv4Adapter connecting_client( const Address& destination )
+{
+  TCPOverIPv4Adapter client;
+  client.config_mut().source = client_address;
+  client.config_mut().destination = destination;
+  client.config_mut().fast_open = true;
+  return client;
+}
+} // namespace
+
+int main()
+{
+  try {
+    // The option survives serialize and parse: a cookie, a cookie request (empty), and no option
+    {
+      for ( const optional<string>& cookie : { optional<string> { "abcdefgh" }, optional<string> { "" },
+                                               optional<string> {} } ) {
+        const TCPSegment seg = make_segment( client_address, server_address, cookie, "hello" );
+        test_should_be( seg.header_length() % 4 == 0, true );
+        test_should_be( seg.header_length() > TCPSegment::HEADER_LENGTH, cookie.has_value() );
+
+        InternetDatagram dgram = make_datagram( client_address, server_address, seg );
+        auto parsed = TCPOverIPv4Adapter::parse_tcp_in_ip( dgram );
+        test_should_be( parsed.has_value(), true );
+        test_should_be( parsed->fast_open_cookie == cookie, true );
+        test_should_be( parsed->message.sender->payload == "hello", true );
+        test_should_be( parsed->message.sender->SYN, true );
+        test_should_be( parsed->udinfo.src_port == client_address.port(), true );
+      }
+    }
+
+    // A server hands out a cookie to a client that asks for one (and drops the data on that SYN)
+    string cookie;
+    {
+      TCPOverIPv4Adapter server = listening_server();
+      auto msg = server.unwrap_tcp_in_ip( client_syn( "", "hello" ) );
+      test_should_be( msg.has_value(), true );
+      test_should_be( msg->sender->SYN, true );
+      test_should_be( msg->sender->payload.empty(), true );
+
+      const auto reply = sent_cookie( server, syn( true ) );
+      test_should_be( reply.has_value(), true );
+      test_should_be( reply->size() == TCPSegment::FAST_OPEN_COOKIE_LENGTH, true );
+      cookie = reply.value();
+    }
+
+    // A valid cookie: the data on the SYN is accepted
+    {
+      TCPOverIPv4Adapter server = listening_server();
+      auto msg = server.unwrap_tcp_in_ip( client_syn( cookie, "hello" ) );
+      test_should_be( msg.has_value(), true );
+      test_should_be( msg->sender->payload == "hello", true );
+      test_should_be( sent_cookie( server, syn( true ) ) == optional<string> {}, true );
+    }
+
+    // A wrong cookie: the data is dropped, and the SYN-ACK carries the right one
+    {
+      string wrong = cookie;
+      wrong.front() = static_cast<char>( wrong.front() ^ 1 );
+      TCPOverIPv4Adapter server = listening_server();
+      auto msg = server.unwrap_tcp_in_ip( client_syn( wrong, "hello" ) );
+      test_should_be( msg.has_value(), true );
+      test_should_be( msg->sender->SYN, true );
+      test_should_be( msg->sender->payload.empty(), true );
+      test_should_be( sent_cookie( server, syn( true ) ) == optional<string> { cookie }, true );
+    }
+
+    // No cookie at all: the data is dropped, and the SYN-ACK offers none
+    {
+      TCPOverIPv4Adapter server = listening_server();
+      auto msg = server.unwrap_tcp_in_ip( client_syn( nullopt, "hello" ) );
+      test_should_be( msg.has_value(), true );
+      test_should_be( msg->sender->payload.empty(), true );
+      test_should_be( sent_cookie( server, syn( true ) ) == optional<string> {}, true );
+    }
+
+    // A client asks for a cookie, caches the one on the SYN-ACK, and presents it on its next connection to the
+    // same server (from another adapter), but not to a different one
+    {
+      TCPOverIPv4Adapter first = connecting_client( server_address );
+      test_should_be( first.has_fast_open_cookie(), false );
+      test_should_be( sent_cookie( first, syn( false ) ) == optional<string> { "" }, true );
+
+      auto msg = first.unwrap_tcp_in_ip( server_syn_ack( "cookie!!" ) );
+      test_should_be( msg.has_value(), true );
+      test_should_be( first.has_fast_open_cookie(), true );
+
+      TCPOverIPv4Adapter second = connecting_client( server_address );
+      test_should_be( second.has_fast_open_cookie(), true );
+      test_should_be( sent_cookie( second, syn( false ) ) == optional<string> { "cookie!!" }, true );
+
+      TCPOverIPv4Adapter elsewhere = connecting_client( Address { "10.144.0.3", 80 } );
+      test_should_be( elsewhere.has_fast_open_cookie(), false );
+      test_should_be( sent_cookie( elsewhere, syn( false ) ) == optional<string> { "" }, true );
+    }
+
+    // Without Fast Open configured, a SYN carries no option
+    {
+      TCPOverIPv4Adapter plain = connecting_client( server_address );
+      plain.config_mut().fast_open = false;
+      test_should_be( sent_cookie( plain, syn( false ) ) == optional<string> {}, true );
+    }
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return 1;
+  }
+
+  return EXIT_SUCCESS;
+}
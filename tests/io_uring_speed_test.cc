@@ -0,0 +1,129 @@
+#include "eventloop.hh"
+#include "exception.hh"
+#include "io_uring.hh"
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <sys/socket.h>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+constexpr size_t DATAGRAM_SIZE = 1500;
+constexpr size_t N_DATAGRAMS = 200'000;
+
+constexpr size_t N_PAIRS = 64;
+constexpr size_t N_READY = 16;
+constexpr size_t N_ROUNDS = 20'000;
+
+pair<FileDescriptor, FileDescriptor> socket_pair( int type )
+{
+  array<int, 2> fds {};
+  CheckSystemCall( "socketpair", ::socketpair( AF_UNIX, type | SOCK_NONBLOCK, 0, fds.data() ) );
+  return { FileDescriptor { fds[0] }, FileDescriptor { fds[1] } };
+}
+
+// Write datagrams in batches (standing in for a TUN device, which takes one datagram per write), draining them
+// after each batch, and report the throughput and the system calls per datagram on the writing side
+void datagram_test( size_t batch_size, bool use_io_uring )
+{
+  auto [device, peer] = socket_pair( SOCK_DGRAM );
+  const int buffer_size = 4 * 1024 * 1024;
+  CheckSystemCall( "setsockopt", ::setsockopt( device.fd_num(), SOL_SOCKET, SO_SNDBUF, &buffer_size, sizeof( int ) ) );
+  CheckSystemCall( "setsockopt", ::setsockopt( peer.fd_num(), SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof( int ) ) );
+
+  BatchWriter writer { device, use_io_uring };
+  const string headers( 40, 'h' );
+  const string payload( DATAGRAM_SIZE - headers.size(), 'x' );
+  string buffer;
+
+  const auto start_time = steady_clock::now();
+  for ( size_t sent = 0; sent < N_DATAGRAMS; sent += batch_size ) {
+    for ( size_t i = 0; i < batch_size; ++i ) {
+      writer.add( array<string_view, 2> { headers, payload } );
+    }
+    writer.flush();
+    for ( size_t i = 0; i < batch_size; ++i ) {
+      buffer.resize( DATAGRAM_SIZE );
+      peer.read( buffer );
+    }
+  }
+  const auto test_duration = duration_cast<duration<double>>( steady_clock::now() - start_time );
+
+  const double gigabits_per_second = 8.0 * N_DATAGRAMS * DATAGRAM_SIZE / test_duration.count() / 1e9;
+  cout << "  batches of " << setw( 2 ) << batch_size << ", " << ( use_io_uring ? "io_uring" : "write(2)" )
+       << ": " << fixed << setprecision( 2 ) << gigabits_per_second << " Gbit/s, " << setprecision( 3 )
+       << static_cast<double>( writer.syscalls() ) / N_DATAGRAMS << " syscalls/datagram\n";
+}
+
+// Make a few of many fds ready at a time, and report the events served per second and per system call
+void eventloop_test( EventLoop::Backend backend )
+{
+  EventLoop loop { backend, EventLoop::Dispatch::AllReady };
+  vector<pair<FileDescriptor, FileDescriptor>> pairs;
+  pairs.reserve( N_PAIRS );
+  size_t events = 0;
+  const size_t category = loop.add_category( "read" );
+  for ( size_t i = 0; i < N_PAIRS; ++i ) {
+    auto& [a, b] = pairs.emplace_back( socket_pair( SOCK_STREAM ) );
+    loop.add_rule( category, a, Direction::In, [&events, &fd = a] {
+      string buffer( 16, 0 );
+      fd.read( buffer );
+      ++events;
+    } );
+  }
+
+  const auto start_time = steady_clock::now();
+  for ( size_t round = 0; round < N_ROUNDS; ++round ) {
+    for ( size_t i = 0; i < N_READY; ++i ) {
+      pairs[( round * N_READY + i * 3 ) % N_PAIRS].second.write( "x" );
+    }
+    for ( const size_t goal = ( round + 1 ) * N_READY; events < goal; ) {
+      loop.wait_next_event( -1 );
+    }
+  }
+  const auto test_duration = duration_cast<duration<double>>( steady_clock::now() - start_time );
+
+  const char* const names[] = { "poll", "epoll", "io_uring" };
+  cout << "  " << setw( 8 ) << names[static_cast<size_t>( loop.backend() )] << ": " << fixed << setprecision( 2 )
+       << static_cast<double>( events ) / test_duration.count() / 1e6 << " M events/s, " << setprecision( 1 )
+       << static_cast<double>( events ) / static_cast<double>( loop.stats().syscalls ) << " events/syscall\n";
+}
+
+void program_body()
+{
+  cout << "io_uring " << ( IoUring::available() ? "is" : "is not" ) << " available.\n";
+
+  cout << "Writing " << N_DATAGRAMS << " datagrams of " << DATAGRAM_SIZE << " bytes:\n";
+  for ( const size_t batch_size : { 1, 8, 32 } ) {
+    datagram_test( batch_size, false );
+    if ( IoUring::available() ) {
+      datagram_test( batch_size, true );
+    }
+  }
+
+  cout << "EventLoop with " << N_READY << " of " << N_PAIRS << " fds ready at a time:\n";
+  for ( const auto backend : { EventLoop::Backend::Poll, EventLoop::Backend::Epoll, EventLoop::Backend::IoUring } ) {
+    eventloop_test( backend );
+  }
+}
+} // namespace
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
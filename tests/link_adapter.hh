@@ -0,0 +1,59 @@
+#pragma once
+
+#include "exception.hh"
+#include "file_descriptor.hh"
+#include "helpers.hh"
+#include "ipv4_datagram.hh"
+#include "tcp_config.hh"
+#include "tcp_over_ip.hh"
+
+#include <cerrno>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <utility>
+#include <vector>
+
+//! An adapter for one end of a datagram socketpair, so two TCP sockets in one process can connect
+class LinkAdapter : public TCPOverIPv4Adapter
+{
+  FileDescriptor link_;
+
+public:
+  static constexpr bool READS_FD_ONLY = true;
+
+  explicit LinkAdapter( FileDescriptor&& link ) : link_( std::move( link ) ) {}
+
+  std::optional<TCPMessage> read()
+  {
+    std::vector<std::string> strs( 3 );
+    strs[0].resize( IPv4Header::LENGTH );
+    strs[1].resize( TCPSegment::HEADER_LENGTH );
+    link_.read( strs );
+
+    InternetDatagram ip_dgram;
+    if ( parse( ip_dgram, std::move( strs ) ) ) {
+      return unwrap_tcp_in_ip( std::move( ip_dgram ) );
+    }
+    return {};
+  }
+
+  // A full link drops the datagram (as a real one would), rather than block the writer
+  void write( const TCPMessage& seg )
+  {
+    auto send = [&]( std::string_view headers, std::string_view payload ) {
+      const std::string datagram = std::string { headers } + std::string { payload };
+      if ( ::send( link_.fd_num(), datagram.data(), datagram.size(), MSG_DONTWAIT ) < 0 and errno != EAGAIN ) {
+        throw unix_error { "send" };
+      }
+    };
+    if ( seg.sender->payload.size() > TCPConfig::MAX_PAYLOAD_SIZE ) {
+      segment_tcp_in_ip( seg, send );
+    } else {
+      send( wrap_tcp_headers( seg ), std::string_view { seg.sender->payload } );
+    }
+  }
+
+  FileDescriptor& fd() { return link_; }
+};
@@ -43,6 +43,12 @@ public:
                    { TCPReceiver { Reassembler { ByteStream { capacity } } } } )
   {}
 
+  TCPReceiverTestHarness( std::string test_name, uint64_t capacity, uint64_t max_capacity )
+    : TestHarness( move( test_name ),
+                   "capacity=" + std::to_string( capacity ) + " and max_capacity=" + std::to_string( max_capacity ),
+                   { TCPReceiver { Reassembler { ByteStream { capacity } }, max_capacity } } )
+  {}
+
   template<std::derived_from<TestStep<Reassembler>> T>
   void execute( const T& test )
   {
@@ -65,6 +71,27 @@ struct ExpectWindow : public ExpectNumber<TCPReceiver, uint16_t>
   uint16_t value( const TCPReceiver& rs ) const override { return rs.send().window_size; }
 };
 
+struct ExpectCapacity : public ExpectNumber<TCPReceiver, uint64_t>
+{
+  using ExpectNumber::ExpectNumber;
+  std::string name() const override { return "capacity"; }
+  uint64_t value( const TCPReceiver& rs ) const override { return rs.writer().capacity(); }
+};
+
+struct ExpectRTTEstimate : public ExpectNumber<TCPReceiver, uint64_t>
+{
+  using ExpectNumber::ExpectNumber;
+  std::string name() const override { return "rtt_estimate"; }
+  uint64_t value( const TCPReceiver& rs ) const override { return rs.rtt_estimate(); }
+};
+
+struct ExpectECE : public ExpectBool<TCPReceiver>
+{
+  using ExpectBool::ExpectBool;
+  std::string name() const override { return "ECE"; }
+  bool value( const TCPReceiver& rs ) const override { return rs.send().ECE; }
+};
+
 struct ExpectAckno : public ExpectNumber<TCPReceiver, std::optional<Wrap32>>
 {
   using ExpectNumber::ExpectNumber;
@@ -118,6 +145,7 @@ struct HasAckno : public ExpectBool<TCPReceiver>
 struct SegmentArrives : public Action<TCPReceiver>
 {
   TCPSenderMessage msg_ {};
+  bool congestion_experienced_ {};
   HasAckno ackno_expected_ { true };
 
   SegmentArrives& with_syn()
@@ -138,6 +166,18 @@ struct SegmentArrives : public Action<TCPReceiver>
     return *this;
   }
 
+  SegmentArrives& with_cwr()
+  {
+    msg_.CWR = true;
+    return *this;
+  }
+
+  SegmentArrives& with_ce()
+  {
+    congestion_experienced_ = true;
+    return *this;
+  }
+
   SegmentArrives& with_seqno( Wrap32 seqno_ )
   {
     msg_.seqno = seqno_;
@@ -160,7 +200,7 @@ struct SegmentArrives : public Action<TCPReceiver>
 
   void execute( TCPReceiver& rs ) const override
   {
-    rs.receive( msg_ );
+    rs.receive( msg_, congestion_experienced_ );
     ackno_expected_.execute( rs );
   }
 
@@ -168,6 +208,9 @@ struct SegmentArrives : public Action<TCPReceiver>
   {
     std::ostringstream ss;
     ss << "receive message: " << to_string( msg_ );
+    if ( congestion_experienced_ ) {
+      ss << " marked CE";
+    }
 
     if ( ackno_expected_.value_ ) {
       ss << " with ackno expected";
@@ -177,3 +220,31 @@ struct SegmentArrives : public Action<TCPReceiver>
     return ss.str();
   }
 };
+
+struct Tick : public Action<TCPReceiver>
+{
+  uint64_t ms_;
+
+  explicit Tick( uint64_t ms ) : ms_( ms ) {}
+  std::string description() const override { return to_string( ms_ ) + " ms pass"; }
+  void execute( TCPReceiver& rs ) const override { rs.tick( ms_ ); }
+};
+
+struct PredictedSegmentArrives : public SegmentArrives
+{
+  bool accepted_;
+
+  explicit PredictedSegmentArrives( bool accepted ) : accepted_( accepted ) {}
+
+  void execute( TCPReceiver& rs ) const override
+  {
+    if ( rs.receive_predicted( msg_ ) != accepted_ ) {
+      throw ExpectationViolation( "receive_predicted() should have returned " + to_string( accepted_ ) );
+    }
+  }
+
+  std::string description() const override
+  {
+    return "receive message on the fast path: " + to_string( msg_ ) + ( accepted_ ? " (accepted)" : " (declined)" );
+  }
+};
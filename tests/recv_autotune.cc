@@ -0,0 +1,122 @@
+#include "byte_stream_test_harness.hh"
+#include "receiver_test_harness.hh"
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+int main()
+{
+  try {
+    {
+      const size_t cap = 1000;
+      const uint32_t isn = 23452;
+      TCPReceiverTestHarness test { "no auto-tuning without a ceiling", cap };
+      test.execute( SegmentArrives {}.with_syn().with_seqno( isn ) );
+      test.execute( Tick { 50 } );
+      test.execute( SegmentArrives {}.with_seqno( isn + 1 ).with_data( string( cap, 'a' ) ) );
+      test.execute( ReadAll { string( cap, 'a' ) } );
+      test.execute( Tick { 50 } );
+      test.execute( SegmentArrives {}.with_seqno( isn + 1 + cap ).with_data( string( cap, 'b' ) ) );
+      test.execute( ExpectRTTEstimate { 0 } );
+      test.execute( ExpectCapacity { cap } );
+      test.execute( ExpectWindow { 0 } );
+    }
+
+    {
+      const size_t cap = 1000;
+      const uint32_t isn = 23452;
+      TCPReceiverTestHarness test { "buffer grows with delivery rate", cap, 8 * cap };
+      test.execute( SegmentArrives {}.with_syn().with_seqno( isn ) );
+      test.execute( ExpectCapacity { cap } );
+      test.execute( Tick { 50 } );
+      test.execute( SegmentArrives {}.with_seqno( isn + 1 ).with_data( string( cap, 'a' ) ) );
+      test.execute( ExpectRTTEstimate { 50 } );
+      test.execute( ExpectCapacity { cap } );
+      test.execute( ReadAll { string( cap, 'a' ) } );
+      test.execute( Tick { 50 } );
+      test.execute( SegmentArrives {}.with_seqno( isn + 1 + cap ).with_data( string( cap, 'b' ) ) );
+      test.execute( ExpectCapacity { 2 * cap } );
+      test.execute( ExpectWindow { cap } );
+      test.execute( ReadAll { string( cap, 'b' ) } );
+      test.execute( Tick { 50 } );
+      test.execute( SegmentArrives {}.with_seqno( isn + 1 + 2 * cap ).with_data( string( 2 * cap, 'c' ) ) );
+      test.execute( ExpectRTTEstimate { 50 } );
+      test.execute( ReadAll { string( 2 * cap, 'c' ) } );
+      test.execute( Tick { 50 } );
+      test.execute( SegmentArrives {}.with_seqno( isn + 1 + 4 * cap ).with_data( "d" ) );
+      test.execute( ExpectCapacity { 4 * cap } );
+      test.execute( ExpectWindow { 4 * cap - 1 } );
+    }
+
+    {
+      const size_t cap = 1000;
+      const uint32_t isn = 23452;
+      TCPReceiverTestHarness test { "buffer growth stops at the ceiling", cap, 3 * cap / 2 };
+      test.execute( SegmentArrives {}.with_syn().with_seqno( isn ) );
+      test.execute( Tick { 20 } );
+      test.execute( SegmentArrives {}.with_seqno( isn + 1 ).with_data( string( cap, 'a' ) ) );
+      test.execute( ReadAll { string( cap, 'a' ) } );
+      test.execute( Tick { 20 } );
+      test.execute( SegmentArrives {}.with_seqno( isn + 1 + cap ).with_data( string( cap, 'b' ) ) );
+      test.execute( ExpectCapacity { 3 * cap / 2 } );
+      test.execute( ExpectWindow { cap / 2 } );
+    }
+
+    {
+      const size_t cap = 1000;
+      const uint32_t isn = 23452;
+      TCPReceiverTestHarness test { "idle flow shrinks back, without moving the window's right edge", cap, 8 * cap };
+      test.execute( SegmentArrives {}.with_syn().with_seqno( isn ) );
+      test.execute( Tick { 50 } );
+      test.execute( SegmentArrives {}.with_seqno( isn + 1 ).with_data( string( cap, 'a' ) ) );
+      test.execute( ReadAll { string( cap, 'a' ) } );
+      test.execute( Tick { 50 } );
+      test.execute( SegmentArrives {}.with_seqno( isn + 1 + cap ).with_data( string( cap, 'b' ) ) );
+      test.execute( ExpectCapacity { 2 * cap } );
+      test.execute( ExpectWindow { cap } );
+      test.execute( Tick { 999 } );
+      test.execute( ExpectCapacity { 2 * cap } );
+      test.execute( Tick { 1 } );
+      test.execute( ExpectWindow { cap } );
+      test.execute( ReadAll { string( cap, 'b' ) } );
+      test.execute( ExpectWindow { cap } );
+      test.execute( SegmentArrives {}.with_seqno( isn + 1 + 2 * cap ).with_data( string( cap / 2, 'c' ) ) );
+      test.execute( ExpectCapacity { cap } );
+      test.execute( ExpectWindow { cap / 2 } );
+      test.execute( ReadAll { string( cap / 2, 'c' ) } );
+      test.execute( ExpectWindow { cap } );
+    }
+
+    {
+      const size_t cap = 1000;
+      const uint32_t isn = 23452;
+      TCPReceiverTestHarness test { "idle flow keeps the data it advertised room for", cap, 8 * cap };
+      test.execute( SegmentArrives {}.with_syn().with_seqno( isn ) );
+      test.execute( Tick { 50 } );
+      test.execute( SegmentArrives {}.with_seqno( isn + 1 ).with_data( string( cap, 'a' ) ) );
+      test.execute( ReadAll { string( cap, 'a' ) } );
+      test.execute( Tick { 50 } );
+      test.execute( SegmentArrives {}.with_seqno( isn + 1 + cap ).with_data( string( cap, 'b' ) ) );
+      test.execute( SegmentArrives {}.with_seqno( isn + 1 + 2 * cap ).with_data( string( cap / 2, 'c' ) ) );
+      test.execute( ExpectCapacity { 2 * cap } );
+      test.execute( Tick { 1000 } );
+      test.execute( ExpectCapacity { 2 * cap } );
+      test.execute( ExpectWindow { cap / 2 } );
+      test.execute( SegmentArrives {}.with_seqno( isn + 1 + 5 * cap / 2 ).with_data( string( cap / 2, 'd' ) ) );
+      test.execute( ExpectWindow { 0 } );
+      test.execute( ReadAll { string( cap, 'b' ) + string( cap / 2, 'c' ) + string( cap / 2, 'd' ) } );
+      test.execute( ExpectWindow { cap } );
+      test.execute( Tick { 1 } );
+      test.execute( ExpectCapacity { cap } );
+    }
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return 1;
+  }
+
+  return EXIT_SUCCESS;
+}
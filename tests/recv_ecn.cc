@@ -0,0 +1,55 @@
+#include "byte_stream_test_harness.hh"
+#include "receiver_test_harness.hh"
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+int main()
+{
+  try {
+    {
+      const uint32_t isn = 51723;
+      TCPReceiverTestHarness test { "CE mark is echoed until CWR", 4000 };
+      test.execute( SegmentArrives {}.with_syn().with_seqno( isn ) );
+      test.execute( ExpectECE { false } );
+      test.execute( SegmentArrives {}.with_seqno( isn + 1 ).with_data( "abcd" ).with_ce() );
+      test.execute( ExpectECE { true } );
+      test.execute( SegmentArrives {}.with_seqno( isn + 5 ).with_data( "efgh" ) );
+      test.execute( ExpectECE { true } );
+      test.execute( SegmentArrives {}.with_seqno( isn + 9 ).with_data( "ijkl" ).with_cwr() );
+      test.execute( ExpectECE { false } );
+      test.execute( ExpectAckno { Wrap32 { isn + 13 } } );
+      test.execute( SegmentArrives {}.with_seqno( isn + 13 ).with_data( "mnop" ) );
+      test.execute( ExpectECE { false } );
+    }
+
+    {
+      const uint32_t isn = 9125;
+      TCPReceiverTestHarness test { "CE on a CWR segment starts a new echo", 4000 };
+      test.execute( SegmentArrives {}.with_syn().with_seqno( isn ) );
+      test.execute( SegmentArrives {}.with_seqno( isn + 1 ).with_data( "abcd" ).with_ce() );
+      test.execute( ExpectECE { true } );
+      test.execute( SegmentArrives {}.with_seqno( isn + 5 ).with_data( "efgh" ).with_cwr().with_ce() );
+      test.execute( ExpectECE { true } );
+      test.execute( ReadAll { "abcdefgh" } );
+    }
+
+    {
+      const uint32_t isn = 3;
+      TCPReceiverTestHarness test { "CE before the SYN is ignored", 4000 };
+      test.execute( SegmentArrives {}.with_seqno( isn + 1 ).with_data( "abcd" ).with_ce().without_ackno() );
+      test.execute( ExpectECE { false } );
+      test.execute( SegmentArrives {}.with_syn().with_seqno( isn ) );
+      test.execute( ExpectECE { false } );
+    }
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return 1;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,118 @@
+#include "exception.hh"
+#include "gro_adapter.hh"
+#include "link_adapter.hh"
+#include "test_should_be.hh"
+
+#include <array>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <sys/socket.h>
+
+using namespace std;
+
+namespace {
+TCPMessage data_segment( uint32_t seqno, const string& payload )
+{
+  TCPMessage msg;
+  msg.sender->seqno = Wrap32 { seqno };
+  msg.sender->payload = payload;
+  msg.receiver->ackno = Wrap32 { 1000 };
+  msg.receiver->window_size = 4096;
+  return msg;
+}
+} // namespace
+
+int main()
+{
+  try {
+    // Back-to-back segments are merged
+    {
+      TCPMessage first = data_segment( 1, "abc" );
+      test_should_be( coalesce_tcp_messages( first, data_segment( 4, "def" ) ), true );
+      test_should_be( coalesce_tcp_messages( first, data_segment( 7, "g" ) ), true );
+      test_should_be( first.sender->payload == "abcdefg", true );
+      test_should_be( first.sender->seqno, Wrap32 { 1 } );
+      test_should_be( first.sender->FIN, false );
+    }
+
+    // A gap or an overlap keeps the segments apart
+    {
+      TCPMessage first = data_segment( 1, "abc" );
+      test_should_be( coalesce_tcp_messages( first, data_segment( 5, "ef" ) ), false );
+      test_should_be( coalesce_tcp_messages( first, data_segment( 3, "cd" ) ), false );
+      test_should_be( first.sender->payload == "abc", true );
+    }
+
+    // The FIN may ride on the last segment, but nothing can follow it
+    {
+      TCPMessage first = data_segment( 1, "abc" );
+      TCPMessage last = data_segment( 4, "de" );
+      last.sender->FIN = true;
+      test_should_be( coalesce_tcp_messages( first, last ), true );
+      test_should_be( first.sender->FIN, true );
+      test_should_be( coalesce_tcp_messages( first, data_segment( 7, "f" ) ), false );
+    }
+
+    // Flags, pure ACKs, and changes to the acknowledgment are never merged
+    {
+      TCPMessage first = data_segment( 1, "abc" );
+      TCPMessage syn = data_segment( 4, "d" );
+      syn.sender->SYN = true;
+      test_should_be( coalesce_tcp_messages( first, syn ), false );
+
+      TCPMessage pure_ack = data_segment( 4, "" );
+      test_should_be( coalesce_tcp_messages( first, pure_ack ), false );
+
+      TCPMessage new_ack = data_segment( 4, "d" );
+      new_ack.receiver->ackno = Wrap32 { 1001 };
+      test_should_be( coalesce_tcp_messages( first, new_ack ), false );
+
+      TCPMessage new_window = data_segment( 4, "d" );
+      new_window.receiver->window_size = 2048;
+      test_should_be( coalesce_tcp_messages( first, new_window ), false );
+
+      TCPMessage marked = data_segment( 4, "d" );
+      marked.CE = true;
+      test_should_be( coalesce_tcp_messages( first, marked ), false );
+
+      test_should_be( first.sender->payload == "abc", true );
+    }
+
+    // The adapter reads every datagram that is ready, merges them, and then stops (without blocking)
+    {
+      array<int, 2> fds {};
+      CheckSystemCall( "socketpair", ::socketpair( AF_UNIX, SOCK_DGRAM, 0, fds.data() ) );
+      LinkAdapter sender { FileDescriptor { fds[0] } };
+      sender.config_mut().source = { "10.144.0.1", "40000" };
+      sender.config_mut().destination = { "10.144.0.2", "80" };
+      GROAdapter receiver { LinkAdapter { FileDescriptor { fds[1] } } };
+      receiver.config_mut().source = { "10.144.0.2", "80" };
+      receiver.config_mut().destination = { "10.144.0.1", "40000" };
+
+      sender.write( data_segment( 1, "abc" ) );
+      sender.write( data_segment( 4, "def" ) );
+      sender.write( data_segment( 7, "g" ) );
+      sender.write( data_segment( 100, "xyz" ) );
+
+      auto msg = receiver.read();
+      test_should_be( msg.has_value(), true );
+      test_should_be( msg->sender->payload == "abcdefg", true );
+      test_should_be( receiver.has_buffered(), true );
+      msg = receiver.read();
+      test_should_be( msg.has_value(), true );
+      test_should_be( msg->sender->payload == "xyz", true );
+      test_should_be( receiver.has_buffered(), false );
+      test_should_be( receiver.segments_read(), 4UL );
+
+      // nothing is ready: the read comes back empty
+      test_should_be( receiver.read().has_value(), false );
+    }
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return 1;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,58 @@
+#include "byte_stream_test_harness.hh"
+#include "receiver_test_harness.hh"
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+int main()
+{
+  try {
+    {
+      const uint32_t isn = 40400;
+      TCPReceiverTestHarness test { "in-order segments take the fast path", 4000 };
+      test.execute( PredictedSegmentArrives { false }.with_seqno( isn + 1 ).with_data( "abcd" ) );
+      test.execute( SegmentArrives {}.with_syn().with_seqno( isn ) );
+      test.execute( PredictedSegmentArrives { true }.with_seqno( isn + 1 ).with_data( "abcd" ) );
+      test.execute( PredictedSegmentArrives { true }.with_seqno( isn + 5 ).with_data( "efgh" ) );
+      test.execute( PredictedSegmentArrives { true }.with_seqno( isn + 9 ) );
+      test.execute( ExpectAckno { Wrap32 { isn + 9 } } );
+      test.execute( ExpectWindow { 3992 } );
+      test.execute( ReadAll { "abcdefgh" } );
+    }
+
+    {
+      const uint32_t isn = 2;
+      TCPReceiverTestHarness test { "unpredicted segments are declined untouched", 8 };
+      test.execute( SegmentArrives {}.with_syn().with_seqno( isn ) );
+      test.execute( PredictedSegmentArrives { false }.with_seqno( isn + 5 ).with_data( "efgh" ) );
+      test.execute( PredictedSegmentArrives { false }.with_seqno( isn + 1 ).with_data( "abcd" ).with_fin() );
+      test.execute( PredictedSegmentArrives { false }.with_seqno( isn + 1 ).with_data( "abcdefghi" ) );
+      test.execute( BytesPushed { 0 } );
+      test.execute( SegmentArrives {}.with_seqno( isn + 5 ).with_data( "efgh" ) );
+      test.execute( PredictedSegmentArrives { false }.with_seqno( isn + 1 ).with_data( "abcd" ) );
+      test.execute( SegmentArrives {}.with_seqno( isn + 1 ).with_data( "abcd" ) );
+      test.execute( ExpectAckno { Wrap32 { isn + 9 } } );
+      test.execute( ReadAll { "abcdefgh" } );
+    }
+
+    {
+      const uint32_t isn = 77;
+      TCPReceiverTestHarness test { "fast path stops once the FIN is known", 4000 };
+      test.execute( SegmentArrives {}.with_syn().with_seqno( isn ) );
+      test.execute( SegmentArrives {}.with_seqno( isn + 5 ).with_fin() );
+      test.execute( PredictedSegmentArrives { false }.with_seqno( isn + 1 ).with_data( "abcd" ) );
+      test.execute( SegmentArrives {}.with_seqno( isn + 1 ).with_data( "abcd" ) );
+      test.execute( ExpectAckno { Wrap32 { isn + 6 } } );
+      test.execute( IsClosed { true } );
+    }
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return 1;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,205 @@
+#include "exception.hh"
+#include "link_adapter.hh"
+#include "random.hh"
+#include "ring_pipe.hh"
+#include "tcp_minnow_socket.hh"
+#include "tcp_minnow_socket_impl.hh"
+#include "test_should_be.hh"
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+namespace {
+string random_bytes( size_t length )
+{
+  auto rd = get_random_engine();
+  string ret( length, 0 );
+  for ( auto& ch : ret ) {
+    ch = static_cast<char>( rd() );
+  }
+  return ret;
+}
+
+// Connect two TCPMinnowSockets, and send a MB or so each way (with the TCPPeer threads busy-polling, if asked)
+void check_connection( bool shared_memory, chrono::microseconds busy_poll = {} )
+{
+  array<int, 2> fds {};
+  CheckSystemCall( "socketpair", ::socketpair( AF_UNIX, SOCK_DGRAM, 0, fds.data() ) );
+  TCPMinnowSocket<LinkAdapter> client { LinkAdapter { FileDescriptor { fds[0] } } };
+  TCPMinnowSocket<LinkAdapter> server { LinkAdapter { FileDescriptor { fds[1] } } };
+  if ( shared_memory ) {
+    client.use_shared_memory( 4096 ); // (small, so the rings fill and wrap around)
+    server.use_shared_memory( 4096 );
+  }
+
+  TCPConfig tcp_config;
+  tcp_config.rt_timeout = 10;
+  tcp_config.busy_poll = busy_poll;
+  FdAdapterConfig client_config;
+  client_config.source = { "10.144.0.1", "40000" };
+  client_config.destination = { "10.144.0.2", "80" };
+  FdAdapterConfig server_config;
+  server_config.source = { "10.144.0.2", "80" };
+
+  thread listener { [&] { server.listen_and_accept( tcp_config, server_config ); } };
+  client.connect( tcp_config, client_config );
+  listener.join();
+
+  const string request = random_bytes( 1'000'000 );
+  const string response = random_bytes( 700'000 );
+  auto read_to_eof = []( TCPMinnowSocket<LinkAdapter>& socket ) {
+    string ret;
+    string buffer;
+    while ( not socket.eof() ) {
+      socket.read( buffer );
+      ret += buffer;
+    }
+    return ret;
+  };
+
+  string received_response;
+  thread client_thread { [&] {
+    client.write_all( request );
+    client.shutdown( SHUT_WR );
+    received_response = read_to_eof( client );
+  } };
+  const string received_request = read_to_eof( server );
+  server.write_all( response );
+  server.shutdown( SHUT_WR );
+  client_thread.join();
+
+  test_should_be( received_request.size(), request.size() );
+  test_should_be( received_request == request, true );
+  test_should_be( received_response.size(), response.size() );
+  test_should_be( received_response == response, true );
+
+  client.wait_until_closed();
+  server.wait_until_closed();
+}
+
+// With the RingPipes in use, the owner's end of the socketpair is shut down, so using the socket through its
+// base class (which would bypass the RingPipes) fails at once instead of waiting forever
+void check_base_class_misuse()
+{
+  array<int, 2> fds {};
+  CheckSystemCall( "socketpair", ::socketpair( AF_UNIX, SOCK_DGRAM, 0, fds.data() ) );
+  TCPMinnowSocket<LinkAdapter> socket { LinkAdapter { FileDescriptor { fds[0] } } };
+  const FileDescriptor peer { fds[1] };
+  socket.use_shared_memory();
+
+  FileDescriptor& base = socket;
+  test_should_be( base.readable(), true );
+  string buffer( 16, 'x' );
+  base.read( buffer );
+  test_should_be( buffer.empty(), true );
+  test_should_be( base.eof(), true );
+}
+} // namespace
+
+int main()
+{
+  try {
+    // The ring holds a power of two bytes, wraps around, and ends after it is closed and drained
+    {
+      RingPipe pipe { 5 };
+      test_should_be( pipe.capacity(), size_t { 8 } );
+      test_should_be( pipe.write( "hello" ), size_t { 5 } );
+      test_should_be( pipe.peek() == "hello", true );
+      pipe.pop( 4 );
+      test_should_be( pipe.write( "wrapping" ), size_t { 7 } );
+      test_should_be( pipe.available_capacity(), size_t { 0 } );
+      test_should_be( pipe.bytes_buffered(), size_t { 8 } );
+      test_should_be( pipe.peek() == "owra", true );
+      pipe.pop( 4 );
+      test_should_be( pipe.peek() == "ppin", true );
+      pipe.pop( 4 );
+      test_should_be( pipe.is_finished(), false );
+      pipe.close();
+      test_should_be( pipe.is_finished(), true );
+    }
+
+    // Each side signals the other only when the other may be waiting
+    {
+      RingPipe pipe { 4 };
+      test_should_be( pipe.readable_event().readable(), false );
+      pipe.write( "a" );
+      test_should_be( pipe.readable_event().readable(), true );
+      RingPipe::clear( pipe.readable_event() );
+      pipe.write( "b" ); // (the reader had not read the "a")
+      test_should_be( pipe.readable_event().readable(), false );
+      pipe.write( "cd" );
+      pipe.pop( 1 ); // (the ring was full)
+      test_should_be( pipe.writable_event().readable(), true );
+      RingPipe::clear( pipe.writable_event() );
+      pipe.pop( 1 );
+      test_should_be( pipe.writable_event().readable(), false );
+
+      pipe.close_reader();
+      test_should_be( pipe.writable_event().readable(), true );
+      bool threw = false;
+      try {
+        pipe.write( "e" );
+      } catch ( const runtime_error& ) {
+        threw = true;
+      }
+      test_should_be( threw, true );
+    }
+
+    // Two threads, blocking on the events
+    {
+      RingPipe pipe { 1000 };
+      const string data = random_bytes( 5'000'000 );
+      thread writer { [&] {
+        string_view remaining = data;
+        while ( not remaining.empty() ) {
+          const size_t len = pipe.write( remaining.substr( 0, 1 + remaining.size() % 3000 ) );
+          if ( len == 0 ) {
+            RingPipe::wait( pipe.writable_event() );
+          }
+          remaining.remove_prefix( len );
+        }
+        pipe.close();
+      } };
+
+      string received;
+      while ( not pipe.is_finished() ) {
+        const string_view chunk = pipe.peek();
+        if ( chunk.empty() ) {
+          RingPipe::wait( pipe.readable_event() );
+          continue;
+        }
+        const size_t len = min( chunk.size(), 1 + received.size() % 700 );
+        received += chunk.substr( 0, len );
+        pipe.pop( len );
+      }
+      writer.join();
+      test_should_be( received.size(), data.size() );
+      test_should_be( received == data, true );
+    }
+
+    // TCPMinnowSocket, through the socketpair and through the RingPipes
+    check_connection( false );
+    check_connection( true );
+    check_connection( true, chrono::microseconds { 200 } ); // (spinning on the RingPipes' indices)
+    check_base_class_misuse();
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -1,4 +1,5 @@
 #include "router.hh"
+#include "arp_message.hh"
 #include "network_interface_test_harness.hh"
 
 #include <algorithm>
@@ -405,12 +406,95 @@ void network_simulator()
 
   cout << "\n\n\033[32;1mCongratulations! All datagrams were routed successfully.\033[m\n";
 }
+
+// With an ECN threshold of 2, the third datagram routed to one interface in one route() finds two ahead of it,
+// and is marked CE if it is ECN-capable. Not-ECT datagrams are never marked, and CE ones are left as they are.
+void ecn_marking()
+{
+  Router router {};
+  const auto in_addr = random_router_ethernet_address();
+  const auto out_addr = random_router_ethernet_address();
+  auto frames_in = make_shared<FramesOut>();
+  auto frames_out = make_shared<FramesOut>();
+  const auto in_id = router.add_interface(
+    make_shared<NetworkInterface>( "eth0", frames_in, in_addr, Address { "192.168.0.1" } ) );
+  const auto out_id = router.add_interface(
+    make_shared<NetworkInterface>( "eth1", frames_out, out_addr, Address { "10.0.0.1" } ) );
+  router.add_route( ip( "10.0.0.0" ), 8, {}, out_id );
+  router.set_ecn_threshold( 2 );
+
+  // let eth1 learn the destination's Ethernet address, so the datagrams go straight out
+  const auto host_addr = random_host_ethernet_address();
+  ARPMessage arp;
+  arp.opcode = ARPMessage::OPCODE_REPLY;
+  arp.sender_ethernet_address = host_addr;
+  arp.sender_ip_address = ip( "10.0.0.5" );
+  arp.target_ethernet_address = out_addr;
+  arp.target_ip_address = ip( "10.0.0.1" );
+  router.interface( out_id )->recv_frame(
+    { .header = { .dst = out_addr, .src = host_addr, .type = EthernetHeader::TYPE_ARP },
+      .payload = serialize( arp ) } );
+
+  auto send = [&]( uint8_t ecn ) {
+    InternetDatagram dgram { { .len = 20, .ttl = 64, .src = ip( "192.168.0.2" ), .dst = ip( "10.0.0.5" ) } };
+    dgram.header.set_ecn( ecn );
+    dgram.header.compute_checksum();
+    router.interface( in_id )->recv_frame(
+      { .header = { .dst = in_addr, .src = random_host_ethernet_address(), .type = EthernetHeader::TYPE_IPv4 },
+        .payload = serialize( dgram ) } );
+  };
+
+  // zero and one ahead (below the threshold), two and three ahead (at it and past it)
+  const vector<uint8_t> sent { IPv4Header::ECN_ECT0,
+                               IPv4Header::ECN_ECT1,
+                               IPv4Header::ECN_ECT0,
+                               IPv4Header::ECN_NOT_ECT,
+                               IPv4Header::ECN_CE,
+                               IPv4Header::ECN_ECT1 };
+  const vector<uint8_t> expected { IPv4Header::ECN_ECT0,
+                                   IPv4Header::ECN_ECT1,
+                                   IPv4Header::ECN_CE,
+                                   IPv4Header::ECN_NOT_ECT,
+                                   IPv4Header::ECN_CE,
+                                   IPv4Header::ECN_CE };
+  for ( const uint8_t ecn : sent ) {
+    send( ecn );
+  }
+  router.route();
+
+  auto expect_forwarded = [&]( uint8_t ecn ) {
+    const EthernetFrame frame = frames_out->expect_frame();
+    InternetDatagram dgram;
+    if ( not parse( dgram, frame.payload ) ) {
+      throw runtime_error( "router sent an unparseable datagram" );
+    }
+    if ( dgram.header.ecn() != ecn ) {
+      throw runtime_error( "router forwarded a datagram with ECN codepoint " + to_string( dgram.header.ecn() )
+                           + " (expected " + to_string( ecn ) + ")" );
+    }
+  };
+  for ( const uint8_t ecn : expected ) {
+    expect_forwarded( ecn );
+  }
+  if ( not frames_out->frames.empty() or router.ecn_marks() != 2 ) {
+    throw runtime_error( "router sent extra frames, or counted " + to_string( router.ecn_marks() )
+                         + " ECN marks (expected 2)" );
+  }
+
+  // each route() starts with empty queues
+  send( IPv4Header::ECN_ECT0 );
+  router.route();
+  expect_forwarded( IPv4Header::ECN_ECT0 );
+
+  cout << "\033[32;1mECN marking works.\033[m\n";
+}
 } // namespace
 
 int main()
 {
   try {
     network_simulator();
+    ecn_marking();
   } catch ( const exception& e ) {
     cerr << "\n\n\n";
     cerr << "\033[31;1mError: " << e.what() << "\033[m\n";
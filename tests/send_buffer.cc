@@ -0,0 +1,70 @@
+#include "random.hh"
+#include "sender_test_harness.hh"
+
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+int main()
+{
+  try {
+    auto rd = get_random_engine();
+
+    {
+      TCPConfig cfg;
+      const Wrap32 isn( rd() );
+      cfg.isn = isn;
+      cfg.send_capacity = 10;
+
+      TCPSenderTestHarness test { "Unacknowledged bytes occupy the send buffer", cfg };
+      test.execute( Push {} );
+      test.execute( ExpectMessage {}.with_syn( true ) );
+      test.execute( AckReceived { Wrap32 { isn + 1 } }.with_win( 1000 ) );
+      test.execute( Push( "abcdefgh" ) );
+      test.execute( ExpectMessage {}.with_data( "abcdefgh" ) );
+      test.execute( ExpectAvailableCapacity { 2 } );
+      test.execute( AckReceived { Wrap32 { isn + 5 } }.with_win( 1000 ) );
+      test.execute( ExpectAvailableCapacity { 2 } );
+      test.execute( AckReceived { Wrap32 { isn + 9 } }.with_win( 1000 ) );
+      test.execute( ExpectAvailableCapacity { 10 } );
+      test.execute( ExpectNoSegment {} );
+    }
+
+    {
+      TCPConfig cfg;
+      const Wrap32 isn( rd() );
+      const uint64_t rto = uniform_int_distribution<uint16_t> { 30, 10000 }( rd );
+      cfg.isn = isn;
+      cfg.rt_timeout = rto;
+
+      TCPSenderTestHarness test { "Retransmissions are rebuilt from the send buffer", cfg };
+      test.execute( Push {} );
+      test.execute( ExpectMessage {}.with_syn( true ) );
+      test.execute( AckReceived { Wrap32 { isn + 1 } }.with_win( 3 ) );
+      test.execute( Push( "abcdefgh" ) );
+      test.execute( ExpectMessage {}.with_data( "abc" ) );
+      test.execute( AckReceived { Wrap32 { isn + 4 } }.with_win( 3 ) );
+      test.execute( ExpectMessage {}.with_data( "def" ) );
+      test.execute( Push( "ijk" ).with_close() );
+      test.execute( ExpectNoSegment {} );
+      test.execute( Tick { rto } );
+      test.execute( ExpectMessage {}.with_seqno( isn + 4 ).with_data( "def" ) );
+      test.execute( AckReceived { Wrap32 { isn + 7 } }.with_win( 10 ) );
+      test.execute( ExpectMessage {}.with_seqno( isn + 7 ).with_data( "ghijk" ).with_fin( true ) );
+      test.execute( Tick { rto } );
+      test.execute( ExpectMessage {}.with_seqno( isn + 7 ).with_data( "ghijk" ).with_fin( true ) );
+      test.execute( AckReceived { Wrap32 { isn + 13 } }.with_win( 10 ) );
+      test.execute( ExpectSeqnosInFlight { 0 } );
+      test.execute( ExpectNoSegment {} );
+    }
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return 1;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,101 @@
+#include "random.hh"
+#include "sender_test_harness.hh"
+
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+int main()
+{
+  try {
+    auto rd = get_random_engine();
+
+    {
+      TCPConfig cfg;
+      const Wrap32 isn( rd() );
+      cfg.isn = isn;
+
+      TCPSenderTestHarness test { "ECN-Echo shrinks the window without a retransmission", cfg };
+      test.execute( Push {} );
+      test.execute( ExpectMessage {}.with_no_flags().with_syn( true ).with_seqno( isn ) );
+      test.execute( AckReceived { Wrap32 { isn + 1 } }.with_win( 60000 ) );
+      test.execute( Push( string( 8000, 'x' ) ) );
+      for ( unsigned int i = 0; i < 8; ++i ) {
+        test.execute( ExpectMessage {}.with_no_flags().with_cwr( false ).with_payload_size( 1000 ) );
+      }
+      test.execute( ExpectCongestionWindow { UINT64_MAX } );
+      test.execute( AckReceived { Wrap32 { isn + 2001 } }.with_win( 60000 ).with_ece() );
+      test.execute( ExpectSeqnosInFlight { 6000 } );
+      test.execute( ExpectCongestionWindow { 3000 } );
+      test.execute( ExpectNoSegment {} );
+      test.execute( Push( string( 1000, 'y' ) ) );
+      test.execute( ExpectNoSegment {} );
+      test.execute( AckReceived { Wrap32 { isn + 8001 } }.with_win( 60000 ) );
+      test.execute( ExpectCongestionWindow { 4000 } );
+      test.execute( ExpectMessage {}.with_no_flags().with_cwr( true ).with_data( string( 1000, 'y' ) ) );
+      test.execute( ExpectConsecutiveRetransmissions { 0 } );
+      test.execute( ExpectNoSegment {} );
+    }
+
+    {
+      TCPConfig cfg;
+      const Wrap32 isn( rd() );
+      cfg.isn = isn;
+
+      TCPSenderTestHarness test { "At most one reduction per window of data", cfg };
+      test.execute( Push {} );
+      test.execute( ExpectMessage {}.with_syn( true ) );
+      test.execute( AckReceived { Wrap32 { isn + 1 } }.with_win( 60000 ) );
+      test.execute( Push( string( 8000, 'x' ) ) );
+      for ( unsigned int i = 0; i < 8; ++i ) {
+        test.execute( ExpectMessage {}.with_payload_size( 1000 ) );
+      }
+      test.execute( AckReceived { Wrap32 { isn + 1001 } }.with_win( 60000 ).with_ece() );
+      test.execute( ExpectCongestionWindow { 3500 } );
+      test.execute( AckReceived { Wrap32 { isn + 2001 } }.with_win( 60000 ).with_ece() );
+      test.execute( ExpectCongestionWindow { 3500 } );
+      test.execute( AckReceived { Wrap32 { isn + 8001 } }.with_win( 60000 ).with_ece() );
+      test.execute( ExpectCongestionWindow { 3500 } );
+      test.execute( ExpectNoSegment {} );
+      test.execute( Push( string( 3000, 'y' ) ) );
+      for ( unsigned int i = 0; i < 3; ++i ) {
+        test.execute( ExpectMessage {}.with_cwr( i == 0 ).with_payload_size( 1000 ) );
+      }
+      test.execute( AckReceived { Wrap32 { isn + 9001 } }.with_win( 60000 ).with_ece() );
+      test.execute( ExpectCongestionWindow { 2000 } );
+      test.execute( Push( string( 1000, 'z' ) ) );
+      test.execute( ExpectNoSegment {} );
+      test.execute( AckReceived { Wrap32 { isn + 11001 } }.with_win( 60000 ) );
+      test.execute( ExpectCongestionWindow { 3000 } );
+      test.execute( ExpectMessage {}.with_cwr( true ).with_data( string( 1000, 'z' ) ) );
+      test.execute( ExpectNoSegment {} );
+    }
+
+    {
+      TCPConfig cfg;
+      const Wrap32 isn( rd() );
+      cfg.isn = isn;
+
+      TCPSenderTestHarness test { "Window is unlimited without congestion marks", cfg };
+      test.execute( Push {} );
+      test.execute( ExpectMessage {}.with_syn( true ) );
+      test.execute( AckReceived { Wrap32 { isn + 1 } }.with_win( 5000 ) );
+      test.execute( Push( string( 5000, 'x' ) ) );
+      for ( unsigned int i = 0; i < 5; ++i ) {
+        test.execute( ExpectMessage {}.with_cwr( false ).with_payload_size( 1000 ) );
+      }
+      test.execute( AckReceived { Wrap32 { isn + 5001 } }.with_win( 5000 ) );
+      test.execute( ExpectCongestionWindow { UINT64_MAX } );
+      test.execute( ExpectNoSegment {} );
+    }
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return 1;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,89 @@
+#include "random.hh"
+#include "sender_test_harness.hh"
+
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+int main()
+{
+  try {
+    auto rd = get_random_engine();
+
+    {
+      TCPConfig cfg;
+      const Wrap32 isn( rd() );
+      cfg.isn = isn;
+
+      TCPSenderTestHarness test { "Fast Open SYN carries data", cfg };
+      test.execute( SetSynPayloadLimit { TCPConfig::MAX_PAYLOAD_SIZE } );
+      test.execute( Push( "hello" ) );
+      test.execute( ExpectMessage {}.with_no_flags().with_syn( true ).with_data( "hello" ).with_seqno( isn ) );
+      test.execute( ExpectSeqnosInFlight { 6 } );
+      test.execute( ExpectNoSegment {} );
+      test.execute( AckReceived { Wrap32 { isn + 6 } }.with_win( 1000 ) );
+      test.execute( ExpectSeqnosInFlight { 0 } );
+      test.execute( ExpectSeqno { isn + 6 } );
+      test.execute( ExpectNoSegment {} );
+    }
+
+    {
+      TCPConfig cfg;
+      const Wrap32 isn( rd() );
+      cfg.isn = isn;
+
+      TCPSenderTestHarness test { "Fast Open SYN payload is limited", cfg };
+      test.execute( SetSynPayloadLimit { 3 } );
+      test.execute( Push( "hello" ) );
+      test.execute( ExpectMessage {}.with_no_flags().with_syn( true ).with_data( "hel" ).with_seqno( isn ) );
+      test.execute( ExpectNoSegment {} );
+      test.execute( AckReceived { Wrap32 { isn + 4 } }.with_win( 1000 ) );
+      test.execute( ExpectMessage {}.with_no_flags().with_data( "lo" ).with_seqno( isn + 4 ) );
+    }
+
+    {
+      TCPConfig cfg;
+      const Wrap32 isn( rd() );
+      const size_t rto = uniform_int_distribution<uint16_t> { 30, 10000 }( rd );
+      cfg.isn = isn;
+      cfg.rt_timeout = rto;
+
+      TCPSenderTestHarness test { "Refused Fast Open data is resent without SYN", cfg };
+      test.execute( SetSynPayloadLimit { TCPConfig::MAX_PAYLOAD_SIZE } );
+      test.execute( Push( "hello" ) );
+      test.execute( ExpectMessage {}.with_no_flags().with_syn( true ).with_data( "hello" ).with_seqno( isn ) );
+      test.execute( AckReceived { Wrap32 { isn + 1 } }.with_win( 1000 ) );
+      test.execute( ExpectMessage {}.with_no_flags().with_data( "hello" ).with_seqno( isn + 1 ) );
+      test.execute( ExpectSeqnosInFlight { 5 } );
+      test.execute( ExpectConsecutiveRetransmissions { 0 } );
+      test.execute( ExpectNoSegment {} );
+      test.execute( Tick { rto } );
+      test.execute( ExpectMessage {}.with_no_flags().with_data( "hello" ).with_seqno( isn + 1 ) );
+      test.execute( AckReceived { Wrap32 { isn + 6 } }.with_win( 1000 ) );
+      test.execute( ExpectSeqnosInFlight { 0 } );
+    }
+
+    {
+      TCPConfig cfg;
+      const Wrap32 isn( rd() );
+      cfg.isn = isn;
+
+      TCPSenderTestHarness test { "Limit has no effect once the SYN is sent", cfg };
+      test.execute( Push( "hello" ) );
+      test.execute( ExpectMessage {}.with_no_flags().with_syn( true ).with_payload_size( 0 ).with_seqno( isn ) );
+      test.execute( SetSynPayloadLimit { TCPConfig::MAX_PAYLOAD_SIZE } );
+      test.execute( Push {} );
+      test.execute( ExpectNoSegment {} );
+      test.execute( ExpectSeqnosInFlight { 1 } );
+    }
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return 1;
+  }
+
+  return EXIT_SUCCESS;
+}
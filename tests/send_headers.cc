@@ -0,0 +1,91 @@
+#include "helpers.hh"
+#include "random.hh"
+#include "tcp_over_ip.hh"
+#include "test_should_be.hh"
+
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+namespace {
+// The headers from the generic path: the serialized datagram, without the payload
+string generic_headers( TCPOverIPv4Adapter& adapter, const TCPMessage& msg )
+{
+  string ret = concat( serialize( adapter.wrap_tcp_in_ip( msg ) ) );
+  ret.resize( ret.size() - msg.sender->payload.size() );
+  return ret;
+}
+} // namespace
+
+int main()
+{
+  try {
+    auto rd = get_random_engine();
+
+    TCPOverIPv4Adapter adapter;
+    adapter.config_mut().source = Address { "10.144.0.1", 1234 };
+    adapter.config_mut().destination = Address { "10.144.0.2", 80 };
+
+    // The patched template matches the generic path, whatever the fields
+    {
+      constexpr size_t N_REPS = 1000;
+      for ( size_t i = 0; i < N_REPS; ++i ) {
+        TCPMessage msg;
+        msg.sender->seqno = Wrap32 { static_cast<uint32_t>( rd() ) };
+        msg.sender->payload = string( rd() % 1001, static_cast<char>( rd() ) );
+        msg.sender->SYN = rd() % 2;
+        msg.sender->FIN = rd() % 2;
+        msg.sender->CWR = rd() % 2;
+        msg.sender->RST = rd() % 8 == 0;
+        if ( rd() % 4 ) {
+          msg.receiver->ackno = Wrap32 { static_cast<uint32_t>( rd() ) };
+        }
+        msg.receiver->window_size = static_cast<uint16_t>( rd() );
+        msg.receiver->ECE = rd() % 2;
+        msg.ECT = rd() % 2;
+
+        const string expected = generic_headers( adapter, msg );
+        test_should_be( string { adapter.wrap_tcp_headers( msg ) } == expected, true );
+      }
+    }
+
+    // A repeated message reuses the last headers
+    {
+      TCPMessage msg;
+      msg.sender->seqno = Wrap32 { 17 };
+      msg.sender->payload = "hello";
+      msg.receiver->ackno = Wrap32 { 99 };
+      msg.receiver->window_size = 1000;
+
+      const string first { adapter.wrap_tcp_headers( msg ) };
+      test_should_be( string { adapter.wrap_tcp_headers( msg ) } == first, true );
+      msg.receiver->window_size = 999;
+      test_should_be( string { adapter.wrap_tcp_headers( msg ) } == first, false );
+      test_should_be( string { adapter.wrap_tcp_headers( msg ) } == generic_headers( adapter, msg ), true );
+    }
+
+    // The template follows changes to the configured addresses
+    {
+      TCPMessage msg;
+      msg.sender->seqno = Wrap32 { 17 };
+      msg.sender->payload = "hello";
+      msg.receiver->ackno = Wrap32 { 99 };
+      msg.receiver->window_size = 1000;
+
+      const string before { adapter.wrap_tcp_headers( msg ) };
+      adapter.config_mut().destination = Address { "10.144.0.3", 8080 };
+      const string after { adapter.wrap_tcp_headers( msg ) };
+      test_should_be( after == before, false );
+      test_should_be( after == generic_headers( adapter, msg ), true );
+    }
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return 1;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -1,10 +1,12 @@
 #include "random.hh"
 #include "sender_test_harness.hh"
 
+#include <chrono>
 #include <cstdint>
 #include <cstdlib>
 #include <exception>
 #include <iostream>
+#include <optional>
 #include <string>
 
 using namespace std;
@@ -46,6 +48,31 @@ int main()
       test.execute( HasError { false } );
     }
 
+    {
+      TCPConfig cfg;
+      const Wrap32 isn( rd() );
+      const uint16_t retx_timeout = uniform_int_distribution<uint16_t> { 10, 10000 }( rd );
+      cfg.isn = isn;
+      cfg.rt_timeout = retx_timeout;
+
+      TCPSenderTestHarness test { "Time to retransmission follows the timer", cfg };
+      test.execute( ExpectTimeToRetransmission { nullopt } );
+      test.execute( Push {} );
+      test.execute( ExpectMessage {}.with_no_flags().with_syn( true ).with_payload_size( 0 ).with_seqno( isn ) );
+      test.execute( ExpectTimeToRetransmission { retx_timeout } );
+      test.execute( Tick { retx_timeout - 1U } );
+      test.execute( ExpectNoSegment {} );
+      test.execute( ExpectTimeToRetransmission { 1 } );
+      test.execute( Tick { 1 } );
+      test.execute( ExpectMessage {}.with_no_flags().with_syn( true ).with_payload_size( 0 ).with_seqno( isn ) );
+      // The timer restarts, with the RTO doubled
+      test.execute( ExpectTimeToRetransmission { 2UL * retx_timeout } );
+      test.execute( AckReceived { Wrap32 { isn + 1 } } );
+      test.execute( ExpectSeqnosInFlight { 0 } );
+      test.execute( ExpectTimeToRetransmission { nullopt } );
+      test.execute( HasError { false } );
+    }
+
     {
       TCPConfig cfg;
       const Wrap32 isn( rd() );
@@ -198,6 +225,33 @@ int main()
       test.execute( ExpectSeqnosInFlight { 0 } );
       test.execute( HasError { false } );
     }
+
+    {
+      TCPConfig cfg;
+      const Wrap32 isn( rd() );
+      const chrono::microseconds retx_timeout { uniform_int_distribution<int64_t> { 10, 2000 }( rd ) };
+      cfg.isn = isn;
+      cfg.rt_timeout_us = retx_timeout;
+
+      TCPSenderTestHarness test { "Sub-millisecond RTO: retx SYN at the right microseconds", cfg };
+      test.execute( Push {} );
+      test.execute( ExpectMessage {}.with_no_flags().with_syn( true ).with_payload_size( 0 ).with_seqno( isn ) );
+      test.execute( ExpectTimeToRetransmission { static_cast<uint64_t>( ( retx_timeout.count() + 999 ) / 1000 ) } );
+      test.execute( Tick { retx_timeout - chrono::microseconds( 1 ) } );
+      test.execute( ExpectNoSegment {} );
+      test.execute( ExpectTimeToRetransmission { 1 } );
+      test.execute( Tick { chrono::microseconds( 1 ) } );
+      test.execute( ExpectMessage {}.with_no_flags().with_syn( true ).with_payload_size( 0 ).with_seqno( isn ) );
+      // Wait twice as long b/c exponential back-off
+      test.execute( Tick { 2 * retx_timeout - chrono::microseconds( 1 ) } );
+      test.execute( ExpectNoSegment {} );
+      test.execute( Tick { chrono::microseconds( 1 ) } );
+      test.execute( ExpectMessage {}.with_no_flags().with_syn( true ).with_payload_size( 0 ).with_seqno( isn ) );
+      test.execute( AckReceived { Wrap32 { isn + 1 } } );
+      test.execute( ExpectSeqnosInFlight { 0 } );
+      test.execute( ExpectTimeToRetransmission { nullopt } );
+      test.execute( HasError { false } );
+    }
   } catch ( const exception& e ) {
     cerr << e.what() << "\n";
     return 1;
@@ -0,0 +1,133 @@
+#include "helpers.hh"
+#include "random.hh"
+#include "sender_test_harness.hh"
+#include "tcp_over_ip.hh"
+#include "test_should_be.hh"
+
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+int main()
+{
+  try {
+    auto rd = get_random_engine();
+
+    {
+      TCPConfig cfg;
+      const Wrap32 isn( rd() );
+      cfg.isn = isn;
+
+      TCPSenderTestHarness test { "Burst is sent as one message", cfg };
+      test.execute( SetSegmentationOffload { true } );
+      test.execute( Push {} );
+      test.execute( ExpectMessage {}.with_syn( true ).with_payload_size( 0 ) );
+      test.execute( AckReceived { Wrap32 { isn + 1 } }.with_win( 5000 ) );
+      test.execute( Push( string( 3500, 'x' ) ) );
+      test.execute(
+        ExpectMessage {}.allowing_super_segment().with_no_flags().with_payload_size( 3500 ).with_seqno( isn + 1 ) );
+      test.execute( ExpectSeqnosInFlight { 3500 } );
+      test.execute( ExpectNoSegment {} );
+      test.execute( Push( string( 2000, 'y' ) ) );
+      test.execute( ExpectMessage {}.allowing_super_segment().with_payload_size( 1500 ).with_seqno( isn + 3501 ) );
+      test.execute( ExpectNoSegment {} );
+    }
+
+    {
+      TCPConfig cfg;
+      const Wrap32 isn( rd() );
+      const size_t rto = uniform_int_distribution<uint16_t> { 30, 10000 }( rd );
+      cfg.isn = isn;
+      cfg.rt_timeout = rto;
+
+      TCPSenderTestHarness test { "Retransmissions are one MSS", cfg };
+      test.execute( SetSegmentationOffload { true } );
+      test.execute( Push {} );
+      test.execute( ExpectMessage {}.with_syn( true ).with_payload_size( 0 ) );
+      test.execute( AckReceived { Wrap32 { isn + 1 } }.with_win( 5000 ) );
+      test.execute( Push( string( 3000, 'x' ) ) );
+      test.execute( ExpectMessage {}.allowing_super_segment().with_payload_size( 3000 ) );
+      test.execute( Tick { rto - 1 } );
+      test.execute( ExpectNoSegment {} );
+      test.execute( Tick { 1 } );
+      test.execute( ExpectMessage {}.with_no_flags().with_payload_size( 1000 ).with_seqno( isn + 1 ) );
+      test.execute( AckReceived { Wrap32 { isn + 1001 } }.with_win( 5000 ) );
+      test.execute( ExpectSeqnosInFlight { 2000 } );
+      test.execute( Tick { rto } );
+      test.execute( ExpectMessage {}.with_no_flags().with_payload_size( 1000 ).with_seqno( isn + 1001 ) );
+      test.execute( AckReceived { Wrap32 { isn + 3001 } }.with_win( 5000 ) );
+      test.execute( ExpectSeqnosInFlight { 0 } );
+      test.execute( ExpectNoSegment {} );
+    }
+
+    {
+      TCPConfig cfg;
+      const Wrap32 isn( rd() );
+      cfg.isn = isn;
+
+      TCPSenderTestHarness test { "FIN rides on the burst", cfg };
+      test.execute( SetSegmentationOffload { true } );
+      test.execute( Push {} );
+      test.execute( ExpectMessage {}.with_syn( true ).with_payload_size( 0 ) );
+      test.execute( AckReceived { Wrap32 { isn + 1 } }.with_win( 5000 ) );
+      test.execute( Push( string( 2500, 'x' ) ).with_close() );
+      test.execute( ExpectMessage {}.allowing_super_segment().with_fin( true ).with_payload_size( 2500 ) );
+      test.execute( ExpectSeqnosInFlight { 2501 } );
+      test.execute( ExpectNoSegment {} );
+    }
+
+    // The adapter splits a super-segment into MSS-sized datagrams with valid headers
+    {
+      TCPOverIPv4Adapter sender;
+      sender.config_mut().source = Address { "10.144.0.1", 1234 };
+      sender.config_mut().destination = Address { "10.144.0.2", 80 };
+      TCPOverIPv4Adapter receiver;
+      receiver.config_mut().source = sender.config().destination;
+      receiver.config_mut().destination = sender.config().source;
+
+      TCPMessage burst;
+      burst.sender->seqno = Wrap32 { 0xffff'fc00 };
+      for ( unsigned int i = 0; i < 2500; ++i ) {
+        burst.sender->payload.push_back( static_cast<char>( 'a' + i % 26 ) );
+      }
+      burst.sender->FIN = true;
+      burst.sender->CWR = true;
+      burst.receiver->ackno = Wrap32 { 42 };
+      burst.receiver->window_size = 1234;
+      burst.ECT = true;
+
+      vector<TCPMessage> out;
+      sender.segment_tcp_in_ip( burst, [&]( string_view headers, string_view payload ) {
+        InternetDatagram dgram;
+        test_should_be( parse( dgram, vector<string> { string { headers } + string { payload } } ), true );
+        auto msg = receiver.unwrap_tcp_in_ip( move( dgram ) );
+        test_should_be( msg.has_value(), true );
+        out.push_back( move( msg.value() ) );
+      } );
+
+      test_should_be( out.size(), size_t { 3 } );
+      string reassembled;
+      for ( size_t i = 0; i < out.size(); ++i ) {
+        test_should_be( out[i].sender->seqno, Wrap32 { 0xffff'fc00 } + static_cast<uint32_t>( i * 1000 ) );
+        test_should_be( out[i].sender->CWR, i == 0 );
+        test_should_be( out[i].sender->FIN, i == 2 );
+        test_should_be( out[i].receiver->ackno.has_value(), true );
+        test_should_be( out[i].receiver->ackno.value(), Wrap32 { 42 } );
+        test_should_be( out[i].receiver->window_size, uint16_t { 1234 } );
+        test_should_be( out[i].ECT, true );
+        reassembled += out[i].sender->payload;
+      }
+      test_should_be( reassembled == burst.sender->payload, true );
+    }
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return 1;
+  }
+
+  return EXIT_SUCCESS;
+}
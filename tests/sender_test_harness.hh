@@ -7,6 +7,7 @@
 #include "tcp_sender.hh"
 #include "wrapping_integers.hh"
 
+#include <chrono>
 #include <optional>
 #include <queue>
 #include <sstream>
@@ -54,8 +55,9 @@ class TCPSenderTestHarness : public TestHarness<SenderAndOutput>
 public:
   TCPSenderTestHarness( std::string name, TCPConfig config )
     : TestHarness( move( name ),
-                   "initial_RTO_ms=" + to_string( config.rt_timeout ) + " and ISN=" + to_string( config.isn ),
-                   { .sender = TCPSender { ByteStream { config.send_capacity }, config.isn, config.rt_timeout } } )
+                   "initial_RTO_us=" + to_string( config.initial_rto().count() )
+                     + " and ISN=" + to_string( config.isn ),
+                   { .sender = TCPSender { ByteStream { config.send_capacity }, config.isn, config.initial_rto() } } )
   {}
 
   template<std::derived_from<TestStep<TCPSender>> T>
@@ -104,6 +106,27 @@ struct ExpectConsecutiveRetransmissions : public ExpectNumber<TCPSender, uint64_
   uint64_t value( const TCPSender& sender ) const override { return sender.consecutive_retransmissions(); }
 };
 
+struct ExpectTimeToRetransmission : public ExpectNumber<TCPSender, std::optional<uint64_t>>
+{
+  using ExpectNumber::ExpectNumber;
+  std::string name() const override { return "time_to_retransmission"; }
+  std::optional<uint64_t> value( const TCPSender& sender ) const override { return sender.time_to_retransmission(); }
+};
+
+struct ExpectAvailableCapacity : public ExpectNumber<TCPSender, uint64_t>
+{
+  using ExpectNumber::ExpectNumber;
+  std::string name() const override { return "writer().available_capacity"; }
+  uint64_t value( const TCPSender& sender ) const override { return sender.writer().available_capacity(); }
+};
+
+struct ExpectCongestionWindow : public ExpectNumber<TCPSender, uint64_t>
+{
+  using ExpectNumber::ExpectNumber;
+  std::string name() const override { return "congestion_window"; }
+  uint64_t value( const TCPSender& sender ) const override { return sender.congestion_window(); }
+};
+
 struct ExpectNoSegment : public Expectation<SenderAndOutput>
 {
   std::string description() const override { return "nothing to send"; }
@@ -122,6 +145,24 @@ struct SetError : public Action<TCPSender>
   void execute( TCPSender& sender ) const override { sender.writer().set_error(); }
 };
 
+struct SetSynPayloadLimit : public Action<TCPSender>
+{
+  uint64_t max_bytes_;
+
+  explicit SetSynPayloadLimit( uint64_t max_bytes ) : max_bytes_( max_bytes ) {}
+  std::string description() const override { return "set_syn_payload_limit(" + to_string( max_bytes_ ) + ")"; }
+  void execute( TCPSender& sender ) const override { sender.set_syn_payload_limit( max_bytes_ ); }
+};
+
+struct SetSegmentationOffload : public Action<TCPSender>
+{
+  bool enabled_;
+
+  explicit SetSegmentationOffload( bool enabled ) : enabled_( enabled ) {}
+  std::string description() const override { return "set_segmentation_offload(" + to_string( enabled_ ) + ")"; }
+  void execute( TCPSender& sender ) const override { sender.set_segmentation_offload( enabled_ ); }
+};
+
 struct HasError : public ExpectBool<TCPSender>
 {
   using ExpectBool::ExpectBool;
@@ -170,10 +211,11 @@ struct Push : public Action<SenderAndOutput>
 
 struct Tick : public Action<SenderAndOutput>
 {
-  uint64_t ms_;
+  std::chrono::microseconds time_;
   std::optional<bool> max_retx_exceeded_ {};
 
-  explicit Tick( uint64_t ms ) : ms_( ms ) {}
+  explicit Tick( uint64_t ms ) : time_( std::chrono::milliseconds( ms ) ) {}
+  explicit Tick( std::chrono::microseconds time ) : time_( time ) {}
 
   Tick& with_max_retx_exceeded( bool val )
   {
@@ -184,7 +226,7 @@ struct Tick : public Action<SenderAndOutput>
   std::string description() const override
   {
     std::ostringstream desc;
-    desc << ms_ << " ms pass";
+    desc << duration() << " pass";
     if ( max_retx_exceeded_.has_value() ) {
       desc << ( max_retx_exceeded_.value() ? " (max # retransmissions exceeded)"
                                            : " (max # retransmissions not exceeded)" );
@@ -194,11 +236,11 @@ struct Tick : public Action<SenderAndOutput>
 
   void execute( SenderAndOutput& ss ) const override
   {
-    ss.sender.tick( ms_, ss.make_transmit() );
+    ss.sender.tick( time_, ss.make_transmit() );
     if ( max_retx_exceeded_.has_value()
          and max_retx_exceeded_ != ( ss.sender.consecutive_retransmissions() > TCPConfig::MAX_RETX_ATTEMPTS ) ) {
       std::ostringstream desc;
-      desc << "after " << ms_ << " ms passed the TCP Sender reported\n\tconsecutive_retransmissions = "
+      desc << "after " << duration() << " passed the TCP Sender reported\n\tconsecutive_retransmissions = "
            << ss.sender.consecutive_retransmissions() << "\nbut it should have been\n\t";
       if ( max_retx_exceeded_.value() ) {
         desc << "greater than ";
@@ -211,6 +253,14 @@ struct Tick : public Action<SenderAndOutput>
   }
 
   constexpr std::string obj() const override { return "TCPSender"; }
+
+  std::string duration() const
+  {
+    if ( time_ % std::chrono::milliseconds( 1 ) == std::chrono::microseconds::zero() ) {
+      return to_string( time_.count() / 1000 ) + " ms";
+    }
+    return to_string( time_.count() ) + " us";
+  }
 };
 
 struct Receive : public Action<SenderAndOutput>
@@ -222,7 +272,8 @@ struct Receive : public Action<SenderAndOutput>
   std::string description() const override
   {
     std::ostringstream desc;
-    desc << "receive(ack=" << to_string( msg_.ackno ) << ", win=" << msg_.window_size << ")";
+    desc << "receive(ack=" << to_string( msg_.ackno ) << ", win=" << msg_.window_size
+         << ( msg_.ECE ? ", +ECE" : "" ) << ")";
     if ( push_ ) {
       desc << ", then push";
     }
@@ -235,6 +286,12 @@ struct Receive : public Action<SenderAndOutput>
     return *this;
   }
 
+  Receive& with_ece()
+  {
+    msg_.ECE = true;
+    return *this;
+  }
+
   void execute( SenderAndOutput& ss ) const override
   {
     ss.sender.receive( msg_ );
@@ -280,11 +337,13 @@ struct ExpectMessage : public Expectation<SenderAndOutput>
   std::optional<bool> syn {};
   std::optional<bool> fin {};
   std::optional<bool> rst {};
+  std::optional<bool> cwr {};
   std::optional<Wrap32> seqno {};
   std::optional<std::string> data {};
   std::optional<size_t> payload_size {};
+  bool super_segment {}; // may the payload be longer than one MSS (with segmentation offload)?
 
-  bool empty() const { return not( syn or fin or rst or seqno or data or payload_size ); }
+  bool empty() const { return not( syn or fin or rst or cwr or seqno or data or payload_size ); }
 
   ExpectMessage& with_syn( bool syn_ )
   {
@@ -310,6 +369,12 @@ struct ExpectMessage : public Expectation<SenderAndOutput>
     return *this;
   }
 
+  ExpectMessage& with_cwr( bool cwr_ )
+  {
+    cwr = cwr_;
+    return *this;
+  }
+
   ExpectMessage& with_seqno( Wrap32 seqno_ )
   {
     seqno = seqno_;
@@ -330,6 +395,12 @@ struct ExpectMessage : public Expectation<SenderAndOutput>
     return *this;
   }
 
+  ExpectMessage& allowing_super_segment()
+  {
+    super_segment = true;
+    return *this;
+  }
+
   std::string message_description() const
   {
     std::ostringstream o;
@@ -361,6 +432,9 @@ struct ExpectMessage : public Expectation<SenderAndOutput>
     if ( rst.has_value() ) {
       o << ( rst.value() ? " +RST" : " -RST" );
     }
+    if ( cwr.has_value() ) {
+      o << ( cwr.value() ? " +CWR" : " -CWR" );
+    }
     return o.str();
   }
 
@@ -377,7 +451,7 @@ struct ExpectMessage : public Expectation<SenderAndOutput>
 
     const TCPSenderMessage seg = ss.expect_message();
 
-    if ( seg.payload.size() > TCPConfig::MAX_PAYLOAD_SIZE ) {
+    if ( seg.payload.size() > TCPConfig::MAX_PAYLOAD_SIZE and not super_segment ) {
       throw ExpectationViolation( "sent a message with a " + std::to_string( seg.payload.size() )
                                   + "-byte payload, which is longer than the maximum ("
                                   + std::to_string( TCPConfig::MAX_PAYLOAD_SIZE ) + ")" );
@@ -391,6 +465,9 @@ struct ExpectMessage : public Expectation<SenderAndOutput>
     if ( rst.has_value() and seg.RST != rst.value() ) {
       throw MessageExpectationViolation( seg, "RST flag", rst.value(), seg.RST );
     }
+    if ( cwr.has_value() and seg.CWR != cwr.value() ) {
+      throw MessageExpectationViolation( seg, "CWR flag", cwr.value(), seg.CWR );
+    }
     if ( seqno.has_value() and seg.seqno != seqno.value() ) {
       throw MessageExpectationViolation( seg, "sequence number", seqno.value(), seg.seqno );
     }
@@ -0,0 +1,184 @@
+#include "exception.hh"
+#include "sharded_tcp_stack.hh"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+constexpr size_t MAX_SHARDS = 8;
+constexpr size_t CONNECTIONS_PER_SHARD = 4;
+constexpr uint64_t TOTAL_BYTES = 64 << 20;
+constexpr size_t CHUNK_SIZE = 16384;
+
+const Address client_address { "10.144.0.2", 0 };
+const Address server_address { "10.144.0.1", 80 };
+
+// `n` datagram links: the queues of the client's device, and of the server's
+pair<vector<FileDescriptor>, vector<FileDescriptor>> datagram_links( size_t n )
+{
+  pair<vector<FileDescriptor>, vector<FileDescriptor>> ret;
+  for ( size_t i = 0; i < n; ++i ) {
+    array<int, 2> fds {};
+    CheckSystemCall( "socketpair", ::socketpair( AF_UNIX, SOCK_DGRAM, 0, fds.data() ) );
+    ret.first.emplace_back( fds[0] );
+    ret.second.emplace_back( fds[1] );
+  }
+  return ret;
+}
+
+// Bytes received by one server shard (on its own cache line, so the shards share nothing)
+struct alignas( 64 ) Counter
+{
+  atomic<uint64_t> bytes { 0 };
+};
+
+// Send TOTAL_BYTES, split evenly over the connections of `n_shards` client shards, to a server with as many
+// shards, and return the throughput in Gbit/s. With `device_queues`, client shard i and server shard i share a
+// link of their own (as the queues of a multi-queue device would steer them); otherwise, each side's shards
+// share one link, behind a dispatcher.
+double speed_test( size_t n_shards, bool device_queues )
+{
+  TCPConfig cfg;
+  cfg.rt_timeout = 100;
+  const uint64_t bytes_per_connection = TOTAL_BYTES / ( n_shards * CONNECTIONS_PER_SHARD );
+  const string chunk( CHUNK_SIZE, 'x' );
+
+  auto [client_devices, server_devices] = datagram_links( device_queues ? n_shards : 1 );
+  auto sharded = [&]( vector<FileDescriptor>&& devices, const ShardedTCPStack::SetupFunction& setup ) {
+    if ( device_queues ) {
+      return ShardedTCPStack { move( devices ), cfg, setup };
+    }
+    return ShardedTCPStack { move( devices.front() ), n_shards, cfg, setup };
+  };
+
+  array<Counter, MAX_SHARDS> received;
+  ShardedTCPStack server = sharded( move( server_devices ), [&]( TCPStack& stack, size_t shard ) {
+    auto listener = stack.listen( server_address );
+    auto& counter = received.at( shard ).bytes;
+    stack.eventloop().add_rule(
+      "accept",
+      [listener, &counter] {
+        auto conn = listener->accept();
+        auto drain = [&counter, &conn = *conn] {
+          Reader& reader = conn.inbound_reader();
+          counter += reader.bytes_buffered();
+          reader.pop( reader.bytes_buffered() );
+        };
+        drain();
+        conn->set_receive_callback( drain );
+      },
+      [listener] { return listener->queued() > 0; } );
+  } );
+
+  const auto start_time = steady_clock::now();
+
+  // behind a dispatcher, each client shard opens its connections from local ports that hash to it, so the replies
+  // come back to it (with device queues, they come back on its own link)
+  ShardedTCPStack client = sharded( move( client_devices ), [&]( TCPStack& stack, size_t shard ) {
+    struct Stream
+    {
+      shared_ptr<TCPStack::Connection> conn;
+      uint64_t remaining;
+    };
+    auto streams = make_shared<vector<Stream>>();
+    for ( uint16_t port = 10000; streams->size() < CONNECTIONS_PER_SHARD; ++port ) {
+      const FlowKey flow { .local_address = client_address.ipv4_numeric(),
+                           .remote_address = server_address.ipv4_numeric(),
+                           .local_port = port,
+                           .remote_port = 80 };
+      if ( device_queues or client.shard_of( flow ) == shard ) {
+        streams->push_back(
+          { stack.connect( Address { client_address.ip(), port }, server_address ), bytes_per_connection } );
+      }
+    }
+
+    auto sendable = [streams] {
+      for ( const auto& stream : *streams ) {
+        if ( stream.remaining and stream.conn->outbound_writer().available_capacity() ) {
+          return true;
+        }
+      }
+      return false;
+    };
+    stack.eventloop().add_rule(
+      "send",
+      [&stack, &chunk, streams] {
+        for ( auto& stream : *streams ) {
+          Writer& writer = stream.conn->outbound_writer();
+          const uint64_t len = min( { stream.remaining, writer.available_capacity(), uint64_t { CHUNK_SIZE } } );
+          if ( len ) {
+            writer.push( chunk.substr( 0, len ) );
+            stream.remaining -= len;
+            stack.push( *stream.conn );
+          }
+        }
+      },
+      sendable );
+  } );
+
+  auto total_received = [&] {
+    uint64_t total = 0;
+    for ( const auto& counter : received ) {
+      total += counter.bytes;
+    }
+    return total;
+  };
+  while ( total_received() < bytes_per_connection * n_shards * CONNECTIONS_PER_SHARD ) {
+    if ( steady_clock::now() - start_time > seconds( 60 ) ) {
+      throw runtime_error( "timed out" );
+    }
+    this_thread::sleep_for( milliseconds( 1 ) );
+  }
+  const auto stop_time = steady_clock::now();
+  client.stop();
+  server.stop();
+
+  const auto test_duration = duration_cast<duration<double>>( stop_time - start_time );
+  return 8 * static_cast<double>( total_received() ) / test_duration.count() / 1e9;
+}
+
+void program_body()
+{
+  cout << "Available cores: " << thread::hardware_concurrency() << "\n";
+  cout << "(Behind the dispatcher, every datagram goes through one thread, which bounds the receive path however\n"
+          " many shards there are: expect that speedup to flatten once the thread is saturated, even with a core\n"
+          " per shard. With a device queue per shard, nothing is shared between the shards.)\n";
+  for ( const bool device_queues : { false, true } ) {
+    double baseline = 0;
+    for ( size_t n_shards = 1; n_shards <= MAX_SHARDS; n_shards *= 2 ) {
+      const double gigabits_per_second = speed_test( n_shards, device_queues );
+      if ( n_shards == 1 ) {
+        baseline = gigabits_per_second;
+      }
+      cout << "ShardedTCPStack with " << n_shards << " shard(s) "
+           << ( device_queues ? "on their own device queues" : "behind a dispatcher" ) << " reached " << fixed
+           << setprecision( 2 ) << gigabits_per_second << " Gbit/s (" << gigabits_per_second / baseline << "x).\n";
+    }
+  }
+}
+} // namespace
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,190 @@
+#include "eventloop.hh"
+#include "exception.hh"
+#include "link_adapter.hh"
+#include "random.hh"
+#include "task.hh"
+#include "tcp_minnow_co_socket.hh"
+#include "tcp_minnow_co_socket_impl.hh"
+#include "test_should_be.hh"
+
+#include <array>
+#include <cstddef>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <vector>
+
+using namespace std;
+
+namespace {
+using CoSocket = TCPMinnowCoSocket<LinkAdapter>;
+
+string random_bytes( size_t length )
+{
+  auto rd = get_random_engine();
+  string ret( length, 0 );
+  for ( auto& ch : ret ) {
+    ch = static_cast<char>( rd() );
+  }
+  return ret;
+}
+
+Task<int> answer()
+{
+  co_return 42;
+}
+
+Task<int> twice_the_answer()
+{
+  co_return 2 * co_await answer();
+}
+
+Task<> failure()
+{
+  throw runtime_error( "failure" );
+  co_return;
+}
+
+// Echo everything back, until EOF
+Task<> echo( CoSocket& server, const TCPConfig& tcp_config, const FdAdapterConfig& config )
+{
+  co_await server.listen_and_accept( tcp_config, config );
+  string buffer;
+  while ( true ) {
+    buffer.clear();
+    co_await server.read( buffer );
+    if ( server.eof() ) {
+      break;
+    }
+    co_await server.write_all( buffer );
+  }
+  co_await server.wait_until_closed();
+}
+
+Task<> send_all( CoSocket& client, string_view data )
+{
+  co_await client.write_all( data );
+  client.shutdown( SHUT_WR );
+}
+
+Task<string> receive_all( CoSocket& socket )
+{
+  string ret;
+  string buffer;
+  while ( not socket.eof() ) {
+    buffer.clear();
+    co_await socket.read( buffer );
+    ret += buffer;
+  }
+  co_return ret;
+}
+
+// Send `data` while receiving the echo (in a second coroutine on the same socket), and return the echo
+Task<string> client_session( CoSocket& client,
+                             const TCPConfig& tcp_config,
+                             const FdAdapterConfig& config,
+                             string_view data )
+{
+  co_await client.connect( tcp_config, config );
+  Task<> sender = send_all( client, data );
+  sender.start();
+  string echoed = co_await receive_all( client );
+  if ( not sender.done() ) {
+    throw runtime_error( "echo finished before the data was sent" );
+  }
+  sender.result();
+  co_await client.wait_until_closed();
+  co_return echoed;
+}
+} // namespace
+
+int main()
+{
+  try {
+    // Tasks are lazy, pass on their results and exceptions, and can await each other
+    {
+      Task<int> task = twice_the_answer();
+      test_should_be( task.done(), false );
+      task.start();
+      test_should_be( task.done(), true );
+      test_should_be( task.result(), 84 );
+
+      Task<> failing = failure();
+      failing.start();
+      bool threw = false;
+      try {
+        failing.result();
+      } catch ( const runtime_error& ) {
+        threw = true;
+      }
+      test_should_be( threw, true );
+    }
+
+    // Many connections, all on one thread and one EventLoop: each client sends a different message to its own
+    // echo server, and reads the echo at the same time
+    {
+      constexpr size_t connections = 16;
+      EventLoop eventloop { EventLoop::Backend::Epoll, EventLoop::Dispatch::AllReady };
+
+      TCPConfig tcp_config;
+      tcp_config.rt_timeout = 10;
+      FdAdapterConfig client_config;
+      client_config.source = { "10.144.0.1", "40000" };
+      client_config.destination = { "10.144.0.2", "80" };
+      FdAdapterConfig server_config;
+      server_config.source = { "10.144.0.2", "80" };
+
+      vector<unique_ptr<CoSocket>> sockets;
+      vector<string> messages;
+      vector<Task<>> servers;
+      vector<Task<string>> clients;
+      for ( size_t i = 0; i < connections; i++ ) {
+        array<int, 2> fds {};
+        CheckSystemCall( "socketpair", ::socketpair( AF_UNIX, SOCK_DGRAM, 0, fds.data() ) );
+        sockets.push_back( make_unique<CoSocket>( eventloop, LinkAdapter { FileDescriptor { fds[0] } } ) );
+        CoSocket& client = *sockets.back();
+        sockets.push_back( make_unique<CoSocket>( eventloop, LinkAdapter { FileDescriptor { fds[1] } } ) );
+        CoSocket& server = *sockets.back();
+        messages.push_back( random_bytes( 20'000 + i * 5'000 ) );
+
+        servers.push_back( echo( server, tcp_config, server_config ) );
+        servers.back().start();
+        clients.push_back( client_session( client, tcp_config, client_config, messages.back() ) );
+        clients.back().start();
+      }
+
+      auto all_done = [&] {
+        return ranges::all_of( servers, []( auto& t ) { return t.done(); } )
+               and ranges::all_of( clients, []( auto& t ) { return t.done(); } );
+      };
+      while ( not all_done() ) {
+        if ( eventloop.wait_next_event( -1 ) == EventLoop::Result::Exit ) {
+          throw runtime_error( "EventLoop exited before the connections finished" );
+        }
+      }
+
+      for ( size_t i = 0; i < connections; i++ ) {
+        servers.at( i ).result();
+        const string echoed = clients.at( i ).result();
+        test_should_be( echoed.size(), messages.at( i ).size() );
+        test_should_be( echoed == messages.at( i ), true );
+      }
+      for ( const auto& socket : sockets ) {
+        test_should_be( socket->active(), false );
+      }
+
+      // with the connections finished (and their timers cancelled), nothing is left to wait for
+      test_should_be( eventloop.wait_next_event( 0 ) == EventLoop::Result::Exit, true );
+    }
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
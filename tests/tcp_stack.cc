@@ -0,0 +1,509 @@
+#include "exception.hh"
+#include "flow_table.hh"
+#include "random.hh"
+#include "tcp_stack.hh"
+#include "test_should_be.hh"
+#include "timer_wheel.hh"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <sys/socket.h>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+namespace {
+// Two devices that carry one datagram per read and write, like the two ends of a TUN link
+pair<FileDescriptor, FileDescriptor> datagram_link()
+{
+  array<int, 2> fds {};
+  CheckSystemCall( "socketpair", ::socketpair( AF_UNIX, SOCK_DGRAM, 0, fds.data() ) );
+  return { FileDescriptor { fds[0] }, FileDescriptor { fds[1] } };
+}
+
+// Take all the messages from a queue
+vector<TCPMessage> exchange_all( vector<TCPMessage>& queue )
+{
+  vector<TCPMessage> ret;
+  ret.swap( queue );
+  return ret;
+}
+
+// Run both stacks until `done` is true
+void run_until( TCPStack& a, TCPStack& b, const function<bool()>& done )
+{
+  const auto deadline = chrono::steady_clock::now() + chrono::seconds( 10 );
+  while ( not done() ) {
+    if ( chrono::steady_clock::now() > deadline ) {
+      throw runtime_error( "timed out" );
+    }
+    a.wait_next_event( 0 );
+    b.wait_next_event( 1 );
+  }
+}
+
+// The devices block when full, so let a long series of writes through a few at a time
+void pace( TCPStack& a, TCPStack& b, size_t i )
+{
+  if ( i % 8 == 7 ) {
+    a.wait_next_event( 0 );
+    b.wait_next_event( 0 );
+  }
+}
+
+string read_all( Reader& reader )
+{
+  string ret;
+  while ( reader.bytes_buffered() ) {
+    ret += reader.peek();
+    reader.pop( reader.peek().size() );
+  }
+  return ret;
+}
+
+// Accept connections from `listener`, and echo, from a receive callback on each accepted connection
+void serve_echo( TCPStack& server,
+                 const shared_ptr<TCPStack::Listener>& listener,
+                 vector<shared_ptr<TCPStack::Connection>>& accepted )
+{
+  server.eventloop().add_rule(
+    "accept",
+    [&server, listener, &accepted] {
+      auto& conn = *accepted.emplace_back( listener->accept() );
+      auto echo = [&server, &conn] {
+        conn.outbound_writer().push( read_all( conn.inbound_reader() ) );
+        if ( conn.inbound_reader().is_finished() and not conn.outbound_writer().is_closed() ) {
+          conn.outbound_writer().close();
+        }
+        server.push( conn );
+      };
+      echo(); // data may have arrived before the connection was accepted
+      conn.set_receive_callback( echo );
+    },
+    [listener] { return listener->queued() > 0; } );
+}
+
+// Each client connection sends a message, and collects what comes back
+vector<shared_ptr<TCPStack::Connection>> send_hellos( TCPStack& client, TCPStack& server, vector<string>& echoes )
+{
+  vector<shared_ptr<TCPStack::Connection>> connections;
+  for ( size_t i = 0; i < echoes.size(); ++i ) {
+    const auto port = static_cast<uint16_t>( 10000 + i );
+    auto& conn = connections.emplace_back(
+      client.connect( Address { "10.144.0.2", port }, Address { "10.144.0.1", 80 } ) );
+    conn->set_receive_callback( [&echo = echoes[i], &conn = *conn] { echo += read_all( conn.inbound_reader() ); } );
+    conn->outbound_writer().push( "hello from " + to_string( port ) );
+    client.push( *conn );
+
+    pace( client, server, i );
+  }
+  return connections;
+}
+
+bool all_echoed( const vector<string>& echoes )
+{
+  for ( size_t i = 0; i < echoes.size(); ++i ) {
+    if ( echoes[i] != "hello from " + to_string( 10000 + i ) ) {
+      return false;
+    }
+  }
+  return true;
+}
+} // namespace
+
+int main()
+{
+  try {
+    auto rd = get_random_engine();
+
+    // The flow table agrees with std::unordered_map through random inserts and erases
+    {
+      FlowTable<uint32_t> table;
+      unordered_map<uint64_t, uint32_t> reference;
+      auto make_key = [&] {
+        return FlowKey { .local_address = 0x0a000001,
+                         .remote_address = 0x0a000100 + static_cast<uint32_t>( rd() % 4 ),
+                         .local_port = 80,
+                         .remote_port = static_cast<uint16_t>( rd() % 1000 ) };
+      };
+      auto id = []( const FlowKey& key ) { return uint64_t { key.remote_address } << 16 | key.remote_port; };
+
+      for ( size_t i = 0; i < 20000; ++i ) {
+        const FlowKey key = make_key();
+        const bool present = reference.contains( id( key ) );
+        test_should_be( table.find( key ) != nullptr, present );
+        if ( present ) {
+          test_should_be( *table.find( key ), reference.at( id( key ) ) );
+          if ( rd() % 2 ) {
+            test_should_be( table.erase( key ), true );
+            reference.erase( id( key ) );
+          }
+        } else {
+          const auto value = static_cast<uint32_t>( rd() );
+          test_should_be( table.insert( key, value ), value );
+          reference[id( key )] = value;
+        }
+        test_should_be( table.size(), reference.size() );
+      }
+
+      table.erase_if( []( const FlowKey& key, uint32_t ) { return key.remote_port % 2 == 0; } );
+      size_t count = 0;
+      table.for_each( [&]( const FlowKey& key, uint32_t value ) {
+        test_should_be( key.remote_port % 2, 1 );
+        test_should_be( value, reference.at( id( key ) ) );
+        ++count;
+      } );
+      test_should_be( count, table.size() );
+    }
+
+    // The hierarchical wheel fires each timer that is not cancelled once, in the first advance past its expiry,
+    // from the next tick to beyond the wheel's span (and whether the advances are small steps or long jumps)
+    {
+      using Wheel = HierarchicalTimerWheel<size_t>;
+      Wheel wheel;
+      vector<uint64_t> expiries;
+      vector<Wheel::Handle> handles;
+      vector<bool> cancelled;
+      vector<bool> fired;
+      uint64_t now = 0;
+      size_t pending = 0;
+      auto random_delay = [&]() -> uint64_t {
+        switch ( rd() % 4 ) {
+          case 0:
+            return 1 + rd() % 64;
+          case 1:
+            return 1 + rd() % 5000;
+          case 2:
+            return 1 + rd() % 1'000'000;
+          default:
+            return 1 + rd() % ( 4 * ( uint64_t { 1 } << ( Wheel::LEVEL_BITS * Wheel::LEVELS ) ) );
+        }
+      };
+      for ( size_t i = 0; i < 5000; ++i ) {
+        expiries.push_back( now + random_delay() );
+        handles.push_back( wheel.schedule( expiries.back(), i ) );
+        cancelled.push_back( false );
+        fired.push_back( false );
+        ++pending;
+
+        const size_t victim = rd() % expiries.size();
+        if ( rd() % 4 == 0 and wheel.pending( handles[victim] ) ) {
+          if ( rd() % 2 ) {
+            test_should_be( wheel.cancel( handles[victim] ), true );
+            test_should_be( wheel.pending( handles[victim] ), false );
+            cancelled[victim] = true;
+            --pending;
+          } else {
+            expiries[victim] = now + random_delay();
+            wheel.reschedule( handles[victim], expiries[victim], victim );
+          }
+        }
+
+        if ( i % 10 == 9 ) {
+          const uint64_t before = now;
+          now += rd() % 8 == 0 ? rd() % 10'000'000 : rd() % 100;
+          wheel.advance( now, [&]( size_t id ) {
+            test_should_be( bool { fired[id] }, false );
+            test_should_be( bool { cancelled[id] }, false );
+            test_should_be( expiries[id] <= now, true );
+            test_should_be( before < expiries[id], true );
+            fired[id] = true;
+            --pending;
+          } );
+          test_should_be( wheel.size(), pending );
+
+          // the next expiry is no later than any pending timer's
+          uint64_t earliest = UINT64_MAX;
+          for ( size_t id = 0; id < expiries.size(); ++id ) {
+            if ( wheel.pending( handles[id] ) ) {
+              earliest = min( earliest, expiries[id] );
+            }
+          }
+          test_should_be( wheel.next_expiry().value_or( UINT64_MAX ) <= earliest, true );
+        }
+      }
+
+      wheel.advance( UINT64_MAX / 2, [&]( size_t id ) { fired[id] = true; } );
+      test_should_be( wheel.size(), size_t { 0 } );
+      test_should_be( wheel.cancel( handles.front() ), false ); // (a stale handle, whose node may be reused)
+      for ( size_t i = 0; i < fired.size(); ++i ) {
+        test_should_be( fired[i] != cancelled[i], true );
+      }
+    }
+
+    // Advancing a wheel to each next expiry in turn reaches a timer (through its cascades) in a few steps
+    {
+      HierarchicalTimerWheel<int> wheel { 10 };
+      test_should_be( wheel.next_expiry().has_value(), false );
+      wheel.schedule( 123'456, 1 );
+      size_t steps = 0;
+      bool fired = false;
+      while ( const auto next = wheel.next_expiry() ) {
+        test_should_be( *next <= 123'460, true );
+        wheel.advance( *next, [&]( int ) { fired = true; } );
+        test_should_be( fired, *next >= 123'460 ); // (the end of the tick it is in)
+        ++steps;
+      }
+      test_should_be( fired, true );
+      test_should_be( steps <= HierarchicalTimerWheel<int>::LEVELS, true );
+    }
+
+    // A TCPPeer's next deadline is its retransmission timer, and then the end of its lingering
+    {
+      TCPConfig cfg;
+      cfg.rt_timeout = 100;
+      TCPPeer client { cfg };
+      TCPPeer server { cfg };
+      vector<TCPMessage> to_client;
+      vector<TCPMessage> to_server;
+      auto sink = []( vector<TCPMessage>& queue ) {
+        return [&queue]( const TCPMessage& msg ) { queue.push_back( msg ); }; // (the copy owns the payload)
+      };
+      auto exchange = [&] {
+        while ( not to_client.empty() or not to_server.empty() ) {
+          for ( auto& msg : exchange_all( to_server ) ) {
+            server.receive( move( msg ), sink( to_client ) );
+          }
+          for ( auto& msg : exchange_all( to_client ) ) {
+            client.receive( move( msg ), sink( to_server ) );
+          }
+        }
+      };
+
+      test_should_be( client.next_deadline().has_value(), false );
+      client.push( sink( to_server ) );
+      test_should_be( client.next_deadline().value(), uint64_t { 100 } );
+      client.tick( 40, sink( to_server ) );
+      test_should_be( client.next_deadline().value(), uint64_t { 60 } );
+      exchange();
+      test_should_be( client.next_deadline().has_value(), false );
+      test_should_be( server.next_deadline().has_value(), false );
+
+      // the client closes first, so it lingers once the server's FIN arrives
+      client.outbound_writer().close();
+      client.push( sink( to_server ) );
+      test_should_be( client.next_deadline().value(), uint64_t { 100 } );
+      exchange();
+      server.outbound_writer().close();
+      server.push( sink( to_client ) );
+      exchange();
+      test_should_be( client.lingering(), true );
+      test_should_be( client.next_deadline().value(), TCPPeer::linger_time( cfg ) );
+      test_should_be( server.active(), false );
+      test_should_be( server.next_deadline().has_value(), false );
+      client.tick( 400, sink( to_server ) );
+      test_should_be( client.next_deadline().value(), TCPPeer::linger_time( cfg ) - 400 );
+      client.tick( TCPPeer::linger_time( cfg ) - 400, sink( to_server ) );
+      test_should_be( client.active(), false );
+      test_should_be( client.next_deadline().has_value(), false );
+    }
+
+    // Many connections over one device: each client sends a message, which the server echoes back
+    {
+      constexpr size_t N_CONNECTIONS = 100;
+      TCPConfig cfg;
+      cfg.rt_timeout = 10;
+
+      auto [client_device, server_device] = datagram_link();
+      TCPStack client { move( client_device ), cfg };
+      TCPStack server { move( server_device ), cfg };
+
+      const auto listener = server.listen( Address { "10.144.0.1", 80 } );
+      vector<shared_ptr<TCPStack::Connection>> accepted;
+      serve_echo( server, listener, accepted );
+
+      vector<string> echoes( N_CONNECTIONS );
+      const auto connections = send_hellos( client, server, echoes );
+      run_until( client, server, [&] { return all_echoed( echoes ); } );
+      test_should_be( client.connection_count(), N_CONNECTIONS );
+      test_should_be( server.connection_count(), N_CONNECTIONS );
+      test_should_be( server.stats().datagrams_unmatched, uint64_t { 0 } );
+
+      for ( size_t i = 0; i < N_CONNECTIONS; ++i ) {
+        connections[i]->outbound_writer().close();
+        client.push( *connections[i] );
+        pace( client, server, i );
+      }
+      run_until( client, server, [&] {
+        for ( const auto& conn : connections ) {
+          if ( not conn->inbound_reader().is_finished() ) {
+            return false;
+          }
+        }
+        return true;
+      } );
+
+      // finished connections are dropped from both stacks (the client's, which linger, leave tombstones)
+      run_until( client, server, [&] { return client.connection_count() == 0 and server.connection_count() == 0; } );
+      test_should_be( client.stats().connections_closed, N_CONNECTIONS );
+      test_should_be( server.stats().connections_closed, N_CONNECTIONS );
+      test_should_be( server.tombstone_count(), size_t { 0 } );
+      run_until( client, server, [&] { return client.tombstone_count() == 0; } );
+    }
+
+    // The stack wakes for its next timer, so a sub-millisecond RTO retransmits a SYN that goes unanswered
+    // within a wait for other events (and no fixed tick holds it back)
+    {
+      TCPConfig cfg;
+      cfg.rt_timeout_us = chrono::microseconds { 300 };
+
+      auto [client_device, silent_device] = datagram_link();
+      silent_device.set_blocking( false );
+      TCPStack client { move( client_device ), cfg };
+      const auto connection = client.connect( Address { "10.144.0.2", 10000 }, Address { "10.144.0.1", 80 } );
+
+      const auto start = chrono::steady_clock::now();
+      client.wait_next_event( 1000 );
+      test_should_be( chrono::steady_clock::now() - start < chrono::milliseconds { 500 }, true );
+      size_t syns = 0;
+      while ( true ) {
+        string datagram;
+        silent_device.read( datagram );
+        if ( silent_device.would_block() ) {
+          break;
+        }
+        ++syns;
+      }
+      test_should_be( syns >= 2, true );
+    }
+
+    // A connection that finishes while lingering leaves a tombstone, which acknowledges a retransmitted FIN
+    {
+      TCPConfig cfg;
+      cfg.rt_timeout = 10;
+
+      auto [client_device, server_device] = datagram_link();
+      FileDescriptor injector = server_device.duplicate();
+      TCPStack client { move( client_device ), cfg };
+      TCPStack server { move( server_device ), cfg };
+      const auto listener = server.listen( Address { "10.144.0.1", 80 } );
+      vector<shared_ptr<TCPStack::Connection>> accepted;
+      serve_echo( server, listener, accepted );
+
+      vector<string> echoes( 1 );
+      const auto connections = send_hellos( client, server, echoes );
+      TCPStack::Connection& conn = *connections.front();
+      run_until( client, server, [&] { return all_echoed( echoes ); } );
+
+      // the client closes first, so it lingers after the server's FIN, and is retired at once
+      conn.outbound_writer().close();
+      client.push( conn );
+      run_until( client, server, [&] { return client.tombstone_count() == 1; } );
+      test_should_be( client.connection_count(), size_t { 0 } );
+      test_should_be( conn.active(), false );
+      test_should_be( conn.inbound_reader().is_finished(), true );
+
+      // the server's FIN again, as if the client's ACK of it was lost
+      TCPOverIPv4Adapter server_adapter;
+      server_adapter.config_mut().source = Address { "10.144.0.1", 80 };
+      server_adapter.config_mut().destination = Address { "10.144.0.2", 10000 };
+      const Wrap32 client_ackno = conn.peer().receiver().send().ackno.value();
+      const TCPMessage fin { .sender = TCPSenderMessage { .seqno = client_ackno + UINT32_MAX, .FIN = true }, // - 1
+                             .receiver = TCPReceiverMessage { .ackno = conn.peer().sender().make_empty_message().seqno,
+                                                              .window_size = 1000 } };
+      server_adapter.write_tcp_in_ip( injector, fin );
+      run_until( client, server, [&] { return client.stats().tombstone_acks == 1; } );
+
+      // ... until the tombstone expires
+      run_until( client, server, [&] { return client.tombstone_count() == 0; } );
+    }
+
+    // A full backlog drops SYNs until the application accepts
+    {
+      constexpr size_t N_CONNECTIONS = 10;
+      constexpr size_t BACKLOG = 4;
+      TCPConfig cfg;
+      cfg.rt_timeout = 10;
+
+      auto [client_device, server_device] = datagram_link();
+      TCPStack client { move( client_device ), cfg };
+      TCPStack server { move( server_device ), cfg };
+      const auto listener = server.listen( Address { "10.144.0.1", 80 }, BACKLOG );
+
+      vector<shared_ptr<TCPStack::Connection>> connections;
+      for ( size_t i = 0; i < N_CONNECTIONS; ++i ) {
+        connections.push_back( client.connect( Address { "10.144.0.2", static_cast<uint16_t>( 10000 + i ) },
+                                               Address { "10.144.0.1", 80 } ) );
+      }
+
+      run_until( client, server, [&] { return listener->queued() == BACKLOG; } );
+      test_should_be( listener->stats().syns_dropped > 0, true );
+      test_should_be( listener->stats().connections_queued, uint64_t { BACKLOG } );
+
+      vector<shared_ptr<TCPStack::Connection>> accepted;
+      run_until( client, server, [&] {
+        while ( auto conn = listener->accept() ) {
+          test_should_be( conn->established(), true );
+          accepted.push_back( move( conn ) );
+        }
+        return accepted.size() == N_CONNECTIONS;
+      } );
+      test_should_be( listener->stats().max_queued, uint64_t { BACKLOG } );
+      test_should_be( listener->half_open(), size_t { 0 } );
+      for ( const auto& conn : connections ) {
+        test_should_be( conn->active(), true );
+      }
+    }
+
+    // Over its SYN-cookie threshold, a listener keeps no state for a SYN, and opens the connection from the ACK
+    {
+      constexpr size_t N_CONNECTIONS = 20;
+      TCPConfig cfg;
+      cfg.rt_timeout = 10;
+
+      auto [client_device, server_device] = datagram_link();
+      TCPStack client { move( client_device ), cfg };
+      TCPStack server { move( server_device ), cfg };
+      const auto listener = server.listen( Address { "10.144.0.1", 80 }, TCPStack::DEFAULT_BACKLOG, 0 );
+      vector<shared_ptr<TCPStack::Connection>> accepted;
+      serve_echo( server, listener, accepted );
+
+      vector<string> echoes( N_CONNECTIONS );
+      const auto connections = send_hellos( client, server, echoes );
+      run_until( client, server, [&] {
+        test_should_be( listener->half_open(), size_t { 0 } );
+        return all_echoed( echoes );
+      } );
+      test_should_be( listener->stats().syns_received, uint64_t { 0 } );
+      test_should_be( listener->stats().syn_cookies_sent >= N_CONNECTIONS, true );
+      test_should_be( listener->stats().syn_cookies_accepted, uint64_t { N_CONNECTIONS } );
+      test_should_be( listener->stats().syn_cookies_rejected, uint64_t { 0 } );
+      test_should_be( accepted.size(), N_CONNECTIONS );
+    }
+
+    // An ACK without a valid SYN cookie opens nothing
+    {
+      auto [raw_device, server_device] = datagram_link();
+      TCPStack server { move( server_device ) };
+      const auto listener = server.listen( Address { "10.144.0.1", 80 }, TCPStack::DEFAULT_BACKLOG, 0 );
+
+      TCPOverIPv4Adapter forger;
+      forger.config_mut().source = Address { "10.144.0.2", 10000 };
+      forger.config_mut().destination = Address { "10.144.0.1", 80 };
+      const TCPMessage ack { .sender = TCPSenderMessage { .seqno = Wrap32 { static_cast<uint32_t>( rd() ) } },
+                             .receiver = TCPReceiverMessage { .ackno = Wrap32 { static_cast<uint32_t>( rd() ) },
+                                                              .window_size = 1000 } };
+      forger.write_tcp_in_ip( raw_device, ack );
+
+      while ( server.stats().datagrams_received == 0 ) {
+        server.wait_next_event( 1 );
+      }
+      test_should_be( listener->stats().syn_cookies_rejected, uint64_t { 1 } );
+      test_should_be( listener->queued(), size_t { 0 } );
+      test_should_be( server.connection_count(), size_t { 0 } );
+    }
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return 1;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,249 @@
+#include "exception.hh"
+#include "sharded_tcp_stack.hh"
+#include "spsc_queue.hh"
+#include "tcp_stack.hh"
+#include "test_should_be.hh"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace {
+// Two devices that carry one datagram per read and write, like the two ends of a TUN link
+pair<FileDescriptor, FileDescriptor> datagram_link()
+{
+  array<int, 2> fds {};
+  CheckSystemCall( "socketpair", ::socketpair( AF_UNIX, SOCK_DGRAM, 0, fds.data() ) );
+  return { FileDescriptor { fds[0] }, FileDescriptor { fds[1] } };
+}
+
+string read_all( Reader& reader )
+{
+  string ret;
+  while ( reader.bytes_buffered() ) {
+    ret += reader.peek();
+    reader.pop( reader.peek().size() );
+  }
+  return ret;
+}
+} // namespace
+
+int main()
+{
+  try {
+    // The queue is FIFO and bounded
+    {
+      SPSCQueue<string> queue { 3 };
+      test_should_be( queue.capacity(), size_t { 4 } );
+      for ( size_t i = 0; i < queue.capacity(); ++i ) {
+        test_should_be( queue.push( to_string( i ) ), true );
+      }
+      string extra = "extra";
+      test_should_be( queue.push( move( extra ) ), false );
+      test_should_be( extra == "extra", true );
+
+      string out;
+      for ( size_t i = 0; i < queue.capacity(); ++i ) {
+        test_should_be( queue.pop( out ), true );
+        test_should_be( out == to_string( i ), true );
+      }
+      test_should_be( queue.pop( out ), false );
+    }
+
+    // ... including across threads
+    {
+      constexpr uint64_t N_VALUES = 1'000'000;
+      SPSCQueue<uint64_t> queue { 64 };
+      thread producer { [&] {
+        for ( uint64_t i = 0; i < N_VALUES; ++i ) {
+          uint64_t value = i;
+          while ( not queue.push( move( value ) ) ) {
+            this_thread::yield();
+          }
+        }
+      } };
+
+      uint64_t expected = 0;
+      while ( expected < N_VALUES ) {
+        uint64_t value = 0;
+        if ( queue.pop( value ) ) {
+          test_should_be( value, expected );
+          ++expected;
+        } else {
+          this_thread::yield();
+        }
+      }
+      producer.join();
+    }
+
+    // A sharded server echoes for many connections, each handled by the shard its flow hashes to
+    {
+      constexpr size_t N_CONNECTIONS = 64;
+      constexpr size_t N_SHARDS = 4;
+      TCPConfig cfg;
+      cfg.rt_timeout = 10;
+
+      auto [client_device, server_device] = datagram_link();
+      TCPStack client { move( client_device ), cfg };
+
+      // each shard's state is touched only by that shard's thread, until the server stops
+      struct ShardState
+      {
+        shared_ptr<TCPStack::Listener> listener {};
+        vector<shared_ptr<TCPStack::Connection>> accepted {};
+      };
+      array<ShardState, N_SHARDS> states;
+
+      ShardedTCPStack server {
+        move( server_device ), N_SHARDS, cfg, [&]( TCPStack& stack, size_t shard ) {
+          auto& state = states.at( shard );
+          state.listener = stack.listen( Address { "10.144.0.1", 80 } );
+          stack.eventloop().add_rule(
+            "accept",
+            [&stack, &state] {
+              auto& conn = *state.accepted.emplace_back( state.listener->accept() );
+              auto echo = [&stack, &conn] {
+                conn.outbound_writer().push( read_all( conn.inbound_reader() ) );
+                stack.push( conn );
+              };
+              echo();
+              conn.set_receive_callback( echo );
+            },
+            [&state] { return state.listener->queued() > 0; } );
+        } };
+      test_should_be( server.shard_count(), N_SHARDS );
+
+      vector<shared_ptr<TCPStack::Connection>> connections;
+      vector<string> echoes( N_CONNECTIONS );
+      for ( size_t i = 0; i < N_CONNECTIONS; ++i ) {
+        const auto port = static_cast<uint16_t>( 10000 + i );
+        auto& conn = connections.emplace_back(
+          client.connect( Address { "10.144.0.2", port }, Address { "10.144.0.1", 80 } ) );
+        conn->set_receive_callback( [&echo = echoes[i], &conn = *conn] { echo += read_all( conn.inbound_reader() ); } );
+        conn->outbound_writer().push( "hello from " + to_string( port ) );
+        client.push( *conn );
+        client.wait_next_event( 0 );
+      }
+
+      const auto deadline = chrono::steady_clock::now() + chrono::seconds( 10 );
+      auto all_echoed = [&] {
+        for ( size_t i = 0; i < N_CONNECTIONS; ++i ) {
+          if ( echoes[i] != "hello from " + to_string( 10000 + i ) ) {
+            return false;
+          }
+        }
+        return true;
+      };
+      while ( not all_echoed() ) {
+        if ( chrono::steady_clock::now() > deadline ) {
+          throw runtime_error( "timed out" );
+        }
+        client.wait_next_event( 1 );
+      }
+      server.stop();
+
+      size_t total = 0;
+      size_t shards_used = 0;
+      for ( size_t shard = 0; shard < N_SHARDS; ++shard ) {
+        for ( const auto& conn : states.at( shard ).accepted ) {
+          test_should_be( server.shard_of( conn->flow() ), shard );
+        }
+        total += states.at( shard ).accepted.size();
+        shards_used += states.at( shard ).accepted.empty() ? 0 : 1;
+        test_should_be( server.datagrams_dropped( shard ), uint64_t { 0 } );
+      }
+      test_should_be( total, N_CONNECTIONS );
+      test_should_be( shards_used > 1, true );
+    }
+
+    // With a device queue per shard, each shard serves the flows its own queue carries (here, those of the client
+    // on the other end of its link), and there is no dispatcher
+    {
+      constexpr size_t N_SHARDS = 4;
+      constexpr size_t CONNECTIONS_PER_LINK = 4;
+      TCPConfig cfg;
+      cfg.rt_timeout = 10;
+
+      vector<unique_ptr<TCPStack>> clients;
+      vector<FileDescriptor> queues;
+      for ( size_t i = 0; i < N_SHARDS; ++i ) {
+        auto [client_device, server_queue] = datagram_link();
+        clients.push_back( make_unique<TCPStack>( move( client_device ), cfg ) );
+        queues.push_back( move( server_queue ) );
+      }
+
+      array<vector<shared_ptr<TCPStack::Connection>>, N_SHARDS> accepted;
+      ShardedTCPStack server { move( queues ), cfg, [&]( TCPStack& stack, size_t shard ) {
+                                auto listener = stack.listen( Address { "10.144.0.1", 80 } );
+                                stack.eventloop().add_rule(
+                                  "accept",
+                                  [&stack, &accepted = accepted.at( shard ), listener] {
+                                    auto& conn = *accepted.emplace_back( listener->accept() );
+                                    auto echo = [&stack, &conn] {
+                                      conn.outbound_writer().push( read_all( conn.inbound_reader() ) );
+                                      stack.push( conn );
+                                    };
+                                    echo();
+                                    conn.set_receive_callback( echo );
+                                  },
+                                  [listener] { return listener->queued() > 0; } );
+                              } };
+      test_should_be( server.shard_count(), N_SHARDS );
+
+      // the client on link i connects from ports 10000 + 100 * i and up
+      vector<shared_ptr<TCPStack::Connection>> connections;
+      vector<string> echoes( N_SHARDS * CONNECTIONS_PER_LINK );
+      for ( size_t i = 0; i < echoes.size(); ++i ) {
+        const auto port = static_cast<uint16_t>( 10000 + 100 * ( i / CONNECTIONS_PER_LINK ) + i );
+        TCPStack& client = *clients.at( i / CONNECTIONS_PER_LINK );
+        auto& conn = connections.emplace_back(
+          client.connect( Address { "10.144.0.2", port }, Address { "10.144.0.1", 80 } ) );
+        conn->set_receive_callback( [&echo = echoes[i], &conn = *conn] { echo += read_all( conn.inbound_reader() ); } );
+        conn->outbound_writer().push( "hello from " + to_string( port ) );
+        client.push( *conn );
+      }
+
+      const auto deadline = chrono::steady_clock::now() + chrono::seconds( 10 );
+      auto all_echoed = [&] {
+        for ( size_t i = 0; i < echoes.size(); ++i ) {
+          if ( echoes[i] != "hello from " + to_string( 10000 + 100 * ( i / CONNECTIONS_PER_LINK ) + i ) ) {
+            return false;
+          }
+        }
+        return true;
+      };
+      while ( not all_echoed() ) {
+        if ( chrono::steady_clock::now() > deadline ) {
+          throw runtime_error( "timed out" );
+        }
+        for ( auto& client : clients ) {
+          client->wait_next_event( 0 );
+        }
+        this_thread::sleep_for( chrono::microseconds( 100 ) );
+      }
+      server.stop();
+
+      for ( size_t shard = 0; shard < N_SHARDS; ++shard ) {
+        test_should_be( accepted.at( shard ).size(), CONNECTIONS_PER_LINK );
+        for ( const auto& conn : accepted.at( shard ) ) {
+          test_should_be( size_t { ( conn->flow().remote_port - 10000U ) / 100 }, shard );
+        }
+      }
+    }
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return 1;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+
+//! \brief Monotonic time, in microseconds, for the TCP timers
+//! \details Read from CLOCK_MONOTONIC, which the vDSO serves without a system call (in tens of nanoseconds).
+//! CLOCK_MONOTONIC_COARSE is cheaper still, but it only moves once per scheduler tick (every 1-4 ms), which is
+//! no finer than the millisecond timers this replaces.
+inline std::chrono::microseconds monotonic_time()
+{
+  timespec ts {};
+  ::clock_gettime( CLOCK_MONOTONIC, &ts );
+  return std::chrono::seconds { ts.tv_sec } + std::chrono::duration_cast<std::chrono::microseconds>(
+           std::chrono::nanoseconds { ts.tv_nsec } );
+}
+
+//! Monotonic time, in whole milliseconds
+inline uint64_t timestamp_ms()
+{
+  return std::chrono::duration_cast<std::chrono::milliseconds>( monotonic_time() ).count();
+}
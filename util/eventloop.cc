@@ -1,9 +1,13 @@
 #include "eventloop.hh"
 #include "exception.hh"
 
+#include <algorithm>
+#include <array>
 #include <cstring>
 #include <iostream>
 #include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <thread>
 
 using namespace std;
 
@@ -12,6 +16,22 @@ unsigned int EventLoop::FDRule::service_count() const
   return direction == Direction::In ? fd.read_count() : fd.write_count();
 }
 
+EventLoop::EventLoop( Backend backend, Dispatch dispatch, size_t rule_budget )
+  : _backend( backend ), _dispatch( dispatch ), _rule_budget( max( rule_budget, size_t { 1 } ) )
+{
+  _rule_categories.reserve( 64 );
+  if ( _backend == Backend::IoUring ) {
+    if ( IoUring::available() ) {
+      _uring = make_unique<IoUring>( URING_ENTRIES );
+    } else {
+      _backend = Backend::Epoll;
+    }
+  }
+  if ( _backend == Backend::Epoll ) {
+    _epoll_fd.emplace( CheckSystemCall( "epoll_create1", ::epoll_create1( EPOLL_CLOEXEC ) ) );
+  }
+}
+
 size_t EventLoop::add_category( const string& name )
 {
   if ( _rule_categories.size() >= _rule_categories.capacity() ) {
@@ -22,10 +42,31 @@ size_t EventLoop::add_category( const string& name )
   return _rule_categories.size() - 1;
 }
 
+size_t EventLoop::category( const string& name )
+{
+  const auto it = ranges::find( _rule_categories, name, &RuleCategory::name );
+  if ( it != _rule_categories.end() ) {
+    return static_cast<size_t>( it - _rule_categories.begin() );
+  }
+  return add_category( name );
+}
+
 EventLoop::BasicRule::BasicRule( size_t s_category_id, InterestT s_interest, CallbackT s_callback )
   : category_id( s_category_id ), interest( move( s_interest ) ), callback( move( s_callback ) )
 {}
 
+bool EventLoop::BasicRule::wants()
+{
+  if ( notifier ) {
+    if ( *notifier == notifier_seen ) {
+      return last_interest;
+    }
+    notifier_seen = *notifier;
+  }
+  last_interest = interest();
+  return last_interest;
+}
+
 EventLoop::FDRule::FDRule( BasicRule&& base,
                            FileDescriptor&& s_fd,
                            Direction s_direction,
@@ -38,6 +79,13 @@ EventLoop::FDRule::FDRule( BasicRule&& base,
   , error( move( s_error ) )
 {}
 
+EventLoop::TimerRule::TimerRule( BasicRule&& base,
+                                 chrono::steady_clock::time_point s_deadline,
+                                 chrono::steady_clock::duration s_period,
+                                 uint64_t s_sequence )
+  : BasicRule( move( base ) ), deadline( s_deadline ), period( s_period ), sequence( s_sequence )
+{}
+
 EventLoop::RuleHandle EventLoop::add_rule( size_t category_id,
                                            FileDescriptor& fd,
                                            Direction direction,
@@ -69,6 +117,375 @@ EventLoop::RuleHandle EventLoop::add_rule( const size_t category_id,
   return RuleHandle { _non_fd_rules.back() };
 }
 
+EventLoop::RuleHandle EventLoop::add_timer( const size_t category_id,
+                                            const uint64_t delay_ms,
+                                            const CallbackT& callback,
+                                            const uint64_t period_ms )
+{
+  return add_timer( category_id, chrono::milliseconds( delay_ms ), callback, chrono::milliseconds( period_ms ) );
+}
+
+EventLoop::RuleHandle EventLoop::add_timer( const size_t category_id,
+                                            const chrono::steady_clock::duration delay,
+                                            const CallbackT& callback,
+                                            const chrono::steady_clock::duration period )
+{
+  if ( category_id >= _rule_categories.size() ) {
+    throw out_of_range( "bad category_id" );
+  }
+
+  // the first timer creates the timerfd, and the rule that fires the timers when it is readable
+  if ( not _timer_fd.has_value() ) {
+    _timer_fd.emplace(
+      CheckSystemCall( "timerfd_create", ::timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC ) ) );
+    add_rule(
+      add_category( "timers" ),
+      *_timer_fd,
+      Direction::In,
+      [this] { fire_timers(); },
+      [this] { return timers_pending(); } );
+  }
+
+  const auto now = chrono::steady_clock::now();
+  _timers.push_back( make_shared<TimerRule>( BasicRule { category_id, [] { return true; }, callback },
+                                             now + delay,
+                                             period,
+                                             _timer_sequence++ ) );
+  auto timer = _timers.back();
+  ranges::push_heap( _timers, later_timer );
+  arm_timer_fd();
+
+  return RuleHandle { timer };
+}
+
+bool EventLoop::later_timer( const shared_ptr<TimerRule>& a, const shared_ptr<TimerRule>& b )
+{
+  return a->deadline != b->deadline ? a->deadline > b->deadline : a->sequence > b->sequence;
+}
+
+bool EventLoop::timers_pending()
+{
+  while ( not _timers.empty() and _timers.front()->cancel_requested ) {
+    ranges::pop_heap( _timers, later_timer );
+    _timers.pop_back();
+  }
+  return not _timers.empty();
+}
+
+void EventLoop::fire_timers()
+{
+  string expirations( sizeof( uint64_t ), 0 );
+  _timer_fd->read( expirations );
+  _timer_fd_deadline = {};
+
+  const auto now = chrono::steady_clock::now();
+  while ( not _timers.empty() and _timers.front()->deadline <= now ) {
+    ranges::pop_heap( _timers, later_timer );
+    auto timer = move( _timers.back() );
+    _timers.pop_back();
+    if ( timer->cancel_requested ) {
+      continue;
+    }
+
+    // a periodic timer goes back in the heap first, so its callback can cancel it
+    if ( timer->period > chrono::steady_clock::duration::zero() ) {
+      timer->deadline += ( ( now - timer->deadline ) / timer->period + 1 ) * timer->period;
+      _timers.push_back( timer );
+      ranges::push_heap( _timers, later_timer );
+    }
+    timer->callback();
+  }
+
+  arm_timer_fd();
+}
+
+void EventLoop::arm_timer_fd()
+{
+  const auto deadline = timers_pending() ? _timers.front()->deadline : chrono::steady_clock::time_point {};
+  if ( deadline == _timer_fd_deadline ) {
+    return;
+  }
+
+  // an all-zero it_value disarms the timer (and the steady clock is CLOCK_MONOTONIC, which never reads zero)
+  const auto since_epoch = chrono::duration_cast<chrono::nanoseconds>( deadline.time_since_epoch() );
+  itimerspec spec {};
+  spec.it_value.tv_sec = static_cast<time_t>( since_epoch.count() / 1'000'000'000 );
+  spec.it_value.tv_nsec = static_cast<long>( since_epoch.count() % 1'000'000'000 );
+  CheckSystemCall( "timerfd_settime", ::timerfd_settime( _timer_fd->fd_num(), TFD_TIMER_ABSTIME, &spec, nullptr ) );
+  _timer_fd_deadline = deadline;
+}
+
+void EventLoop::register_rule( FDRule& rule )
+{
+  const int fd_num = rule.fd.fd_num();
+  auto [registration, inserted] = _registrations.try_emplace( fd_num );
+  registration->second.fd_num = fd_num;
+  if ( inserted and _uring ) {
+    const auto read_ahead = ranges::find_if( _read_aheads, [&]( const optional<ReadAhead>& entry ) {
+      return entry.has_value() and not entry->released and not entry->fd.closed() and entry->fd.fd_num() == fd_num;
+    } );
+    if ( read_ahead != _read_aheads.end() ) {
+      registration->second.read_ahead = static_cast<int>( read_ahead - _read_aheads.begin() );
+    }
+  }
+  if ( inserted and _epoll_fd.has_value() ) {
+    epoll_event event { .events = 0, .data = { .fd = fd_num } }; // (errors and hangups are always reported)
+    if ( ::epoll_ctl( _epoll_fd->fd_num(), EPOLL_CTL_ADD, fd_num, &event ) < 0 ) {
+      // an fd that does not support polling (e.g. a regular file) never blocks, and poll(2) says it is ready
+      if ( errno != EPERM ) {
+        throw unix_error { "epoll_ctl" };
+      }
+      registration->second.always_ready = true;
+    }
+  }
+  registration->second.rules.push_back( &rule );
+  rule.registration = &registration->second;
+}
+
+void EventLoop::unregister_rule( FDRule& rule )
+{
+  if ( not rule.registration ) {
+    return;
+  }
+  auto& rules = rule.registration->rules;
+  rule.registration = nullptr;
+
+  erase( rules, &rule );
+  if ( rules.empty() ) {
+    const int fd_num = rule.fd.fd_num();
+    const auto registration = _registrations.extract( fd_num );
+    if ( registration.mapped().read_ahead >= 0 ) {
+      release_read_ahead( registration.mapped().read_ahead );
+    }
+    if ( _uring and registration.mapped().armed ) {
+      // the poll request holds the file open, so it is cancelled now rather than with the next wait
+      io_uring_sqe& sqe = _uring->next_sqe();
+      sqe.opcode = IORING_OP_POLL_REMOVE;
+      sqe.addr = registration.mapped().armed;
+      _uring->submit();
+    } else if ( _epoll_fd.has_value() and not rule.fd.closed() and not registration.mapped().always_ready ) {
+      CheckSystemCall( "epoll_ctl", ::epoll_ctl( _epoll_fd->fd_num(), EPOLL_CTL_DEL, fd_num, nullptr ) );
+    }
+  }
+}
+
+void EventLoop::update_registration( Registration& registration )
+{
+  // an fd that is read ahead is polled only for the other events (and the read, submitted later, polls for input)
+  const uint32_t polled = registration.read_ahead >= 0 ? registration.wanted & ~uint32_t { EPOLLIN }
+                                                         : registration.wanted;
+  if ( polled == registration.events ) {
+    return;
+  }
+  if ( registration.always_ready ) {
+    registration.events = registration.wanted;
+    return;
+  }
+
+  if ( _epoll_fd.has_value() ) {
+    epoll_event event { .events = registration.wanted, .data = { .fd = registration.fd_num } };
+    CheckSystemCall( "epoll_ctl", ::epoll_ctl( _epoll_fd->fd_num(), EPOLL_CTL_MOD, registration.fd_num, &event ) );
+    registration.events = registration.wanted;
+    return;
+  }
+
+  // with io_uring, replace the poll request in flight (if any) with one for the wanted events (if any)
+  if ( registration.armed ) {
+    io_uring_sqe& sqe = _uring->next_sqe();
+    sqe.opcode = IORING_OP_POLL_REMOVE;
+    sqe.addr = registration.armed;
+    registration.armed = 0;
+  }
+  if ( polled ) {
+    // (a generation of zero is left for the read-ahead requests)
+    _uring_generation = _uring_generation == UINT32_MAX ? 1 : _uring_generation + 1;
+    io_uring_sqe& sqe = _uring->next_sqe();
+    sqe.opcode = IORING_OP_POLL_ADD;
+    sqe.fd = registration.fd_num;
+    sqe.poll32_events = polled;
+    registration.armed = uint64_t { _uring_generation } << 32U | static_cast<uint32_t>( registration.fd_num );
+    sqe.user_data = registration.armed;
+  }
+  registration.events = polled;
+}
+
+void EventLoop::read_ahead( FileDescriptor& fd )
+{
+  if ( not _uring ) {
+    return;
+  }
+
+  // the first fd sets up the buffer, and a table of fixed files with an empty index for each fd
+  if ( _read_aheads.empty() ) {
+    _read_ahead_buffer.resize( READ_AHEAD_FDS * READ_AHEAD_SIZE );
+    _uring->register_buffer( _read_ahead_buffer );
+    const array<int, READ_AHEAD_FDS> empty_files = [] {
+      array<int, READ_AHEAD_FDS> files {};
+      files.fill( -1 );
+      return files;
+    }();
+    _uring->register_files( empty_files );
+    _read_aheads.resize( READ_AHEAD_FDS );
+  }
+
+  const auto free_index
+    = ranges::find_if( _read_aheads, []( const optional<ReadAhead>& entry ) { return not entry.has_value(); } );
+  if ( free_index == _read_aheads.end() ) {
+    throw runtime_error( "EventLoop: more than " + to_string( READ_AHEAD_FDS ) + " fds read ahead" );
+  }
+  const int index = static_cast<int>( free_index - _read_aheads.begin() );
+  _uring->update_file( static_cast<unsigned>( index ), fd.fd_num() );
+  free_index->emplace( ReadAhead { fd.duplicate() } );
+  fd.set_read_ahead_only( true );
+
+  // an fd that already has rules is polled for input no longer (from the next wait)
+  const auto registration = _registrations.find( fd.fd_num() );
+  if ( registration != _registrations.end() ) {
+    registration->second.read_ahead = index;
+  }
+}
+
+void EventLoop::submit_read_ahead( Registration& registration )
+{
+  ReadAhead& read_ahead = *_read_aheads.at( registration.read_ahead );
+  if ( read_ahead.in_flight or read_ahead.fd.has_read_ahead() or read_ahead.fd.eof() ) {
+    return;
+  }
+
+  // a poll request for input, linked to the read (so the read does not find the fd empty, or block the ring)
+  const auto index = static_cast<uint32_t>( registration.read_ahead );
+  io_uring_sqe& poll = _uring->next_sqe();
+  poll.opcode = IORING_OP_POLL_ADD;
+  poll.flags = IOSQE_FIXED_FILE | IOSQE_IO_LINK;
+  poll.fd = registration.read_ahead;
+  poll.poll32_events = EPOLLIN;
+  poll.user_data = 0;
+
+  io_uring_sqe& read = _uring->next_sqe();
+  read.opcode = IORING_OP_READ_FIXED;
+  read.flags = IOSQE_FIXED_FILE;
+  read.fd = registration.read_ahead;
+  read.addr = reinterpret_cast<uint64_t>( &_read_ahead_buffer.at( index * READ_AHEAD_SIZE ) ); // NOLINT(*-cast)
+  read.len = READ_AHEAD_SIZE;
+  read.buf_index = 0;
+  read.off = UINT64_MAX; // (the file's position, for an fd that has one)
+  read.user_data = index + 1; // (a generation of zero tells it from a poll request)
+  read_ahead.in_flight = true;
+}
+
+void EventLoop::complete_read_ahead( const io_uring_cqe& cqe, size_t& n_ready )
+{
+  const auto index = static_cast<int>( cqe.user_data - 1 );
+  ReadAhead& read_ahead = *_read_aheads.at( index );
+  read_ahead.in_flight = false;
+
+  // the bytes go to the FileDescriptor (an empty read is EOF), even if the fd left the loop as they were read
+  if ( cqe.res >= 0 ) {
+    const char* const data = &_read_ahead_buffer.at( static_cast<size_t>( index ) * READ_AHEAD_SIZE );
+    read_ahead.fd.set_read_ahead( string( data, static_cast<size_t>( cqe.res ) ) );
+    ++_stats.read_aheads;
+  }
+  if ( read_ahead.released ) {
+    release_read_ahead( index );
+    return;
+  }
+
+  const auto registration = _registrations.find( read_ahead.fd.fd_num() );
+  if ( registration == _registrations.end() or registration->second.read_ahead != index ) {
+    return;
+  }
+  if ( cqe.res == -EAGAIN or cqe.res == -ECANCELED ) {
+    // the fd was polled ready but nothing was read after all, or the thread that submitted the read exited, so
+    // read again, within the same wait
+    submit_read_ahead( registration->second );
+    return;
+  }
+
+  if ( n_ready == _epoll_events.size() ) {
+    _epoll_events.emplace_back();
+  }
+  const uint32_t revents = cqe.res >= 0 ? uint32_t { EPOLLIN } : uint32_t { EPOLLERR };
+  _epoll_events[n_ready++] = { .events = revents, .data = { .fd = registration->first } };
+}
+
+void EventLoop::release_read_ahead( const int index )
+{
+  ReadAhead& read_ahead = *_read_aheads.at( index );
+  read_ahead.fd.set_read_ahead_only( false );
+  if ( read_ahead.in_flight ) {
+    // the read holds the index (and its part of the buffer) until it completes, so it is cancelled now, with
+    // the poll request it may still be waiting on
+    read_ahead.released = true;
+    io_uring_sqe& sqe = _uring->next_sqe();
+    sqe.opcode = IORING_OP_ASYNC_CANCEL;
+    sqe.fd = index;
+    sqe.cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_FD_FIXED | IORING_ASYNC_CANCEL_ALL;
+    _uring->submit();
+    return;
+  }
+  _uring->update_file( static_cast<unsigned>( index ), -1 );
+  _read_aheads.at( index ).reset();
+}
+
+size_t EventLoop::wait_ready( const int timeout_ms )
+{
+  if ( _epoll_fd.has_value() ) {
+    _epoll_events.resize( max( _registrations.size(), size_t { 1 } ) );
+    ++_stats.syscalls;
+    return CheckSystemCall( "epoll_wait",
+                            ::epoll_wait( _epoll_fd->fd_num(),
+                                          _epoll_events.data(),
+                                          static_cast<int>( _epoll_events.size() ),
+                                          timeout_ms ) );
+  }
+
+  // Submit the poll requests and wait for a completion. A completion may be for a request that was cancelled
+  // (or for the cancellation), in which case the wait goes on, until the timeout.
+  const auto deadline = chrono::steady_clock::now() + chrono::milliseconds( timeout_ms );
+  int remaining_ms = timeout_ms;
+  size_t n_ready = 0;
+  while ( true ) {
+    ++_stats.syscalls;
+    _uring->submit( 1, remaining_ms );
+    const size_t n_completions = _uring->for_each_completion( [&]( const io_uring_cqe& cqe ) {
+      if ( cqe.user_data != 0 and cqe.user_data >> 32U == 0 ) {
+        complete_read_ahead( cqe, n_ready );
+        return;
+      }
+      const auto registration = _registrations.find( static_cast<int>( cqe.user_data & UINT32_MAX ) );
+      if ( cqe.user_data == 0 or registration == _registrations.end()
+           or registration->second.armed != cqe.user_data ) {
+        return;
+      }
+
+      // the poll request is one-shot, so the next wait asks again (or this one, if the request was cancelled
+      // because the thread that submitted it exited, e.g. one that connected a socket and then handed it over)
+      registration->second.armed = 0;
+      registration->second.events = 0;
+      if ( cqe.res == -ECANCELED ) {
+        update_registration( registration->second );
+        return;
+      }
+      if ( n_ready == _epoll_events.size() ) {
+        _epoll_events.emplace_back();
+      }
+      const uint32_t revents = cqe.res < 0 ? uint32_t { EPOLLERR } : static_cast<uint32_t>( cqe.res );
+      _epoll_events[n_ready++] = { .events = revents, .data = { .fd = registration->first } };
+    } );
+
+    if ( n_ready > 0 or n_completions == 0 or timeout_ms == 0 ) {
+      return n_ready;
+    }
+    if ( timeout_ms > 0 ) {
+      const auto left = chrono::ceil<chrono::milliseconds>( deadline - chrono::steady_clock::now() ).count();
+      if ( left <= 0 ) {
+        return 0;
+      }
+      remaining_ms = static_cast<int>( left );
+    }
+  }
+}
+
 void EventLoop::RuleHandle::cancel()
 {
   const shared_ptr<BasicRule> rule_shared_ptr = rule_weak_ptr_.lock();
@@ -77,34 +494,52 @@ void EventLoop::RuleHandle::cancel()
   }
 }
 
+void EventLoop::RuleHandle::subscribe( const Notifier& notifier )
+{
+  const shared_ptr<BasicRule> rule_shared_ptr = rule_weak_ptr_.lock();
+  if ( rule_shared_ptr ) {
+    rule_shared_ptr->notifier = notifier.raised_;
+    rule_shared_ptr->notifier_seen = *notifier.raised_ - 1; // (so the next wait asks)
+  }
+}
+
 // NOLINTBEGIN(*-cognitive-complexity)
 // NOLINTBEGIN(*-signed-bitwise)
 EventLoop::Result EventLoop::wait_next_event( const int timeout_ms )
 {
+  ++_stats.waits;
+  bool rule_fired = false;
+  bool rule_pending = false; // a rule used up its budget, and is still interested
+
   // first, handle the non-file-descriptor-related rules
   {
     for ( auto it = _non_fd_rules.begin(); it != _non_fd_rules.end(); ) {
       auto& this_rule = **it;
-      bool rule_fired = false;
 
       if ( this_rule.cancel_requested ) {
         it = _non_fd_rules.erase( it );
         continue;
       }
 
-      uint8_t iterations = 0;
-      while ( this_rule.interest() ) {
-        if ( iterations++ >= 128 ) {
+      size_t iterations = 0;
+      while ( this_rule.wants() ) {
+        if ( _dispatch == Dispatch::AllReady and iterations == _rule_budget ) {
+          rule_pending = true;
+          break;
+        }
+        if ( _dispatch == Dispatch::One and iterations >= 128 ) {
           throw runtime_error( "EventLoop: busy wait detected: rule \""
                                + _rule_categories.at( this_rule.category_id ).name + "\" is still interested after "
                                + to_string( iterations ) + " iterations" );
         }
 
+        ++iterations;
+        ++_stats.callbacks;
         rule_fired = true;
         this_rule.callback();
       }
 
-      if ( rule_fired ) {
+      if ( rule_fired and _dispatch == Dispatch::One ) {
         return Result::Success; /* only serve one rule on each iteration */
       }
 
@@ -112,7 +547,78 @@ EventLoop::Result EventLoop::wait_next_event( const int timeout_ms )
     }
   }
 
-  // now the file-descriptor-related rules. poll any "interested" file descriptors
+  // with AllReady, the fds are still served if a rule fired, but without waiting
+  const int fd_timeout_ms = rule_fired ? 0 : timeout_ms;
+  const Result result = fd_timeout_ms != 0 and _busy_poll > chrono::steady_clock::duration::zero()
+                          ? busy_poll_fds( fd_timeout_ms )
+                          : wait_fds( fd_timeout_ms );
+  if ( rule_fired or rule_pending ) {
+    return Result::Success;
+  }
+  return result;
+}
+
+EventLoop::Result EventLoop::wait_fds( const int timeout_ms )
+{
+  return _backend == Backend::Poll ? wait_poll( timeout_ms ) : wait_registered( timeout_ms );
+}
+
+EventLoop::Result EventLoop::busy_poll_fds( const int timeout_ms )
+{
+  const auto start = chrono::steady_clock::now();
+  const auto spin_end
+    = timeout_ms > 0 ? min( start + _busy_poll, start + chrono::milliseconds( timeout_ms ) ) : start + _busy_poll;
+  auto now = start;
+  auto next_fd_poll = start; // (with spin checks, the fds are polled only every SPIN_POLL_INTERVAL)
+  do {
+    bool checked_ready = false;
+    for ( const auto& check : _spin_checks ) {
+      ++_stats.spin_checks;
+      if ( check() ) {
+        checked_ready = true;
+        break;
+      }
+    }
+    if ( checked_ready ) {
+      _stats.spin_time += chrono::steady_clock::now() - start;
+      ++_stats.busy_poll_hits;
+      return Result::Success;
+    }
+
+    if ( now < next_fd_poll ) {
+      now = chrono::steady_clock::now();
+      continue;
+    }
+    ++_stats.busy_polls;
+    const Result result = wait_fds( 0 );
+    now = chrono::steady_clock::now();
+    if ( result != Result::Timeout ) {
+      _stats.spin_time += now - start;
+      _stats.busy_poll_hits += result == Result::Success ? 1 : 0;
+      return result;
+    }
+    if ( not _spin_checks.empty() ) {
+      next_fd_poll = now + SPIN_POLL_INTERVAL;
+    }
+  } while ( now < spin_end );
+  _stats.spin_time += now - start;
+  ++_stats.busy_poll_misses;
+
+  // then block, for whatever is left of the timeout
+  int remaining_ms = timeout_ms;
+  if ( timeout_ms > 0 ) {
+    remaining_ms = static_cast<int>(
+      chrono::ceil<chrono::milliseconds>( start + chrono::milliseconds( timeout_ms ) - now ).count() );
+    if ( remaining_ms <= 0 ) {
+      return Result::Timeout;
+    }
+  }
+  return wait_fds( remaining_ms );
+}
+
+EventLoop::Result EventLoop::wait_poll( const int timeout_ms )
+{
+  // poll any "interested" file descriptors
   vector<pollfd> pollfds {};
   pollfds.reserve( _fd_rules.size() );
   bool something_to_poll = false;
@@ -142,7 +648,7 @@ EventLoop::Result EventLoop::wait_next_event( const int timeout_ms )
       continue;
     }
 
-    if ( this_rule.interest() ) {
+    if ( this_rule.wants() ) {
       pollfds.push_back( { this_rule.fd.fd_num(),
                            static_cast<int16_t>( this_rule.direction == Direction::In ? POLLIN : POLLOUT ),
                            0 } );
@@ -159,69 +665,223 @@ EventLoop::Result EventLoop::wait_next_event( const int timeout_ms )
   }
 
   // call poll -- wait until one of the fds satisfies one of the rules (writeable/readable)
-  if ( 0 == CheckSystemCall( "poll", ::poll( pollfds.data(), pollfds.size(), timeout_ms ) ) ) {
+  ++_stats.syscalls;
+  const auto before = timeout_ms != 0 ? chrono::steady_clock::now() : chrono::steady_clock::time_point {};
+  const int n_ready = CheckSystemCall( "poll", ::poll( pollfds.data(), pollfds.size(), timeout_ms ) );
+  if ( timeout_ms != 0 ) {
+    _stats.blocked_time += chrono::steady_clock::now() - before;
+  }
+  if ( n_ready == 0 ) {
     return Result::Timeout;
   }
 
-  // go through the poll results
-  for ( auto [it, idx] = make_pair( _fd_rules.begin(), static_cast<size_t>( 0 ) ); it != _fd_rules.end(); ++idx ) {
+  // go through the poll results (but not the rules that callbacks added, which come after the polled ones)
+  bool served = false;
+  for ( auto [it, idx] = make_pair( _fd_rules.begin(), static_cast<size_t>( 0 ) );
+        it != _fd_rules.end() and idx < pollfds.size();
+        ++idx ) {
     const auto& this_pollfd = pollfds.at( idx );
-    auto& this_rule = **it;
 
-    const auto poll_error = static_cast<bool>( this_pollfd.revents & ( POLLERR | POLLNVAL ) );
-    if ( poll_error ) {
-      /* see if fd is a socket */
-      int socket_error = 0;
-      socklen_t optlen = sizeof( socket_error );
-      const int ret = getsockopt( this_rule.fd.fd_num(), SOL_SOCKET, SO_ERROR, &socket_error, &optlen );
-      if ( ret == -1 and errno == ENOTSOCK ) {
-        cerr << "error on polled file descriptor for rule \"" << _rule_categories.at( this_rule.category_id ).name
-             << "\"\n";
-      } else if ( ret == -1 ) {
-        throw unix_error( "getsockopt" );
-      } else if ( optlen != sizeof( socket_error ) ) {
-        throw runtime_error( "unexpected length from getsockopt: " + to_string( optlen ) );
-      } else if ( socket_error ) {
-        cerr << "error on polled socket for rule \"" << _rule_categories.at( this_rule.category_id ).name
-             << "\": " << strerror( socket_error ) << "\n";
-      }
+    switch ( service( **it, this_pollfd.events, this_pollfd.revents, served ) ) {
+      case FDOutcome::Served:
+        if ( _dispatch == Dispatch::One ) {
+          return Result::Success; /* only serve one rule on each iteration */
+        }
+        served = true;
+        ++it;
+        break;
+      case FDOutcome::Defunct:
+        it = _fd_rules.erase( it );
+        break;
+      case FDOutcome::Idle:
+        ++it;
+        break;
+    }
+  }
 
-      this_rule.error();
-      this_rule.cancel();
+  return Result::Success;
+}
+
+// The epoll flags are the poll flags, so one service() handles both backends
+static_assert( EPOLLIN == POLLIN and EPOLLOUT == POLLOUT and EPOLLERR == POLLERR and EPOLLHUP == POLLHUP );
+
+EventLoop::Result EventLoop::wait_registered( const int timeout_ms )
+{
+  // Drop the rules that are cancelled or finished, and ask the others for their interest. (A rule that is
+  // dropped always comes before any rule added after it, which might have reused its fd number.)
+  ++_registered_waits;
+  _interest_changes.clear();
+
+  // io_uring ties a request to the thread that submitted it (its task work completes the request, and its exit
+  // cancels it), so when another thread takes over the loop (e.g. a socket that connected and then started its
+  // own thread), the requests are cancelled now and submitted again by this thread
+  if ( _uring and this_thread::get_id() != _uring_thread ) {
+    _uring_thread = this_thread::get_id();
+    io_uring_sqe& sqe = _uring->next_sqe();
+    sqe.opcode = IORING_OP_ASYNC_CANCEL;
+    sqe.cancel_flags = IORING_ASYNC_CANCEL_ANY | IORING_ASYNC_CANCEL_ALL;
+  }
+  bool something_to_poll = false;
+  for ( auto it = _fd_rules.begin(); it != _fd_rules.end(); ) {
+    auto& this_rule = **it;
+
+    if ( this_rule.cancel_requested ) {
+      unregister_rule( this_rule ); // (as with poll, no cancellation callback)
       it = _fd_rules.erase( it );
       continue;
     }
 
-    const auto poll_ready = static_cast<bool>( this_pollfd.revents & this_pollfd.events );
-    const auto poll_hup = static_cast<bool>( this_pollfd.revents & POLLHUP );
-    if ( poll_hup && ( ( this_pollfd.events && !poll_ready ) or ( this_rule.direction == Direction::Out ) ) ) {
-      // if we asked for the status, and the _only_ condition was a hangup, this FD is defunct:
-      //   - if it was POLLIN and nothing is readable, no more will ever be readable
-      //   - if it was POLLOUT, it will not be writable again
-      // additionally, consider FD defunct if rule will only query for Direction::Out
+    if ( ( this_rule.direction == Direction::In and this_rule.fd.eof() ) or this_rule.fd.closed() ) {
       this_rule.cancel();
+      unregister_rule( this_rule );
       it = _fd_rules.erase( it );
       continue;
     }
 
-    if ( poll_ready ) {
-      // we only want to call callback if revents includes the event we asked for
-      const auto count_before = this_rule.service_count();
-      this_rule.callback();
+    if ( not this_rule.registration ) {
+      register_rule( this_rule );
+    }
+    Registration& registration = *this_rule.registration;
+    if ( registration.wait != _registered_waits ) {
+      registration.wait = _registered_waits;
+      registration.wanted = 0;
+      _interest_changes.push_back( &registration );
+    }
+
+    this_rule.interested = this_rule.wants();
+    if ( this_rule.interested ) {
+      registration.wanted |= this_rule.direction == Direction::In ? EPOLLIN : EPOLLOUT;
+      something_to_poll = true;
+    }
+    ++it;
+  }
 
-      if ( count_before == this_rule.service_count() and ( not this_rule.fd.closed() ) and this_rule.interest() ) {
-        throw runtime_error( "EventLoop: busy wait detected: rule \""
-                             + _rule_categories.at( this_rule.category_id ).name
-                             + "\" did not read/write fd and is still interested" );
+  // modify the registrations whose interest changed, and read ahead the fds whose input is wanted
+  _ready_now.clear();
+  for ( Registration* registration : _interest_changes ) {
+    update_registration( *registration );
+    if ( registration->always_ready and registration->wanted ) {
+      _ready_now.push_back( { .events = registration->wanted, .data = { .fd = registration->fd_num } } );
+    }
+    if ( registration->read_ahead >= 0 and ( registration->wanted & EPOLLIN ) ) {
+      if ( _read_aheads.at( registration->read_ahead )->fd.has_read_ahead() ) {
+        _ready_now.push_back( { .events = EPOLLIN, .data = { .fd = registration->fd_num } } );
+      } else {
+        submit_read_ahead( *registration );
       }
+    }
+  }
+
+  if ( not something_to_poll ) {
+    return Result::Exit;
+  }
 
-      return Result::Success; /* only serve one rule on each iteration */
+  // wait for the ready fds (without blocking, if some are ready already), and add the ones that are
+  const int wait_timeout_ms = _ready_now.empty() ? timeout_ms : 0;
+  const auto before = wait_timeout_ms != 0 ? chrono::steady_clock::now() : chrono::steady_clock::time_point {};
+  size_t n_ready = wait_ready( wait_timeout_ms );
+  if ( wait_timeout_ms != 0 ) {
+    _stats.blocked_time += chrono::steady_clock::now() - before;
+  }
+  for ( const epoll_event& event : _ready_now ) {
+    if ( n_ready == _epoll_events.size() ) {
+      _epoll_events.emplace_back();
+    }
+    _epoll_events[n_ready++] = event;
+  }
+  if ( n_ready == 0 ) {
+    return Result::Timeout;
+  }
+
+  bool served = false;
+  for ( size_t i = 0; i < n_ready; ++i ) {
+    const epoll_event& event = _epoll_events.at( i );
+    const auto registration = _registrations.find( event.data.fd );
+    if ( registration == _registrations.end() ) {
+      continue;
     }
 
-    ++it; // if we got here, it means we didn't call _fd_rules.erase()
+    // (a copy, since a defunct rule leaves the registration)
+    const vector<FDRule*> rules = registration->second.rules;
+    for ( FDRule* rule : rules ) {
+      const short events = rule->interested ? ( rule->direction == Direction::In ? POLLIN : POLLOUT ) : 0;
+      switch ( service( *rule, events, static_cast<short>( event.events ), served ) ) {
+        case FDOutcome::Served:
+          if ( _dispatch == Dispatch::One ) {
+            return Result::Success; /* only serve one rule on each iteration */
+          }
+          served = true;
+          break;
+        case FDOutcome::Defunct:
+          unregister_rule( *rule );
+          rule->cancel_requested = true; // the next wait removes it
+          break;
+        case FDOutcome::Idle:
+          break;
+      }
+    }
   }
 
   return Result::Success;
 }
+
+EventLoop::FDOutcome EventLoop::service( FDRule& this_rule, const short events, const short revents, bool recheck )
+{
+  const auto poll_error = static_cast<bool>( revents & ( POLLERR | POLLNVAL ) );
+  if ( poll_error ) {
+    /* see if fd is a socket */
+    int socket_error = 0;
+    socklen_t optlen = sizeof( socket_error );
+    const int ret = getsockopt( this_rule.fd.fd_num(), SOL_SOCKET, SO_ERROR, &socket_error, &optlen );
+    if ( ret == -1 and errno == ENOTSOCK ) {
+      cerr << "error on polled file descriptor for rule \"" << _rule_categories.at( this_rule.category_id ).name
+           << "\"\n";
+    } else if ( ret == -1 ) {
+      throw unix_error( "getsockopt" );
+    } else if ( optlen != sizeof( socket_error ) ) {
+      throw runtime_error( "unexpected length from getsockopt: " + to_string( optlen ) );
+    } else if ( socket_error ) {
+      cerr << "error on polled socket for rule \"" << _rule_categories.at( this_rule.category_id ).name
+           << "\": " << strerror( socket_error ) << "\n";
+    }
+
+    this_rule.error();
+    this_rule.cancel();
+    return FDOutcome::Defunct;
+  }
+
+  const auto poll_ready = static_cast<bool>( revents & events );
+  const auto poll_hup = static_cast<bool>( revents & POLLHUP );
+  if ( poll_hup && ( ( events && !poll_ready ) or ( this_rule.direction == Direction::Out ) ) ) {
+    // if we asked for the status, and the _only_ condition was a hangup, this FD is defunct:
+    //   - if it was POLLIN and nothing is readable, no more will ever be readable
+    //   - if it was POLLOUT, it will not be writable again
+    // additionally, consider FD defunct if rule will only query for Direction::Out
+    this_rule.cancel();
+    return FDOutcome::Defunct;
+  }
+
+  if ( poll_ready ) {
+    // an earlier callback in this wakeup may have cancelled the rule, closed the fd or changed the interest
+    if ( recheck and ( this_rule.cancel_requested or this_rule.fd.closed() or not this_rule.wants() ) ) {
+      return FDOutcome::Idle;
+    }
+
+    // we only want to call callback if revents includes the event we asked for
+    const auto count_before = this_rule.service_count();
+    ++_stats.callbacks;
+    this_rule.callback();
+
+    if ( count_before == this_rule.service_count() and ( not this_rule.fd.closed() ) and this_rule.wants() ) {
+      throw runtime_error( "EventLoop: busy wait detected: rule \""
+                           + _rule_categories.at( this_rule.category_id ).name
+                           + "\" did not read/write fd and is still interested" );
+    }
+
+    return FDOutcome::Served;
+  }
+
+  return FDOutcome::Idle;
+}
 // NOLINTEND(*-signed-bitwise)
 // NOLINTEND(*-cognitive-complexity)
@@ -1,13 +1,53 @@
 #pragma once
 
+#include <chrono>
+#include <cstdint>
 #include <functional>
 #include <list>
 #include <memory>
+#include <optional>
+#include <thread>
 #include <poll.h>
+#include <sys/epoll.h>
+#include <unordered_map>
+#include <vector>
 
 #include "file_descriptor.hh"
+#include "io_uring.hh"
 
-//! Waits for events on file descriptors and executes corresponding callbacks.
+//! \brief Waits for events on file descriptors and executes corresponding callbacks.
+//! \details With the Poll backend, each wait builds a pollfd for every rule and calls [poll(2)](\ref man2::poll).
+//! With the Epoll backend, each fd is registered once with an [epoll(7)](\ref man7::epoll) instance, its
+//! registration is modified only when the rules' interest in it changes, and only the fds that are ready come
+//! back from the wait. (The interest functions are still called on every wait, unless the rules are subscribed
+//! to a Notifier, but they make no system calls.) epoll refuses fds that cannot block, such as regular files and
+//! /dev/null; as poll(2) does, the Epoll backend then treats such an fd as always ready.
+//! The IoUring backend keeps the same registrations, but as one-shot poll requests on an
+//! [io_uring(7)](\ref man7::io_uring): the requests for the fds whose interest changed (or that were ready last
+//! time) are submitted by the same system call that waits, so a wait is always one system call. An fd that is
+//! read ahead (see read_ahead) is not polled for reading at all: the ring reads it, into a buffer registered with
+//! the ring and naming the fd as a fixed file, and a completed read makes its rules ready and hands the bytes to
+//! the FileDescriptor, so the rule's own read makes no system call.
+//!
+//! By default, each wait runs one rule. With Dispatch::AllReady, it runs every rule that is ready: each
+//! interested non-fd rule, up to its budget of calls (a rule still interested after that runs again at the next
+//! wait, which then does not block), and then each ready fd rule, once. A rule is asked again for its interest
+//! before it runs, in case an earlier callback in the same wait changed it.
+//!
+//! Timer rules run at a deadline (once, or periodically). They are kept in a min-heap, and one
+//! [timerfd](\ref man2::timerfd_create), armed for the earliest deadline, wakes the wait when it comes; all the
+//! timers that are due then run together. A cancelled timer is dropped when it reaches the top of the heap.
+//!
+//! With busy-polling (see set_busy_poll), a wait that would block first polls the fds without blocking, over
+//! and over, for up to a set time. A thread that is woken from a blocking wait pays for the wakeup (and for the
+//! scheduler to run it again); one that spins sees the fd ready as soon as it is, at the cost of a core. Each of
+//! those polls is still a system call, so an owner that can tell cheaply (e.g. from the indices of a RingPipe)
+//! when there may be something to do adds a spin check: then the spin runs the checks, and polls the fds only
+//! once every SPIN_POLL_INTERVAL.
+//!
+//! A rule subscribed to a Notifier keeps the last answer of its interest function until the Notifier is
+//! raised, so the interest is asked again only when something it depends on (e.g. a ByteStream, through its
+//! listener) has changed.
 class EventLoop
 {
 public:
@@ -18,6 +58,56 @@ public:
     Out // Callback will be triggered when Rule::fd is writable.
   };
 
+  //! How the EventLoop waits for its file descriptors
+  enum class Backend : uint8_t
+  {
+    Poll, //!< [poll(2)](\ref man2::poll) on every fd, every time
+    Epoll,  //!< A persistent [epoll(7)](\ref man7::epoll) set
+    IoUring //!< Poll requests on an io_uring (or Epoll, if the kernel does not allow io_uring)
+  };
+
+  //! How many rules each wait runs
+  enum class Dispatch : uint8_t
+  {
+    One,     //!< The first rule that is ready
+    AllReady //!< Every rule that is ready
+  };
+
+  //! Size of the io_uring's submission queue, with Backend::IoUring
+  static constexpr unsigned URING_ENTRIES = 256;
+
+  //! Most fds read ahead at once, and the most bytes each read ahead takes (enough for any datagram)
+  static constexpr unsigned READ_AHEAD_FDS = 4;
+  static constexpr size_t READ_AHEAD_SIZE = 65536;
+
+  //! Default budget of calls for a non-fd rule in one wait, with Dispatch::AllReady
+  static constexpr size_t DEFAULT_RULE_BUDGET = 64;
+
+  struct Stats
+  {
+    uint64_t waits {};     //!< Calls to wait_next_event
+    uint64_t syscalls {};  //!< Calls to poll or epoll_wait
+    uint64_t callbacks {}; //!< Rule callbacks run (so callbacks / syscalls is the events handled per syscall)
+    uint64_t read_aheads {}; //!< Reads completed by the io_uring, for fds that are read ahead
+
+    uint64_t busy_polls {};       //!< Non-blocking polls while busy-polling (see set_busy_poll)
+    uint64_t spin_checks {};      //!< Spin checks run while busy-polling (see add_spin_check)
+    uint64_t busy_poll_hits {};   //!< Waits that busy-polling served without blocking
+    uint64_t busy_poll_misses {}; //!< Waits that busy-polled for the whole budget, and then blocked
+    std::chrono::nanoseconds spin_time {};    //!< Time spent busy-polling
+    std::chrono::nanoseconds blocked_time {}; //!< Time blocked in poll, epoll_wait or io_uring_enter
+  };
+
+  //! An edge notification for rules' interest (see RuleHandle::subscribe). Copies raise the same notification.
+  class Notifier
+  {
+    friend class EventLoop;
+    std::shared_ptr<uint64_t> raised_ { std::make_shared<uint64_t>() }; //!< How many times it has been raised
+
+  public:
+    void raise() { ++*raised_; }
+  };
+
 private:
   using CallbackT = std::function<void( void )>;
   using InterestT = std::function<bool( void )>;
@@ -34,17 +124,49 @@ private:
     CallbackT callback;
     bool cancel_requested {};
 
+    std::shared_ptr<const uint64_t> notifier {}; //!< The Notifier's count of raises, if the rule is subscribed
+    uint64_t notifier_seen {};                   //!< The count when the interest function was last asked
+    bool last_interest {};                       //!< What it answered
+
     BasicRule( size_t s_category_id, InterestT s_interest, CallbackT s_callback );
+
+    //! Is the rule interested? (Asks the interest function, unless the rule's Notifier has not been raised.)
+    bool wants();
   };
 
+  struct TimerRule : public BasicRule
+  {
+    std::chrono::steady_clock::time_point deadline;
+    std::chrono::steady_clock::duration period; //!< Zero for a one-shot timer
+    uint64_t sequence;                          //!< Breaks ties between equal deadlines, first come first served
+
+    TimerRule( BasicRule&& base,
+               std::chrono::steady_clock::time_point s_deadline,
+               std::chrono::steady_clock::duration s_period,
+               uint64_t s_sequence );
+  };
+
+  struct Registration;
+
   struct FDRule : public BasicRule
   {
     FileDescriptor fd;   //!< FileDescriptor to monitor for activity.
     Direction direction; //!< Direction::In for reading from fd, Direction::Out for writing to fd.
     CallbackT cancel;    //!< A callback that is called when the rule is cancelled (e.g. on EOF or hangup)
     CallbackT error;     //!< A callback that is called when the fd has an error before cancellation
+    bool interested {};  //!< Result of the interest function, as of the last wait
+
+    //! The epoll set's registration for the fd, if the rule is in it
+    Registration* registration {};
 
     FDRule( BasicRule&& base, FileDescriptor&& s_fd, Direction s_direction, CallbackT s_cancel, CallbackT s_error );
+    ~FDRule() = default;
+
+    //! The epoll set's registration points to the rule, so it stays in place
+    FDRule( const FDRule& ) = delete;
+    FDRule& operator=( const FDRule& ) = delete;
+    FDRule( FDRule&& ) = delete;
+    FDRule& operator=( FDRule&& ) = delete;
 
     //! Returns the number of times fd has been read or written, depending on the value of Rule::direction.
     //! \details This function is used internally by EventLoop; you will not need to call it
@@ -54,9 +176,99 @@ private:
   std::vector<RuleCategory> _rule_categories {};
   std::list<std::shared_ptr<FDRule>> _fd_rules {};
   std::list<std::shared_ptr<BasicRule>> _non_fd_rules {};
+  std::vector<std::shared_ptr<TimerRule>> _timers {}; //!< A min-heap on the deadline (see later_timer)
+
+  //! The rules on one fd, and the events the epoll set has for it
+  struct Registration
+  {
+    int fd_num {};
+    uint32_t events {}; //!< Events registered with the epoll set (or asked for by the poll request in flight)
+    uint32_t wanted {}; //!< Events the rules are interested in, as of this wait
+    uint64_t wait {};   //!< The wait that `wanted` was computed for
+    uint64_t armed {};  //!< With io_uring, the user_data of the poll request in flight (zero if none)
+    bool always_ready {}; //!< epoll refused the fd (e.g. a regular file), so it is ready whenever it is wanted
+    int read_ahead { -1 }; //!< With io_uring, the fd's index in _read_aheads, if it is read ahead
+    std::vector<FDRule*> rules {};
+  };
+
+  Backend _backend;
+  Dispatch _dispatch;
+  size_t _rule_budget;
+  std::chrono::steady_clock::duration _busy_poll {};
+  std::vector<InterestT> _spin_checks {};
+  Stats _stats {};
+  std::optional<FileDescriptor> _epoll_fd {};
+  std::unordered_map<int, Registration> _registrations {};
+  std::vector<epoll_event> _epoll_events {};
+  std::vector<Registration*> _interest_changes {};
+  std::vector<epoll_event> _ready_now {}; //!< Events known without waiting (always-ready fds, bytes read ahead)
+  uint64_t _registered_waits {};
+
+  //! An fd that the io_uring reads ahead (see read_ahead), at an index of the ring's fixed files and a slot of
+  //! _read_ahead_buffer
+  struct ReadAhead
+  {
+    FileDescriptor fd;
+    bool in_flight {}; //!< A read request is in flight
+    bool released {};  //!< The fd left the loop while a read was in flight, so the index is freed when it completes
+  };
+  std::vector<std::optional<ReadAhead>> _read_aheads {};
+  std::vector<char> _read_ahead_buffer {}; //!< Registered with the ring (and so it outlives it)
+  std::unique_ptr<IoUring> _uring {};
+  uint32_t _uring_generation {}; //!< Tells a poll request from earlier ones on the same fd number
+  std::thread::id _uring_thread {}; //!< The thread that submitted the requests in flight
+
+  std::optional<FileDescriptor> _timer_fd {}; //!< Created with the first timer
+  std::chrono::steady_clock::time_point _timer_fd_deadline {}; //!< What the timerfd is armed for (zero if not)
+  uint64_t _timer_sequence {};
+
+  //! The heap order for _timers
+  static bool later_timer( const std::shared_ptr<TimerRule>& a, const std::shared_ptr<TimerRule>& b );
+
+  //! Are any timers pending? (Drops the cancelled ones from the top of the heap.)
+  bool timers_pending();
+
+  //! Run the timers that are due, and rearm the timerfd for the next one
+  void fire_timers();
+
+  //! Arm the timerfd for the earliest deadline (if it is not already)
+  void arm_timer_fd();
+
+  //! What became of a rule whose fd had events
+  enum class FDOutcome : uint8_t
+  {
+    Idle,   //!< Nothing the rule asked for
+    Served, //!< The callback ran
+    Defunct //!< The fd had an error or hung up, so the rule was cancelled (and should be removed)
+  };
+
+  //! Handle the `revents` (in poll(2) terms) for a rule that asked for `events`. If `recheck`, ask the rule for
+  //! its interest again before running it.
+  FDOutcome service( FDRule& rule, short events, short revents, bool recheck );
+
+  //! Add a rule to the epoll registration for its fd
+  void register_rule( FDRule& rule );
+
+  //! Remove a rule from the epoll registration for its fd (unless the fd was closed, which removes it already)
+  void unregister_rule( FDRule& rule );
+
+  //! Bring the epoll set's (or io_uring's) events for a registration up to date with the rules' interest
+  void update_registration( Registration& registration );
+
+  //! Wait for registered fds to be ready, into _epoll_events; returns how many are
+  size_t wait_ready( int timeout_ms );
 
 public:
-  EventLoop() { _rule_categories.reserve( 64 ); }
+  explicit EventLoop( Backend backend = Backend::Epoll,
+                      Dispatch dispatch = Dispatch::One,
+                      size_t rule_budget = DEFAULT_RULE_BUDGET );
+  ~EventLoop() = default;
+
+  //! The timer rule refers back to the EventLoop, so it stays in place
+  EventLoop( const EventLoop& ) = delete;
+  EventLoop& operator=( const EventLoop& ) = delete;
+  EventLoop( EventLoop&& ) = delete;
+  EventLoop& operator=( EventLoop&& ) = delete;
 
   //! Returned by each call to EventLoop::wait_next_event.
   enum class Result : uint8_t
@@ -69,6 +281,10 @@ public:
 
   size_t add_category( const std::string& name );
 
+  //! The category with this name, added if there is none yet (so the rules of many objects on one EventLoop,
+  //! e.g. TCPMinnowCoSockets, can share categories instead of using them up)
+  size_t category( const std::string& name );
+
   class RuleHandle
   {
     std::weak_ptr<BasicRule> rule_weak_ptr_;
@@ -79,6 +295,10 @@ public:
     {}
 
     void cancel();
+
+    //! Ask the rule's interest function only at the next wait, and after `notifier` is raised; whatever the
+    //! interest depends on must raise it when it changes
+    void subscribe( const Notifier& notifier );
   };
 
   RuleHandle add_rule(
@@ -93,7 +313,18 @@ public:
   RuleHandle
   add_rule( size_t category_id, const CallbackT& callback, const InterestT& interest = [] { return true; } );
 
-  //! Calls [poll(2)](\ref man2::poll) and then executes callback for each ready fd.
+  //! Run `callback` once, `delay_ms` from now. With a nonzero `period_ms`, run it again every `period_ms` after
+  //! that, until the rule is cancelled. (A periodic timer that falls behind skips the deadlines it missed.)
+  RuleHandle add_timer( size_t category_id, uint64_t delay_ms, const CallbackT& callback, uint64_t period_ms = 0 );
+
+  //! The same, at the clock's resolution
+  RuleHandle add_timer( size_t category_id,
+                        std::chrono::steady_clock::duration delay,
+                        const CallbackT& callback,
+                        std::chrono::steady_clock::duration period = {} );
+
+  //! Calls [poll(2)](\ref man2::poll) (or [epoll_wait(2)](\ref man2::epoll_wait)) and then executes callback for
+  //! a ready fd.
   Result wait_next_event( int timeout_ms );
 
   // convenience function to add category and rule at the same time
@@ -102,6 +333,57 @@ public:
   {
     return add_rule( add_category( name ), std::forward<Targs>( Fargs )... );
   }
+
+  template<typename... Targs>
+  auto add_timer( const std::string& name, Targs&&... Fargs )
+  {
+    return add_timer( add_category( name ), std::forward<Targs>( Fargs )... );
+  }
+
+  //! Timers that have not fired (or been dropped) yet
+  size_t timer_count() const { return _timers.size(); }
+
+  Backend backend() const { return _backend; }
+  Dispatch dispatch() const { return _dispatch; }
+
+  //! \brief With the IoUring backend, read `fd` with io_uring requests instead of polling it for reading
+  //! \details A rule on the fd runs when a read has completed, and its FileDescriptor::read returns the bytes
+  //! already read (see FileDescriptor::set_read_ahead), so reading the fd costs no system call of its own. The fd
+  //! must be one that is read only with FileDescriptor::read (e.g. a TUN device or a stream socket, but not a
+  //! socket read with recvfrom). Does nothing with the other backends.
+  void read_ahead( FileDescriptor& fd );
+
+  //! Before blocking for the fds, poll them without blocking, over and over, for up to `budget` (zero, the
+  //! default, turns busy-polling off)
+  void set_busy_poll( std::chrono::steady_clock::duration budget ) { _busy_poll = budget; }
+  std::chrono::steady_clock::duration busy_poll() const { return _busy_poll; }
+
+  //! While busy-polling with spin checks, how often the fds are polled
+  static constexpr std::chrono::microseconds SPIN_POLL_INTERVAL { 10 };
+
+  //! While busy-polling, run `check` (which must be cheap, and make no system call) on every spin, and poll
+  //! the fds only every SPIN_POLL_INTERVAL; the wait returns as soon as a check returns true, so the rules are
+  //! asked again. (A check that returns true should raise whatever Notifier those rules are subscribed to.)
+  void add_spin_check( const InterestT& check ) { _spin_checks.push_back( check ); }
+  const Stats& stats() const { return _stats; }
+
+private:
+  //! The fd-rule half of wait_next_event, with the Poll backend or one that keeps registrations
+  Result wait_fds( int timeout_ms );
+  Result wait_poll( int timeout_ms );
+  Result wait_registered( int timeout_ms );
+
+  //! wait_fds, but busy-polling first
+  Result busy_poll_fds( int timeout_ms );
+
+  //! Submit a read for an fd that is read ahead, if there is none in flight and nothing left from the last one
+  void submit_read_ahead( Registration& registration );
+
+  //! A read ahead completed: hand the bytes to the FileDescriptor, and report the fd ready (in _epoll_events)
+  void complete_read_ahead( const io_uring_cqe& cqe, size_t& n_ready );
+
+  //! Give up an fd's index in _read_aheads (once no read is in flight)
+  void release_read_ahead( int index );
 };
 
 using Direction = EventLoop::Direction;
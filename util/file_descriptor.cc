@@ -2,8 +2,12 @@
 
 #include "exception.hh"
 
+#include <algorithm>
+#include <array>
+#include <cstring>
 #include <fcntl.h>
 #include <iostream>
+#include <poll.h>
 #include <stdexcept>
 #include <sys/types.h>
 #include <sys/uio.h>
@@ -29,10 +33,33 @@ size_t FileDescriptor::FDWrapper::CheckRead( string_view what, ssize_t return_va
   if ( return_value == 0 ) {
     eof_ = true;
   }
+  would_block_ = return_value < 0 and non_blocking_ and ( errno == EAGAIN or errno == EWOULDBLOCK );
 
   return CheckFDSystemCall( what, return_value );
 }
 
+size_t FileDescriptor::FDWrapper::ReadAhead( span<const iovec> iovecs )
+{
+  if ( not has_read_ahead_ ) { // (the fd is read ahead only, and nothing has been read ahead yet)
+    would_block_ = true;
+    return 0;
+  }
+
+  size_t bytes_read = 0;
+  for ( const auto& vec : iovecs ) {
+    const size_t len = min( vec.iov_len, read_ahead_.size() - bytes_read );
+    memcpy( vec.iov_base, read_ahead_.data() + bytes_read, len );
+    bytes_read += len;
+  }
+  if ( read_ahead_.empty() ) {
+    eof_ = true;
+  }
+  read_ahead_.erase( 0, bytes_read );
+  has_read_ahead_ = not read_ahead_.empty();
+  would_block_ = false;
+  return bytes_read;
+}
+
 size_t FileDescriptor::CheckFDSystemCall( string_view what, ssize_t return_value ) const
 {
   if ( not internal_fd_ ) {
@@ -100,7 +127,10 @@ void FileDescriptor::read( string& buffer )
     buffer.resize( kReadBufferSize );
   }
 
-  const size_t bytes_read = CheckRead( "read", ::read( fd_num(), buffer.data(), buffer.size() ) );
+  const size_t bytes_read
+    = reads_ahead()
+        ? internal_fd_->ReadAhead( array { iovec { .iov_base = buffer.data(), .iov_len = buffer.size() } } )
+        : CheckRead( "read", ::read( fd_num(), buffer.data(), buffer.size() ) );
   register_read();
 
   if ( bytes_read > buffer.size() ) {
@@ -126,7 +156,8 @@ void FileDescriptor::read( vector<string>& buffers )
   const size_t total_size = to_iovecs( buffers, iovecs );
 
   const size_t bytes_read
-    = CheckRead( "readv", readv( fd_num(), iovecs.data(), static_cast<int>( iovecs.size() ) ) );
+    = reads_ahead() ? internal_fd_->ReadAhead( iovecs )
+                    : CheckRead( "readv", readv( fd_num(), iovecs.data(), static_cast<int>( iovecs.size() ) ) );
   register_read();
 
   if ( bytes_read > total_size ) {
@@ -161,7 +192,8 @@ size_t FileDescriptor::write( string_view buffer )
   const size_t bytes_written = CheckFDSystemCall( "write", ::write( fd_num(), buffer.data(), buffer.size() ) );
   register_write();
 
-  if ( bytes_written == 0 and not buffer.empty() ) {
+  // (on a non-blocking descriptor, 0 means that it had no room)
+  if ( bytes_written == 0 and not buffer.empty() and blocking() ) {
     throw runtime_error( "write returned 0 given non-empty input buffer" );
   }
 
@@ -178,7 +210,7 @@ size_t FileDescriptor::write( const std::vector<iovec>& iovecs, size_t total_siz
     = CheckFDSystemCall( "writev", ::writev( fd_num(), iovecs.data(), static_cast<int>( iovecs.size() ) ) );
   register_write();
 
-  if ( bytes_written == 0 and total_size != 0 ) {
+  if ( bytes_written == 0 and total_size != 0 and blocking() ) {
     throw runtime_error( "writev returned 0 given non-empty input buffer" );
   }
 
@@ -202,3 +234,19 @@ void FileDescriptor::set_blocking( bool blocking )
 
   internal_fd_->non_blocking_ = not blocking;
 }
+
+void FileDescriptor::set_read_ahead( string data )
+{
+  internal_fd_->read_ahead_ = move( data );
+  internal_fd_->has_read_ahead_ = true;
+}
+
+bool FileDescriptor::readable() const
+{
+  if ( reads_ahead() ) {
+    return has_read_ahead();
+  }
+  pollfd pfd { fd_num(), POLLIN, 0 };
+  CheckSystemCall( "poll", ::poll( &pfd, 1, 0 ) );
+  return pfd.revents & POLLIN; // NOLINT(*-bitwise)
+}
@@ -5,6 +5,8 @@
 #include <bits/types/struct_iovec.h>
 #include <cstddef>
 #include <memory>
+#include <span>
+#include <string>
 #include <vector>
 
 // A reference-counted handle to a file descriptor
@@ -21,7 +23,8 @@ public:
   // `write_all` writes a buffer completely.
   void write_all( std::string_view buffer );
 
-  // `write` writes *from* a buffer or range of buffers and returns the number of bytes it actually wrote.
+  // `write` writes *from* a buffer or range of buffers and returns the number of bytes it actually wrote
+  // (0 if the descriptor is non-blocking and has no room).
   size_t write( std::string_view buffer );
   size_t write( const StringViewRange auto&& buffers )
   {
@@ -36,6 +39,18 @@ public:
   // Set blocking(true) or non-blocking(false) status on the file descriptor
   void set_blocking( bool blocking );
 
+  // Is there something to read right now? (polls with a zero timeout)
+  bool readable() const;
+
+  // Bytes that were read from the fd ahead of the reader (by an EventLoop, with io_uring): the next reads
+  // return them before reading the fd again. An empty string stands for EOF.
+  void set_read_ahead( std::string data );
+  bool has_read_ahead() const { return internal_fd_->has_read_ahead_; }
+
+  // While the EventLoop reads the fd ahead, a read that finds nothing read ahead does not read the fd itself: it
+  // finds nothing, as a non-blocking read of an empty fd would (so draining the fd costs no system call)
+  void set_read_ahead_only( bool read_ahead_only ) { internal_fd_->read_ahead_only_ = read_ahead_only; }
+
   // Copy a FileDescriptor explicitly, increasing the internal reference count
   FileDescriptor duplicate() const;
 
@@ -45,6 +60,7 @@ public:
   // Accessors
   int fd_num() const { return internal_fd_->fd_; }                        // underlying descriptor number
   bool eof() const { return internal_fd_->eof_; }                         // EOF flag state
+  bool would_block() const { return internal_fd_->would_block_; }         // last read found nothing (non-blocking)
   bool closed() const { return internal_fd_->closed_; }                   // closed flag state
   bool blocking() const { return not internal_fd_->non_blocking_; }       // blocking state
   unsigned int read_count() const { return internal_fd_->read_count_; }   // number of reads
@@ -67,8 +83,12 @@ private:
     bool eof_ = false;          // Flag indicating whether FDWrapper::fd_ is at EOF
     bool closed_ = false;       // Flag indicating whether FDWrapper::fd_ has been closed
     bool non_blocking_ = false; // Flag indicating whether FDWrapper::fd_ is non-blocking
+    bool would_block_ = false;  // Flag indicating whether the last read of a non-blocking fd_ found nothing
     unsigned read_count_ = 0;   // The number of times FDWrapper::fd_ has been read
     unsigned write_count_ = 0;  // The numberof times FDWrapper::fd_ has been written
+    bool has_read_ahead_ = false; // Flag indicating whether FDWrapper::read_ahead_ holds the next bytes to read
+    std::string read_ahead_ {};   // Bytes already read from fd_ (see set_read_ahead)
+    bool read_ahead_only_ = false; // Flag indicating whether fd_ is read only ahead (see set_read_ahead_only)
 
     // Construct from a file descriptor number returned by the kernel
     explicit FDWrapper( int fd );
@@ -80,6 +100,9 @@ private:
     size_t CheckFDSystemCall( std::string_view what, ssize_t return_value ) const;
     size_t CheckRead( std::string_view what, ssize_t return_value );
 
+    // Copy the bytes read ahead into `iovecs` (keeping any that do not fit for the next read), or find nothing
+    size_t ReadAhead( std::span<const iovec> iovecs );
+
     // An FDWrapper cannot be copied or moved
     FDWrapper( const FDWrapper& other ) = delete;
     FDWrapper& operator=( const FDWrapper& other ) = delete;
@@ -96,6 +119,9 @@ private:
   // Private write method that takes a vector of iovecs (an internal OS structure)
   size_t write( const std::vector<iovec>& iovecs, size_t total_size );
 
+  // Does a read take the bytes read ahead (or find nothing), instead of reading the fd?
+  bool reads_ahead() const { return internal_fd_->has_read_ahead_ or internal_fd_->read_ahead_only_; }
+
 protected:
   // size of buffer to allocate by read(), recv(), etc., when passed-in buffer is empty
   static constexpr size_t kReadBufferSize = 16384;
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <random>
+#include <utility>
+#include <vector>
+
+//! The 4-tuple that identifies a TCP connection, from our side (addresses are numeric, in host byte order)
+struct FlowKey
+{
+  uint32_t local_address {};
+  uint32_t remote_address {};
+  uint16_t local_port {};
+  uint16_t remote_port {};
+
+  bool operator==( const FlowKey& other ) const = default;
+};
+
+//! A hash of a FlowKey, keyed by `seed`
+inline uint64_t flow_hash( const FlowKey& key, uint64_t seed )
+{
+  uint64_t x = ( static_cast<uint64_t>( key.local_address ) << 32 | key.remote_address ) ^ seed;
+  x = ( x ^ ( x >> 31 ) ) * 0x9e3779b97f4a7c15ULL;
+  x ^= ( static_cast<uint64_t>( key.local_port ) << 16 | key.remote_port ) * 0xbf58476d1ce4e5b9ULL;
+  x = ( x ^ ( x >> 29 ) ) * 0x94d049bb133111ebULL;
+  return x ^ ( x >> 32 );
+}
+
+//! \brief An open-addressing hash table from FlowKey to `V`
+//! \details The slots are one flat array, probed linearly from the key's home slot, so a lookup usually touches
+//! one or two cache lines and never chases a pointer. The table doubles when it is half full. Deletion shifts
+//! later entries of the probe run back (instead of leaving tombstones), so lookups stay short under churn. The
+//! hash is keyed with a per-table random seed, so remote peers cannot choose ports that all collide.
+template<class V>
+class FlowTable
+{
+public:
+  explicit FlowTable( size_t initial_capacity = 16 )
+    : slots_( std::bit_ceil( std::max( initial_capacity, size_t { 2 } ) ) )
+  {}
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  size_t capacity() const { return slots_.size(); }
+
+  //! The value for `key`, or nullptr
+  V* find( const FlowKey& key )
+  {
+    const size_t i = index_of( key );
+    return slots_[i].has_value() ? &slots_[i]->value : nullptr;
+  }
+
+  const V* find( const FlowKey& key ) const
+  {
+    const size_t i = index_of( key );
+    return slots_[i].has_value() ? &slots_[i]->value : nullptr;
+  }
+
+  //! Insert `value` for `key` (which must not be present), and return a reference to it
+  V& insert( const FlowKey& key, V value )
+  {
+    if ( 2 * ( size_ + 1 ) > slots_.size() ) {
+      grow();
+    }
+    const size_t i = index_of( key );
+    slots_[i].emplace( Slot { key, std::move( value ) } );
+    ++size_;
+    return slots_[i]->value;
+  }
+
+  //! Remove `key`; returns `false` if it was not present
+  bool erase( const FlowKey& key )
+  {
+    size_t i = index_of( key );
+    if ( not slots_[i].has_value() ) {
+      return false;
+    }
+    slots_[i].reset();
+    --size_;
+
+    // Backward-shift deletion: move up any entry whose probe run passes through the hole
+    const size_t mask = slots_.size() - 1;
+    for ( size_t j = ( i + 1 ) & mask; slots_[j].has_value(); j = ( j + 1 ) & mask ) {
+      const size_t home = hash( slots_[j]->key ) & mask;
+      if ( ( ( j - home ) & mask ) >= ( ( j - i ) & mask ) ) {
+        slots_[i] = std::move( slots_[j] );
+        slots_[j].reset();
+        i = j;
+      }
+    }
+    return true;
+  }
+
+  //! Call `f( key, value )` on every entry
+  template<class F>
+  void for_each( F&& f )
+  {
+    for ( auto& slot : slots_ ) {
+      if ( slot.has_value() ) {
+        f( std::as_const( slot->key ), slot->value );
+      }
+    }
+  }
+
+  //! Remove every entry for which `pred( key, value )` is true; returns how many were removed
+  template<class Pred>
+  size_t erase_if( Pred&& pred )
+  {
+    doomed_.clear();
+    for_each( [&]( const FlowKey& key, V& value ) {
+      if ( pred( key, value ) ) {
+        doomed_.push_back( key );
+      }
+    } );
+    for ( const auto& key : doomed_ ) {
+      erase( key );
+    }
+    return doomed_.size();
+  }
+
+private:
+  struct Slot
+  {
+    FlowKey key;
+    V value;
+  };
+
+  std::vector<std::optional<Slot>> slots_;
+  size_t size_ {};
+  uint64_t seed_ { std::random_device {}() };
+  std::vector<FlowKey> doomed_ {};
+
+  size_t hash( const FlowKey& key ) const { return flow_hash( key, seed_ ); }
+
+  //! The slot that holds `key`, or the empty slot where it would go
+  size_t index_of( const FlowKey& key ) const
+  {
+    const size_t mask = slots_.size() - 1;
+    size_t i = hash( key ) & mask;
+    while ( slots_[i].has_value() and not( slots_[i]->key == key ) ) {
+      i = ( i + 1 ) & mask;
+    }
+    return i;
+  }
+
+  void grow()
+  {
+    std::vector<std::optional<Slot>> old( slots_.size() * 2 );
+    std::swap( old, slots_ );
+    for ( auto& slot : old ) {
+      if ( slot.has_value() ) {
+        slots_[index_of( slot->key )] = std::move( slot );
+      }
+    }
+  }
+};
@@ -0,0 +1,29 @@
+#include "gro_adapter.hh"
+
+using namespace std;
+
+bool coalesce_tcp_messages( TCPMessage& into, const TCPMessage& next )
+{
+  const TCPSenderMessage& first = into.sender;
+  const TCPSenderMessage& second = next.sender;
+  const TCPReceiverMessage& first_ack = into.receiver;
+  const TCPReceiverMessage& second_ack = next.receiver;
+
+  if ( first.SYN or first.FIN or first.RST or first.CWR or second.SYN or second.RST or second.CWR ) {
+    return false;
+  }
+  if ( first.payload.empty() or second.payload.empty() or second.seqno != first.seqno + first.payload.size() ) {
+    return false;
+  }
+  if ( first_ack.ackno != second_ack.ackno or first_ack.window_size != second_ack.window_size
+       or first_ack.RST or second_ack.RST or first_ack.ECE != second_ack.ECE ) {
+    return false;
+  }
+  if ( into.ECT != next.ECT or into.CE != next.CE ) {
+    return false;
+  }
+
+  into.sender->payload.append( second.payload );
+  into.sender->FIN = second.FIN;
+  return true;
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "file_descriptor.hh"
+#include "tcp_config.hh"
+#include "tcp_segment.hh"
+
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <optional>
+#include <span>
+#include <utility>
+
+//! \brief Merge `next` onto the end of `into` if it is the back-to-back continuation of the same segment stream
+//! \details The two messages must both carry data, `next` must start where `into` ends, and everything else
+//! (ackno, window, and ECN marks) must be the same. No flags may be set, except that `next` may carry the FIN.
+//! \returns `true` if `next` was merged (and can be discarded)
+bool coalesce_tcp_messages( TCPMessage& into, const TCPMessage& next );
+
+//! \brief Generic receive offload: an adapter that coalesces in-order segments before the TCPPeer sees them
+//! \details Each read() drains every datagram that is ready on the underlying file descriptor (up to a batch
+//! limit, reading until the non-blocking descriptor has nothing left, with no poll in between), merging runs of
+//! back-to-back segments into one TCPMessage with a combined payload, as Linux GRO does. The TCPPeer then
+//! parses, reassembles and acknowledges once per run instead of once per segment.
+//! Messages that could not be merged are kept in order; the caller drains them while has_buffered() is true.
+template<typename AdapterT>
+class GROAdapter
+{
+private:
+  //! The underlying FD adapter
+  AdapterT _adapter;
+
+  //! Messages read in the current batch and not yet returned
+  std::deque<TCPMessage> _pending {};
+
+  //! Segments read and messages delivered (so segments - messages were coalesced away)
+  size_t _segments_read {};
+  size_t _messages_delivered {};
+
+public:
+  static constexpr size_t MAX_BATCH = 64;               //!< Most datagrams read per batch
+  static constexpr size_t MAX_MERGED_PAYLOAD = 1 << 16; //!< Largest combined payload, in bytes
+
+  //! Reads go to the underlying AdapterT (see ReadAheadTCPDatagramAdapter)
+  static constexpr bool READS_FD_ONLY = requires { requires AdapterT::READS_FD_ONLY; };
+
+  //! Conversion to a FileDescriptor by returning the underlying AdapterT
+  FileDescriptor& fd() { return _adapter.fd(); }
+
+  //! Construct from the adapter to read from
+  explicit GROAdapter( AdapterT&& adapter ) : _adapter( std::move( adapter ) ) { fd().set_blocking( false ); }
+
+  //! \brief Return the next (possibly coalesced) message, reading a new batch if none is left from the last one
+  std::optional<TCPMessage> read()
+  {
+    if ( _pending.empty() ) {
+      for ( size_t i = 0; i < MAX_BATCH; ++i ) {
+        auto msg = _adapter.read();
+        if ( fd().would_block() ) {
+          break;
+        }
+        if ( not msg.has_value() ) {
+          continue;
+        }
+        ++_segments_read;
+        if ( _pending.empty()
+             or _pending.back().sender->payload.size() + msg->sender->payload.size() > MAX_MERGED_PAYLOAD
+             or not coalesce_tcp_messages( _pending.back(), msg.value() ) ) {
+          _pending.push_back( std::move( msg.value() ) );
+        }
+      }
+    }
+
+    if ( _pending.empty() ) {
+      return {};
+    }
+    TCPMessage ret = std::move( _pending.front() );
+    _pending.pop_front();
+    ++_messages_delivered;
+    return ret;
+  }
+
+  //! Are there messages left over from the last batch?
+  bool has_buffered() const { return not _pending.empty(); }
+
+  //! Write to the underlying AdapterT instance
+  void write( const TCPMessage& seg ) { _adapter.write( seg ); }
+
+  //! Write a batch to the underlying AdapterT instance (if it takes batches)
+  void write_batch( std::span<const TCPMessage> msgs )
+    requires requires( AdapterT& a ) { a.write_batch( msgs ); }
+  {
+    _adapter.write_batch( msgs );
+  }
+
+  size_t segments_read() const { return _segments_read; }           //!< Segments read from the adapter
+  size_t messages_delivered() const { return _messages_delivered; } //!< Messages returned by read()
+
+  //! \name
+  //! Passthrough functions to the underlying AdapterT instance
+
+  void set_listening( const bool l ) { _adapter.set_listening( l ); } //!< FdAdapterBase::set_listening passthrough
+  const FdAdapterConfig& config() const { return _adapter.config(); } //!< FdAdapterBase::config passthrough
+  FdAdapterConfig& config_mut() { return _adapter.config_mut(); }     //!< FdAdapterBase::config_mut passthrough
+  void tick( const std::chrono::microseconds since_last_tick ) { _adapter.tick( since_last_tick ); }
+  bool has_fast_open_cookie() const { return _adapter.has_fast_open_cookie(); }
+};
@@ -0,0 +1,244 @@
+#include "io_uring.hh"
+#include "exception.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <ctime>
+#include <iterator>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+int io_uring_setup( unsigned entries, io_uring_params& params )
+{
+  return static_cast<int>( ::syscall( __NR_io_uring_setup, entries, &params ) );
+}
+
+span<byte> map_ring( int fd, size_t length, off_t offset )
+{
+  void* const ring = ::mmap( nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset );
+  if ( ring == MAP_FAILED ) {
+    throw unix_error { "mmap" };
+  }
+  return { static_cast<byte*>( ring ), length };
+}
+
+template<typename T>
+T* at_offset( span<byte> ring, uint32_t offset )
+{
+  return reinterpret_cast<T*>( ring.data() + offset ); // NOLINT(*-reinterpret-cast)
+}
+} // namespace
+
+IoUring::IoUring( const unsigned entries )
+  : ring_fd_( CheckSystemCall( "io_uring_setup", io_uring_setup( entries, params_ ) ) )
+{
+  const auto& sq = params_.sq_off;
+  const auto& cq = params_.cq_off;
+  sq_ring_ = map_ring( ring_fd_.fd_num(), sq.array + params_.sq_entries * sizeof( unsigned ), IORING_OFF_SQ_RING );
+  cq_ring_ = map_ring( ring_fd_.fd_num(), cq.cqes + params_.cq_entries * sizeof( io_uring_cqe ), IORING_OFF_CQ_RING );
+  const auto sqes = map_ring( ring_fd_.fd_num(), params_.sq_entries * sizeof( io_uring_sqe ), IORING_OFF_SQES );
+  sqes_ = { reinterpret_cast<io_uring_sqe*>( sqes.data() ), params_.sq_entries }; // NOLINT(*-reinterpret-cast)
+
+  sq_head_ = at_offset<unsigned>( sq_ring_, sq.head );
+  sq_tail_ = at_offset<unsigned>( sq_ring_, sq.tail );
+  sq_mask_ = *at_offset<unsigned>( sq_ring_, sq.ring_mask );
+  sq_array_ = at_offset<unsigned>( sq_ring_, sq.array );
+  cq_head_ = at_offset<unsigned>( cq_ring_, cq.head );
+  cq_tail_ = at_offset<unsigned>( cq_ring_, cq.tail );
+  cq_mask_ = *at_offset<unsigned>( cq_ring_, cq.ring_mask );
+  cqes_ = at_offset<io_uring_cqe>( cq_ring_, cq.cqes );
+}
+
+IoUring::~IoUring()
+{
+  ::munmap( sqes_.data(), sqes_.size_bytes() );
+  ::munmap( cq_ring_.data(), cq_ring_.size() );
+  ::munmap( sq_ring_.data(), sq_ring_.size() );
+}
+
+bool IoUring::available()
+{
+  static const bool available = [] {
+    try {
+      const IoUring probe { 1 };
+      return true;
+    } catch ( const unix_error& ) {
+      return false;
+    }
+  }();
+  return available;
+}
+
+unsigned IoUring::load_acquire( const unsigned* p )
+{
+  return atomic_ref<const unsigned> { *p }.load( memory_order_acquire );
+}
+
+void IoUring::store_release( unsigned* p, unsigned value )
+{
+  atomic_ref<unsigned> { *p }.store( value, memory_order_release );
+}
+
+io_uring_sqe& IoUring::next_sqe()
+{
+  const unsigned tail = *sq_tail_;
+  if ( tail - load_acquire( sq_head_ ) == params_.sq_entries ) {
+    submit();
+  }
+
+  const unsigned index = tail & sq_mask_;
+  io_uring_sqe& sqe = sqes_[index];
+  sqe = {};
+  sq_array_[index] = index;
+  store_release( sq_tail_, tail + 1 );
+  ++pending_;
+  return sqe;
+}
+
+void IoUring::submit( const unsigned wait_nr, const int timeout_ms )
+{
+  unsigned flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+  __kernel_timespec ts { .tv_sec = timeout_ms / 1000,
+                         .tv_nsec = static_cast<long long>( timeout_ms % 1000 ) * 1'000'000 };
+  io_uring_getevents_arg arg {
+    .sigmask = 0, .sigmask_sz = _NSIG / 8, .pad = 0, .ts = reinterpret_cast<uint64_t>( &ts ) }; // NOLINT(*-cast)
+  const bool with_timeout = wait_nr > 0 and timeout_ms >= 0;
+  if ( with_timeout ) {
+    flags |= IORING_ENTER_EXT_ARG;
+  }
+
+  // The kernel reports a failed wait (ETIME or EINTR) only if the call submitted nothing, so those requests are
+  // still pending. An interrupted call is made again; a timed-out wait returns.
+  long ret = 0;
+  do {
+    ++enters_;
+    ret = ::syscall( __NR_io_uring_enter,
+                     ring_fd_.fd_num(),
+                     pending_,
+                     wait_nr,
+                     flags,
+                     with_timeout ? &arg : nullptr,
+                     with_timeout ? sizeof( arg ) : 0 );
+  } while ( ret < 0 and errno == EINTR );
+  if ( ret < 0 ) {
+    if ( errno == ETIME ) {
+      return;
+    }
+    throw unix_error { "io_uring_enter" };
+  }
+  pending_ -= min( pending_, static_cast<unsigned>( ret ) );
+}
+
+void IoUring::register_files( span<const int> fds )
+{
+  CheckSystemCall( "io_uring_register",
+                   static_cast<int>( ::syscall(
+                     __NR_io_uring_register, ring_fd_.fd_num(), IORING_REGISTER_FILES, fds.data(), fds.size() ) ) );
+}
+
+void IoUring::update_file( const unsigned index, const int fd )
+{
+  io_uring_files_update update {
+    .offset = index, .resv = 0, .fds = reinterpret_cast<uint64_t>( &fd ) }; // NOLINT(*-reinterpret-cast)
+  CheckSystemCall( "io_uring_register",
+                   static_cast<int>( ::syscall(
+                     __NR_io_uring_register, ring_fd_.fd_num(), IORING_REGISTER_FILES_UPDATE, &update, 1 ) ) );
+}
+
+void IoUring::register_buffer( span<char> buffer )
+{
+  const iovec vec { .iov_base = buffer.data(), .iov_len = buffer.size() };
+  CheckSystemCall(
+    "io_uring_register",
+    static_cast<int>( ::syscall( __NR_io_uring_register, ring_fd_.fd_num(), IORING_REGISTER_BUFFERS, &vec, 1 ) ) );
+}
+
+BatchWriter::BatchWriter( FileDescriptor& fd, bool use_io_uring ) : fd_( fd.duplicate() )
+{
+  if ( use_io_uring ) {
+    uring_ = make_unique<IoUring>( MAX_BATCH );
+    buffer_.resize( BUFFER_SIZE );
+    const int fd_num = fd_.fd_num();
+    uring_->register_files( span { &fd_num, 1 } );
+    uring_->register_buffer( buffer_ );
+  }
+}
+
+void BatchWriter::add( span<const string_view> buffers )
+{
+  if ( not uring_ ) {
+    static thread_local vector<string_view> nonempty; // (FileDescriptor::write does not take empty buffers)
+    nonempty.clear();
+    ranges::copy_if( buffers, back_inserter( nonempty ), []( string_view buffer ) { return not buffer.empty(); } );
+    ++syscalls_;
+    fd_.write( span { nonempty } );
+    return;
+  }
+
+  size_t length = 0;
+  for ( const auto buffer : buffers ) {
+    length += buffer.size();
+  }
+  if ( length > BUFFER_SIZE ) {
+    throw runtime_error( "BatchWriter: datagram too long" );
+  }
+  if ( used_ + length > BUFFER_SIZE or batch_size_ == MAX_BATCH ) {
+    flush();
+  }
+
+  char* const datagram = buffer_.data() + used_;
+  for ( const auto buffer : buffers ) {
+    ranges::copy( buffer, buffer_.data() + used_ );
+    used_ += buffer.size();
+  }
+
+  // each write is linked to the next, so they are done in order (the last write's link is taken off in flush)
+  io_uring_sqe& sqe = uring_->next_sqe();
+  sqe.opcode = IORING_OP_WRITE_FIXED;
+  sqe.flags = IOSQE_FIXED_FILE | IOSQE_IO_LINK;
+  sqe.fd = 0;
+  sqe.addr = reinterpret_cast<uint64_t>( datagram ); // NOLINT(*-reinterpret-cast)
+  sqe.len = static_cast<uint32_t>( length );
+  sqe.buf_index = 0;
+  sqe.user_data = length;
+  last_sqe_ = &sqe;
+  ++batch_size_;
+}
+
+void BatchWriter::flush()
+{
+  if ( batch_size_ == 0 ) {
+    return;
+  }
+
+  last_sqe_->flags &= ~IOSQE_IO_LINK;
+
+  // The buffer can be reused only once every write has completed. A wait can end early (the call that submits
+  // the requests returns once they are submitted, even if its wait was cut short), so count the completions.
+  int error = 0;
+  unsigned completed = 0;
+  while ( completed < batch_size_ ) {
+    ++syscalls_;
+    uring_->submit( batch_size_ - completed );
+    completed += uring_->for_each_completion( [&]( const io_uring_cqe& cqe ) {
+      if ( cqe.res < 0 and error == 0 ) {
+        error = -cqe.res;
+      } else if ( cqe.res >= 0 and static_cast<uint64_t>( cqe.res ) != cqe.user_data and error == 0 ) {
+        error = EMSGSIZE; // a datagram device writes all of a datagram or none of it
+      }
+    } );
+  }
+  used_ = 0;
+  batch_size_ = 0;
+  last_sqe_ = nullptr;
+  if ( error ) {
+    throw unix_error { "io_uring write", error };
+  }
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include "file_descriptor.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <linux/io_uring.h>
+#include <memory>
+#include <span>
+#include <string_view>
+#include <vector>
+
+//! \brief An [io_uring(7)](\ref man7::io_uring) instance: a submission queue and a completion queue shared with
+//! the kernel
+//! \details This is the little of liburing that minnow needs, over the raw system calls. Requests are prepared
+//! in the submission queue with next_sqe(), and submitted together (and waited for) with one call to submit().
+class IoUring
+{
+public:
+  //! Set up a ring with room for `entries` requests (throws unix_error if the kernel does not have io_uring)
+  explicit IoUring( unsigned entries );
+  ~IoUring();
+
+  //! The rings are mapped memory, and the queues point into them, so they stay in place
+  IoUring( const IoUring& ) = delete;
+  IoUring& operator=( const IoUring& ) = delete;
+  IoUring( IoUring&& ) = delete;
+  IoUring& operator=( IoUring&& ) = delete;
+
+  //! Can this process set up an io_uring? (Checked once, by setting one up.)
+  static bool available();
+
+  //! A zeroed entry at the tail of the submission queue (which is submitted first, if the queue is full)
+  io_uring_sqe& next_sqe();
+
+  //! \brief Submit the prepared requests, and wait until `wait_nr` requests have completed
+  //! \details With a `timeout_ms` (not negative), returns after that long, even if fewer have completed. A call
+  //! that submits requests may also return before they complete, so a caller that needs them done counts the
+  //! completions. A wait interrupted by a signal is restarted.
+  void submit( unsigned wait_nr = 0, int timeout_ms = -1 );
+
+  //! Call `f( cqe )` for each completion in the completion queue, and consume them; returns how many
+  template<class F>
+  size_t for_each_completion( F&& f )
+  {
+    size_t count = 0;
+    for ( unsigned head = load_acquire( cq_head_ ); head != load_acquire( cq_tail_ ); ++head, ++count ) {
+      f( static_cast<const io_uring_cqe&>( cqes_[head & cq_mask_] ) );
+      store_release( cq_head_, head + 1 );
+    }
+    return count;
+  }
+
+  //! Register files with the ring, so a request can name them by index (with IOSQE_FIXED_FILE); an fd of -1
+  //! leaves its index empty, to be filled in by update_file()
+  void register_files( std::span<const int> fds );
+
+  //! Put `fd` (or nothing, for -1) at an index of the registered files
+  void update_file( unsigned index, int fd );
+
+  //! Register a buffer with the ring, so a READ_FIXED or WRITE_FIXED request (with buf_index 0) need not map it
+  void register_buffer( std::span<char> buffer );
+
+  //! Prepared requests that have not been submitted
+  unsigned pending() const { return pending_; }
+
+  //! Calls to [io_uring_enter(2)](\ref man2::io_uring_enter)
+  uint64_t enters() const { return enters_; }
+
+private:
+  static unsigned load_acquire( const unsigned* p );
+  static void store_release( unsigned* p, unsigned value );
+
+  io_uring_params params_ {}; //!< Filled in by io_uring_setup, as ring_fd_ is initialized (so it comes first)
+  FileDescriptor ring_fd_;
+
+  std::span<std::byte> sq_ring_ {};
+  std::span<std::byte> cq_ring_ {};
+  std::span<io_uring_sqe> sqes_ {};
+
+  unsigned* sq_head_ {};
+  unsigned* sq_tail_ {};
+  unsigned sq_mask_ {};
+  unsigned* sq_array_ {};
+  unsigned* cq_head_ {};
+  unsigned* cq_tail_ {};
+  unsigned cq_mask_ {};
+  io_uring_cqe* cqes_ {};
+
+  unsigned pending_ {};
+  uint64_t enters_ {};
+};
+
+//! \brief Writes a batch of datagrams to a file descriptor (e.g. a TUN device) with one system call
+//! \details Each datagram is copied into a buffer registered with an io_uring, and written with a WRITE_FIXED
+//! request on the fd as a fixed file; the requests are linked, so the datagrams go out in order. Without
+//! io_uring, each datagram is a separate write(2).
+class BatchWriter
+{
+public:
+  //! Room in the registered buffer for one batch (a longer batch is written in pieces)
+  static constexpr size_t BUFFER_SIZE = 256 * 1024;
+
+  //! Most datagrams in one batch (and so, in one system call)
+  static constexpr unsigned MAX_BATCH = 256;
+
+  explicit BatchWriter( FileDescriptor& fd, bool use_io_uring = IoUring::available() );
+  ~BatchWriter() = default;
+
+  BatchWriter( const BatchWriter& ) = delete;
+  BatchWriter& operator=( const BatchWriter& ) = delete;
+  BatchWriter( BatchWriter&& ) = default;
+  BatchWriter& operator=( BatchWriter&& ) = default;
+
+  //! Add a datagram (given as the buffers to concatenate) to the batch
+  void add( std::span<const std::string_view> buffers );
+
+  //! Write out the batch
+  void flush();
+
+  bool uses_io_uring() const { return uring_ != nullptr; }
+
+  //! System calls made for the datagrams (io_uring_enter, or write)
+  uint64_t syscalls() const { return syscalls_; }
+
+private:
+  FileDescriptor fd_;
+  std::unique_ptr<IoUring> uring_ {};
+  std::vector<char> buffer_ {};
+  size_t used_ {};
+  unsigned batch_size_ {};
+  io_uring_sqe* last_sqe_ {}; //!< The last write in the batch (whose link to the next is removed on flush)
+  uint64_t syscalls_ {};
+};
@@ -13,6 +13,13 @@ struct IPv4Header
   static constexpr uint8_t DEFAULT_TTL = 128; // A reasonable default TTL value
   static constexpr uint8_t PROTO_TCP = 6;     // Protocol number for TCP
 
+  // ECN codepoints, in the low two bits of the type-of-service field (RFC 3168)
+  static constexpr uint8_t ECN_MASK = 0b11;
+  static constexpr uint8_t ECN_NOT_ECT = 0b00; // Not ECN-capable transport
+  static constexpr uint8_t ECN_ECT1 = 0b01;    // ECN-capable transport, ECT(1)
+  static constexpr uint8_t ECN_ECT0 = 0b10;    // ECN-capable transport, ECT(0)
+  static constexpr uint8_t ECN_CE = 0b11;      // Congestion experienced
+
   static constexpr uint64_t serialized_length() { return LENGTH; }
 
   /*
@@ -51,6 +58,10 @@ struct IPv4Header
   // Length of the payload
   uint16_t payload_length() const;
 
+  // ECN field of the type of service (does not recompute the checksum)
+  uint8_t ecn() const { return tos & ECN_MASK; }
+  void set_ecn( uint8_t codepoint ) { tos = static_cast<uint8_t>( ( tos & ~ECN_MASK ) | ( codepoint & ECN_MASK ) ); }
+
   // Pseudo-header's contribution to the TCP checksum
   uint32_t pseudo_checksum() const;
 
@@ -5,8 +5,10 @@
 #include "tcp_config.hh"
 #include "tcp_segment.hh"
 
+#include <chrono>
 #include <optional>
 #include <random>
+#include <span>
 #include <utility>
 
 //! An adapter class that adds random dropping behavior to an FD adapter
@@ -31,6 +33,9 @@ private:
   }
 
 public:
+  //! Reads go to the underlying AdapterT (see ReadAheadTCPDatagramAdapter)
+  static constexpr bool READS_FD_ONLY = requires { requires AdapterT::READS_FD_ONLY; };
+
   //! Conversion to a FileDescriptor by returning the underlying AdapterT
   FileDescriptor& fd() { return _adapter.fd(); }
 
@@ -59,11 +64,31 @@ public:
     return _adapter.write( seg );
   }
 
+  //! \brief Write a batch to the underlying AdapterT instance (if it takes batches), potentially dropping each
+  //! datagram; the runs of datagrams that are kept are passed on as batches
+  void write_batch( std::span<const TCPMessage> msgs )
+    requires requires( AdapterT& a ) { a.write_batch( msgs ); }
+  {
+    size_t run = 0; // first message of the current run
+    for ( size_t i = 0; i < msgs.size(); ++i ) {
+      if ( _should_drop( true ) ) {
+        if ( i > run ) {
+          _adapter.write_batch( msgs.subspan( run, i - run ) );
+        }
+        run = i + 1;
+      }
+    }
+    if ( msgs.size() > run ) {
+      _adapter.write_batch( msgs.subspan( run ) );
+    }
+  }
+
   //! \name
   //! Passthrough functions to the underlying AdapterT instance
 
   void set_listening( const bool l ) { _adapter.set_listening( l ); } //!< FdAdapterBase::set_listening passthrough
   const FdAdapterConfig& config() const { return _adapter.config(); } //!< FdAdapterBase::config passthrough
   FdAdapterConfig& config_mut() { return _adapter.config_mut(); }     //!< FdAdapterBase::config_mut passthrough
-  void tick( const size_t ms_since_last_tick ) { _adapter.tick( ms_since_last_tick ); }
+  void tick( const std::chrono::microseconds since_last_tick ) { _adapter.tick( since_last_tick ); }
+  bool has_fast_open_cookie() const { return _adapter.has_fast_open_cookie(); }
 };
@@ -0,0 +1,133 @@
+#include "ring_pipe.hh"
+#include "exception.hh"
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <poll.h>
+#include <stdexcept>
+#include <string>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+FileDescriptor make_event()
+{
+  return FileDescriptor { CheckSystemCall( "eventfd", ::eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC ) ) };
+}
+
+FileDescriptor dup_fd( const FileDescriptor& fd )
+{
+  return FileDescriptor { CheckSystemCall( "dup", ::dup( fd.fd_num() ) ) };
+}
+} // namespace
+
+RingPipe::RingPipe( const size_t capacity )
+  : buffer_( bit_ceil( max( capacity, size_t { 1 } ) ) )
+  , readable_event_( make_event() )
+  , readable_signal_( dup_fd( readable_event_ ) )
+  , writable_event_( make_event() )
+  , writable_signal_( dup_fd( writable_event_ ) )
+{
+  // (so a clear with nothing signalled reads nothing, rather than throwing)
+  readable_event_.set_blocking( false );
+  writable_event_.set_blocking( false );
+}
+
+size_t RingPipe::available_capacity() const
+{
+  return buffer_.size() - ( tail_.load( memory_order_relaxed ) - head_.load( memory_order_acquire ) );
+}
+
+// The fences (here and in pop) make the check for a waiting peer safe: either the peer sees this side's new
+// index before it decides to wait, or this side sees that the peer had caught up, and signals it.
+size_t RingPipe::write( const string_view data )
+{
+  if ( reader_closed() ) {
+    throw runtime_error( "RingPipe: write with no reader" );
+  }
+
+  const size_t tail = tail_.load( memory_order_relaxed );
+  const size_t len = min( data.size(), available_capacity() );
+  if ( len == 0 ) {
+    return 0;
+  }
+
+  const size_t offset = tail & ( buffer_.size() - 1 );
+  const size_t first = min( len, buffer_.size() - offset );
+  ranges::copy( data.substr( 0, first ), buffer_.begin() + static_cast<ptrdiff_t>( offset ) );
+  ranges::copy( data.substr( first, len - first ), buffer_.begin() );
+  tail_.store( tail + len, memory_order_release );
+
+  atomic_thread_fence( memory_order_seq_cst );
+  if ( head_.load( memory_order_relaxed ) == tail ) {
+    signal( readable_signal_ ); // the reader had read everything, so it may be waiting
+  }
+  return len;
+}
+
+void RingPipe::close()
+{
+  closed_.store( true, memory_order_release );
+  signal( readable_signal_ );
+}
+
+string_view RingPipe::peek() const
+{
+  const size_t head = head_.load( memory_order_relaxed );
+  const size_t tail = tail_.load( memory_order_acquire );
+  const size_t offset = head & ( buffer_.size() - 1 );
+  return { buffer_.data() + offset, min( tail - head, buffer_.size() - offset ) };
+}
+
+void RingPipe::pop( const size_t len )
+{
+  const size_t head = head_.load( memory_order_relaxed );
+  if ( len > tail_.load( memory_order_acquire ) - head ) {
+    throw runtime_error( "RingPipe: pop of more than is buffered" );
+  }
+  head_.store( head + len, memory_order_release );
+
+  atomic_thread_fence( memory_order_seq_cst );
+  if ( len > 0 and tail_.load( memory_order_relaxed ) - head == buffer_.size() ) {
+    signal( writable_signal_ ); // the writer had filled the ring, so it may be waiting
+  }
+}
+
+size_t RingPipe::bytes_buffered() const
+{
+  return tail_.load( memory_order_acquire ) - head_.load( memory_order_relaxed );
+}
+
+bool RingPipe::is_finished() const
+{
+  // (closed_ first: once it is set, the writer's last tail_ is visible)
+  return closed_.load( memory_order_acquire ) and bytes_buffered() == 0;
+}
+
+void RingPipe::close_reader()
+{
+  reader_closed_.store( true, memory_order_release );
+  signal( writable_signal_ );
+}
+
+void RingPipe::signal( FileDescriptor& event )
+{
+  const uint64_t one = 1;
+  event.write( string_view { reinterpret_cast<const char*>( &one ), sizeof( one ) } ); // NOLINT(*-reinterpret-cast)
+}
+
+void RingPipe::clear( FileDescriptor& event )
+{
+  string counter( sizeof( uint64_t ), 0 );
+  event.read( counter );
+}
+
+void RingPipe::wait( FileDescriptor& event )
+{
+  pollfd pfd { event.fd_num(), POLLIN, 0 };
+  CheckSystemCall( "poll", ::poll( &pfd, 1, -1 ) );
+  clear( event );
+}
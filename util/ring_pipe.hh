@@ -0,0 +1,81 @@
+#pragma once
+
+#include "file_descriptor.hh"
+
+#include <atomic>
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+//! \brief A one-way byte channel between two threads of one process: a pipe, but with the bytes in a lock-free
+//! ring in the process's own memory
+//! \details A write copies the bytes into the ring, and a read copies them out (or peeks at them in place), with
+//! no system call. The eventfds are only for waiting: the reader waits on readable_event() when the ring is
+//! empty, and the writer on writable_event() when it is full. Each side signals the other only when the other
+//! may be waiting -- a write when the reader had read everything, a pop when the writer had filled the ring --
+//! so a bulk transfer in which neither side catches up with the other makes no system calls at all.
+//!
+//! One thread writes (write, close) and one other thread reads (peek, pop, close_reader).
+class RingPipe
+{
+public:
+  //! A ring of at least `capacity` bytes (rounded up to a power of two)
+  explicit RingPipe( size_t capacity );
+
+  size_t capacity() const { return buffer_.size(); }
+
+  //! \name Writer
+  //!@{
+  size_t write( std::string_view data ); //!< Copy as much of `data` as fits, and return how much
+  void close();                          //!< Nothing more will be written (the reader sees EOF when it drains)
+  size_t available_capacity() const;     //!< How many bytes a write could copy right now
+  bool reader_closed() const { return reader_closed_.load( std::memory_order_acquire ); }
+
+  //! Signalled when a pop makes room in a full ring, or the reader closes
+  FileDescriptor& writable_event() { return writable_event_; }
+  //!@}
+
+  //! \name Reader
+  //!@{
+  std::string_view peek() const; //!< The next bytes (maybe not all of them, if they wrap around the ring)
+  void pop( size_t len );        //!< Remove `len` bytes
+  size_t bytes_buffered() const;
+  bool is_finished() const; //!< Closed, and fully popped
+  void close_reader();      //!< Nothing more will be read (so a write throws)
+
+  //! Signalled when a write puts bytes in an empty ring, or the writer closes
+  FileDescriptor& readable_event() { return readable_event_; }
+  //!@}
+
+  //! \name Indices
+  //! Bytes ever written, and ever popped: a side that spins instead of waiting on an event watches the other
+  //! side's index move
+  //!@{
+  size_t bytes_written() const { return tail_.load( std::memory_order_acquire ); }
+  size_t bytes_popped() const { return head_.load( std::memory_order_acquire ); }
+  //!@}
+
+  //! Clear an event after waking on it
+  static void clear( FileDescriptor& event );
+
+  //! Block until an event is signalled, and clear it
+  static void wait( FileDescriptor& event );
+
+private:
+  static constexpr size_t CACHE_LINE = 64;
+
+  static void signal( FileDescriptor& event );
+
+  std::vector<char> buffer_;
+
+  FileDescriptor readable_event_;  //!< eventfd, read by the reader
+  FileDescriptor readable_signal_; //!< The same eventfd, written by the writer
+  FileDescriptor writable_event_;  //!< eventfd, read by the writer
+  FileDescriptor writable_signal_; //!< The same eventfd, written by the reader
+
+  std::atomic<bool> closed_ { false };
+  std::atomic<bool> reader_closed_ { false };
+
+  alignas( CACHE_LINE ) std::atomic<size_t> head_ { 0 }; //!< Bytes popped (written by the reader)
+  alignas( CACHE_LINE ) std::atomic<size_t> tail_ { 0 }; //!< Bytes written (written by the writer)
+};
@@ -0,0 +1,119 @@
+#pragma once
+
+#include "file_descriptor.hh"
+#include "flow_table.hh"
+#include "spsc_queue.hh"
+#include "tcp_config.hh"
+#include "tcp_stack.hh"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+//! \brief A TCP endpoint over one IPv4 device, sharded by flow across worker threads
+//! \details Each shard is a TCPStack with its own EventLoop, running on its own thread, and owns some of the
+//! connections. The datagrams reach the shards in one of two ways:
+//!
+//! - With one device queue per shard (e.g. the queues of a multi-queue TunFD), the device steers the flows:
+//!   each shard's stack reads and writes its own queue, and no thread sits between the device and the shards,
+//!   so the receive path scales with the shards (and the cores) as the TCP work does. A shard owns the flows
+//!   that the device steers to its queue: for a multi-queue TUN device, the flows the kernel spreads onto it,
+//!   and those it last wrote to the device (so a connection a shard opens comes back to it).
+//! - With a single device fd, a dispatcher thread reads the device, finds each datagram's 4-tuple in its
+//!   headers, and passes the datagram to the shard its flow hash (shard_of()) selects, through a lock-free
+//!   SPSCQueue, waking the shard with an eventfd. Shards write their outbound datagrams to the device directly.
+//!   Every inbound datagram passes through the one dispatcher thread (a read system call, a header lookup and
+//!   a queue push each), so the inbound rate is bounded by that thread however many shards there are.
+//!
+//! The application runs on the shards, shared-nothing: the setup function is called on each shard's thread
+//! before its loop starts, to add listeners and rules to that shard's TCPStack, and everything it touches from
+//! there on belongs to that shard. Every shard should listen on the same ports (like SO_REUSEPORT), since a SYN
+//! goes to whichever shard its flow is steered to. To connect from a shard behind the dispatcher, pick a local
+//! port for which shard_of() is that shard, so that the replies are steered back to it.
+class ShardedTCPStack
+{
+public:
+  using SetupFunction = std::function<void( TCPStack& stack, size_t shard )>;
+
+  //! Capacity of each shard's inbound queue, in datagrams (the dispatcher drops datagrams beyond it)
+  static constexpr size_t QUEUE_CAPACITY = 4096;
+
+  //! Most datagrams read from the device on one wakeup of the dispatcher
+  static constexpr size_t MAX_READS_PER_EVENT = 64;
+
+  //! Largest datagram the dispatcher reads from the device (a longer one is truncated, and then dropped)
+  static constexpr size_t MAX_DATAGRAM_SIZE = 16384;
+
+  //! How often the dispatcher and the shards check for stop(), in milliseconds (a shard's timers wake it on
+  //! their own)
+  static constexpr int STOP_CHECK_MS = 10;
+
+  //! Take over `device` (see TCPStack), and start `n_shards` shards behind a dispatcher, each set up by `setup`
+  ShardedTCPStack( FileDescriptor&& device, size_t n_shards, const TCPConfig& cfg, const SetupFunction& setup );
+
+  //! Take over the queues of a device that steers the flows itself, and start a shard on each, set up by `setup`
+  ShardedTCPStack( std::vector<FileDescriptor>&& queues, const TCPConfig& cfg, const SetupFunction& setup );
+
+  //! Stops the shards and the dispatcher
+  ~ShardedTCPStack();
+
+  //! Stop the shards and the dispatcher, and wait for their threads to finish
+  void stop();
+
+  size_t shard_count() const { return shards_.size(); }
+
+  //! The shard that the dispatcher steers a flow to (from this endpoint's side); with device queues, the device
+  //! decides instead
+  size_t shard_of( const FlowKey& flow ) const { return flow_hash( flow, seed_ ) % shards_.size(); }
+
+  //! Datagrams that the dispatcher dropped because the shard's inbound queue was full
+  uint64_t datagrams_dropped( size_t shard ) const { return shards_.at( shard )->dropped.load(); }
+
+  //! \name
+  //! The threads refer to this object, so it cannot be moved or copied
+
+  //!@{
+  ShardedTCPStack( const ShardedTCPStack& ) = delete;
+  ShardedTCPStack( ShardedTCPStack&& ) = delete;
+  ShardedTCPStack& operator=( const ShardedTCPStack& ) = delete;
+  ShardedTCPStack& operator=( ShardedTCPStack&& ) = delete;
+  //!@}
+
+private:
+  struct Shard
+  {
+    SPSCQueue<std::string> inbound { QUEUE_CAPACITY }; //!< Datagrams steered to the shard
+    FileDescriptor wakeup;                              //!< eventfd, read by the shard
+    FileDescriptor wakeup_writer;                       //!< The same eventfd, written by the dispatcher
+    std::atomic<uint64_t> dropped {};
+    std::optional<FileDescriptor> queue {}; //!< The shard's own device queue, if the device steers the flows
+    std::thread thread {};
+
+    Shard();
+  };
+
+  uint64_t seed_;
+  std::optional<FileDescriptor> device_ {}; //!< The device the dispatcher reads (without device queues)
+  std::vector<std::unique_ptr<Shard>> shards_ {};
+  std::atomic_bool stop_ { false };
+  std::thread dispatcher_ {};
+
+  //! Start the shards' threads
+  void start_shards( const TCPConfig& cfg, const SetupFunction& setup );
+
+  //! The shard that a raw datagram is steered to (shard 0 if it has no TCP 4-tuple)
+  size_t steer( std::string_view datagram ) const;
+
+  //! Main loop of the dispatcher thread
+  void dispatch();
+
+  //! Main loop of a shard's thread
+  void run_shard( size_t index, const TCPConfig& cfg, const SetupFunction& setup );
+};
@@ -214,6 +214,46 @@ void DatagramSocket::send( vector<iovec>& iovecs, size_t total_size, const optio
   }
 }
 
+void DatagramSocket::send_batch( span<const string> payloads, const optional<Address>& destination )
+{
+  static thread_local vector<iovec> iovecs;
+  static thread_local vector<mmsghdr> messages;
+  iovecs.resize( payloads.size() );
+  messages.resize( payloads.size() );
+
+  for ( size_t i = 0; i < payloads.size(); ++i ) {
+    // NOLINTNEXTLINE(*-const-cast)
+    iovecs[i] = { .iov_base = const_cast<char*>( payloads[i].data() ), .iov_len = payloads[i].size() };
+    messages[i] = { .msg_hdr = { .msg_name = destination.has_value() // NOLINTNEXTLINE(*-const-cast)
+                                               ? static_cast<void*>( const_cast<sockaddr*>( destination->raw() ) )
+                                               : nullptr,
+                                 .msg_namelen = destination.has_value() ? destination->size() : 0,
+                                 .msg_iov = &iovecs[i],
+                                 .msg_iovlen = 1,
+                                 .msg_control = nullptr,
+                                 .msg_controllen {},
+                                 .msg_flags {} },
+                    .msg_len = 0 };
+  }
+
+  size_t sent = 0;
+  while ( sent < payloads.size() ) {
+    const size_t count = CheckFDSystemCall(
+      "sendmmsg", ::sendmmsg( fd_num(), messages.data() + sent, static_cast<unsigned>( payloads.size() - sent ), 0 ) );
+    register_write();
+    if ( count == 0 ) {
+      throw runtime_error( "sendmmsg sent no datagrams" );
+    }
+    sent += count;
+  }
+
+  for ( size_t i = 0; i < payloads.size(); ++i ) {
+    if ( messages[i].msg_len != payloads[i].size() ) {
+      throw runtime_error( "sendmmsg sent some length other than that of payload" );
+    }
+  }
+}
+
 // mark the socket as listening for incoming connections
 //! \param[in] backlog is the number of waiting connections to queue (see [listen(2)](\ref man2::listen))
 void TCPSocket::listen( const int backlog )
@@ -4,6 +4,8 @@
 #include "file_descriptor.hh"
 
 #include <functional>
+#include <span>
+#include <string>
 #include <sys/socket.h>
 
 //! \brief Base class for network sockets (TCP, UDP, etc.)
@@ -73,6 +75,9 @@ public:
     send( iovecs, total_size, destination );
   }
 
+  //! Send several datagrams with one system call (see [sendmmsg(2)](\ref man2::sendmmsg))
+  void send_batch( std::span<const std::string> payloads, const std::optional<Address>& destination = {} );
+
 private:
   void send( std::vector<iovec>& iovecs, size_t total_size, const std::optional<Address>& destination = {} );
 
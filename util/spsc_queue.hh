@@ -0,0 +1,62 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+//! \brief A bounded, lock-free queue between one producer thread and one consumer thread
+//! \details A ring of slots with a head index (advanced by the consumer) and a tail index (advanced by the
+//! producer). Each side keeps a cached copy of the other side's index, so it touches the other side's cache
+//! line only when the ring looks full (to the producer) or empty (to the consumer).
+template<class T>
+class SPSCQueue
+{
+public:
+  explicit SPSCQueue( size_t capacity ) : slots_( std::bit_ceil( std::max( capacity, size_t { 2 } ) ) ) {}
+
+  size_t capacity() const { return slots_.size(); }
+
+  //! Producer: append `value`, unless the queue is full (then returns `false`, and `value` is untouched)
+  bool push( T&& value )
+  {
+    const size_t tail = tail_.load( std::memory_order_relaxed );
+    if ( tail - head_cache_ == slots_.size() ) {
+      head_cache_ = head_.load( std::memory_order_acquire );
+      if ( tail - head_cache_ == slots_.size() ) {
+        return false;
+      }
+    }
+    slots_[tail & ( slots_.size() - 1 )] = std::move( value );
+    tail_.store( tail + 1, std::memory_order_release );
+    return true;
+  }
+
+  //! Consumer: move the oldest value into `out`, unless the queue is empty (then returns `false`)
+  bool pop( T& out )
+  {
+    const size_t head = head_.load( std::memory_order_relaxed );
+    if ( head == tail_cache_ ) {
+      tail_cache_ = tail_.load( std::memory_order_acquire );
+      if ( head == tail_cache_ ) {
+        return false;
+      }
+    }
+    out = std::move( slots_[head & ( slots_.size() - 1 )] );
+    head_.store( head + 1, std::memory_order_release );
+    return true;
+  }
+
+private:
+  static constexpr size_t CACHE_LINE = 64;
+
+  std::vector<T> slots_;
+
+  alignas( CACHE_LINE ) std::atomic<size_t> head_ { 0 }; //!< Next slot to pop (written by the consumer)
+  size_t tail_cache_ { 0 };                              //!< The consumer's copy of tail_
+
+  alignas( CACHE_LINE ) std::atomic<size_t> tail_ { 0 }; //!< Next slot to push (written by the producer)
+  size_t head_cache_ { 0 };                              //!< The producer's copy of head_
+};
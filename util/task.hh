@@ -0,0 +1,153 @@
+#pragma once
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+
+template<class T>
+class Task;
+
+namespace task_detail {
+//! Where a finished Task goes next: back to the coroutine that awaited it (if any), with no stack growth
+struct FinalAwaiter
+{
+  std::coroutine_handle<> continuation;
+
+  bool await_ready() const noexcept { return false; }
+  std::coroutine_handle<> await_suspend( std::coroutine_handle<> /* finished */ ) const noexcept
+  {
+    return continuation ? continuation : std::noop_coroutine();
+  }
+  void await_resume() const noexcept {}
+};
+
+struct PromiseBase
+{
+  std::coroutine_handle<> continuation {};
+  std::exception_ptr exception {};
+
+  std::suspend_always initial_suspend() const noexcept { return {}; }
+  FinalAwaiter final_suspend() const noexcept { return { continuation }; }
+  void unhandled_exception() { exception = std::current_exception(); }
+
+  void rethrow() const
+  {
+    if ( exception ) {
+      std::rethrow_exception( exception );
+    }
+  }
+};
+
+template<class T>
+struct Promise : PromiseBase
+{
+  std::optional<T> value {};
+
+  Task<T> get_return_object();
+  void return_value( T v ) { value.emplace( std::move( v ) ); }
+  T take()
+  {
+    rethrow();
+    return std::move( value.value() );
+  }
+};
+
+template<>
+struct Promise<void> : PromiseBase
+{
+  Task<void> get_return_object();
+  void return_void() const {}
+  void take() const { rethrow(); }
+};
+} // namespace task_detail
+
+//! \brief A coroutine that produces a T (or throws), for single-threaded code driven by an EventLoop
+//! \details A Task is lazy: it runs when it is awaited (`co_await task`, from another coroutine, which resumes
+//! when the task finishes) or when its owner calls start(). It runs until it suspends, e.g. on an awaiter that
+//! an EventLoop rule resumes later (see TCPMinnowCoSocket), and the owner keeps calling
+//! EventLoop::wait_next_event until done().
+template<class T = void>
+class Task
+{
+public:
+  using promise_type = task_detail::Promise<T>;
+
+  ~Task()
+  {
+    if ( handle_ ) {
+      handle_.destroy();
+    }
+  }
+
+  //! A task owns its coroutine frame, so it can be moved but not copied
+  Task( Task&& other ) noexcept : handle_( std::exchange( other.handle_, {} ) ) {}
+  Task& operator=( Task&& other ) noexcept
+  {
+    if ( this != &other ) {
+      if ( handle_ ) {
+        handle_.destroy();
+      }
+      handle_ = std::exchange( other.handle_, {} );
+    }
+    return *this;
+  }
+  Task( const Task& ) = delete;
+  Task& operator=( const Task& ) = delete;
+
+  //! Run the task from the top, until it first suspends (or finishes)
+  void start()
+  {
+    if ( not handle_ or handle_.done() ) {
+      throw std::runtime_error( "Task::start() on a task that is not waiting to start" );
+    }
+    handle_.resume();
+  }
+
+  bool done() const { return handle_ and handle_.done(); }
+
+  //! The result of a finished task (or the exception it threw)
+  T result()
+  {
+    if ( not done() ) {
+      throw std::runtime_error( "Task::result() before the task is done" );
+    }
+    return handle_.promise().take();
+  }
+
+  //! Awaiting a task runs it, and resumes the awaiting coroutine with its result once it finishes
+  auto operator co_await() && noexcept
+  {
+    struct Awaiter
+    {
+      std::coroutine_handle<promise_type> task;
+
+      bool await_ready() const noexcept { return false; }
+      std::coroutine_handle<> await_suspend( std::coroutine_handle<> awaiting ) const noexcept
+      {
+        task.promise().continuation = awaiting;
+        return task;
+      }
+      T await_resume() const { return task.promise().take(); }
+    };
+    return Awaiter { handle_ };
+  }
+
+private:
+  friend promise_type;
+  explicit Task( std::coroutine_handle<promise_type> handle ) : handle_( handle ) {}
+
+  std::coroutine_handle<promise_type> handle_;
+};
+
+template<class T>
+Task<T> task_detail::Promise<T>::get_return_object()
+{
+  return Task<T> { std::coroutine_handle<Promise<T>>::from_promise( *this ) };
+}
+
+inline Task<void> task_detail::Promise<void>::get_return_object()
+{
+  return Task<void> { std::coroutine_handle<Promise<void>>::from_promise( *this ) };
+}
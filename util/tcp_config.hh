@@ -3,6 +3,7 @@
 #include "address.hh"
 #include "wrapping_integers.hh"
 
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
 
@@ -15,10 +16,21 @@ public:
   static constexpr uint16_t TIMEOUT_DFLT = 1000;    //!< Default re-transmit timeout is 1 second
   static constexpr unsigned MAX_RETX_ATTEMPTS = 8;  //!< Maximum re-transmit attempts before giving up
 
-  uint16_t rt_timeout = TIMEOUT_DFLT;      //!< Initial value of the retransmission timeout, in milliseconds
-  size_t recv_capacity = DEFAULT_CAPACITY; //!< Receive capacity, in bytes
-  size_t send_capacity = DEFAULT_CAPACITY; //!< Sender capacity, in bytes
-  Wrap32 isn { 137 };                      //!< Default initial sequence number
+  uint16_t rt_timeout = TIMEOUT_DFLT;         //!< Initial value of the retransmission timeout, in milliseconds
+  std::chrono::microseconds rt_timeout_us {}; //!< ... in microseconds, for a sub-millisecond RTO (if nonzero)
+  size_t recv_capacity = DEFAULT_CAPACITY;    //!< Receive capacity, in bytes
+  size_t recv_capacity_max = 0;               //!< Ceiling for receive-buffer auto-tuning, in bytes (0 = disabled)
+  size_t send_capacity = DEFAULT_CAPACITY;    //!< Sender capacity, in bytes
+  Wrap32 isn { 137 };                         //!< Default initial sequence number
+  bool ecn = false;                           //!< Negotiate Explicit Congestion Notification (RFC 3168)
+  bool segmentation_offload = false;          //!< Send bursts as one message, split into MSS-sized datagrams later
+  std::chrono::microseconds busy_poll {};     //!< Busy-poll the event loop this long before blocking (0 = never)
+
+  //! The initial retransmission timeout: rt_timeout_us if it is set, or else rt_timeout
+  std::chrono::microseconds initial_rto() const
+  {
+    return rt_timeout_us > std::chrono::microseconds::zero() ? rt_timeout_us : std::chrono::milliseconds { rt_timeout };
+  }
 };
 
 //! Config for classes derived from FdAdapter
@@ -28,6 +40,8 @@ public:
   Address source { "0", 0 };      //!< Source address and port
   Address destination { "0", 0 }; //!< Destination address and port
 
+  bool fast_open = false; //!< Use TCP Fast Open (RFC 7413) cookies to carry data on the SYN
+
   uint16_t loss_rate_dn = 0; //!< Downlink loss rate (for LossyFdAdapter)
   uint16_t loss_rate_up = 0; //!< Uplink loss rate (for LossyFdAdapter)
 };
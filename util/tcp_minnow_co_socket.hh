@@ -0,0 +1,160 @@
+#pragma once
+
+#include "address.hh"
+#include "eventloop.hh"
+#include "task.hh"
+#include "tcp_config.hh"
+#include "tcp_peer.hh"
+#include "tuntap_adapter.hh"
+
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+//! Single-threaded counterpart of TCPMinnowSocket, with a coroutine API on the caller's EventLoop
+template<TCPDatagramAdapter AdaptT>
+class TCPMinnowCoSocket
+{
+public:
+  //! Construct from the interface for reading and writing datagrams, and the EventLoop that will drive the
+  //! socket (which must outlive the socket's use)
+  TCPMinnowCoSocket( EventLoop& eventloop, AdaptT&& datagram_interface );
+
+  //! Size of the buffer that read() fills, if it is passed an empty one
+  static constexpr size_t READ_BUFFER_SIZE = 16384;
+
+  //! Connect using the specified configurations; finishes once connect succeeds (or throws if it fails)
+  Task<> connect( const TCPConfig& c_tcp, const FdAdapterConfig& c_ad );
+
+  //! Listen for, and accept, a single connection
+  Task<> listen_and_accept( const TCPConfig& c_tcp, const FdAdapterConfig& c_ad );
+
+  //! \name
+  //! The data stream, with the same semantics as a blocking socket's, except that the waits suspend the
+  //! coroutine instead of the thread
+
+  //!@{
+  Task<size_t> read( std::string& buffer ); //!< Read into `buffer` (resized to what was read: empty at EOF)
+  Task<size_t> write( std::string_view buffer ); //!< Write as much as fits, and return how much
+  Task<> write_all( std::string_view buffer );
+  void shutdown( int how ); //!< Doesn't wait (SHUT_WR sends the FIN as soon as the outbound data is sent)
+  //!@}
+
+  //! Shut down both directions, and finish once the TCP connection has (cleanly or not)
+  Task<> wait_until_closed();
+
+  bool eof() const { return _eof; }
+
+  //! Is the TCP connection still open (or lingering)?
+  bool active() const { return _tcp.has_value() and _tcp->active(); }
+
+  const Address& peer_address() const { return _datagram_adapter.config().destination; }
+
+  //! Cancels the socket's rules. (A connection that is still open is just abandoned; the peer will time out.)
+  ~TCPMinnowCoSocket();
+
+  //! \name
+  //! The EventLoop's rules refer back to the socket, so it stays in place
+
+  //!@{
+  TCPMinnowCoSocket( const TCPMinnowCoSocket& ) = delete;
+  TCPMinnowCoSocket( TCPMinnowCoSocket&& ) = delete;
+  TCPMinnowCoSocket& operator=( const TCPMinnowCoSocket& ) = delete;
+  TCPMinnowCoSocket& operator=( TCPMinnowCoSocket&& ) = delete;
+  //!@}
+
+private:
+  EventLoop& _eventloop;
+
+  //! Adapter to underlying datagram socket (e.g., UDP or IP)
+  AdaptT _datagram_adapter;
+
+  //! TCP state machine
+  std::optional<TCPPeer> _tcp {};
+
+  //! A coroutine suspended until `ready` returns true, which a rule on the EventLoop then resumes
+  struct Waiter
+  {
+    std::coroutine_handle<> handle {};
+    std::function<bool()> ready {};
+  };
+  Waiter _reader {};  //!< In read
+  Waiter _writer {};  //!< In write
+  Waiter _control {}; //!< In connect, listen_and_accept or wait_until_closed
+
+  //! The awaiter for a Waiter (one coroutine at a time). It holds only references: GCC 12 may destroy a
+  //! temporary in a co_await expression twice, so the predicate is a named local of the awaiting coroutine.
+  struct Until
+  {
+    TCPMinnowCoSocket& socket;
+    Waiter& waiter;
+    const std::function<bool()>& ready;
+
+    bool await_ready() const { return ready(); }
+    void await_suspend( std::coroutine_handle<> handle );
+    void await_resume() const {}
+  };
+
+  //! Raised after anything that may make a Waiter ready (or change the TCPPeer's interest in the network)
+  EventLoop::Notifier _interest_changed {};
+
+  std::vector<EventLoop::RuleHandle> _rules {};
+
+  //! Set up the TCPPeer and the rules on the EventLoop
+  void _initialize_TCP( const TCPConfig& config );
+
+  //! Add the rule that resumes a Waiter's coroutine once it is ready
+  void _add_resume_rule( const std::string& name, Waiter& waiter );
+
+  //! TCPPeer push and receive (after ticking it up to now), and tick
+  void _tcp_push();
+  void _tcp_receive( TCPMessage msg );
+  void _tcp_tick();
+
+  //! After a push, tick or receive: drop the inbound data if it was shut down, raise _interest_changed, and
+  //! make sure a timer rule wakes the loop by the TCPPeer's next deadline
+  void _after_tcp();
+
+  std::optional<EventLoop::RuleHandle> _tcp_timer {}; //!< Ticks the TCPPeer at its next deadline
+  std::chrono::microseconds _tcp_timer_deadline {};   //!< When _tcp_timer fires (in monotonic_time() terms)
+  std::chrono::microseconds _last_tick {};            //!< When the TCPPeer was last ticked
+  size_t _tcp_timer_category {};
+
+  bool _inbound_shutdown { false }; //!< Has the owner shut down the inbound data (so it is dropped)?
+  bool _eof { false };
+};
+
+using TCPOverIPv4MinnowCoSocket = TCPMinnowCoSocket<TCPOverIPv4OverTunFdAdapter>;
+
+//! \class TCPMinnowCoSocket
+//! Where a TCPMinnowSocket runs each connection's TCPPeer on a thread of its own, and passes the data to and
+//! from the owner thread through a socketpair (or RingPipes), a TCPMinnowCoSocket runs everything on the thread
+//! that runs the EventLoop. Its rules read the datagrams and tick the TCPPeer, and the owner's coroutines read
+//! from and write to the TCPPeer's streams directly. Many sockets can share one EventLoop (and one thread),
+//! with no context switches and no copies between threads.
+//!
+//! A read, write or connect that has to wait suspends the calling coroutine, and a rule on the EventLoop
+//! resumes it once the socket is ready, from within EventLoop::wait_next_event:
+//!
+//!     Task<> echo( TCPOverIPv4MinnowCoSocket& sock ) {
+//!       co_await sock.listen_and_accept( tcp_config, adapter_config );
+//!       std::string buffer;
+//!       while ( not sock.eof() ) {
+//!         co_await sock.read( buffer );
+//!         co_await sock.write_all( buffer );
+//!       }
+//!       co_await sock.wait_until_closed();
+//!     }
+//!
+//!     Task<> task = echo( sock );
+//!     task.start();
+//!     while ( not task.done() ) { eventloop.wait_next_event( -1 ); }
+//!     task.result(); // (rethrows, if the task threw)
+//!
+//! Only one coroutine at a time may wait in each of read, write, and the others (connect, listen_and_accept
+//! and wait_until_closed). TCP Fast Open is not supported.
@@ -0,0 +1,318 @@
+#include "tcp_minnow_co_socket.hh"
+
+#include "clock.hh"
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <utility>
+
+template<TCPDatagramAdapter AdaptT>
+TCPMinnowCoSocket<AdaptT>::TCPMinnowCoSocket( EventLoop& eventloop, AdaptT&& datagram_interface )
+  : _eventloop( eventloop ), _datagram_adapter( std::move( datagram_interface ) )
+{}
+
+template<TCPDatagramAdapter AdaptT>
+TCPMinnowCoSocket<AdaptT>::~TCPMinnowCoSocket()
+{
+  for ( auto& rule : _rules ) {
+    rule.cancel();
+  }
+  if ( _tcp_timer.has_value() ) {
+    _tcp_timer->cancel();
+  }
+}
+
+template<TCPDatagramAdapter AdaptT>
+void TCPMinnowCoSocket<AdaptT>::Until::await_suspend( std::coroutine_handle<> handle )
+{
+  if ( waiter.handle ) {
+    throw std::runtime_error( "TCPMinnowCoSocket: two coroutines waiting for the same thing" );
+  }
+  waiter.handle = handle;
+  waiter.ready = ready;
+  socket._interest_changed.raise();
+}
+
+template<TCPDatagramAdapter AdaptT>
+void TCPMinnowCoSocket<AdaptT>::_tcp_push()
+{
+  _tcp_tick();
+  if constexpr ( BatchingTCPDatagramAdapter<AdaptT> ) {
+    _tcp->push_batched( [&]( std::span<const TCPMessage> msgs ) { _datagram_adapter.write_batch( msgs ); } );
+  } else {
+    _tcp->push( [&]( const TCPMessage& x ) { _datagram_adapter.write( x ); } );
+  }
+  _after_tcp();
+}
+
+template<TCPDatagramAdapter AdaptT>
+void TCPMinnowCoSocket<AdaptT>::_tcp_receive( TCPMessage msg )
+{
+  _tcp_tick();
+  if constexpr ( BatchingTCPDatagramAdapter<AdaptT> ) {
+    _tcp->receive_batched( std::move( msg ),
+                           [&]( std::span<const TCPMessage> msgs ) { _datagram_adapter.write_batch( msgs ); } );
+  } else {
+    _tcp->receive( std::move( msg ), [&]( const TCPMessage& x ) { _datagram_adapter.write( x ); } );
+  }
+  _after_tcp();
+}
+
+//! Ticks the TCPPeer (and the adapter) by the time since the last tick. A tick before the TCPPeer's next
+//! deadline does nothing, so ticking before each push and receive (and at the deadline) is the same as ticking
+//! all the time.
+template<TCPDatagramAdapter AdaptT>
+void TCPMinnowCoSocket<AdaptT>::_tcp_tick()
+{
+  const auto now = monotonic_time();
+  if ( _tcp->active() ) {
+    if constexpr ( BatchingTCPDatagramAdapter<AdaptT> ) {
+      _tcp->tick_batched( now - _last_tick,
+                          [&]( std::span<const TCPMessage> msgs ) { _datagram_adapter.write_batch( msgs ); } );
+    } else {
+      _tcp->tick( now - _last_tick, [&]( const TCPMessage& x ) { _datagram_adapter.write( x ); } );
+    }
+    _datagram_adapter.tick( now - _last_tick );
+  }
+  _last_tick = now;
+}
+
+template<TCPDatagramAdapter AdaptT>
+void TCPMinnowCoSocket<AdaptT>::_after_tcp()
+{
+  if ( _inbound_shutdown ) {
+    _tcp->inbound_reader().pop( _tcp->inbound_reader().bytes_buffered() );
+  }
+  _interest_changed.raise();
+
+  const auto delay = _tcp->next_deadline_us();
+  if ( not delay.has_value() ) {
+    // (a pending timer would keep the event loop from exiting)
+    if ( _tcp_timer.has_value() ) {
+      _tcp_timer->cancel();
+      _tcp_timer.reset();
+    }
+    return;
+  }
+
+  // a timer that fires early is harmless (it just ticks, and arms another), so one that is already set for no
+  // later than the deadline is kept
+  const auto deadline = monotonic_time() + delay.value();
+  if ( _tcp_timer.has_value() and _tcp_timer_deadline <= deadline ) {
+    return;
+  }
+  if ( _tcp_timer.has_value() ) {
+    _tcp_timer->cancel();
+  }
+  _tcp_timer = _eventloop.add_timer( _tcp_timer_category, delay.value(), [&] {
+    _tcp_timer.reset();
+    _tcp_tick();
+    _after_tcp();
+  } );
+  _tcp_timer_deadline = deadline;
+}
+
+template<TCPDatagramAdapter AdaptT>
+void TCPMinnowCoSocket<AdaptT>::_initialize_TCP( const TCPConfig& config )
+{
+  if ( _tcp ) {
+    throw std::runtime_error( "TCPMinnowCoSocket: TCPPeer already initialized" );
+  }
+  _tcp.emplace( config );
+  _last_tick = monotonic_time();
+  _tcp_timer_category = _eventloop.category( "TCPPeer deadline" );
+
+  // The rules ask for their interest only when _interest_changed is raised, which is after every push, tick
+  // and receive, every read and write, and whenever a coroutine starts or stops waiting. (The categories are
+  // shared with the other sockets on the EventLoop.)
+
+  // rule 1: read from the network into the TCPPeer
+  _rules.push_back( _eventloop.add_rule(
+    _eventloop.category( "receive TCP segment from the network" ),
+    _datagram_adapter.fd(),
+    Direction::In,
+    [&] {
+      if ( auto seg = _datagram_adapter.read() ) {
+        _tcp_receive( std::move( seg.value() ) );
+      }
+
+      // a batching adapter (e.g. GROAdapter) may have read more than one message
+      if constexpr ( requires { _datagram_adapter.has_buffered(); } ) {
+        while ( _datagram_adapter.has_buffered() and _tcp->active() ) {
+          if ( auto seg = _datagram_adapter.read() ) {
+            _tcp_receive( std::move( seg.value() ) );
+          }
+        }
+      }
+    },
+    [&] { return _tcp->active(); } ) );
+
+  // rules 2-4: resume the coroutines waiting in read, in write, and for the connection
+  _add_resume_rule( "resume reader", _reader );
+  _add_resume_rule( "resume writer", _writer );
+  _add_resume_rule( "resume connection control", _control );
+
+  for ( auto& rule : _rules ) {
+    rule.subscribe( _interest_changed );
+  }
+}
+
+template<TCPDatagramAdapter AdaptT>
+void TCPMinnowCoSocket<AdaptT>::_add_resume_rule( const std::string& name, Waiter& waiter )
+{
+  _rules.push_back( _eventloop.add_rule(
+    _eventloop.category( name ),
+    [&] {
+      waiter.ready = nullptr;
+      _interest_changed.raise(); // (the rule's own interest has changed)
+      std::exchange( waiter.handle, {} ).resume();
+    },
+    [&] { return waiter.handle and waiter.ready(); } ) );
+}
+
+//! \param[in] c_tcp is the TCPConfig for the TCPConnection
+//! \param[in] c_ad is the FdAdapterConfig for the FdAdapter
+template<TCPDatagramAdapter AdaptT>
+Task<> TCPMinnowCoSocket<AdaptT>::connect( const TCPConfig& c_tcp, const FdAdapterConfig& c_ad )
+{
+  _initialize_TCP( c_tcp );
+  _datagram_adapter.config_mut() = c_ad;
+
+  _tcp_push();
+  const auto syn_length = _tcp->sender().sequence_numbers_in_flight();
+  if ( syn_length == 0 ) {
+    throw std::runtime_error( "After TCPConnection::connect(), expected the SYN to be in flight" );
+  }
+
+  const std::function<bool()> connected
+    = [&] { return not _tcp->active() or _tcp->sender().sequence_numbers_in_flight() != syn_length; };
+  co_await Until { *this, _control, connected };
+
+  if ( not _tcp->active() or _tcp->inbound_reader().has_error() ) {
+    throw std::runtime_error( "TCPMinnowCoSocket: error on connecting to " + c_ad.destination.to_string() );
+  }
+}
+
+//! \param[in] c_tcp is the TCPConfig for the TCPConnection
+//! \param[in] c_ad is the FdAdapterConfig for the FdAdapter
+template<TCPDatagramAdapter AdaptT>
+Task<> TCPMinnowCoSocket<AdaptT>::listen_and_accept( const TCPConfig& c_tcp, const FdAdapterConfig& c_ad )
+{
+  _initialize_TCP( c_tcp );
+  _datagram_adapter.config_mut() = c_ad;
+  _datagram_adapter.set_listening( true );
+
+  // (as with TCPMinnowSocket, data that arrived on the SYN is handed over without waiting for the handshake)
+  const std::function<bool()> accepted = [&] {
+    return not _tcp->active()
+           or ( _tcp->has_ackno()
+                and ( _tcp->sender().sequence_numbers_in_flight() == 0 or _tcp->inbound_reader().bytes_buffered() ) );
+  };
+  co_await Until { *this, _control, accepted };
+
+  if ( not _tcp->active() ) {
+    throw std::runtime_error( "TCPMinnowCoSocket: error on accepting a connection" );
+  }
+}
+
+template<TCPDatagramAdapter AdaptT>
+Task<size_t> TCPMinnowCoSocket<AdaptT>::read( std::string& buffer )
+{
+  if ( not _tcp ) {
+    throw std::runtime_error( "TCPMinnowCoSocket: read before connecting" );
+  }
+
+  Reader& inbound = _tcp->inbound_reader();
+  const std::function<bool()> readable = [&] {
+    return inbound.bytes_buffered() or inbound.is_finished() or inbound.has_error() or not _tcp->active();
+  };
+  co_await Until { *this, _reader, readable };
+
+  if ( buffer.empty() ) {
+    buffer.resize( READ_BUFFER_SIZE );
+  }
+
+  // (two peeks, if the bytes wrap around the ByteStream's buffer)
+  size_t bytes_read = 0;
+  while ( bytes_read < buffer.size() ) {
+    const std::string_view data = inbound.peek().substr( 0, buffer.size() - bytes_read );
+    if ( data.empty() ) {
+      break;
+    }
+    std::ranges::copy( data, buffer.begin() + static_cast<std::ptrdiff_t>( bytes_read ) );
+    inbound.pop( data.size() );
+    bytes_read += data.size();
+  }
+  buffer.resize( bytes_read );
+
+  if ( bytes_read == 0 ) {
+    if ( inbound.has_error() ) {
+      throw std::runtime_error( "TCPMinnowCoSocket: connection reset" );
+    }
+    _eof = true;
+  }
+  _interest_changed.raise();
+  co_return bytes_read;
+}
+
+template<TCPDatagramAdapter AdaptT>
+Task<size_t> TCPMinnowCoSocket<AdaptT>::write( const std::string_view buffer )
+{
+  if ( not _tcp ) {
+    throw std::runtime_error( "TCPMinnowCoSocket: write before connecting" );
+  }
+
+  Writer& outbound = _tcp->outbound_writer();
+  const std::function<bool()> writable = [&] {
+    return buffer.empty() or outbound.available_capacity() > 0 or outbound.is_closed() or outbound.has_error()
+           or not _tcp->active();
+  };
+  co_await Until { *this, _writer, writable };
+
+  if ( outbound.is_closed() or outbound.has_error() or not _tcp->active() ) {
+    throw std::runtime_error( "TCPMinnowCoSocket: write to a closed connection" );
+  }
+
+  const size_t bytes_written = std::min( buffer.size(), outbound.available_capacity() );
+  outbound.push( std::string { buffer.substr( 0, bytes_written ) } );
+  _tcp_push();
+  co_return bytes_written;
+}
+
+template<TCPDatagramAdapter AdaptT>
+Task<> TCPMinnowCoSocket<AdaptT>::write_all( std::string_view buffer )
+{
+  while ( not buffer.empty() ) {
+    buffer.remove_prefix( co_await write( buffer ) );
+  }
+}
+
+//! \param[in] how can be `SHUT_RD`, `SHUT_WR`, or `SHUT_RDWR`; see [shutdown(2)](\ref man2::shutdown)
+template<TCPDatagramAdapter AdaptT>
+void TCPMinnowCoSocket<AdaptT>::shutdown( const int how )
+{
+  if ( not _tcp ) {
+    throw std::runtime_error( "TCPMinnowCoSocket: shutdown before connecting" );
+  }
+
+  if ( how == SHUT_RD or how == SHUT_RDWR ) {
+    _inbound_shutdown = true;
+  }
+  if ( ( how == SHUT_WR or how == SHUT_RDWR ) and not _tcp->outbound_writer().is_closed() ) {
+    _tcp->outbound_writer().close();
+  }
+  _tcp_push();
+}
+
+template<TCPDatagramAdapter AdaptT>
+Task<> TCPMinnowCoSocket<AdaptT>::wait_until_closed()
+{
+  shutdown( SHUT_RDWR );
+  const std::function<bool()> closed = [&] { return not _tcp->active(); };
+  co_await Until { *this, _control, closed };
+}
@@ -2,14 +2,19 @@
 
 #include "eventloop.hh"
 #include "file_descriptor.hh"
+#include "ring_pipe.hh"
 #include "socket.hh"
 #include "tcp_config.hh"
 #include "tcp_peer.hh"
 #include "tuntap_adapter.hh"
 
 #include <atomic>
+#include <chrono>
 #include <cstdint>
+#include <memory>
 #include <optional>
+#include <string>
+#include <string_view>
 #include <thread>
 
 //! Multithreaded wrapper around TCPPeer that approximates the Unix sockets API
@@ -31,6 +36,28 @@ public:
   //! Listen and accept using the specified configurations; blocks until accept succeeds or fails
   void listen_and_accept( const TCPConfig& c_tcp, const FdAdapterConfig& c_ad );
 
+  //! Default capacity of each RingPipe (see use_shared_memory)
+  static constexpr size_t SHARED_MEMORY_CAPACITY = 256 * 1024;
+
+  //! Carry the data between the owner and the TCPPeer thread through a pair of RingPipes instead of the
+  //! socketpair, so each chunk is copied once on each side, with no system calls while the data keeps flowing.
+  //! Call before connect or listen_and_accept. The owner must then read, write and shut down the stream
+  //! through this class's own methods, which hide the base class's. To make a mistake plain, the owner's end of
+  //! the socketpair is shut down: through a FileDescriptor& or Socket&, a read sees EOF at once, a write fails
+  //! with EPIPE (and SIGPIPE), and polling the fd finds it readable.
+  void use_shared_memory( size_t capacity = SHARED_MEMORY_CAPACITY );
+
+  //! \name
+  //! The owner's end of the data stream, with the same semantics as a socket's (blocking, unless the socket is
+  //! set non-blocking), through the RingPipes if they are in use
+
+  //!@{
+  void read( std::string& buffer );
+  size_t write( std::string_view buffer );
+  void write_all( std::string_view buffer );
+  void shutdown( int how );
+  //!@}
+
   //! When a connected socket is destructed, it will send a RST
   ~TCPMinnowSocket();
 
@@ -56,6 +83,10 @@ public:
   // Return peer address from underlying datagram adapter
   const Address& peer_address() const { return _datagram_adapter.config().destination; }
 
+  //! The TCPPeer thread's EventLoop statistics (e.g. how much it busy-polled). Only valid once the thread has
+  //! finished (after wait_until_closed).
+  const EventLoop::Stats& eventloop_stats() const { return _eventloop.stats(); }
+
 protected:
   //! Adapter to underlying datagram socket (e.g., UDP or IP)
   AdaptT _datagram_adapter;
@@ -70,12 +101,51 @@ private:
   //! TCP state machine
   std::optional<TCPPeer> _tcp {};
 
-  //! eventloop that handles all the events (new inbound datagram, new outbound bytes, new inbound bytes)
-  EventLoop _eventloop {};
+  //! eventloop that handles all the events (new inbound datagram, new outbound bytes, new inbound bytes); with
+  //! io_uring, the ring also reads the datagrams and outbound bytes ahead of the rules (see _initialize_TCP)
+  EventLoop _eventloop { EventLoop::Backend::IoUring, EventLoop::Dispatch::AllReady };
+
+  //! TCPPeer push, tick and receive, writing the outbound messages to the adapter (as one batch, if the
+  //! adapter can write batches)
+  void _tcp_push();
+  void _tcp_tick( std::chrono::microseconds since_last_tick );
+  void _tcp_receive( TCPMessage msg );
+
+  //! Raised when anything the rules' interest depends on changes: the TCPPeer's streams (through their
+  //! listeners), whether it is active, or the shutdown flags
+  EventLoop::Notifier _interest_changed {};
+  bool _tcp_active {}; //!< Whether the TCPPeer was active, as of the last push, tick or receive
+
+  //! Raise _interest_changed if the TCPPeer became active or inactive
+  void _check_active();
+
+  //! The RingPipes between the owner and the TCPPeer thread, if in use (see use_shared_memory)
+  struct SharedChannel
+  {
+    RingPipe outbound; //!< Written by the owner, read by the TCPPeer thread
+    RingPipe inbound;  //!< Written by the TCPPeer thread, read by the owner
+
+    explicit SharedChannel( size_t capacity ) : outbound( capacity ), inbound( capacity ) {}
+  };
+  std::unique_ptr<SharedChannel> _shared {};
+
+  //! Is there inbound data (or the end of the stream) still to hand to the owner?
+  bool _inbound_pending();
+
+  //! Rules 2 and 3 of the event loop (see _initialize_TCP), with the socketpair or the RingPipes
+  void _add_socketpair_rules();
+  void _add_shared_memory_rules();
 
   //! Process events while specified condition is true
   void _tcp_loop( const std::function<bool()>& condition );
 
+  //! Make sure a timer rule wakes the loop by the TCPPeer's next deadline
+  void _arm_tcp_timer();
+
+  std::optional<EventLoop::RuleHandle> _tcp_timer {}; //!< Wakes the loop for the TCPPeer's next deadline
+  std::chrono::microseconds _tcp_timer_deadline {};   //!< When _tcp_timer fires (in monotonic_time() terms)
+  size_t _tcp_timer_category {};
+
   //! Main loop of TCPPeer thread
   void _tcp_main();
 
@@ -87,6 +157,10 @@ private:
 
   std::atomic_bool _abort { false }; //!< Flag used by the owner to force the TCPPeer thread to shut down
 
+  //! An eventfd that the owner signals (through its own duplicate) to wake the TCPPeer thread to see _abort
+  FileDescriptor _abort_event;
+  FileDescriptor _abort_signal;
+
   bool _inbound_shutdown { false }; //!< Has TCPMinnowSocket shut down the incoming data to the owner?
 
   bool _outbound_shutdown { false }; //!< Has the owner shut down the outbound data to the TCP connection?
@@ -96,6 +170,7 @@ private:
 
 using TCPOverIPv4MinnowSocket = TCPMinnowSocket<TCPOverIPv4OverTunFdAdapter>;
 using LossyTCPOverIPv4MinnowSocket = TCPMinnowSocket<LossyFdAdapter<TCPOverIPv4OverTunFdAdapter>>;
+using GROTCPOverIPv4MinnowSocket = TCPMinnowSocket<GROAdapter<LossyFdAdapter<TCPOverIPv4OverTunFdAdapter>>>;
 
 //! \class TCPMinnowSocket
 //! This class involves the simultaneous operation of two threads.
@@ -116,6 +191,10 @@ using LossyTCPOverIPv4MinnowSocket = TCPMinnowSocket<LossyFdAdapter<TCPOverIPv4O
 //!   and [accept(2)](\ref man2::accept)
 //! - if TCPMinnowSocket is destructed while a TCP connection is open, the connection is
 //!   immediately terminated with a RST (call `wait_until_closed` to avoid this)
+//!
+//! By default, the data passes between the two threads through a socketpair, so the owner's end is a
+//! real file descriptor (which can be polled, or passed on as a Socket&). With use_shared_memory(), it passes
+//! through two RingPipes instead, and the owner's end is only this class's read, write and shutdown methods.
 
 //! Helper class that makes a TCPOverIPv4MinnowSocket behave more like a (kernel) TCPSocket
 class CS144TCPSocket : public TCPOverIPv4MinnowSocket
@@ -1,31 +1,75 @@
 #include "tcp_minnow_socket.hh"
 
+#include "clock.hh"
 #include "exception.hh"
 
+#include <algorithm>
 #include <cstddef>
 #include <exception>
 #include <iostream>
+#include <memory>
+#include <span>
 #include <stdexcept>
 #include <string>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
+#include <unistd.h>
 #include <utility>
 
-static constexpr size_t TCP_TICK_MS = 10;
+template<TCPDatagramAdapter AdaptT>
+void TCPMinnowSocket<AdaptT>::_tcp_push()
+{
+  if constexpr ( BatchingTCPDatagramAdapter<AdaptT> ) {
+    _tcp->push_batched( [&]( std::span<const TCPMessage> msgs ) { _datagram_adapter.write_batch( msgs ); } );
+  } else {
+    _tcp->push( [&]( const TCPMessage& x ) { _datagram_adapter.write( x ); } );
+  }
+  _check_active();
+}
+
+template<TCPDatagramAdapter AdaptT>
+void TCPMinnowSocket<AdaptT>::_tcp_tick( std::chrono::microseconds since_last_tick )
+{
+  if constexpr ( BatchingTCPDatagramAdapter<AdaptT> ) {
+    _tcp->tick_batched( since_last_tick,
+                        [&]( std::span<const TCPMessage> msgs ) { _datagram_adapter.write_batch( msgs ); } );
+  } else {
+    _tcp->tick( since_last_tick, [&]( const TCPMessage& x ) { _datagram_adapter.write( x ); } );
+  }
+  _check_active();
+}
 
-inline uint64_t timestamp_ms()
+template<TCPDatagramAdapter AdaptT>
+void TCPMinnowSocket<AdaptT>::_tcp_receive( TCPMessage msg )
 {
-  static_assert( std::is_same_v<std::chrono::steady_clock::duration, std::chrono::nanoseconds> );
+  if constexpr ( BatchingTCPDatagramAdapter<AdaptT> ) {
+    _tcp->receive_batched( std::move( msg ),
+                           [&]( std::span<const TCPMessage> msgs ) { _datagram_adapter.write_batch( msgs ); } );
+  } else {
+    _tcp->receive( std::move( msg ), [&]( const TCPMessage& x ) { _datagram_adapter.write( x ); } );
+  }
+  _check_active();
+}
 
-  return std::chrono::steady_clock::now().time_since_epoch().count() / 1000000;
+template<TCPDatagramAdapter AdaptT>
+void TCPMinnowSocket<AdaptT>::_check_active()
+{
+  if ( _tcp->active() != _tcp_active ) {
+    _tcp_active = not _tcp_active;
+    _interest_changed.raise();
+  }
 }
 
+//! The loop is tickless: it sleeps until an event, or until the timer rule for the TCPPeer's next deadline
+//! fires, and then ticks the TCPPeer by the time that has passed (to the microsecond).
 //! \param[in] condition is a function returning true if loop should continue
 template<TCPDatagramAdapter AdaptT>
 void TCPMinnowSocket<AdaptT>::_tcp_loop( const std::function<bool()>& condition )
 {
-  auto base_time = timestamp_ms();
+  auto base_time = monotonic_time();
   while ( condition() ) {
-    auto ret = _eventloop.wait_next_event( TCP_TICK_MS );
+    _arm_tcp_timer();
+    auto ret = _eventloop.wait_next_event( -1 );
     if ( ret == EventLoop::Result::Exit or _abort ) {
       break;
     }
@@ -35,14 +79,40 @@ void TCPMinnowSocket<AdaptT>::_tcp_loop( const std::function<bool()>& condition
     }
 
     if ( _tcp.value().active() ) {
-      const auto next_time = timestamp_ms();
-      _tcp.value().tick( next_time - base_time, [&]( const auto& x ) { _datagram_adapter.write( x ); } );
+      const auto next_time = monotonic_time();
+      _tcp_tick( next_time - base_time );
       _datagram_adapter.tick( next_time - base_time );
       base_time = next_time;
     }
   }
 }
 
+template<TCPDatagramAdapter AdaptT>
+void TCPMinnowSocket<AdaptT>::_arm_tcp_timer()
+{
+  const auto delay = _tcp.has_value() ? _tcp->next_deadline_us() : std::nullopt;
+  if ( not delay.has_value() ) {
+    // (a pending timer would keep the event loop from exiting)
+    if ( _tcp_timer.has_value() ) {
+      _tcp_timer->cancel();
+      _tcp_timer.reset();
+    }
+    return;
+  }
+
+  // a timer that fires early is harmless (the loop just ticks, and arms another), so one that is already set
+  // for no later than the deadline is kept
+  const auto deadline = monotonic_time() + delay.value();
+  if ( _tcp_timer.has_value() and _tcp_timer_deadline <= deadline ) {
+    return;
+  }
+  if ( _tcp_timer.has_value() ) {
+    _tcp_timer->cancel();
+  }
+  _tcp_timer = _eventloop.add_timer( _tcp_timer_category, delay.value(), [&] { _tcp_timer.reset(); } );
+  _tcp_timer_deadline = deadline;
+}
+
 //! \param[in] data_socket_pair is a pair of connected AF_UNIX SOCK_STREAM sockets
 //! \param[in] datagram_interface is the interface for reading and writing datagrams
 template<TCPDatagramAdapter AdaptT>
@@ -51,6 +121,8 @@ TCPMinnowSocket<AdaptT>::TCPMinnowSocket( std::pair<FileDescriptor, FileDescript
   : LocalStreamSocket( std::move( data_socket_pair.first ) )
   , _datagram_adapter( std::move( datagram_interface ) )
   , _thread_data( std::move( data_socket_pair.second ) )
+  , _abort_event( CheckSystemCall( "eventfd", ::eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC ) ) )
+  , _abort_signal( CheckSystemCall( "dup", ::dup( _abort_event.fd_num() ) ) )
 {
   _thread_data.set_blocking( false );
 }
@@ -59,8 +131,14 @@ template<TCPDatagramAdapter AdaptT>
 void TCPMinnowSocket<AdaptT>::_initialize_TCP( const TCPConfig& config )
 {
   _tcp.emplace( config );
+  _tcp_active = _tcp->active();
+  _eventloop.set_busy_poll( config.busy_poll );
 
-  // Set up the event loop
+  // Set up the event loop. Each rule asks its interest function only when _interest_changed is raised: by
+  // the streams, when they become readable, writable, finished (and so on), by _check_active, and by the
+  // callbacks that set the shutdown flags.
+  _tcp->outbound_writer().set_listener( [&] { _interest_changed.raise(); } );
+  _tcp->inbound_reader().set_listener( [&] { _interest_changed.raise(); } );
 
   // There are three events to handle:
   //
@@ -74,27 +152,80 @@ void TCPMinnowSocket<AdaptT>::_initialize_TCP( const TCPConfig& config )
   //    (needs to be read from the inbound_stream and written
   //    to the local stream socket back to the application)
 
+  // With io_uring, the ring reads the datagrams and the owner's bytes ahead of rules 1 and 2, so those reads
+  // cost no system call of their own (see EventLoop::read_ahead)
+  if constexpr ( ReadAheadTCPDatagramAdapter<AdaptT> ) {
+    _eventloop.read_ahead( _datagram_adapter.fd() );
+  }
+  if ( not _shared ) {
+    _eventloop.read_ahead( _thread_data );
+  }
+
   // rule 1: read from filtered packet stream and dump into TCPConnection
-  _eventloop.add_rule(
+  auto receive_rule = _eventloop.add_rule(
     "receive TCP segment from the network",
     _datagram_adapter.fd(),
     Direction::In,
     [&] {
       if ( auto seg = _datagram_adapter.read() ) {
-        _tcp->receive( std::move( seg.value() ), [&]( const auto& x ) { _datagram_adapter.write( x ); } );
+        _tcp_receive( std::move( seg.value() ) );
+      }
+
+      // a batching adapter (e.g. GROAdapter) may have read more than one message
+      if constexpr ( requires { _datagram_adapter.has_buffered(); } ) {
+        while ( _datagram_adapter.has_buffered() and _tcp->active() ) {
+          if ( auto seg = _datagram_adapter.read() ) {
+            _tcp_receive( std::move( seg.value() ) );
+          }
+        }
       }
 
       // debugging output:
-      if ( _thread_data.eof() and _tcp.value().sender().sequence_numbers_in_flight() == 0 and not _fully_acked ) {
+      if ( _outbound_shutdown and _tcp.value().sender().sequence_numbers_in_flight() == 0 and not _fully_acked ) {
         std::cerr << "DEBUG: minnow outbound stream to " << _datagram_adapter.config().destination.to_string()
                   << " has been fully acknowledged.\n";
         _fully_acked = true;
       }
     },
     [&] { return _tcp->active(); } );
+  receive_rule.subscribe( _interest_changed );
+
+  // rules 2 and 3: read from the owner into the outbound stream, and from the inbound stream to the owner
+  if ( _shared ) {
+    _add_shared_memory_rules();
+  } else {
+    _add_socketpair_rules();
+  }
 
+  // rule 4: wake up when the owner aborts (as long as there is anything else to wait for)
+  auto abort_rule = _eventloop.add_rule(
+    "abort",
+    _abort_event,
+    Direction::In,
+    [&] {
+      std::string counter( sizeof( uint64_t ), 0 );
+      _abort_event.read( counter );
+    },
+    [&] { return _tcp->active() or _inbound_pending(); } );
+  abort_rule.subscribe( _interest_changed );
+
+  // and the timer for the TCPPeer's next deadline, which replaces a periodic tick
+  _tcp_timer_category = _eventloop.add_category( "TCPPeer deadline" );
+}
+
+template<TCPDatagramAdapter AdaptT>
+bool TCPMinnowSocket<AdaptT>::_inbound_pending()
+{
+  return not _inbound_shutdown
+         and ( _tcp->inbound_reader().bytes_buffered() or _tcp->inbound_reader().is_finished()
+               or _tcp->inbound_reader().has_error() );
+}
+
+template<TCPDatagramAdapter AdaptT>
+void TCPMinnowSocket<AdaptT>::_add_socketpair_rules()
+{
   // rule 2: read from pipe into outbound buffer
-  _eventloop.add_rule(
+  auto push_rule = _eventloop.add_rule(
     "push bytes to TCPPeer",
     _thread_data,
     Direction::In,
@@ -115,7 +246,7 @@ void TCPMinnowSocket<AdaptT>::_initialize_TCP( const TCPConfig& config )
                   << " still in flight).\n";
       }
 
-      _tcp->push( [&]( const auto& x ) { _datagram_adapter.write( x ); } );
+      _tcp_push();
     },
     [&] {
       return ( _tcp->active() ) and ( not _outbound_shutdown )
@@ -129,9 +260,10 @@ void TCPMinnowSocket<AdaptT>::_initialize_TCP( const TCPConfig& config )
       std::cerr << "DEBUG: minnow outbound stream had error.\n";
       _tcp->outbound_writer().set_error();
     } );
+  push_rule.subscribe( _interest_changed );
 
   // rule 3: read from inbound buffer into pipe
-  _eventloop.add_rule(
+  auto pull_rule = _eventloop.add_rule(
     "read bytes from inbound stream",
     _thread_data,
     Direction::Out,
@@ -149,22 +281,123 @@ void TCPMinnowSocket<AdaptT>::_initialize_TCP( const TCPConfig& config )
       if ( inbound.is_finished() or inbound.has_error() ) {
         _thread_data.shutdown( SHUT_WR );
         _inbound_shutdown = true;
+        _interest_changed.raise();
 
         // debugging output:
         std::cerr << "DEBUG: minnow inbound stream from " << _datagram_adapter.config().destination.to_string()
                   << " finished " << ( inbound.has_error() ? "uncleanly.\n" : "cleanly.\n" );
       }
     },
+    [&] { return _inbound_pending(); },
     [&] {
-      return _tcp->inbound_reader().bytes_buffered()
-             or ( ( _tcp->inbound_reader().is_finished() or _tcp->inbound_reader().has_error() )
-                  and not _inbound_shutdown );
+      // the owner hung up (e.g. wait_until_closed before the end of the inbound stream), so it reads no more
+      _inbound_shutdown = true;
+      _interest_changed.raise();
     },
-    [&] {},
     [&] {
       std::cerr << "DEBUG: minnow inbound stream had error.\n";
       _tcp->inbound_reader().set_error();
     } );
+  pull_rule.subscribe( _interest_changed );
+}
+
+//! The rules that move the data are not fd rules, since the RingPipes need no system calls; the eventfd rules
+//! only wake the loop when the owner may have been waiting (and so the rules' interest may have changed).
+template<TCPDatagramAdapter AdaptT>
+void TCPMinnowSocket<AdaptT>::_add_shared_memory_rules()
+{
+  // rule 2: read from the outbound RingPipe into the outbound stream
+  auto push_rule = _eventloop.add_rule(
+    "push bytes to TCPPeer",
+    [&] {
+      RingPipe& from_owner = _shared->outbound;
+      Writer& writer = _tcp->outbound_writer();
+      const std::string_view data = from_owner.peek().substr( 0, writer.available_capacity() );
+      writer.push( std::string { data } );
+      from_owner.pop( data.size() );
+      _interest_changed.raise();
+
+      if ( from_owner.is_finished() ) {
+        writer.close();
+        _outbound_shutdown = true;
+
+        // debugging output:
+        std::cerr << "DEBUG: minnow outbound stream to " << _datagram_adapter.config().destination.to_string()
+                  << " finished (" << _tcp.value().sender().sequence_numbers_in_flight() << " seqno"
+                  << ( _tcp.value().sender().sequence_numbers_in_flight() == 1 ? "" : "s" )
+                  << " still in flight).\n";
+      }
+
+      _tcp_push();
+    },
+    [&] {
+      return _tcp->active() and not _outbound_shutdown and _tcp->outbound_writer().available_capacity() > 0
+             and ( _shared->outbound.bytes_buffered() > 0 or _shared->outbound.is_finished() );
+    } );
+  push_rule.subscribe( _interest_changed );
+
+  auto from_owner_rule = _eventloop.add_rule(
+    "wake for bytes from the owner",
+    _shared->outbound.readable_event(),
+    Direction::In,
+    [&] {
+      RingPipe::clear( _shared->outbound.readable_event() );
+      _interest_changed.raise();
+    },
+    [&] { return _tcp->active() and not _outbound_shutdown; } );
+  from_owner_rule.subscribe( _interest_changed );
+
+  // rule 3: read from the inbound stream into the inbound RingPipe (or drop the bytes, if the owner will not
+  // read them)
+  auto pull_rule = _eventloop.add_rule(
+    "read bytes from inbound stream",
+    [&] {
+      Reader& inbound = _tcp->inbound_reader();
+      if ( _shared->inbound.reader_closed() ) {
+        inbound.pop( inbound.bytes_buffered() );
+      } else if ( inbound.bytes_buffered() ) {
+        inbound.pop( _shared->inbound.write( inbound.peek() ) );
+      }
+      _interest_changed.raise();
+
+      if ( inbound.is_finished() or inbound.has_error() ) {
+        _shared->inbound.close();
+        _inbound_shutdown = true;
+
+        // debugging output:
+        std::cerr << "DEBUG: minnow inbound stream from " << _datagram_adapter.config().destination.to_string()
+                  << " finished " << ( inbound.has_error() ? "uncleanly.\n" : "cleanly.\n" );
+      }
+    },
+    [&] {
+      return _inbound_pending()
+             and ( _shared->inbound.available_capacity() > 0 or _shared->inbound.reader_closed()
+                   or _tcp->inbound_reader().bytes_buffered() == 0 );
+    } );
+  pull_rule.subscribe( _interest_changed );
+
+  auto to_owner_rule = _eventloop.add_rule(
+    "wake for room to the owner",
+    _shared->inbound.writable_event(),
+    Direction::In,
+    [&] {
+      RingPipe::clear( _shared->inbound.writable_event() );
+      _interest_changed.raise();
+    },
+    [&] { return _inbound_pending(); } );
+  to_owner_rule.subscribe( _interest_changed );
+
+  // while busy-polling, see the owner's writes and pops in the RingPipes' indices, with no system call
+  _eventloop.add_spin_check(
+    [&, seen = std::pair { _shared->outbound.bytes_written(), _shared->inbound.bytes_popped() }]() mutable {
+      const std::pair now { _shared->outbound.bytes_written(), _shared->inbound.bytes_popped() };
+      if ( now == seen ) {
+        return false;
+      }
+      seen = now;
+      _interest_changed.raise();
+      return true;
+    } );
 }
 
 //! \brief Call [socketpair](\ref man2::socketpair) and return connected Unix-domain sockets of specified type
@@ -193,6 +426,9 @@ TCPMinnowSocket<AdaptT>::~TCPMinnowSocket()
       std::cerr << "Warning: unclean shutdown of TCPMinnowSocket\n";
       // force the other side to exit
       _abort.store( true );
+      const uint64_t one = 1;
+      _abort_signal.write(
+        std::string_view { reinterpret_cast<const char*>( &one ), sizeof( one ) } ); // NOLINT(*-reinterpret-cast)
       _tcp_thread.join();
     }
   } catch ( const std::exception& e ) {
@@ -200,6 +436,101 @@ TCPMinnowSocket<AdaptT>::~TCPMinnowSocket()
   }
 }
 
+template<TCPDatagramAdapter AdaptT>
+void TCPMinnowSocket<AdaptT>::use_shared_memory( const size_t capacity )
+{
+  if ( _tcp ) {
+    throw std::runtime_error( "use_shared_memory() with TCPConnection already initialized" );
+  }
+  _shared = std::make_unique<SharedChannel>( capacity );
+
+  // The socketpair carries nothing now, so shut down the owner's end: a read through a FileDescriptor& or
+  // Socket& (which would not see the RingPipes) gets EOF at once, and a write fails with EPIPE.
+  LocalStreamSocket::shutdown( SHUT_RDWR );
+}
+
+template<TCPDatagramAdapter AdaptT>
+void TCPMinnowSocket<AdaptT>::read( std::string& buffer )
+{
+  if ( not _shared ) {
+    LocalStreamSocket::read( buffer );
+    return;
+  }
+
+  if ( buffer.empty() ) {
+    buffer.resize( kReadBufferSize );
+  }
+
+  RingPipe& inbound = _shared->inbound;
+  while ( blocking() and inbound.bytes_buffered() == 0 and not inbound.is_finished() ) {
+    RingPipe::wait( inbound.readable_event() );
+  }
+
+  // (two peeks, if the bytes wrap around the ring)
+  size_t bytes_read = 0;
+  while ( bytes_read < buffer.size() ) {
+    const std::string_view data = inbound.peek().substr( 0, buffer.size() - bytes_read );
+    if ( data.empty() ) {
+      break;
+    }
+    std::ranges::copy( data, buffer.begin() + static_cast<std::ptrdiff_t>( bytes_read ) );
+    inbound.pop( data.size() );
+    bytes_read += data.size();
+  }
+  register_read();
+
+  buffer.resize( bytes_read );
+  if ( bytes_read == 0 and inbound.is_finished() ) {
+    set_eof();
+  }
+}
+
+template<TCPDatagramAdapter AdaptT>
+size_t TCPMinnowSocket<AdaptT>::write( const std::string_view buffer )
+{
+  if ( not _shared ) {
+    return LocalStreamSocket::write( buffer );
+  }
+
+  RingPipe& outbound = _shared->outbound;
+  size_t bytes_written = outbound.write( buffer );
+  while ( bytes_written == 0 and not buffer.empty() and blocking() ) {
+    RingPipe::wait( outbound.writable_event() );
+    bytes_written = outbound.write( buffer );
+  }
+  register_write();
+  return bytes_written;
+}
+
+template<TCPDatagramAdapter AdaptT>
+void TCPMinnowSocket<AdaptT>::write_all( std::string_view buffer )
+{
+  if ( not _shared ) {
+    LocalStreamSocket::write_all( buffer );
+    return;
+  }
+
+  if ( not blocking() ) {
+    throw std::runtime_error( "write_all requires a blocking file descriptor" );
+  }
+  while ( not buffer.empty() ) {
+    buffer.remove_prefix( write( buffer ) );
+  }
+}
+
+//! \param[in] how can be `SHUT_RD`, `SHUT_WR`, or `SHUT_RDWR`; see [shutdown(2)](\ref man2::shutdown)
+template<TCPDatagramAdapter AdaptT>
+void TCPMinnowSocket<AdaptT>::shutdown( const int how )
+{
+  if ( _shared and ( how == SHUT_WR or how == SHUT_RDWR ) ) {
+    _shared->outbound.close();
+  }
+  if ( _shared and ( how == SHUT_RD or how == SHUT_RDWR ) ) {
+    _shared->inbound.close_reader();
+  }
+  LocalStreamSocket::shutdown( how );
+}
+
 template<TCPDatagramAdapter AdaptT>
 void TCPMinnowSocket<AdaptT>::wait_until_closed()
 {
@@ -230,13 +561,28 @@ void TCPMinnowSocket<AdaptT>::connect( const TCPConfig& c_tcp, const FdAdapterCo
     throw std::runtime_error( "TCPPeer not successfully initialized" );
   }
 
-  _tcp->push( [&]( const auto& x ) { _datagram_adapter.write( x ); } );
+  // With TCP Fast Open, whatever the application wrote before connecting rides on the SYN.
+  if ( c_ad.fast_open and _datagram_adapter.has_fast_open_cookie() ) {
+    std::string data;
+    if ( _shared ) {
+      data = _shared->outbound.peek().substr( 0, TCPConfig::MAX_PAYLOAD_SIZE );
+      _shared->outbound.pop( data.size() );
+    } else {
+      data.resize( TCPConfig::MAX_PAYLOAD_SIZE );
+      _thread_data.read( data );
+    }
+    _tcp->outbound_writer().push( data );
+    _tcp->set_syn_payload_limit( data.size() );
+  }
+
+  _tcp_push();
 
-  if ( _tcp->sender().sequence_numbers_in_flight() != 1 ) {
-    throw std::runtime_error( "After TCPConnection::connect(), expected sequence_numbers_in_flight() == 1" );
+  const auto syn_length = _tcp->sender().sequence_numbers_in_flight();
+  if ( syn_length == 0 ) {
+    throw std::runtime_error( "After TCPConnection::connect(), expected the SYN to be in flight" );
   }
 
-  _tcp_loop( [&] { return _tcp->sender().sequence_numbers_in_flight() == 1; } );
+  _tcp_loop( [&] { return _tcp->sender().sequence_numbers_in_flight() == syn_length; } );
 
   if ( not _tcp.has_value() ) {
     throw std::runtime_error( "TCPPeer destroyed unexpectedly" );
@@ -265,7 +611,12 @@ void TCPMinnowSocket<AdaptT>::listen_and_accept( const TCPConfig& c_tcp, const F
   _datagram_adapter.set_listening( true );
 
   std::cerr << "DEBUG: minnow listening for incoming connection...\n";
-  _tcp_loop( [&] { return ( not _tcp->has_ackno() ) or ( _tcp->sender().sequence_numbers_in_flight() ); } );
+  // Data that arrived on the SYN (TCP Fast Open) is handed to the application without waiting for the
+  // handshake to complete.
+  _tcp_loop( [&] {
+    return ( not _tcp->has_ackno() )
+           or ( _tcp->sender().sequence_numbers_in_flight() and not _tcp->inbound_reader().bytes_buffered() );
+  } );
   std::cerr << "DEBUG: minnow new connection from " << _datagram_adapter.config().destination.to_string() << ".\n";
 
   _tcp_thread = std::thread( &TCPMinnowSocket::_tcp_main, this );
@@ -279,7 +630,11 @@ void TCPMinnowSocket<AdaptT>::_tcp_main()
       throw std::runtime_error( "no TCP" );
     }
     _tcp_loop( [] { return true; } );
-    shutdown( SHUT_RDWR );
+    LocalStreamSocket::shutdown( SHUT_RDWR );
+    if ( _shared ) {
+      _shared->inbound.close();
+      _shared->outbound.close_reader();
+    }
     if ( not _tcp.has_value() ) {
       throw std::runtime_error( "TCP implementation destroyed unexpectedly" );
     }
@@ -1,15 +1,114 @@
 #include "tcp_over_ip.hh"
 
+#include "checksum.hh"
+#include "exception.hh"
 #include "helpers.hh"
 #include "ipv4_datagram.hh"
 #include "ipv4_header.hh"
 
+#include <algorithm>
+#include <array>
 #include <arpa/inet.h>
+#include <mutex>
+#include <poll.h>
+#include <random>
+#include <stdexcept>
 #include <unistd.h>
+#include <unordered_map>
 #include <utility>
 
 using namespace std;
 
+namespace {
+//! Server side of TCP Fast Open: a cookie is a keyed hash of the client's address. The key is a per-process
+//! secret, so cookies are invalidated when the process restarts. (RFC 7413 suggests a block cipher; this
+//! mixing function is cheaper and adequate for a teaching stack, but not cryptographically strong.)
+string make_fast_open_cookie( uint32_t client_address )
+{
+  static const uint64_t secret = [] {
+    random_device rd;
+    return ( static_cast<uint64_t>( rd() ) << 32 ) | rd();
+  }();
+
+  uint64_t x = secret ^ ( client_address * 0x9e3779b97f4a7c15ULL );
+  x = ( x ^ ( x >> 30 ) ) * 0xbf58476d1ce4e5b9ULL;
+  x = ( x ^ ( x >> 27 ) ) * 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+
+  string cookie( TCPSegment::FAST_OPEN_COOKIE_LENGTH, 0 );
+  for ( auto& c : cookie ) {
+    c = static_cast<char>( x );
+    x >>= 8;
+  }
+  return cookie;
+}
+
+//! Client side of TCP Fast Open: cookies received from servers, by server address. A cookie is for the *next*
+//! connection to the server, which has an adapter of its own (perhaps on another thread, e.g. in a
+//! TCPMinnowSocket), so the cache belongs to the process, not to an adapter.
+struct FastOpenCookieCache
+{
+  mutex lock {}; //!< Held for every access to `cookies`
+  unordered_map<uint32_t, string> cookies {};
+};
+
+FastOpenCookieCache& fast_open_cookie_cache()
+{
+  static FastOpenCookieCache cache;
+  return cache;
+}
+
+//! Offsets of the header fields that vary from segment to segment: in the IPv4 header, and in the TCP header
+//! (which starts at offset TCPH)
+constexpr size_t IPH_TOS = 1, IPH_LEN = 2, IPH_CKSUM = 10;
+constexpr size_t TCPH = IPv4Header::LENGTH;
+constexpr size_t TCPH_SEQNO = 4, TCPH_ACKNO = 8, TCPH_FLAGS = 13, TCPH_WINDOW = 14, TCPH_CKSUM = 16;
+
+class Wrap32Raw : public Wrap32
+{
+public:
+  uint32_t raw_value() const { return raw_value_; }
+};
+
+uint32_t raw_value( Wrap32 n )
+{
+  return Wrap32Raw { n }.raw_value();
+}
+
+//! Sum of the big-endian 16-bit words of `s` (before folding), for the Internet checksum
+uint32_t sum_words( string_view s )
+{
+  uint32_t sum = 0;
+  for ( size_t i = 0; i + 1 < s.size(); i += 2 ) {
+    sum += ( static_cast<uint32_t>( static_cast<uint8_t>( s[i] ) ) << 8 ) + static_cast<uint8_t>( s[i + 1] );
+  }
+  return sum;
+}
+
+//! Big-endian accessors for patching serialized headers in place
+void put_be16( string& s, size_t pos, uint16_t val )
+{
+  s[pos] = static_cast<char>( val >> 8 );
+  s[pos + 1] = static_cast<char>( val );
+}
+
+void put_be32( string& s, size_t pos, uint32_t val )
+{
+  put_be16( s, pos, static_cast<uint16_t>( val >> 16 ) );
+  put_be16( s, pos + 2, static_cast<uint16_t>( val ) );
+}
+
+//! Write one datagram to `device` (with no empty iovec for a pure ACK), waiting for room if it is non-blocking
+//! and full
+void write_datagram( FileDescriptor& device, string_view headers, string_view payload )
+{
+  while ( ( payload.empty() ? device.write( headers ) : device.write( array { headers, payload } ) ) == 0 ) {
+    pollfd pfd { device.fd_num(), POLLOUT, 0 };
+    CheckSystemCall( "poll", ::poll( &pfd, 1, -1 ) );
+  }
+}
+} // namespace
+
 //! \details This function attempts to parse a TCP segment from
 //! the IP datagram's payload.
 //!
@@ -26,28 +125,24 @@ optional<TCPMessage> TCPOverIPv4Adapter::unwrap_tcp_in_ip( InternetDatagram ip_d
 {
   // is the IPv4 datagram for us?
   // Note: it's valid to bind to address "0" (INADDR_ANY) and reply from actual address contacted
-  if ( not listening() and ( ip_dgram.header.dst != config().source.ipv4_numeric() ) ) {
+  if ( not listening() and ( ip_dgram.header.dst != header_template().src_ip ) ) {
     return {};
   }
 
   // is the IPv4 datagram from our peer?
-  if ( not listening() and ( ip_dgram.header.src != config().destination.ipv4_numeric() ) ) {
-    return {};
-  }
-
-  // does the IPv4 datagram claim that its payload is a TCP segment?
-  if ( ip_dgram.header.proto != IPv4Header::PROTO_TCP ) {
+  if ( not listening() and ( ip_dgram.header.src != header_template().dst_ip ) ) {
     return {};
   }
 
   // is the payload a valid TCP segment?
-  TCPSegment tcp_seg;
-  if ( not parse( tcp_seg, move( ip_dgram.payload ), ip_dgram.header.pseudo_checksum() ) ) {
+  auto parsed = parse_tcp_in_ip( ip_dgram );
+  if ( not parsed.has_value() ) {
     return {};
   }
+  TCPSegment& tcp_seg = parsed.value();
 
   // is the TCP segment for us?
-  if ( tcp_seg.udinfo.dst_port != config().source.port() ) {
+  if ( tcp_seg.udinfo.dst_port != header_template().src_port ) {
     return {};
   }
 
@@ -64,28 +159,56 @@ optional<TCPMessage> TCPOverIPv4Adapter::unwrap_tcp_in_ip( InternetDatagram ip_d
   }
 
   // is the TCP segment from our peer?
-  if ( tcp_seg.udinfo.src_port != config().destination.port() ) {
+  if ( tcp_seg.udinfo.src_port != header_template().dst_port ) {
     return {};
   }
 
+  if ( config().fast_open and tcp_seg.message.sender->SYN ) {
+    receive_fast_open( ip_dgram.header.src, tcp_seg );
+  }
+
   return move( tcp_seg.message );
 }
 
+optional<TCPSegment> TCPOverIPv4Adapter::parse_tcp_in_ip( InternetDatagram& ip_dgram )
+{
+  // does the IPv4 datagram claim that its payload is a TCP segment?
+  if ( ip_dgram.header.proto != IPv4Header::PROTO_TCP ) {
+    return {};
+  }
+
+  TCPSegment tcp_seg;
+  if ( not parse( tcp_seg, move( ip_dgram.payload ), ip_dgram.header.pseudo_checksum() ) ) {
+    return {};
+  }
+
+  tcp_seg.message.ECT = ip_dgram.header.ecn() != IPv4Header::ECN_NOT_ECT;
+  tcp_seg.message.CE = ip_dgram.header.ecn() == IPv4Header::ECN_CE;
+  return tcp_seg;
+}
+
 //! Takes a TCP segment, sets port numbers as necessary, and wraps it in an IPv4 datagram
 //! \param[in] seg is the TCP segment to convert
 InternetDatagram TCPOverIPv4Adapter::wrap_tcp_in_ip( const TCPMessage& msg )
 {
+  const HeaderTemplate& tmpl = header_template();
   const size_t payload_size = msg.sender->payload.size();
   TCPSegment seg { .message = { .sender = msg.sender.borrow(), .receiver = msg.receiver.borrow() } };
   // set the port numbers in the TCP segment
-  seg.udinfo.src_port = config().source.port();
-  seg.udinfo.dst_port = config().destination.port();
+  seg.udinfo.src_port = tmpl.src_port;
+  seg.udinfo.dst_port = tmpl.dst_port;
+  if ( config().fast_open and msg.sender->SYN ) {
+    send_fast_open( seg );
+  }
 
   // create an Internet Datagram and set its addresses and length
   InternetDatagram ip_dgram;
-  ip_dgram.header.src = config().source.ipv4_numeric();
-  ip_dgram.header.dst = config().destination.ipv4_numeric();
-  ip_dgram.header.len = ip_dgram.header.hlen * 4 + 20 /* tcp header len */ + payload_size;
+  ip_dgram.header.src = tmpl.src_ip;
+  ip_dgram.header.dst = tmpl.dst_ip;
+  if ( msg.ECT ) {
+    ip_dgram.header.set_ecn( IPv4Header::ECN_ECT0 );
+  }
+  ip_dgram.header.len = ip_dgram.header.hlen * 4 + seg.header_length() + payload_size;
 
   // set payload, calculating TCP checksum using information from IP header
   seg.compute_checksum( ip_dgram.header.pseudo_checksum() );
@@ -94,3 +217,182 @@ InternetDatagram TCPOverIPv4Adapter::wrap_tcp_in_ip( const TCPMessage& msg )
 
   return ip_dgram;
 }
+
+string_view TCPOverIPv4Adapter::wrap_tcp_headers( const TCPMessage& msg )
+{
+  // A SYN with a Fast Open option has a longer TCP header than the template
+  if ( config().fast_open and msg.sender->SYN ) {
+    _syn_headers = concat( serialize( wrap_tcp_in_ip( msg ) ) );
+    _syn_headers.resize( _syn_headers.size() - msg.sender->payload.size() );
+    return _syn_headers;
+  }
+
+  const HeaderKey key { .seqno = msg.sender->seqno,
+                        .ackno = msg.receiver->ackno,
+                        .payload_length = msg.sender->payload.size(),
+                        .window_size = msg.receiver->window_size,
+                        .flags = TCPSegment::flags( msg ),
+                        .ECT = msg.ECT };
+  const HeaderTemplate& tmpl = header_template();
+  if ( _last_headers == key ) {
+    return tmpl.headers;
+  }
+  return patch_headers( key, msg.sender->payload );
+}
+
+void TCPOverIPv4Adapter::segment_tcp_in_ip( const TCPMessage& msg, const SegmentOutput& output )
+{
+  const TCPSenderMessage& whole = msg.sender;
+  if ( whole.SYN ) {
+    throw runtime_error( "segment_tcp_in_ip: cannot segment a SYN" );
+  }
+
+  constexpr uint8_t FLAG_CWR = 0b1000'0000, FLAG_FIN = 0b0000'0001;
+  HeaderKey key { .seqno = whole.seqno,
+                  .ackno = msg.receiver->ackno,
+                  .payload_length = 0,
+                  .window_size = msg.receiver->window_size,
+                  .flags = TCPSegment::flags( msg ),
+                  .ECT = msg.ECT };
+  const uint8_t flags = key.flags;
+
+  const string_view payload = whole.payload;
+  size_t offset = 0;
+  do {
+    const string_view slice = payload.substr( offset, TCPConfig::MAX_PAYLOAD_SIZE );
+    const bool first = offset == 0;
+    const bool last = offset + slice.size() == payload.size();
+
+    key.seqno = whole.seqno + static_cast<uint32_t>( offset );
+    key.payload_length = slice.size();
+    key.flags = flags & ( first ? 0xff : ~FLAG_CWR ) & ( last ? 0xff : ~FLAG_FIN ); // NOLINT(*-bitwise)
+    output( patch_headers( key, slice ), slice );
+    offset += slice.size();
+  } while ( offset < payload.size() );
+}
+
+void TCPOverIPv4Adapter::write_tcp_in_ip( FileDescriptor& device, const TCPMessage& msg )
+{
+  if ( msg.sender->payload.size() > TCPConfig::MAX_PAYLOAD_SIZE ) {
+    segment_tcp_in_ip( msg, [&]( string_view headers, string_view payload ) {
+      write_datagram( device, headers, payload );
+    } );
+    return;
+  }
+
+  write_datagram( device, wrap_tcp_headers( msg ), msg.sender->payload );
+}
+
+TCPOverIPv4Adapter::HeaderTemplate& TCPOverIPv4Adapter::header_template()
+{
+  if ( _template.has_value() and _template->source == config().source
+       and _template->destination == config().destination ) {
+    return _template.value();
+  }
+
+  _last_headers.reset();
+  HeaderTemplate& tmpl = _template.emplace( HeaderTemplate { .source = config().source,
+                                                             .destination = config().destination,
+                                                             .src_ip = config().source.ipv4_numeric(),
+                                                             .dst_ip = config().destination.ipv4_numeric(),
+                                                             .src_port = config().source.port(),
+                                                             .dst_port = config().destination.port() } );
+
+  // Serialize the headers of an empty segment, then sum the fields that are the same for every segment
+  TCPSegment seg;
+  seg.udinfo.src_port = tmpl.src_port;
+  seg.udinfo.dst_port = tmpl.dst_port;
+  InternetDatagram ip_dgram;
+  ip_dgram.header.src = tmpl.src_ip;
+  ip_dgram.header.dst = tmpl.dst_ip;
+  ip_dgram.header.len = ip_dgram.header.hlen * 4 + seg.header_length();
+  ip_dgram.payload = serialize( seg );
+  tmpl.headers = concat( serialize( ip_dgram ) );
+
+  string fixed = tmpl.headers;
+  fill_n( fixed.begin() + IPH_TOS, 1, 0 );
+  fill_n( fixed.begin() + IPH_LEN, 2, 0 );
+  fill_n( fixed.begin() + IPH_CKSUM, 2, 0 );
+  fill_n( fixed.begin() + TCPH + TCPH_SEQNO, 4, 0 );
+  fill_n( fixed.begin() + TCPH + TCPH_ACKNO, 4, 0 );
+  fill_n( fixed.begin() + TCPH + TCPH_FLAGS, 1, 0 );
+  fill_n( fixed.begin() + TCPH + TCPH_WINDOW, 2, 0 );
+  fill_n( fixed.begin() + TCPH + TCPH_CKSUM, 2, 0 );
+  tmpl.ip_fixed_checksum = sum_words( string_view { fixed }.substr( 0, TCPH ) );
+  tmpl.tcp_fixed_checksum = ( tmpl.src_ip >> 16 ) + static_cast<uint16_t>( tmpl.src_ip ) + ( tmpl.dst_ip >> 16 )
+                            + static_cast<uint16_t>( tmpl.dst_ip ) + IPv4Header::PROTO_TCP
+                            + sum_words( string_view { fixed }.substr( TCPH ) );
+  return tmpl;
+}
+
+string_view TCPOverIPv4Adapter::patch_headers( const HeaderKey& key, string_view payload )
+{
+  string& h = header_template().headers;
+  const uint32_t seqno = raw_value( key.seqno );
+  const uint32_t ackno = raw_value( key.ackno.value_or( Wrap32 { 0 } ) );
+  const uint8_t tos = key.ECT ? IPv4Header::ECN_ECT0 : IPv4Header::ECN_NOT_ECT;
+  const auto tcp_length = static_cast<uint16_t>( TCPSegment::HEADER_LENGTH + payload.size() );
+  const auto ip_length = static_cast<uint16_t>( TCPH + tcp_length );
+
+  h[IPH_TOS] = static_cast<char>( tos );
+  put_be16( h, IPH_LEN, ip_length );
+  put_be16( h, IPH_CKSUM, InternetChecksum { _template->ip_fixed_checksum + tos + ip_length }.value() );
+
+  put_be32( h, TCPH + TCPH_SEQNO, seqno );
+  put_be32( h, TCPH + TCPH_ACKNO, ackno );
+  h[TCPH + TCPH_FLAGS] = static_cast<char>( key.flags );
+  put_be16( h, TCPH + TCPH_WINDOW, key.window_size );
+  InternetChecksum tcp_check { _template->tcp_fixed_checksum + tcp_length + ( seqno >> 16 )
+                               + static_cast<uint16_t>( seqno ) + ( ackno >> 16 ) + static_cast<uint16_t>( ackno )
+                               + key.flags + key.window_size };
+  tcp_check.add( payload );
+  put_be16( h, TCPH + TCPH_CKSUM, tcp_check.value() );
+
+  _last_headers = key;
+  return h;
+}
+
+//! \details On a SYN (the listening side), data is accepted only with a valid cookie; otherwise the payload is
+//! dropped, so only the SYN is acknowledged and the client resends the data after the handshake. A client that
+//! asked for a cookie (or presented a stale one) gets a fresh cookie on the SYN-ACK. On a SYN-ACK (the
+//! connecting side), a cookie from the server is cached for future connections.
+void TCPOverIPv4Adapter::receive_fast_open( uint32_t peer_address, TCPSegment& seg )
+{
+  if ( seg.message.receiver->ackno.has_value() ) {
+    if ( seg.fast_open_cookie.has_value() and not seg.fast_open_cookie->empty() ) {
+      auto& cache = fast_open_cookie_cache();
+      const lock_guard guard { cache.lock };
+      cache.cookies[peer_address] = seg.fast_open_cookie.value();
+    }
+    return;
+  }
+
+  const string cookie = make_fast_open_cookie( peer_address );
+  if ( seg.fast_open_cookie != cookie ) {
+    seg.message.sender->payload.clear();
+    seg.message.sender->FIN = false;
+    if ( seg.fast_open_cookie.has_value() ) {
+      _fast_open_reply_cookie = cookie;
+    }
+  }
+}
+
+void TCPOverIPv4Adapter::send_fast_open( TCPSegment& seg )
+{
+  if ( seg.message.receiver.get().ackno.has_value() ) {
+    seg.fast_open_cookie = _fast_open_reply_cookie;
+    return;
+  }
+
+  auto& cache = fast_open_cookie_cache();
+  const lock_guard guard { cache.lock };
+  const auto it = cache.cookies.find( config().destination.ipv4_numeric() );
+  seg.fast_open_cookie = it == cache.cookies.end() ? string {} : it->second;
+}
+
+bool TCPOverIPv4Adapter::has_fast_open_cookie() const
+{
+  auto& cache = fast_open_cookie_cache();
+  const lock_guard guard { cache.lock };
+  return cache.cookies.contains( config().destination.ipv4_numeric() );
+}
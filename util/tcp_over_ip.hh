@@ -1,10 +1,14 @@
 #pragma once
 
 #include "fd_adapter.hh"
+#include "file_descriptor.hh"
 #include "ipv4_datagram.hh"
 #include "tcp_segment.hh"
 
+#include <functional>
 #include <optional>
+#include <string>
+#include <string_view>
 
 //! \brief A converter from TCP segments to serialized IPv4 datagrams
 class TCPOverIPv4Adapter : public FdAdapterBase
@@ -12,5 +16,88 @@ class TCPOverIPv4Adapter : public FdAdapterBase
 public:
   std::optional<TCPMessage> unwrap_tcp_in_ip( InternetDatagram ip_dgram );
 
+  //! \brief Parse the TCP segment in a datagram (with its ECN marks), whatever connection it belongs to
+  //! \details The datagram's payload is consumed; its header is left for the caller (e.g. to find the flow).
+  static std::optional<TCPSegment> parse_tcp_in_ip( InternetDatagram& ip_dgram );
+
+  //! The datagram's payload borrows the message's payload (no copy), so it must be written out (or copied)
+  //! while `msg` is still alive.
   InternetDatagram wrap_tcp_in_ip( const TCPMessage& msg );
+
+  //! \brief The serialized IPv4 and TCP headers for `msg`; its payload follows them on the wire
+  //! \details This is the fast path of wrap_tcp_in_ip. The headers are patched into a per-connection template,
+  //! so only the fields that vary (lengths, ECN, seqno, ackno, flags, window and the checksums) are written, and
+  //! the checksums start from precomputed sums over everything else. If the message has the same seqno, length,
+  //! flags, ackno and window as the last one (a repeated ACK or retransmission), the last headers are returned
+  //! as they are. The view is valid until the next call.
+  std::string_view wrap_tcp_headers( const TCPMessage& msg );
+
+  //! Receives the serialized IPv4 and TCP headers of one datagram, and its slice of the payload
+  using SegmentOutput = std::function<void( std::string_view headers, std::string_view payload )>;
+
+  //! \brief Segmentation offload: wrap a message with a payload of any size as a series of datagrams with at
+  //! most TCPConfig::MAX_PAYLOAD_SIZE bytes of payload each
+  //! \details Each datagram's headers are patched into the per-connection template (see wrap_tcp_headers).
+  //! A CWR goes only on the first datagram and a FIN only on the last.
+  //! The message may not carry a SYN.
+  void segment_tcp_in_ip( const TCPMessage& msg, const SegmentOutput& output );
+
+  //! \brief Wrap `msg` and write it to `device`, which takes one IPv4 datagram per write (e.g. a TUN device)
+  //! \details Uses wrap_tcp_headers, or segment_tcp_in_ip if the payload is longer than one datagram's.
+  //! If `device` is non-blocking and has no room, this waits for room (as a write to a blocking one would).
+  void write_tcp_in_ip( FileDescriptor& device, const TCPMessage& msg );
+
+  //! Is there a cached Fast Open cookie for the configured destination (so the SYN may carry data)? The cache
+  //! is shared by all the adapters in the process, and safe to use from any thread.
+  bool has_fast_open_cookie() const;
+
+private:
+  //! \brief Per-connection IPv4 and TCP header template
+  //! \details Rebuilt whenever the configured addresses change (e.g. when a listening adapter learns its peer).
+  struct HeaderTemplate
+  {
+    Address source;
+    Address destination;
+    uint32_t src_ip {};
+    uint32_t dst_ip {};
+    uint16_t src_port {};
+    uint16_t dst_port {};
+
+    std::string headers {};         //!< IPv4 and TCP headers, without options, as last patched
+    uint32_t ip_fixed_checksum {};  //!< Sum of the IPv4 header's fixed fields
+    uint32_t tcp_fixed_checksum {}; //!< Sum of the pseudo-header's addresses and protocol, and fixed TCP fields
+  };
+  std::optional<HeaderTemplate> _template {};
+
+  //! The fields that determine a segment's headers (with the payload, which is fixed by seqno and length)
+  struct HeaderKey
+  {
+    Wrap32 seqno { 0 };
+    std::optional<Wrap32> ackno {};
+    size_t payload_length {};
+    uint16_t window_size {};
+    uint8_t flags {};
+    bool ECT {};
+
+    bool operator==( const HeaderKey& other ) const = default;
+  };
+  std::optional<HeaderKey> _last_headers {};
+
+  //! Headers of the last SYN with a Fast Open option (which does not fit the template)
+  std::string _syn_headers {};
+
+  //! The template for the configured addresses
+  HeaderTemplate& header_template();
+
+  //! Patch the template for one segment, and return it
+  std::string_view patch_headers( const HeaderKey& key, std::string_view payload );
+
+  //! Apply TCP Fast Open (RFC 7413) rules to an inbound segment
+  void receive_fast_open( uint32_t peer_address, TCPSegment& seg );
+
+  //! Attach a Fast Open option to an outbound SYN, if appropriate
+  void send_fast_open( TCPSegment& seg );
+
+  //! Cookie to return on our SYN-ACK (to a client that requested one or sent a stale one)
+  std::optional<std::string> _fast_open_reply_cookie {};
 };
@@ -7,33 +7,98 @@
 #include "tcp_sender.hh"
 #include "tcp_sender_message.hh"
 
+#include <algorithm>
+#include <chrono>
+#include <concepts>
+#include <cstddef>
 #include <functional>
 #include <optional>
+#include <span>
+#include <vector>
+
+/* Anything that can be called to send a TCPMessage */
+template<typename F>
+concept TCPMessageSink = std::invocable<const F&, TCPMessage>;
 
 class TCPPeer
 {
-  auto make_send( const auto& transmit )
+  auto make_send( const auto& transmit, bool new_data = false )
+  {
+    return [&, new_data]( const TCPSenderMessage& x ) { send( x, transmit, new_data ); };
+  }
+
+  auto collect()
   {
-    return [&]( const TCPSenderMessage& x ) { send( x, transmit ); };
+    return [this]( TCPMessage msg ) {
+      if ( batch_size_ == batch_.size() ) {
+        batch_.emplace_back();
+      }
+      TCPMessage& slot = batch_[batch_size_];
+      // The sender lends each message out of one reused buffer, and a TCPMessage owns its payload, so the batch
+      // copies it (into the slot's buffer, reused from call to call). Holding views into the outbound stream
+      // instead would need a non-owning payload type in TCPSenderMessage.
+      slot.sender.get_mut() = msg.sender.get();
+      slot.receiver = std::move( msg.receiver );
+      slot.ECT = msg.ECT;
+      slot.CE = msg.CE;
+      ++batch_size_;
+    };
   }
 
 public:
-  explicit TCPPeer( const TCPConfig& cfg ) : cfg_( cfg ) {}
+  explicit TCPPeer( const TCPConfig& cfg ) : cfg_( cfg )
+  {
+    sender_.set_segmentation_offload( cfg_.segmentation_offload );
+  }
 
   Writer& outbound_writer() { return sender_.writer(); }
   Reader& inbound_reader() { return receiver_.reader(); }
 
-  /* Type of the `transmit` function that the push and tick methods can use to send messages */
+  /* Type of the `transmit` function that the push and tick methods can use to send messages. The methods take
+     any TCPMessageSink: a TransmitFunction works, and a lambda avoids the type erasure, so the whole send path
+     down to the adapter can be inlined. */
   using TransmitFunction = std::function<void( TCPMessage )>;
 
-  /* Passthrough methods */
-  void push( const TransmitFunction& transmit ) { sender_.push( make_send( transmit ) ); }
-  void tick( uint64_t t, const TransmitFunction& transmit )
+  /* Passthrough methods. Time may be given in milliseconds, or at microsecond resolution. */
+  void push( const TCPMessageSink auto& transmit ) { sender_.push( make_send( transmit, true ) ); }
+  void tick( uint64_t t, const TCPMessageSink auto& transmit ) { tick( std::chrono::milliseconds( t ), transmit ); }
+  void tick( std::chrono::microseconds t, const TCPMessageSink auto& transmit )
   {
     cumulative_time_ += t;
+    receiver_.tick( t );
     sender_.tick( t, make_send( transmit ) );
   }
+  /* Type of a `transmit` function that takes all the messages from one push, tick or receive at once, so the
+     datagram adapter can write them out together (e.g. with sendmmsg) */
+  using BatchTransmitFunction = std::function<void( std::span<const TCPMessage> )>;
+
+  /* Batched versions of push, tick and receive. The messages are copied into a batch that is reused from call
+     to call, and passed to `transmit` once at the end (if there are any). Unlike the unbatched path, which hands
+     each message to `transmit` while it is still in the sender's buffer, this copies every payload once more:
+     the batching trades a copy per segment for fewer system calls. */
+  void push_batched( const BatchTransmitFunction& transmit )
+  {
+    push( collect() );
+    flush_batch( transmit );
+  }
+  void tick_batched( uint64_t t, const BatchTransmitFunction& transmit )
+  {
+    tick_batched( std::chrono::milliseconds( t ), transmit );
+  }
+  void tick_batched( std::chrono::microseconds t, const BatchTransmitFunction& transmit )
+  {
+    tick( t, collect() );
+    flush_batch( transmit );
+  }
+  void receive_batched( TCPMessage msg, const BatchTransmitFunction& transmit )
+  {
+    receive( std::move( msg ), collect() );
+    flush_batch( transmit );
+  }
+
   bool has_ackno() const { return receiver_.send().ackno.has_value(); }
+  void set_syn_payload_limit( uint64_t max_bytes ) { sender_.set_syn_payload_limit( max_bytes ); }
+  bool ecn() const { return ecn_; } // was ECN negotiated on the handshake?
 
   /* Is the peer still active? */
   bool active() const
@@ -42,17 +107,68 @@ public:
     const bool sender_active = sender_.sequence_numbers_in_flight() or not sender_.reader().is_finished();
     const bool receiver_active = not receiver_.writer().is_closed();
     const bool lingering
-      = linger_after_streams_finish_ and ( cumulative_time_ < time_of_last_receipt_ + 10UL * cfg_.rt_timeout );
+      = linger_after_streams_finish_ and ( cumulative_time_ < time_of_last_receipt_ + linger_time_us( cfg_ ) );
 
     return ( not any_errors ) and ( sender_active or receiver_active or lingering );
   }
 
-  void receive( TCPMessage msg, const TransmitFunction& transmit )
+  /* Is the peer active only to linger after both streams finished (e.g. to acknowledge a retransmitted FIN)? */
+  bool lingering() const
+  {
+    return active() and sender_.sequence_numbers_in_flight() == 0 and sender_.reader().is_finished()
+           and receiver_.writer().is_closed();
+  }
+
+  /* How many ms (rounded up) until a tick() has something to do: the retransmission timer expires, the lingering
+     ends, or the receiver's auto-tuning finds the flow idle. Until then (and with no new segments or bytes to
+     push), ticking the peer is a no-op, so an event loop can sleep until the deadline. nullopt if no timer is
+     running. */
+  std::optional<uint64_t> next_deadline() const
+  {
+    const auto deadline = next_deadline_us();
+    if ( not deadline.has_value() ) {
+      return std::nullopt;
+    }
+    return std::chrono::ceil<std::chrono::milliseconds>( deadline.value() ).count();
+  }
+
+  /* The same, to the microsecond */
+  std::optional<std::chrono::microseconds> next_deadline_us() const
+  {
+    if ( not active() ) {
+      return std::nullopt;
+    }
+
+    std::optional<std::chrono::microseconds> deadline = sender_.time_to_retransmission_us();
+    auto earliest = [&]( std::optional<std::chrono::microseconds> t ) {
+      if ( t.has_value() ) {
+        deadline = std::min( deadline.value_or( std::chrono::microseconds::max() ), t.value() );
+      }
+    };
+    earliest( receiver_.time_to_idle_us() );
+    if ( lingering() and linger_after_streams_finish_ ) {
+      earliest( time_of_last_receipt_ + linger_time_us( cfg_ ) - cumulative_time_ );
+    }
+    return deadline;
+  }
+
+  /* How long a peer lingers after the last segment it receives, once the streams finish (in ms, rounded up) */
+  static uint64_t linger_time( const TCPConfig& cfg )
+  {
+    return std::chrono::ceil<std::chrono::milliseconds>( linger_time_us( cfg ) ).count();
+  }
+  static std::chrono::microseconds linger_time_us( const TCPConfig& cfg ) { return 10 * cfg.initial_rto(); }
+
+  void receive( TCPMessage msg, const TCPMessageSink auto& transmit )
   {
     if ( not active() ) {
       return;
     }
 
+    if ( receive_predicted( msg, transmit ) ) {
+      return;
+    }
+
     // Record time in case this peer has to linger after streams finish.
     time_of_last_receipt_ = cumulative_time_;
 
@@ -64,11 +180,22 @@ public:
     const auto our_ackno = receiver_.send().ackno;
     need_send_ |= ( our_ackno.has_value() and msg.sender->seqno + 1 == our_ackno.value() );
 
+    // ECN negotiation (RFC 3168 section 6.1.1): an ECN-setup SYN carries ECE and CWR, and an ECN-setup
+    // SYN-ACK carries ECE alone.
+    const bool syn = msg.sender->SYN;
+    if ( cfg_.ecn and syn ) {
+      const bool setup_syn = not msg.receiver->ackno.has_value() and msg.receiver->ECE and msg.sender->CWR;
+      const bool setup_syn_ack = msg.receiver->ackno.has_value() and msg.receiver->ECE and not msg.sender->CWR;
+      ecn_ = setup_syn or setup_syn_ack;
+    }
+
     // Give incoming TCPSenderMessage to receiver.
-    receiver_.receive( std::move( msg.sender ) );
+    receiver_.receive( std::move( msg.sender ), ecn_ and msg.CE );
 
-    // Give incoming TCPReceiverMessage to sender.
-    sender_.receive( msg.receiver );
+    // Give incoming TCPReceiverMessage to sender. An ECE on a SYN is negotiation, not a congestion signal.
+    TCPReceiverMessage ack = msg.receiver;
+    ack.ECE = ack.ECE and ecn_ and not syn;
+    sender_.receive( ack );
 
     // Send reply if needed.
     push( transmit );
@@ -77,9 +204,13 @@ public:
     }
 
     // Did the inbound stream finish before the outbound stream? If so, no need to linger after streams finish.
-    if ( receiver_.writer().is_closed() and not std::as_const( sender_ ).reader().is_finished() ) {
+    if ( receiver_.writer().is_closed() and not sender_.fully_sent() ) {
       linger_after_streams_finish_ = false;
     }
+
+    // Predict the next segment: the ackno and window the peer last told us about.
+    predicted_ackno_ = msg.receiver->ackno;
+    predicted_window_ = msg.receiver->window_size;
   }
 
   // Testing interface
@@ -88,18 +219,84 @@ public:
 
 private:
   TCPConfig cfg_;
-  TCPSender sender_ { ByteStream { cfg_.send_capacity }, cfg_.isn, cfg_.rt_timeout };
-  TCPReceiver receiver_ { Reassembler { ByteStream { cfg_.recv_capacity } } };
+  TCPSender sender_ { ByteStream { cfg_.send_capacity }, cfg_.isn, cfg_.initial_rto() };
+  TCPReceiver receiver_ { Reassembler { ByteStream { cfg_.recv_capacity } }, cfg_.recv_capacity_max };
 
   bool need_send_ {};
+  bool ecn_ {};
+
+  // Header prediction (Van Jacobson, 1990). On an established connection, nearly every segment is either
+  // the next in-order data segment that acknowledges nothing new, or a pure ACK for new data; in both
+  // cases, it has no flags and repeats the window from the last segment. Those skip the general receive
+  // path: data goes straight to the inbound stream, and a pure ACK only advances the sender (and pushes
+  // if there is more to send). Anything else -- including a duplicate ACK -- takes the slow path.
+  std::optional<Wrap32> predicted_ackno_ {};
+  uint16_t predicted_window_ {};
 
-  void send( const TCPSenderMessage& sender_message, const TransmitFunction& transmit )
+  bool receive_predicted( const TCPMessage& msg, const TCPMessageSink auto& transmit )
   {
-    transmit( { .sender = borrow( sender_message ), .receiver = receiver_.send() } );
+    const TCPSenderMessage& seg = msg.sender;
+    const TCPReceiverMessage& ack = msg.receiver;
+    if ( not predicted_ackno_.has_value() or not ack.ackno.has_value() or ack.window_size != predicted_window_
+         or ack.RST or ack.ECE or msg.CE ) {
+      return false;
+    }
+
+    if ( seg.payload.empty() ) {
+      if ( ack.ackno == predicted_ackno_ or not receiver_.receive_predicted( seg ) ) {
+        return false;
+      }
+      sender_.receive( ack );
+      predicted_ackno_ = ack.ackno;
+      if ( sender_.bytes_unsent() or sender_.fully_sent() ) {
+        push( transmit );
+      }
+    } else {
+      if ( ack.ackno != predicted_ackno_ or not receiver_.receive_predicted( seg ) ) {
+        return false;
+      }
+      need_send_ = true;
+      push( transmit );
+      if ( need_send_ ) {
+        send( sender_.make_empty_message(), transmit );
+      }
+    }
+
+    time_of_last_receipt_ = cumulative_time_;
+    return true;
+  }
+
+  // New data segments on an ECN connection are sent ECN-capable. Retransmissions, pure ACKs and SYNs are not
+  // (RFC 3168 section 6.1.5).
+  void send( const TCPSenderMessage& sender_message, const TCPMessageSink auto& transmit, bool new_data = false )
+  {
+    TCPMessage msg { .sender = borrow( sender_message ), .receiver = receiver_.send() };
+    if ( cfg_.ecn and sender_message.SYN and not msg.receiver->ackno.has_value() ) {
+      TCPSenderMessage setup_syn = sender_message;
+      setup_syn.CWR = true;
+      msg.sender = std::move( setup_syn );
+      msg.receiver->ECE = true;
+    } else if ( ecn_ and sender_message.SYN ) {
+      msg.receiver->ECE = true;
+    }
+    msg.ECT = ecn_ and new_data and not sender_message.SYN and not sender_message.payload.empty();
+    transmit( std::move( msg ) );
     need_send_ = false;
   }
 
+  // Messages collected for a batched call. Entries past batch_size_ are kept so their buffers can be reused.
+  std::vector<TCPMessage> batch_ {};
+  size_t batch_size_ {};
+
+  void flush_batch( const BatchTransmitFunction& transmit )
+  {
+    if ( batch_size_ > 0 ) {
+      transmit( std::span<const TCPMessage> { batch_.data(), batch_size_ } );
+      batch_size_ = 0;
+    }
+  }
+
   bool linger_after_streams_finish_ { true }; // one peer may need to linger to make sure all closure conditions met
-  uint64_t cumulative_time_ {};
-  uint64_t time_of_last_receipt_ {};
+  std::chrono::microseconds cumulative_time_ {};
+  std::chrono::microseconds time_of_last_receipt_ {};
 };
@@ -9,6 +9,39 @@ using namespace std;
 
 static_assert( !( TCPSegment::HEADER_LENGTH & 0x03 ) ); // header length must be divisible by 4
 
+void TCPSegment::parse_options( Parser& parser, size_t length )
+{
+  fast_open_cookie.reset();
+  while ( length > 0 and not parser.has_error() ) {
+    uint8_t kind {};
+    parser.integer( kind );
+    --length;
+    if ( kind == OPTION_END ) {
+      break;
+    }
+    if ( kind == OPTION_NOP ) {
+      continue;
+    }
+
+    uint8_t option_length {};
+    parser.integer( option_length );
+    if ( option_length < 2 or option_length - 1U > length ) {
+      parser.set_error();
+      return;
+    }
+    length -= option_length - 1U;
+
+    if ( kind == OPTION_FAST_OPEN ) {
+      std::string cookie( option_length - 2U, 0 );
+      parser.string( cookie );
+      fast_open_cookie = move( cookie );
+    } else {
+      parser.remove_prefix( option_length - 2U );
+    }
+  }
+  parser.remove_prefix( length );
+}
+
 void TCPSegment::parse( Parser& parser, uint32_t datagram_layer_pseudo_checksum )
 {
   /* verify checksum */
@@ -40,6 +73,8 @@ void TCPSegment::parse( Parser& parser, uint32_t datagram_layer_pseudo_checksum
     message.receiver->ackno.reset(); // no ACK
   }
 
+  message.sender->CWR = octet & 0b1000'0000;
+  message.receiver->ECE = octet & 0b0100'0000;
   message.sender->RST = message.receiver->RST = octet & 0b0000'0100;
   message.sender->SYN = octet & 0b0000'0010;
   message.sender->FIN = octet & 0b0000'0001;
@@ -48,12 +83,15 @@ void TCPSegment::parse( Parser& parser, uint32_t datagram_layer_pseudo_checksum
   parser.integer( udinfo.cksum );
   parser.integer( raw16 ); // urgent pointer
 
-  // skip any options or anything extra in the header
+  // parse the options we understand, and skip the rest
   if ( data_offset < ( HEADER_LENGTH >> 2 ) ) {
     parser.set_error();
     return;
   }
-  parser.remove_prefix( ( data_offset * 4 ) - HEADER_LENGTH );
+  parse_options( parser, ( data_offset * 4 ) - HEADER_LENGTH );
+  if ( parser.has_error() ) {
+    return;
+  }
 
   parser.concatenate_all_remaining( message.sender->payload );
 }
@@ -70,15 +108,41 @@ void TCPSegment::serialize( Serializer& serializer ) const
   serializer.integer( udinfo.dst_port );
   serializer.integer( Wrap32Serializable { message.sender->seqno }.raw_value() );
   serializer.integer( Wrap32Serializable { message.receiver->ackno.value_or( Wrap32 { 0 } ) }.raw_value() );
-  serializer.integer( uint8_t { ( HEADER_LENGTH >> 2 ) << 4 } ); // data offset
-  const bool reset = message.sender->RST or message.receiver->RST;
-  const uint8_t flags = ( message.receiver->ackno.has_value() ? 0b0001'0000U : 0 ) | ( reset ? 0b0000'0100U : 0 )
-                        | ( message.sender->SYN ? 0b0000'0010U : 0 ) | ( message.sender->FIN ? 0b0000'0001U : 0 );
-  serializer.integer( flags );
+  serializer.integer( static_cast<uint8_t>( ( header_length() >> 2 ) << 4 ) ); // data offset
+  serializer.integer( flags( message ) );
   serializer.integer( message.receiver->window_size );
   serializer.integer( udinfo.cksum );
   serializer.integer( uint16_t { 0 } ); // urgent pointer
-  serializer.buffer( message.sender->payload );
+
+  if ( fast_open_cookie.has_value() ) {
+    serializer.integer( OPTION_FAST_OPEN );
+    serializer.integer( static_cast<uint8_t>( fast_open_cookie->size() + 2 ) );
+    for ( const char c : fast_open_cookie.value() ) {
+      serializer.integer( static_cast<uint8_t>( c ) );
+    }
+    for ( size_t i = fast_open_cookie->size() + 2; i % 4; ++i ) {
+      serializer.integer( OPTION_END );
+    }
+  }
+
+  serializer.buffer( borrow( message.sender->payload ) );
+}
+
+uint8_t TCPSegment::flags( const TCPMessage& message )
+{
+  const bool reset = message.sender->RST or message.receiver->RST;
+  return ( message.sender->CWR ? 0b1000'0000U : 0 ) | ( message.receiver->ECE ? 0b0100'0000U : 0 )
+         | ( message.receiver->ackno.has_value() ? 0b0001'0000U : 0 ) | ( reset ? 0b0000'0100U : 0 )
+         | ( message.sender->SYN ? 0b0000'0010U : 0 ) | ( message.sender->FIN ? 0b0000'0001U : 0 );
+}
+
+uint8_t TCPSegment::header_length() const
+{
+  if ( not fast_open_cookie.has_value() ) {
+    return HEADER_LENGTH;
+  }
+  const size_t options_length = fast_open_cookie->size() + 2;
+  return HEADER_LENGTH + ( ( options_length + 3 ) & ~size_t { 3 } );
 }
 
 void TCPSegment::compute_checksum( uint32_t datagram_layer_pseudo_checksum )
@@ -106,9 +170,18 @@ string TCPSegment::to_string() const
   if ( message.sender->FIN ) {
     ss << " +FIN";
   }
+  if ( fast_open_cookie.has_value() ) {
+    ss << ( fast_open_cookie->empty() ? " +TFO-request" : " +TFO-cookie" );
+  }
   if ( message.sender->RST or message.receiver->RST ) {
     ss << " +RST";
   }
+  if ( message.sender->CWR ) {
+    ss << " +CWR";
+  }
+  if ( message.receiver->ECE ) {
+    ss << " +ECE";
+  }
   auto ackno = message.receiver->ackno;
   if ( ackno.has_value() ) {
     ss << " ACK<" << Wrap32Serializable { *ackno }.raw_value() << ">";
@@ -6,6 +6,9 @@
 #include "tcp_sender_message.hh"
 #include "udinfo.hh"
 
+#include <optional>
+#include <string>
+
 // A TCPMessage (a concept used only in CS144) models the full
 // messages sent between TCP endpoints, omitting the multiplexing
 // information and checksum.
@@ -13,6 +16,10 @@ struct TCPMessage
 {
   Ref<TCPSenderMessage> sender {};
   Ref<TCPReceiverMessage> receiver {};
+
+  // ECN codepoint of the IP datagram that carries the message (RFC 3168)
+  bool ECT {}; // ECN-capable transport: a congested router may mark the datagram instead of dropping it
+  bool CE {};  // congestion experienced: a router marked the datagram
 };
 
 // A TCPSegment represents a complete (STD 7 / RFC 9293) TCP segment.
@@ -22,6 +29,9 @@ struct TCPSegment
   TCPMessage message {};
   UserDatagramInfo udinfo {};
 
+  // TCP Fast Open (RFC 7413) option: an empty cookie is a cookie request
+  std::optional<std::string> fast_open_cookie {};
+
   void parse( Parser& parser, uint32_t datagram_layer_pseudo_checksum );
   void serialize( Serializer& serializer ) const;
 
@@ -29,6 +39,20 @@ struct TCPSegment
 
   static constexpr uint8_t HEADER_LENGTH = 20; // TCP header length, not including options
 
+  static constexpr uint8_t OPTION_END = 0;        // End of option list
+  static constexpr uint8_t OPTION_NOP = 1;        // No-operation (padding)
+  static constexpr uint8_t OPTION_FAST_OPEN = 34; // TCP Fast Open cookie
+  static constexpr uint8_t FAST_OPEN_COOKIE_LENGTH = 8;
+
+  // TCP header length, including options and padding
+  uint8_t header_length() const;
+
+  // The flags byte of the TCP header for a message (CWR, ECE, ACK, RST, SYN and FIN)
+  static uint8_t flags( const TCPMessage& message );
+
   // Return a string containing a summary in human-readable format
   std::string to_string() const;
+
+private:
+  void parse_options( Parser& parser, size_t length );
 };
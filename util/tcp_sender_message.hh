@@ -7,7 +7,7 @@
 /*
  * The TCPSenderMessage structure contains the information sent from a TCP sender to its receiver.
  *
- * It contains five fields:
+ * It contains six fields:
  *
  * 1) The sequence number (seqno) of the beginning of the segment. If the SYN flag is set, this is the
  *    sequence number of the SYN flag. Otherwise, it's the sequence number of the beginning of the payload.
@@ -20,6 +20,9 @@
  * 4) The FIN flag. If set, the payload represents the ending of the byte stream.
  *
  * 5) The RST (reset) flag. If set, the stream has suffered an error and the connection should be aborted.
+ *
+ * 6) The CWR (congestion window reduced) flag. If set, the sender has responded to an ECN-Echo from the
+ *    receiver (RFC 3168), so the receiver can stop echoing the congestion signal.
  */
 
 struct TCPSenderMessage
@@ -32,6 +35,8 @@ struct TCPSenderMessage
 
   bool RST {};
 
+  bool CWR {};
+
   // How many sequence numbers does this segment use?
   size_t sequence_length() const { return SYN + payload.size() + FIN; }
 };
@@ -0,0 +1,300 @@
+#pragma once
+
+#include "address.hh"
+#include "eventloop.hh"
+#include "file_descriptor.hh"
+#include "flow_table.hh"
+#include "ipv4_datagram.hh"
+#include "tcp_config.hh"
+#include "tcp_over_ip.hh"
+#include "tcp_peer.hh"
+#include "timer_wheel.hh"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+//! \brief A TCP endpoint that serves many connections over one IPv4 device (e.g. a TUN device), on one thread
+//! \details Where a TCPMinnowSocket has a TCPPeer, an adapter and a thread for each connection, a TCPStack reads
+//! every datagram from a single device and demultiplexes it by 4-tuple, through a FlowTable, to the connection's
+//! TCPPeer. All the connections are driven from one EventLoop: the application runs on the same thread, in
+//! callbacks (or in its own rules on eventloop()), reading and writing each connection's streams directly and
+//! calling push() after it writes. A Listener completes handshakes in the background and queues the established
+//! connections for accept().
+//!
+//! Each connection keeps its own TCPOverIPv4Adapter, for its header template. (TCP Fast Open is not supported.)
+//!
+//! Time is kept in one HierarchicalTimerWheel shared by every connection: each connection has a timer for its
+//! TCPPeer's next deadline (a retransmission, the end of its lingering, or an idle receiver), rescheduled after
+//! each segment or push, and a tick of the stack visits only the connections whose timers have come due. A
+//! connection's TCPPeer is ticked (by all the time since it was last ticked) only then, and before it sends or
+//! receives, which is the same as ticking it every time, since a tick before the next deadline does nothing.
+//! (So a TCPSender still counts its own retransmission timer, but the wheel holds its deadline, folded into the
+//! TCPPeer's, and no tick of the stack sweeps the connections.)
+//! The stack's time is in microseconds, from monotonic_time(), and it wakes for the wheel's next non-empty
+//! bucket with a timer rule on its event loop (rearmed before each wait), so it sleeps until a deadline is due
+//! rather than waking at a fixed interval.
+//!
+//! Once both streams of a connection have finished, and its TCPPeer stays active only to linger (in case the
+//! other side retransmits its FIN), the stack frees the connection and keeps a tombstone in its place: the
+//! flow's final sequence numbers and a timer in the wheel. The tombstone acknowledges a retransmitted FIN as
+//! the peer would have, until it expires (or a new connection takes the flow).
+class TCPStack
+{
+  //! A timer in the stack's wheel: a connection's next deadline, or a tombstone's expiry
+  struct Timer
+  {
+    FlowKey flow {};
+    bool tombstone {};
+  };
+  using Timers = HierarchicalTimerWheel<Timer>;
+
+public:
+  class Listener;
+
+  //! One connection of the stack. The stack holds it until its TCPPeer is no longer active; the application may
+  //! keep it longer (e.g. to read the rest of the inbound stream).
+  class Connection
+  {
+  public:
+    Connection( const FlowKey& flow, const TCPConfig& cfg );
+    ~Connection() = default;
+
+    //! A connection is shared by pointer, and never copied or moved
+    Connection( const Connection& ) = delete;
+    Connection& operator=( const Connection& ) = delete;
+    Connection( Connection&& ) = delete;
+    Connection& operator=( Connection&& ) = delete;
+
+    Writer& outbound_writer() { return peer_.outbound_writer(); }
+    Reader& inbound_reader() { return peer_.inbound_reader(); }
+    const FlowKey& flow() const { return flow_; }
+    //! Is the connection still held by the stack (and not yet retired to a tombstone)?
+    bool active() const { return not retired_ and peer_.active(); }
+    const TCPPeer& peer() const { return peer_; }
+
+    //! Has the handshake completed (our SYN was acknowledged, and nothing else is in flight yet)?
+    bool established() const
+    {
+      return peer_.active() and peer_.has_ackno() and peer_.sender().sequence_numbers_in_flight() == 0;
+    }
+
+    //! Called after each inbound segment for this connection. (To avoid a reference cycle, the callback should
+    //! not capture the connection's shared_ptr.)
+    void set_receive_callback( std::function<void()> callback ) { on_receive_ = std::move( callback ); }
+
+  private:
+    friend class TCPStack;
+
+    FlowKey flow_;
+    TCPPeer peer_;
+    TCPOverIPv4Adapter adapter_ {};
+    std::function<void()> on_receive_ {};
+    Listener* listener_ {};   //!< The listener that accepted the SYN, until the handshake completes
+    bool retired_ {};         //!< Has the stack replaced the connection with a tombstone?
+    Timers::Handle timer_ {}; //!< For the TCPPeer's next deadline
+    uint64_t time_us_ {};     //!< The stack's time when the TCPPeer was last ticked
+  };
+
+  //! \brief Accepts connections to one local address and port
+  //! \details A SYN to the listener opens a half-open connection, whose handshake completes in the background.
+  //! Established connections wait in the backlog for accept(). Half-open connections count against the backlog
+  //! too (so each one has a place when its handshake completes): while it is full, new SYNs are dropped, and the
+  //! clients will retransmit them. To be woken when there is something to accept, add a rule on the stack's
+  //! eventloop() that is interested while queued() > 0.
+  //!
+  //! A listener with a SYN-cookie threshold keeps no state for a SYN once that many connections are half-open
+  //! (or the backlog is full of them): it answers with a SYN-ACK whose ISN is a SYN cookie, a keyed hash of the
+  //! flow, the client's ISN and the time, and opens the connection only when an ACK returns a valid cookie.
+  //! A flood of SYNs then costs no memory. (The cookie carries no options, so those connections do not use ECN.)
+  class Listener
+  {
+  public:
+    struct Stats
+    {
+      uint64_t syns_received {};        //!< SYNs that opened a half-open connection
+      uint64_t syns_dropped {};         //!< SYNs (or SYN-cookie ACKs) dropped because the backlog was full
+      uint64_t connections_queued {};   //!< Connections queued in the backlog
+      uint64_t max_queued {};           //!< High-water mark of the backlog
+      uint64_t syn_cookies_sent {};     //!< SYNs answered with a SYN cookie
+      uint64_t syn_cookies_accepted {}; //!< ACKs with a valid SYN cookie, which opened a connection
+      uint64_t syn_cookies_rejected {}; //!< ACKs for no connection, without a valid SYN cookie
+    };
+
+    Listener( const Address& local, size_t backlog, size_t syn_cookie_threshold );
+
+    //! The next established connection, or nullptr if there is none
+    std::shared_ptr<Connection> accept();
+
+    size_t backlog() const { return backlog_; }
+    size_t queued() const { return queue_.size(); }
+    size_t half_open() const { return half_open_; }
+    bool syn_cookies() const { return syn_cookie_threshold_ != NO_SYN_COOKIES; }
+    const Stats& stats() const { return stats_; }
+
+  private:
+    friend class TCPStack;
+
+    uint32_t address_;
+    uint16_t port_;
+    size_t backlog_;
+    size_t syn_cookie_threshold_;
+    std::deque<std::shared_ptr<Connection>> queue_ {};
+    size_t half_open_ {};
+    Stats stats_ {};
+  };
+
+  struct Stats
+  {
+    uint64_t datagrams_received {};  //!< Datagrams read from the device
+    uint64_t datagrams_invalid {};   //!< ... that were not valid TCP segments
+    uint64_t datagrams_unmatched {}; //!< ... that did not reach a connection (including SYNs a listener dropped)
+    uint64_t connections_opened {};
+    uint64_t connections_closed {};  //!< Connections dropped (or retired to a tombstone) by the stack
+    uint64_t tombstone_acks {};      //!< ACKs sent from tombstones, to retransmitted FINs
+  };
+
+  //! Width of a tick of the stack's timer wheel, in microseconds (a timer fires up to one tick late)
+  static constexpr uint64_t TIMER_TICK_US = 10;
+
+  //! Default length of a listener's backlog
+  static constexpr size_t DEFAULT_BACKLOG = 128;
+
+  //! SYN-cookie threshold of a listener that never sends SYN cookies
+  static constexpr size_t NO_SYN_COOKIES = SIZE_MAX;
+
+  //! A SYN cookie is valid for one to two of these periods (in milliseconds)
+  static constexpr uint64_t SYN_COOKIE_PERIOD_MS = 64000;
+
+  //! Most datagrams read from the device on one wakeup of the event loop
+  static constexpr size_t MAX_READS_PER_EVENT = 64;
+
+  //! \brief Take over a device that reads and writes one IPv4 datagram per call
+  //! \details That is a TunFD in practice; tests use a datagram socket.
+  //! `cfg` is the TCPConfig of every connection (except its ISN, which is chosen at random).
+  //! If `read_device` is true, the device is made non-blocking, and each wakeup reads until nothing is left.
+  //! If it is false, the stack only writes to the device, and its owner hands it the inbound datagrams with
+  //! receive() (as a ShardedTCPStack does for its shards).
+  explicit TCPStack( FileDescriptor&& device, const TCPConfig& cfg = {}, bool read_device = true );
+
+  //! Handle an inbound datagram (in one or more buffers) that the owner read from the device
+  void receive( std::vector<std::string> datagram );
+
+  //! Open a connection from `local` to `remote`, and send the SYN
+  std::shared_ptr<Connection> connect( const Address& local, const Address& remote );
+
+  //! Listen for connections to `local` (whose address may be "0", for any address), queueing up to `backlog`
+  //! established connections, and answering SYNs with SYN cookies once `syn_cookie_threshold` are half-open
+  std::shared_ptr<Listener> listen( const Address& local,
+                                    size_t backlog = DEFAULT_BACKLOG,
+                                    size_t syn_cookie_threshold = NO_SYN_COOKIES );
+
+  //! Send what the application has written to the connection's outbound stream
+  void push( Connection& connection );
+
+  //! Wait for and handle the next event (up to `timeout_ms`, or until the next timer is due), then tick the
+  //! stack by the time that has passed
+  EventLoop::Result wait_next_event( int timeout_ms );
+
+  //! Advance the stack's time: tick the connections whose timers have come due (and drop the ones that are no
+  //! longer active), and expire tombstones
+  void tick( std::chrono::microseconds since_last_tick );
+  void tick( uint64_t ms_since_last_tick ) { tick( std::chrono::milliseconds { ms_since_last_tick } ); }
+
+  //! The stack's event loop, where the application may add its own rules
+  EventLoop& eventloop() { return eventloop_; }
+
+  size_t connection_count() const { return flows_.size(); }
+  size_t tombstone_count() const { return tombstones_.size(); }
+  const Stats& stats() const { return stats_; }
+
+private:
+  TCPConfig cfg_;
+  FileDescriptor device_;
+  EventLoop eventloop_ { EventLoop::Backend::Epoll, EventLoop::Dispatch::AllReady };
+  FlowTable<std::shared_ptr<Connection>> flows_ {};
+  std::vector<std::shared_ptr<Listener>> listeners_ {};
+  std::default_random_engine rng_;
+  Stats stats_ {};
+  std::chrono::microseconds last_tick_; //!< The monotonic_time() of the last tick
+  uint64_t syn_cookie_secret_;
+  TCPOverIPv4Adapter stateless_adapter_ {}; //!< Writes segments for flows without a connection
+
+  //! What remains of a connection that finished while lingering: enough to acknowledge a retransmitted FIN
+  struct Tombstone
+  {
+    Wrap32 seqno; //!< Our next sequence number (after our FIN)
+    Wrap32 ackno; //!< Our acknowledgment number (after the other side's FIN)
+    uint16_t window_size;
+    Timers::Handle timer;
+  };
+  FlowTable<Tombstone> tombstones_ {};
+  Timers timers_ { TIMER_TICK_US };
+  uint64_t time_us_ {}; //!< Time passed in ticks, in microseconds
+
+  std::optional<EventLoop::RuleHandle> wakeup_ {}; //!< A timer rule for the wheel's next expiry, if armed
+  std::chrono::microseconds wakeup_deadline_ {};   //!< ... and when it fires, in monotonic_time()
+  size_t wakeup_category_;
+
+  //! Arm (or disarm) the event loop's timer rule for the wheel's next expiry
+  void arm_wakeup();
+
+  //! Read and handle the datagrams that are ready on the device
+  void read_datagrams();
+
+  //! Hand a datagram to its connection (or to a listener)
+  void deliver( InternetDatagram ip_dgram );
+
+  //! Create a connection for `flow`, with initial sequence number `isn`, and add it to the table
+  std::shared_ptr<Connection> open( const FlowKey& flow, Wrap32 isn );
+
+  //! A random initial sequence number
+  Wrap32 random_isn();
+
+  //! The listener for a flow's local address and port, if any
+  Listener* find_listener( const FlowKey& flow ) const;
+
+  //! A SYN to a listener: open a half-open connection, or answer with a SYN cookie (or drop it)
+  Connection* accept_syn( Listener& listener, const FlowKey& flow, const TCPMessage& syn );
+
+  //! An ACK to a listener: if it returns a valid SYN cookie, open the connection the cookie stands for
+  Connection* accept_syn_cookie( Listener& listener, const FlowKey& flow, const TCPMessage& ack );
+
+  //! The SYN cookie for a flow and the client's ISN, in a given SYN_COOKIE_PERIOD_MS period
+  uint32_t syn_cookie( const FlowKey& flow, uint32_t client_isn, uint64_t period ) const;
+
+  //! A half-open connection completed its handshake: move it to its listener's backlog
+  void establish( Connection& connection );
+
+  //! Tick a connection's TCPPeer by the time since it was last ticked
+  void catch_up( Connection& connection );
+
+  //! Reschedule a connection's timer for its TCPPeer's next deadline (or the next tick, if the stack is to drop
+  //! it)
+  void schedule( Connection& connection );
+
+  //! A connection's timer came due: tick it, and drop it if it is no longer active (or only lingering)
+  void expire( Connection& connection );
+
+  //! A connection is only lingering: replace it with a tombstone (the caller drops it from the table)
+  void retire( Connection& connection );
+
+  //! A segment for a flow that has a tombstone: acknowledge it if it needs a reply, and extend the linger
+  void receive_on_tombstone( const FlowKey& flow, Tombstone& tombstone, const TCPMessage& msg );
+
+  //! Write a segment for a flow, from no connection
+  void write_stateless( const FlowKey& flow, const TCPMessage& msg );
+
+  //! The TCPMessageSink for a connection: wrap each message and write it to the device
+  auto transmit( Connection& connection )
+  {
+    return [this, &connection]( const TCPMessage& msg ) { connection.adapter_.write_tcp_in_ip( device_, msg ); };
+  }
+};
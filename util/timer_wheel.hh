@@ -0,0 +1,259 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <utility>
+#include <vector>
+
+//! \brief A hierarchical timing wheel (Varghese and Lauck, 1987), for many timers that are often cancelled
+//! \details Level 0 has a bucket for each of the next SLOTS ticks; each higher level has a bucket for each of the
+//! next SLOTS spans of the level below. A timer goes in the lowest level whose range covers its expiry, and moves
+//! down a level (cascades) as time reaches its bucket, so scheduling, cancelling and expiring each cost O(1) per
+//! timer, and an advance visits only the buckets whose time has come (skipping over empty levels). Timers live in
+//! doubly-linked lists threaded through one vector of nodes, and a Handle names a node and its generation, so a
+//! stale handle (to a timer that fired or was cancelled, and whose node was reused) is harmless. A timer fires at
+//! the first advance() at or past its expiry, up to one tick late.
+template<class T>
+class HierarchicalTimerWheel
+{
+public:
+  static constexpr unsigned LEVEL_BITS = 6;
+  static constexpr uint32_t SLOTS = 1U << LEVEL_BITS; //!< Buckets in each level
+  static constexpr unsigned LEVELS = 4;               //!< So the wheel spans SLOTS^LEVELS ticks
+
+  //! A scheduled timer, for cancel() (a default Handle names no timer)
+  struct Handle
+  {
+    uint32_t index { NIL };
+    uint32_t generation {};
+  };
+
+  //! A wheel whose ticks are `tick_width` wide, starting at `now` (in whatever unit of time the owner keeps:
+  //! milliseconds, say, or microseconds)
+  explicit HierarchicalTimerWheel( uint64_t tick_width = 1, uint64_t now = 0 )
+    : tick_width_( std::max( tick_width, uint64_t { 1 } ) ), next_tick_( now / tick_width_ + 1 )
+  {
+    heads_.fill( NIL );
+  }
+
+  //! Fire `value` at the first advance() to `expiry` or later (through a tick not yet advanced through)
+  Handle schedule( uint64_t expiry, T value )
+  {
+    uint32_t index = free_;
+    if ( index == NIL ) {
+      index = static_cast<uint32_t>( nodes_.size() );
+      nodes_.emplace_back();
+    } else {
+      free_ = nodes_[index].next;
+    }
+    Node& node = nodes_[index];
+    node.expiry_tick = std::max( ( expiry + tick_width_ - 1 ) / tick_width_, next_tick_ );
+    node.value = std::move( value );
+    link( index );
+    ++size_;
+    return { index, node.generation };
+  }
+
+  //! Cancel a timer (if it has not fired yet), and reset its handle; returns whether it was pending
+  bool cancel( Handle& handle )
+  {
+    const bool was_pending = pending( handle );
+    if ( was_pending ) {
+      unlink( handle.index );
+      release( handle.index );
+    }
+    handle = {};
+    return was_pending;
+  }
+
+  //! Cancel a timer (if it is pending), and schedule it again
+  void reschedule( Handle& handle, uint64_t expiry, T value )
+  {
+    cancel( handle );
+    handle = schedule( expiry, std::move( value ) );
+  }
+
+  //! Is the timer scheduled, and yet to fire?
+  bool pending( const Handle& handle ) const
+  {
+    return handle.index < nodes_.size() and nodes_[handle.index].generation == handle.generation
+           and nodes_[handle.index].bucket != FREE;
+  }
+
+  //! Advance the wheel to `now`, calling `expire( value )` for each timer that has come due. (`expire` may
+  //! schedule and cancel timers.)
+  template<class F>
+  void advance( uint64_t now, F&& expire )
+  {
+    const uint64_t end_tick = now / tick_width_ + 1; // advance through the tick that contains `now`
+    while ( next_tick_ < end_tick ) {
+      if ( size_ == 0 ) {
+        next_tick_ = end_tick;
+        break;
+      }
+
+      // with nothing in the lower levels, skip to the next tick where the lowest occupied level cascades
+      unsigned lowest = 0;
+      while ( lowest < LEVELS - 1 and level_size_[lowest] == 0 ) {
+        ++lowest;
+      }
+      const uint64_t span = uint64_t { 1 } << ( LEVEL_BITS * lowest );
+      const uint64_t skip_to = std::min( ( next_tick_ + span - 1 ) / span * span, end_tick );
+      if ( skip_to > next_tick_ ) {
+        next_tick_ = skip_to;
+        continue;
+      }
+
+      const uint64_t tick = next_tick_;
+      for ( unsigned level = LEVELS - 1; level > 0; --level ) {
+        if ( ( tick & ( ( uint64_t { 1 } << ( LEVEL_BITS * level ) ) - 1 ) ) == 0 ) {
+          cascade( level, tick );
+        }
+      }
+
+      // fire from a list of its own, so `expire` can cancel a timer that is about to fire (and any timer it
+      // schedules goes in a later tick)
+      move_bucket( bucket_of( 0, tick ), EXPIRING );
+      ++next_tick_;
+      while ( heads_[EXPIRING] != NIL ) {
+        const uint32_t index = heads_[EXPIRING];
+        unlink( index );
+        T value = std::move( nodes_[index].value );
+        release( index );
+        expire( std::move( value ) );
+      }
+    }
+  }
+
+  //! Timers that have not fired yet
+  size_t size() const { return size_; }
+
+  //! \brief The earliest time an advance() could fire a timer (or cascade one closer), if any timer is pending
+  //! \details The start of the first non-empty bucket of any level: exact for a timer in level 0, and otherwise a
+  //! lower bound (the time its bucket cascades), so an owner that sleeps until then wakes no later than the first
+  //! expiry, and asks again.
+  std::optional<uint64_t> next_expiry() const
+  {
+    std::optional<uint64_t> earliest;
+    for ( unsigned level = 0; level < LEVELS; ++level ) {
+      if ( level_size_[level] == 0 ) {
+        continue;
+      }
+      const unsigned shift = LEVEL_BITS * level;
+      const uint64_t first_slot = ( next_tick_ + ( uint64_t { 1 } << shift ) - 1 ) >> shift;
+      for ( uint64_t slot = first_slot; slot < first_slot + SLOTS; ++slot ) {
+        if ( heads_[bucket_of( level, slot << shift )] != NIL ) {
+          earliest = std::min( earliest.value_or( UINT64_MAX ), ( slot << shift ) * tick_width_ );
+          break;
+        }
+      }
+    }
+    return earliest;
+  }
+
+private:
+  static constexpr uint32_t NIL = UINT32_MAX;
+  static constexpr uint32_t EXPIRING = LEVELS * SLOTS; //!< The list of timers firing now
+  static constexpr uint32_t FREE = EXPIRING + 1;       //!< The "bucket" of a node on the free list
+
+  struct Node
+  {
+    uint64_t expiry_tick {};
+    T value {};
+    uint32_t prev { NIL };
+    uint32_t next { NIL };
+    uint32_t bucket { FREE };
+    uint32_t generation {};
+  };
+
+  static uint32_t bucket_of( unsigned level, uint64_t tick )
+  {
+    return level * SLOTS + static_cast<uint32_t>( ( tick >> ( LEVEL_BITS * level ) ) & ( SLOTS - 1 ) );
+  }
+
+  //! Put a node in the bucket for its expiry: the lowest level whose range reaches it (or the top level, to be
+  //! placed again when it cascades, if it is beyond the wheel's span)
+  void link( uint32_t index )
+  {
+    const uint64_t delta = nodes_[index].expiry_tick - next_tick_;
+    unsigned level = 0;
+    while ( level < LEVELS - 1 and ( delta >> ( LEVEL_BITS * ( level + 1 ) ) ) != 0 ) {
+      ++level;
+    }
+    const uint64_t max_tick = next_tick_ + ( uint64_t { 1 } << ( LEVEL_BITS * LEVELS ) ) - 1;
+    push( bucket_of( level, std::min( nodes_[index].expiry_tick, max_tick ) ), index );
+  }
+
+  void push( uint32_t bucket, uint32_t index )
+  {
+    Node& node = nodes_[index];
+    node.bucket = bucket;
+    node.prev = NIL;
+    node.next = heads_[bucket];
+    if ( node.next != NIL ) {
+      nodes_[node.next].prev = index;
+    }
+    heads_[bucket] = index;
+    if ( bucket < EXPIRING ) {
+      ++level_size_[bucket / SLOTS];
+    }
+  }
+
+  void unlink( uint32_t index )
+  {
+    Node& node = nodes_[index];
+    if ( node.prev != NIL ) {
+      nodes_[node.prev].next = node.next;
+    } else {
+      heads_[node.bucket] = node.next;
+    }
+    if ( node.next != NIL ) {
+      nodes_[node.next].prev = node.prev;
+    }
+    if ( node.bucket < EXPIRING ) {
+      --level_size_[node.bucket / SLOTS];
+    }
+    node.bucket = FREE;
+  }
+
+  //! Put an unlinked node on the free list, so any handle to it goes stale
+  void release( uint32_t index )
+  {
+    Node& node = nodes_[index];
+    node.value = T {};
+    ++node.generation;
+    node.next = free_;
+    free_ = index;
+    --size_;
+  }
+
+  void move_bucket( uint32_t from, uint32_t to )
+  {
+    for ( uint32_t index = heads_[from], next = NIL; index != NIL; index = next ) {
+      next = nodes_[index].next;
+      unlink( index );
+      push( to, index );
+    }
+  }
+
+  //! Time has reached a bucket of a higher level: spread its timers over the levels below
+  void cascade( unsigned level, uint64_t tick )
+  {
+    for ( uint32_t index = heads_[bucket_of( level, tick )], next = NIL; index != NIL; index = next ) {
+      next = nodes_[index].next;
+      unlink( index );
+      link( index );
+    }
+  }
+
+  uint64_t tick_width_;
+  uint64_t next_tick_; //!< The first tick that has not been advanced through
+  std::vector<Node> nodes_ {};
+  std::array<uint32_t, LEVELS * SLOTS + 1> heads_ {}; //!< The first node of each bucket, and of EXPIRING
+  std::array<size_t, LEVELS> level_size_ {};
+  uint32_t free_ { NIL };
+  size_t size_ {};
+};
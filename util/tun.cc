@@ -14,19 +14,22 @@ using namespace std;
 //! \param[in] devname is the name of the TUN or TAP device, specified at its creation.
 //! \param[in] is_tun is `true` for a TUN device (expects IP datagrams), or `false` for a TAP device (expects
 //! Ethernet frames)
+//! \param[in] multi_queue is `true` to attach one more queue of a multi-queue device: the kernel spreads the
+//! device's flows over its queues, and sends each flow to the queue that last wrote it
 //!
 //! To create a TUN device, you should already have run
 //!
 //!     ip tuntap add mode tun user `username` name `devname`
 //!
-//! as root before calling this function.
+//! as root before calling this function (adding `multi_queue` to open it with `multi_queue` set).
 
-TunTapFD::TunTapFD( const string& devname, const bool is_tun )
+TunTapFD::TunTapFD( const string& devname, const bool is_tun, const bool multi_queue )
   : FileDescriptor( ::CheckSystemCall( "open", open( CLONEDEV, O_RDWR | O_CLOEXEC ) ) )
 {
   struct ifreq tun_req {};
 
-  tun_req.ifr_flags = static_cast<int16_t>( ( is_tun ? IFF_TUN : IFF_TAP ) | IFF_NO_PI ); // no packetinfo
+  tun_req.ifr_flags = static_cast<int16_t>( ( is_tun ? IFF_TUN : IFF_TAP ) | IFF_NO_PI  // no packetinfo
+                                            | ( multi_queue ? IFF_MULTI_QUEUE : 0 ) );
 
   // copy devname to ifr_name, making sure to null terminate
 
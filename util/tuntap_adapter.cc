@@ -1,6 +1,8 @@
 #include "tuntap_adapter.hh"
 #include "helpers.hh"
 
+#include <array>
+
 using namespace std;
 
 optional<TCPMessage> TCPOverIPv4OverTunFdAdapter::read()
@@ -19,7 +21,25 @@ optional<TCPMessage> TCPOverIPv4OverTunFdAdapter::read()
 
 void TCPOverIPv4OverTunFdAdapter::write( const TCPMessage& seg )
 {
-  _tun.write( serialize( wrap_tcp_in_ip( seg ) ) );
+  write_tcp_in_ip( _tun, seg );
+}
+
+void TCPOverIPv4OverTunFdAdapter::write_batch( span<const TCPMessage> msgs )
+{
+  if ( not _batch_writer.has_value() ) {
+    _batch_writer.emplace( _tun );
+  }
+
+  for ( const auto& msg : msgs ) {
+    if ( msg.sender->payload.size() > TCPConfig::MAX_PAYLOAD_SIZE ) {
+      segment_tcp_in_ip( msg, [&]( string_view headers, string_view payload ) {
+        _batch_writer->add( array { headers, payload } );
+      } );
+    } else {
+      _batch_writer->add( array { wrap_tcp_headers( msg ), string_view { msg.sender->payload } } );
+    }
+  }
+  _batch_writer->flush();
 }
 
 //! Specialize LossyFdAdapter to TCPOverIPv4OverTunFdAdapter
@@ -1,11 +1,14 @@
 #pragma once
 
+#include "gro_adapter.hh"
+#include "io_uring.hh"
 #include "lossy_fd_adapter.hh"
 #include "tcp_over_ip.hh"
 #include "tcp_segment.hh"
 #include "tun.hh"
 
 #include <optional>
+#include <span>
 #include <utility>
 
 template<class T>
@@ -15,13 +18,27 @@ concept TCPDatagramAdapter = requires( T a, TCPMessage seg ) {
   { a.read() } -> std::same_as<std::optional<TCPMessage>>;
 };
 
+//! An adapter that can also write all the messages from one TCPPeer call at once
+template<class T>
+concept BatchingTCPDatagramAdapter = TCPDatagramAdapter<T> and requires( T a, std::span<const TCPMessage> msgs ) {
+  { a.write_batch( msgs ) } -> std::same_as<void>;
+};
+
+//! An adapter whose fd is read only with FileDescriptor::read, so an io_uring can read it ahead of the adapter
+//! (see EventLoop::read_ahead)
+template<class T>
+concept ReadAheadTCPDatagramAdapter = TCPDatagramAdapter<T> and requires { requires T::READS_FD_ONLY; };
+
 //! \brief A FD adapter for IPv4 datagrams read from and written to a TUN device
 class TCPOverIPv4OverTunFdAdapter : public TCPOverIPv4Adapter
 {
 private:
   TunFD _tun;
+  std::optional<BatchWriter> _batch_writer {}; //!< Set up with the first batch
 
 public:
+  static constexpr bool READS_FD_ONLY = true; //!< See ReadAheadTCPDatagramAdapter
+
   //! Construct from a TunFD
   explicit TCPOverIPv4OverTunFdAdapter( TunFD&& tun ) : _tun( std::move( tun ) ) {}
 
@@ -31,6 +48,10 @@ public:
   //! Creates an IPv4 datagram from a TCP segment and writes it to the TUN device
   void write( const TCPMessage& seg );
 
+  //! Writes the datagrams for several TCP segments to the TUN device, with one system call if the kernel has
+  //! io_uring (see BatchWriter)
+  void write_batch( std::span<const TCPMessage> msgs );
+
   //! Access the underlying TUN device
   explicit operator TunFD&() { return _tun; }
 
@@ -41,5 +62,7 @@ public:
   FileDescriptor& fd() { return _tun; }
 };
 
-static_assert( TCPDatagramAdapter<TCPOverIPv4OverTunFdAdapter> );
-static_assert( TCPDatagramAdapter<LossyFdAdapter<TCPOverIPv4OverTunFdAdapter>> );
+static_assert( BatchingTCPDatagramAdapter<TCPOverIPv4OverTunFdAdapter> );
+static_assert( BatchingTCPDatagramAdapter<LossyFdAdapter<TCPOverIPv4OverTunFdAdapter>> );
+static_assert( BatchingTCPDatagramAdapter<GROAdapter<LossyFdAdapter<TCPOverIPv4OverTunFdAdapter>>> );
+static_assert( ReadAheadTCPDatagramAdapter<GROAdapter<LossyFdAdapter<TCPOverIPv4OverTunFdAdapter>>> );